@@ -20,6 +20,11 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -28,6 +33,109 @@
 #include "helpers.h"
 #include "ual-tracepoint.h"
 
+/* Seconds a prelaunched job waits to be used before exiting */
+#define PRELAUNCH_TIMEOUT (10 * 60)
+
+/* Pull a file into the page cache so that the exec doesn't wait on it */
+static void
+preload_file (const gchar * path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		g_debug("Unable to open '%s' to preload: %s", path, strerror(errno));
+		return;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
+
+/* We're prelaunching, so everything is setup, warm up the files the
+   application is going to need and then wait to be told to go. A
+   SIGUSR1 means launch, anything else or a timeout means we're
+   not needed. */
+static gboolean
+prelaunch_park (const gchar * app_id, const gchar * command)
+{
+	gchar * binary = g_find_program_in_path(command);
+	if (binary != NULL) {
+		preload_file(binary);
+		g_free(binary);
+	}
+
+	/* Colon separated list of libraries that most applications use */
+	const gchar * preload = g_getenv("UBUNTU_APP_LAUNCH_PRELOAD");
+	if (preload != NULL) {
+		gchar ** files = g_strsplit(preload, ":", -1);
+		int i;
+		for (i = 0; files[i] != NULL; i++) {
+			if (files[i][0] != '\0') {
+				preload_file(files[i]);
+			}
+		}
+		g_strfreev(files);
+	}
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	sigprocmask(SIG_BLOCK, &signals, NULL);
+
+	ual_tracepoint(exec_parked, app_id);
+
+	/* Don't wait forever, if whoever parked us has gone away nobody
+	   is going to tell us to launch */
+	struct timespec timeout = { .tv_sec = PRELAUNCH_TIMEOUT, .tv_nsec = 0 };
+
+	int sig = -1;
+	do {
+		sig = sigtimedwait(&signals, NULL, &timeout);
+	} while (sig < 0 && errno == EINTR);
+
+	sigprocmask(SIG_UNBLOCK, &signals, NULL);
+
+	ual_tracepoint(exec_unparked, app_id, sig == SIGUSR1);
+
+	return sig == SIGUSR1;
+}
+
+/* Tell the process that launched us when we got to each of our
+   milestones so it can put them on the timeline of the launch. The
+   times are CLOCK_MONOTONIC so they line up with the ones it took.
+   Nobody waits on this, if nobody is listening it is dropped. */
+static void
+timeline_report (const gchar * app_id, gint64 exec_start, gint64 parsed, gint64 pre_exec)
+{
+	const gchar * launcher = g_getenv("APP_LAUNCHER_PID");
+	if (app_id == NULL || launcher == NULL || launcher[0] == '\0') {
+		return;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	/* Abstract socket, so the path starts with a nul */
+	int namelen = g_snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "%s%s", LAUNCH_TIMELINE_SOCKET, launcher);
+	if (namelen >= (int)sizeof(addr.sun_path) - 1) {
+		return;
+	}
+
+	int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (sock < 0) {
+		return;
+	}
+
+	gchar * report = g_strdup_printf("%s %" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %" G_GINT64_FORMAT, app_id, exec_start, parsed, pre_exec);
+	if (sendto(sock, report, strlen(report), 0, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + 1 + namelen) < 0) {
+		g_debug("Unable to send launch timeline: %s", strerror(errno));
+	}
+
+	g_free(report);
+	close(sock);
+}
+
 int
 main (int argc, char * argv[])
 {
@@ -46,10 +154,18 @@ main (int argc, char * argv[])
 	const gchar * app_id = g_getenv("APP_ID");
 
 	ual_tracepoint(exec_start, app_id);
+	gint64 exec_start = g_get_monotonic_time();
 
 	/* URIs */
 	const gchar * app_uris = g_getenv("APP_URIS");
 
+	/* When prelaunching we don't know the URIs yet, so a prelaunched
+	   job is only used for launches without them */
+	gboolean prelaunch = g_strcmp0(g_getenv("APP_PRELAUNCH"), "1") == 0;
+	if (prelaunch) {
+		app_uris = NULL;
+	}
+
 	/* Look to see if we have a directory defined that we
 	   should be using for everything.  If so, change to it
 	   and add it to the path */
@@ -140,6 +256,7 @@ main (int argc, char * argv[])
 	}
 
 	ual_tracepoint(exec_parse_complete, app_id);
+	gint64 parse_complete = g_get_monotonic_time();
 
 	if (g_getenv("MIR_SOCKET") != NULL && g_strcmp0(g_getenv("APP_XMIR_ENABLE"), "1") == 0) {
 		g_debug("XMir Helper being used");
@@ -153,10 +270,64 @@ main (int argc, char * argv[])
 		g_array_prepend_val(newargv, xmir_helper);
 	}
 
+	/* Helpers in a Mir prompt session get their exec line wrapped with
+	   the socket demangler, which gets the socket and then execs the
+	   helper. We can ask for the socket ourselves and save the exec,
+	   keeping the demangler if that doesn't work out. */
+	if (newargv->len > 0 && g_strcmp0(g_array_index(newargv, gchar *, 0), DEMANGLER_PATH) == 0 &&
+			g_strcmp0(g_getenv("UBUNTU_APP_LAUNCH_DEMANGLE_EXEC"), "1") != 0) {
+		const gchar * mir_name = g_getenv("UBUNTU_APP_LAUNCH_DEMANGLE_NAME");
+		const gchar * mir_path = g_getenv("UBUNTU_APP_LAUNCH_DEMANGLE_PATH");
+
+		ual_tracepoint(exec_demangle_start, app_id);
+
+		gint fd = -1;
+		if (mir_name != NULL && mir_name[0] != '\0' && mir_path != NULL && mir_path[0] != '\0') {
+			fd = mir_socket_demangle(mir_name, mir_path);
+		}
+
+		if (fd >= 0) {
+			gchar * mirsocketbuf = g_strdup_printf("fd://%d", fd);
+			g_setenv("MIR_SOCKET", mirsocketbuf, TRUE);
+			g_debug("MIR_SOCKET=%s", mirsocketbuf);
+			g_free(mirsocketbuf);
+
+			g_unsetenv("UBUNTU_APP_LAUNCH_DEMANGLE_NAME");
+			g_unsetenv("UBUNTU_APP_LAUNCH_DEMANGLE_PATH");
+
+			g_free(g_array_index(newargv, gchar *, 0));
+			g_array_remove_index(newargv, 0);
+		} else {
+			g_debug("Falling back to the socket demangler");
+		}
+
+		ual_tracepoint(exec_demangle_complete, app_id, fd >= 0);
+	}
+
 	/* Now exec */
 	gchar ** nargv = (gchar**)g_array_free(newargv, FALSE);
 
+	if (prelaunch) {
+		if (!prelaunch_park(app_id, nargv[0])) {
+			g_debug("Prelaunched job stopped without being used");
+			g_strfreev(nargv);
+			return 0;
+		}
+	}
+
+	/* The application doesn't need to know */
+	g_unsetenv("APP_PRELAUNCH");
+
+	/* The job is setup with 'expect stop' so that it doesn't get marked as
+	   started while we're parked, stopping here tells Upstart that we're
+	   going and it'll continue us */
+	if (g_strcmp0(g_getenv("APP_EXPECT_STOP"), "1") == 0) {
+		g_unsetenv("APP_EXPECT_STOP");
+		raise(SIGSTOP);
+	}
+
 	ual_tracepoint(exec_pre_exec, app_id);
+	timeline_report(app_id, exec_start, parse_complete, g_get_monotonic_time());
 
 	int execret = execvp(nargv[0], nargv);
 
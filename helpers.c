@@ -20,6 +20,8 @@
 #include <json-glib/json-glib.h>
 #include <click.h>
 #include <upstart.h>
+#include <fcntl.h>
+#include <gio/gunixfdlist.h>
 #include "helpers.h"
 
 /* Take an app ID and validate it and then break it up
@@ -479,95 +481,6 @@ set_confined_envvars (EnvHandle * handle, const gchar * package, const gchar * a
 	return;
 }
 
-static void
-unity_signal_cb (GDBusConnection * con, const gchar * sender, const gchar * path, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data)
-{
-	GMainLoop * mainloop = (GMainLoop *)user_data;
-	g_main_loop_quit(mainloop);
-}
-
-struct _handshake_t {
-	GDBusConnection * con;
-	GMainLoop * mainloop;
-	guint signal_subscribe;
-	GSource * timeout;
-};
-
-static gboolean
-unity_too_slow_cb (gpointer user_data)
-{
-	handshake_t * handshake = (handshake_t *)user_data;
-	g_main_loop_quit(handshake->mainloop);
-	handshake->timeout = NULL;
-	return G_SOURCE_REMOVE;
-}
-
-handshake_t *
-starting_handshake_start (const gchar *   app_id, int timeout_s)
-{
-	GError * error = NULL;
-	handshake_t * handshake = g_new0(handshake_t, 1);
-
-	GMainContext * context = g_main_context_get_thread_default();
-
-	handshake->mainloop = g_main_loop_new(context, FALSE);
-	handshake->con = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
-
-	if (error != NULL) {
-		g_critical("Unable to connect to session bus: %s", error->message);
-		g_error_free(error);
-		g_free(handshake);
-		return NULL;
-	}
-
-	/* Set up listening for the unfrozen signal from Unity */
-	handshake->signal_subscribe = g_dbus_connection_signal_subscribe(handshake->con,
-		NULL, /* sender */
-		"com.canonical.UbuntuAppLaunch", /* interface */
-		"UnityStartingSignal", /* signal */
-		"/", /* path */
-		app_id, /* arg0 */
-		G_DBUS_SIGNAL_FLAGS_NONE,
-		unity_signal_cb, handshake->mainloop,
-		NULL); /* user data destroy */
-
-	/* Send unfreeze to to Unity */
-	g_dbus_connection_emit_signal(handshake->con,
-		NULL, /* destination */
-		"/", /* path */
-		"com.canonical.UbuntuAppLaunch", /* interface */
-		"UnityStartingBroadcast", /* signal */
-		g_variant_new("(s)", app_id),
-		&error);
-
-	/* Really, Unity? */
-	handshake->timeout = g_timeout_source_new_seconds(timeout_s);
-	g_source_set_callback(handshake->timeout, unity_too_slow_cb, handshake, NULL);
-	g_source_attach(handshake->timeout, context);
-
-	return handshake;
-}
-
-void
-starting_handshake_wait (handshake_t * handshake)
-{
-	if (handshake == NULL)
-		return;
-
-	g_main_loop_run(handshake->mainloop);
-
-	if (handshake->timeout != NULL) {
-		g_source_destroy(handshake->timeout);
-		g_source_unref(handshake->timeout);
-		handshake->timeout = NULL;
-	}
-	g_main_loop_unref(handshake->mainloop);
-	g_dbus_connection_signal_unsubscribe(handshake->con, handshake->signal_subscribe);
-	g_object_unref(handshake->con);
-
-	g_free(handshake);
-}
-
 EnvHandle *
 env_handle_start (void)
 {
@@ -584,18 +497,21 @@ env_handle_add (EnvHandle * handle, const gchar * variable, const gchar * value)
 	g_variant_builder_add_value((GVariantBuilder*)handle, env);
 }
 
-void
-env_handle_finish (EnvHandle * handle)
+/* Sends all the variables in the handle to Upstart in a single
+   SetEnvList call and frees the handle. Without wait the message is
+   only flushed onto the bus, the reply isn't waited for. */
+gboolean
+env_handle_send (EnvHandle * handle, GDBusConnection * bus, gboolean wait)
 {
-	g_return_if_fail(handle != NULL);
+	g_return_val_if_fail(handle != NULL, FALSE);
 	/* Check to see if we can get the job environment */
 	const gchar * job_name = g_getenv("UPSTART_JOB");
 	const gchar * instance_name = g_getenv("UPSTART_INSTANCE");
-	g_return_if_fail(job_name != NULL);
-
-	/* Get a bus, let's go! */
-	GDBusConnection * bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
-	g_return_if_fail(bus != NULL);
+	if (job_name == NULL || bus == NULL) {
+		g_warning("Unable to set environment without a job and a bus");
+		g_variant_builder_unref((GVariantBuilder*)handle);
+		return FALSE;
+	}
 
 	GVariantBuilder builder; /* Target: (assb) */
 	g_variant_builder_init(&builder, G_VARIANT_TYPE_TUPLE);
@@ -609,11 +525,38 @@ env_handle_finish (EnvHandle * handle)
 
 	/* The value itself */
 	g_variant_builder_add_value(&builder, g_variant_builder_end((GVariantBuilder*)handle));
+	g_variant_builder_unref((GVariantBuilder*)handle);
 
 	/* Do we want to replace?  Yes, we do! */
 	g_variant_builder_add_value(&builder, g_variant_new_boolean(TRUE));
 
 	GError * error = NULL;
+
+	if (!wait) {
+		g_dbus_connection_call(bus,
+			DBUS_SERVICE_UPSTART,
+			DBUS_PATH_UPSTART,
+			DBUS_INTERFACE_UPSTART,
+			"SetEnvList",
+			g_variant_builder_end(&builder),
+			NULL, /* reply */
+			G_DBUS_CALL_FLAGS_NONE,
+			-1, /* timeout */
+			NULL, /* cancelable */
+			NULL, NULL); /* callback */
+
+		/* We're usually about to exit, make sure it's out the door */
+		g_dbus_connection_flush_sync(bus, NULL, &error);
+
+		if (error != NULL) {
+			g_warning("Unable to send environment variables: %s", error->message);
+			g_error_free(error);
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
 	GVariant * reply = g_dbus_connection_call_sync(bus,
 		DBUS_SERVICE_UPSTART,
 		DBUS_PATH_UPSTART,
@@ -633,7 +576,94 @@ env_handle_finish (EnvHandle * handle)
 	if (error != NULL) {
 		g_warning("Unable to set environment variables: %s", error->message);
 		g_error_free(error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void
+env_handle_finish (EnvHandle * handle)
+{
+	g_return_if_fail(handle != NULL);
+
+	/* Get a bus, let's go! */
+	GDBusConnection * bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+
+	env_handle_send(handle, bus, TRUE);
+
+	g_clear_object(&bus);
+}
+
+/* Ask the process that exported a SocketDemangler object for the Mir
+   socket. Returns the file descriptor, which is left open across exec,
+   or -1 if we couldn't get it. */
+gint
+mir_socket_demangle (const gchar * name, const gchar * path)
+{
+	g_return_val_if_fail(name != NULL && name[0] != '\0', -1);
+	g_return_val_if_fail(path != NULL && path[0] != '\0', -1);
+
+	g_debug("Mir socket connection to %s:%s", name, path);
+
+	GError * error = NULL;
+	GDBusConnection * bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+
+	if (error != NULL) {
+		g_warning("Unable to get session bus: %s", error->message);
+		g_error_free(error);
+		return -1;
+	}
+
+	GUnixFDList * fdlist = NULL;
+	GVariant * retval = g_dbus_connection_call_with_unix_fd_list_sync(
+		bus,
+		name,
+		path,
+		"com.canonical.UbuntuAppLaunch.SocketDemangler",
+		"GetMirSocket",
+		NULL,
+		G_VARIANT_TYPE("(h)"),
+		G_DBUS_CALL_FLAGS_NO_AUTO_START,
+		-1, /* timeout */
+		NULL, /* fd list in */
+		&fdlist,
+		NULL, /* cancelable */
+		&error);
+
+	g_clear_object(&bus);
+
+	if (error != NULL) {
+		g_warning("Unable to get Mir socket over dbus: %s", error->message);
+		g_error_free(error);
+		return -1;
+	}
+
+	gint32 handle = 0;
+	g_variant_get(retval, "(h)", &handle);
+	g_variant_unref(retval);
+
+	if (fdlist == NULL || handle >= g_unix_fd_list_get_length(fdlist)) {
+		g_warning("Handle is %d but the FD list only has %d entries", handle, fdlist == NULL ? 0 : g_unix_fd_list_get_length(fdlist));
+		g_clear_object(&fdlist);
+		return -1;
+	}
+
+	gint fd = g_unix_fd_list_get(fdlist, handle, &error);
+	g_clear_object(&fdlist);
+
+	if (error != NULL) {
+		g_warning("Unable to get Unix FD: %s", error->message);
+		g_error_free(error);
+		return -1;
+	}
+
+	/* Make sure the FD doesn't close on exec */
+	if (fcntl(fd, F_SETFD, 0) != 0) {
+		g_warning("File descriptor is invalid");
+		close(fd);
+		return -1;
 	}
 
-	g_object_unref(bus);
+	return fd;
 }
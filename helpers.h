@@ -21,6 +21,10 @@
 
 G_BEGIN_DECLS
 
+/* Abstract socket that exec-line-exec sends its launch milestones
+   to, the PID of the launcher goes on the end */
+#define LAUNCH_TIMELINE_SOCKET "ubuntu-app-launch/timeline/"
+
 typedef struct _EnvHandle EnvHandle;
 
 gboolean  app_id_to_triplet      (const gchar *   app_id,
@@ -45,11 +49,9 @@ void        env_handle_add       (EnvHandle *     handle,
                                   const gchar *   variable,
                                   const gchar *   value);
 void        env_handle_finish    (EnvHandle *     handle);
-
-typedef struct _handshake_t handshake_t;
-handshake_t * starting_handshake_start   (const gchar *   app_id,
-                                          int timeout_s);
-void      starting_handshake_wait        (handshake_t *   handshake);
+gboolean    env_handle_send      (EnvHandle *     handle,
+                                  GDBusConnection * bus,
+                                  gboolean        wait);
 
 GDBusConnection * cgroup_manager_connection (void);
 void              cgroup_manager_unref (GDBusConnection * cgroup_manager);
@@ -60,5 +62,8 @@ GList *   pids_from_cgroup       (GDBusConnection * cgmanager,
 gboolean   verify_keyfile        (GKeyFile *    inkeyfile,
                                   const gchar * desktop);
 
+gint       mir_socket_demangle   (const gchar * name,
+                                  const gchar * path);
+
 G_END_DECLS
 
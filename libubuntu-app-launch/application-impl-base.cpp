@@ -23,10 +23,19 @@
 #include <map>
 #include <numeric>
 
+#include <signal.h>
 #include <upstart.h>
 
 #include "application-impl-base.h"
+#include "bus-name-index.h"
+#include "cgroup-usage.h"
 #include "helpers.h"
+#include "launch-timeline.h"
+#include "memory-reclaim.h"
+#include "prelaunch-pool.h"
+#include "readahead-recorder.h"
+#include "priority-control.h"
+#include "proc-watcher.h"
 #include "registry-impl.h"
 #include "second-exec-core.h"
 
@@ -104,9 +113,18 @@ bool UpstartInstance::isRunning()
 }
 
 /** Uses Upstart to get the primary PID of the instance using Upstart's
-    DBus interface */
+    DBus interface. The instance path and the PID are kept until Upstart
+    says the instance changed state, so checking again is free. */
 pid_t UpstartInstance::primaryPid()
 {
+    {
+        std::lock_guard<std::mutex> guard(pidLock_);
+        if (pid_ != 0 && !registry_->impl->instanceStateChangedSince(instancePath_, pidSerial_))
+        {
+            return pid_;
+        }
+    }
+
     auto jobpath = registry_->impl->upstartJobPath(job_);
     if (jobpath.empty())
     {
@@ -117,78 +135,93 @@ pid_t UpstartInstance::primaryPid()
     return registry_->impl->thread.executeOnThread<pid_t>([this, &jobpath]() -> pid_t {
         GError* error = nullptr;
 
-        std::string instancename = std::string(appId_);
-        if (job_ != "application-click")
-        {
-            instancename += "-" + instance_;
-        }
-
-        g_debug("Getting instance by name: %s", instance_.c_str());
-        GVariant* vinstance_path =
-            g_dbus_connection_call_sync(registry_->impl->_dbus.get(),                   /* connection */
-                                        DBUS_SERVICE_UPSTART,                           /* service */
-                                        jobpath.c_str(),                                /* object path */
-                                        DBUS_INTERFACE_UPSTART_JOB,                     /* iface */
-                                        "GetInstanceByName",                            /* method */
-                                        g_variant_new("(s)", instancename.c_str()),     /* params */
-                                        G_VARIANT_TYPE("(o)"),                          /* return type */
-                                        G_DBUS_CALL_FLAGS_NONE,                         /* flags */
-                                        -1,                                             /* timeout: default */
-                                        registry_->impl->thread.getCancellable().get(), /* cancellable */
-                                        &error);
-
-        if (error != nullptr)
-        {
-            g_warning("Unable to get instance '%s' of job '%s': %s", instance_.c_str(), job_.c_str(), error->message);
-            g_error_free(error);
-            return 0;
-        }
+        /* Make sure we hear about changes before we look, and remember
+           where we were so we know if one came in while we looked */
+        registry_->impl->watchInstanceStates();
+        auto serial = registry_->impl->instanceStateSerial();
 
-        /* Jump rope to make this into a C++ type */
         std::string instance_path;
-        gchar* cinstance_path = nullptr;
-        g_variant_get(vinstance_path, "(o)", &cinstance_path);
-        g_variant_unref(vinstance_path);
-        if (cinstance_path != nullptr)
         {
-            instance_path = cinstance_path;
-            g_free(cinstance_path);
+            std::lock_guard<std::mutex> guard(pidLock_);
+            instance_path = instancePath_;
         }
 
         if (instance_path.empty())
         {
-            g_debug("No instance object for instance name: %s", instance_.c_str());
-            return 0;
+            std::string instancename = std::string(appId_);
+            if (job_ != "application-click")
+            {
+                instancename += "-" + instance_;
+            }
+
+            g_debug("Getting instance by name: %s", instance_.c_str());
+            GVariant* vinstance_path =
+                g_dbus_connection_call_sync(registry_->impl->_dbus.get(),                   /* connection */
+                                            DBUS_SERVICE_UPSTART,                           /* service */
+                                            jobpath.c_str(),                                /* object path */
+                                            DBUS_INTERFACE_UPSTART_JOB,                     /* iface */
+                                            "GetInstanceByName",                            /* method */
+                                            g_variant_new("(s)", instancename.c_str()),     /* params */
+                                            G_VARIANT_TYPE("(o)"),                          /* return type */
+                                            G_DBUS_CALL_FLAGS_NONE,                         /* flags */
+                                            -1,                                             /* timeout: default */
+                                            registry_->impl->thread.getCancellable().get(), /* cancellable */
+                                            &error);
+
+            if (error != nullptr)
+            {
+                g_warning("Unable to get instance '%s' of job '%s': %s", instance_.c_str(), job_.c_str(),
+                          error->message);
+                g_error_free(error);
+                return 0;
+            }
+
+            const gchar* cinstance_path = nullptr;
+            g_variant_get(vinstance_path, "(&o)", &cinstance_path);
+            instance_path = cinstance_path;
+            g_variant_unref(vinstance_path);
+
+            if (instance_path.empty())
+            {
+                g_debug("No instance object for instance name: %s", instance_.c_str());
+                return 0;
+            }
         }
 
-        GVariant* props_tuple =
-            g_dbus_connection_call_sync(registry_->impl->_dbus.get(),                          /* connection */
-                                        DBUS_SERVICE_UPSTART,                                  /* service */
-                                        instance_path.c_str(),                                 /* object path */
-                                        "org.freedesktop.DBus.Properties",                     /* interface */
-                                        "GetAll",                                              /* method */
-                                        g_variant_new("(s)", DBUS_INTERFACE_UPSTART_INSTANCE), /* params */
-                                        G_VARIANT_TYPE("(a{sv})"),                             /* return type */
-                                        G_DBUS_CALL_FLAGS_NONE,                                /* flags */
-                                        -1,                                                    /* timeout: default */
-                                        registry_->impl->thread.getCancellable().get(),        /* cancellable */
+        /* Only ask for what we need, not all the properties */
+        GVariant* params = g_variant_new("(ss)", DBUS_INTERFACE_UPSTART_INSTANCE, "processes");
+        GVariant* process_tuple =
+            g_dbus_connection_call_sync(registry_->impl->_dbus.get(),                   /* connection */
+                                        DBUS_SERVICE_UPSTART,                           /* service */
+                                        instance_path.c_str(),                          /* object path */
+                                        "org.freedesktop.DBus.Properties",              /* interface */
+                                        "Get",                                          /* method */
+                                        params,                                         /* params */
+                                        G_VARIANT_TYPE("(v)"),                          /* return type */
+                                        G_DBUS_CALL_FLAGS_NONE,                         /* flags */
+                                        -1,                                             /* timeout: default */
+                                        registry_->impl->thread.getCancellable().get(), /* cancellable */
                                         &error);
 
         if (error != nullptr)
         {
-            g_warning("Unable to name of properties '%s': %s", instance_path.c_str(), error->message);
+            /* The instance has probably gone away, so the path could
+               belong to a new one next time */
+            g_debug("Unable to get processes of '%s': %s", instance_path.c_str(), error->message);
             g_error_free(error);
-            error = nullptr;
+
+            std::lock_guard<std::mutex> guard(pidLock_);
+            instancePath_.clear();
+            pid_ = 0;
             return 0;
         }
 
-        GVariant* props_dict = g_variant_get_child_value(props_tuple, 0);
+        GVariant* processes_variant = g_variant_get_child_value(process_tuple, 0);
+        GVariant* processes = g_variant_get_variant(processes_variant);
 
         pid_t retval = 0;
-        GVariant* processes = g_variant_lookup_value(props_dict, "processes", G_VARIANT_TYPE("a(si)"));
-        if (processes != nullptr && g_variant_n_children(processes) > 0)
+        if (g_variant_is_of_type(processes, G_VARIANT_TYPE("a(si)")) && g_variant_n_children(processes) > 0)
         {
-
             GVariant* first_entry = g_variant_get_child_value(processes, 0);
             GVariant* pidv = g_variant_get_child_value(first_entry, 1);
 
@@ -202,7 +235,14 @@ pid_t UpstartInstance::primaryPid()
             g_debug("Unable to get 'processes' from properties of instance at path: %s", instance_path.c_str());
         }
 
-        g_variant_unref(props_dict);
+        g_variant_unref(processes);
+        g_variant_unref(processes_variant);
+        g_variant_unref(process_tuple);
+
+        std::lock_guard<std::mutex> guard(pidLock_);
+        instancePath_ = instance_path;
+        pid_ = retval;
+        pidSerial_ = serial;
 
         return retval;
     });
@@ -264,7 +304,14 @@ std::vector<pid_t> UpstartInstance::pids(const std::shared_ptr<Registry>& reg,
                                          const AppID& appid,
                                          const std::string& jobpath)
 {
-    auto pids = reg->impl->pidsFromCgroup(jobpath);
+    auto watcher = reg->impl->getProcWatcher();
+    auto pids = reg->impl->thread.executeOnThread<std::vector<pid_t>>([&reg, &jobpath, &watcher]() {
+        if (watcher && watcher->isTracking(jobpath))
+        {
+            return watcher->pids(jobpath);
+        }
+        return reg->impl->pidsFromCgroup(jobpath);
+    });
     g_debug("Got %d PIDs for AppID '%s'", int(pids.size()), std::string(appid).c_str());
     return pids;
 }
@@ -280,7 +327,11 @@ void UpstartInstance::pause()
     auto jobpath = upstartJobPath();
 
     registry->impl->thread.executeOnThread([registry, appid, jobpath] {
-        auto pids = forAllPids(registry, appid, jobpath, [registry](pid_t pid) {
+        std::weak_ptr<Registry> weakReg = registry;
+        auto pids = forAllPids(registry, appid, jobpath, ProcWatcher::Handler::LIFECYCLE, [weakReg](pid_t pid) {
+            auto registry = weakReg.lock();
+            if (!registry)
+                return;
             auto oomval = oom::paused();
             g_debug("Pausing PID: %d (%d)", pid, int(oomval));
             kill(pid, 0);
@@ -291,7 +342,29 @@ void UpstartInstance::pause()
             errno = 0;
         });
 
+        /* The paused score is set by the pause handler, an older one
+           shouldn't override it on new children */
+        auto watcher = registry->impl->getProcWatcher();
+        if (watcher)
+        {
+            watcher->clearHandler(jobpath, ProcWatcher::Handler::OOM);
+        }
+
         pidListToDbus(registry, appid, pids, "ApplicationPaused");
+
+        registry->impl->oomPolicyPaused(jobpath, [weakReg, appid, jobpath](std::int32_t score) {
+            auto registry = weakReg.lock();
+            if (!registry)
+                return;
+            /* Next to the pause handler, so new children are still stopped */
+            forAllPids(registry, appid, jobpath, ProcWatcher::Handler::OOM, [weakReg, score](pid_t pid) {
+                auto registry = weakReg.lock();
+                if (registry)
+                    oomValueToPid(registry, pid, static_cast<oom::Score>(score));
+            });
+        });
+
+        reclaimMemory(registry, appid, jobpath, pids);
     });
 
     registry_->impl->zgSendEvent(appId_, ZEITGEIST_ZG_LEAVE_EVENT);
@@ -308,16 +381,35 @@ void UpstartInstance::resume()
     auto jobpath = upstartJobPath();
 
     registry->impl->thread.executeOnThread([registry, appid, jobpath] {
-        auto pids = forAllPids(registry, appid, jobpath, [registry](pid_t pid) {
+        registry->impl->oomPolicyResumed(jobpath);
+        bool cgroupSched = schedulingToCGroup(registry, jobpath, SchedulingClass::FOREGROUND);
+
+        std::weak_ptr<Registry> weakReg = registry;
+        auto resumePid = [weakReg, cgroupSched](pid_t pid) {
+            auto registry = weakReg.lock();
+            if (!registry)
+                return;
             auto oomval = oom::focused();
             g_debug("Resuming PID: %d (%d)", pid, int(oomval));
             kill(pid, 0);
             if (errno != ESRCH) {
                 signalToPid(pid, SIGCONT);
                 oomValueToPid(registry, pid, oomval);
+                if (!cgroupSched)
+                    PriorityControl::applyToPid(pid, SchedulingClass::FOREGROUND);
             }
             errno = 0;
-        });
+        };
+        auto pids = forAllPids(registry, appid, jobpath, ProcWatcher::Handler::LIFECYCLE, resumePid);
+
+        /* That sets the score and class of new children too, so what
+           was set while it was paused doesn't apply to them anymore */
+        auto watcher = registry->impl->getProcWatcher();
+        if (watcher)
+        {
+            watcher->clearHandler(jobpath, ProcWatcher::Handler::OOM);
+            watcher->clearHandler(jobpath, ProcWatcher::Handler::SCHEDULING);
+        }
 
         pidListToDbus(registry, appid, pids, "ApplicationResumed");
     });
@@ -329,62 +421,76 @@ void UpstartInstance::resume()
     send a SIGTERM and five seconds later start killing things. */
 void UpstartInstance::stop()
 {
-    if (!registry_->impl->thread.executeOnThread<bool>([this]() {
+    if (!registry_->impl->thread.executeOnThread<bool>(
+            [this]() { return stopJob(registry_, std::string(appId_), job_, instance_, false); }))
+    {
+        g_warning("Unable to stop Upstart instance");
+    }
+}
 
-            g_debug("Stopping job %s app_id %s instance_id %s", job_.c_str(), std::string(appId_).c_str(),
-                    instance_.c_str());
+/** Ask Upstart to stop a job instance, must be called on the registry
+    thread.
 
-            auto jobpath = registry_->impl->upstartJobPath(job_);
-            if (jobpath.empty())
-            {
-                throw new std::runtime_error("Unable to get job path for Upstart job '" + job_ + "'");
-            }
+    \param reg Registry of persistent connections to use
+    \param appid Application ID
+    \param job Upstart job name
+    \param instance Instance ID, empty if none
+    \param wait Whether Upstart should reply only once the job has stopped
+*/
+bool UpstartInstance::stopJob(const std::shared_ptr<Registry>& reg,
+                              const std::string& appid,
+                              const std::string& job,
+                              const std::string& instance,
+                              bool wait)
+{
+    g_debug("Stopping job %s app_id %s instance_id %s", job.c_str(), appid.c_str(), instance.c_str());
 
-            GVariantBuilder builder;
-            g_variant_builder_init(&builder, G_VARIANT_TYPE_TUPLE);
-            g_variant_builder_open(&builder, G_VARIANT_TYPE_ARRAY);
+    auto jobpath = reg->impl->upstartJobPath(job);
+    if (jobpath.empty())
+    {
+        throw new std::runtime_error("Unable to get job path for Upstart job '" + job + "'");
+    }
 
-            g_variant_builder_add_value(
-                &builder, g_variant_new_take_string(g_strdup_printf("APP_ID=%s", std::string(appId_).c_str())));
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_TUPLE);
+    g_variant_builder_open(&builder, G_VARIANT_TYPE_ARRAY);
 
-            if (!instance_.empty())
-            {
-                g_variant_builder_add_value(
-                    &builder, g_variant_new_take_string(g_strdup_printf("INSTANCE_ID=%s", instance_.c_str())));
-            }
+    g_variant_builder_add_value(&builder, g_variant_new_take_string(g_strdup_printf("APP_ID=%s", appid.c_str())));
 
-            g_variant_builder_close(&builder);
-            g_variant_builder_add_value(&builder, g_variant_new_boolean(FALSE)); /* wait */
-
-            GError* error = nullptr;
-            GVariant* stop_variant =
-                g_dbus_connection_call_sync(registry_->impl->_dbus.get(),                   /* Dbus */
-                                            DBUS_SERVICE_UPSTART,                           /* Upstart name */
-                                            jobpath.c_str(),                                /* path */
-                                            DBUS_INTERFACE_UPSTART_JOB,                     /* interface */
-                                            "Stop",                                         /* method */
-                                            g_variant_builder_end(&builder),                /* params */
-                                            nullptr,                                        /* return */
-                                            G_DBUS_CALL_FLAGS_NONE,                         /* flags */
-                                            -1,                                             /* timeout: default */
-                                            registry_->impl->thread.getCancellable().get(), /* cancellable */
-                                            &error);                                        /* error (hopefully not) */
+    if (!instance.empty())
+    {
+        g_variant_builder_add_value(&builder,
+                                    g_variant_new_take_string(g_strdup_printf("INSTANCE_ID=%s", instance.c_str())));
+    }
 
-            g_clear_pointer(&stop_variant, g_variant_unref);
+    g_variant_builder_close(&builder);
+    g_variant_builder_add_value(&builder, g_variant_new_boolean(wait ? TRUE : FALSE)); /* wait */
 
-            if (error != nullptr)
-            {
-                g_warning("Unable to stop job %s app_id %s instance_id %s: %s", job_.c_str(),
-                          std::string(appId_).c_str(), instance_.c_str(), error->message);
-                g_error_free(error);
-                return false;
-            }
+    GError* error = nullptr;
+    GVariant* stop_variant =
+        g_dbus_connection_call_sync(reg->impl->_dbus.get(),                   /* Dbus */
+                                    DBUS_SERVICE_UPSTART,                     /* Upstart name */
+                                    jobpath.c_str(),                          /* path */
+                                    DBUS_INTERFACE_UPSTART_JOB,               /* interface */
+                                    "Stop",                                   /* method */
+                                    g_variant_builder_end(&builder),          /* params */
+                                    nullptr,                                  /* return */
+                                    G_DBUS_CALL_FLAGS_NONE,                   /* flags */
+                                    -1,                                       /* timeout: default */
+                                    reg->impl->thread.getCancellable().get(), /* cancellable */
+                                    &error);                                  /* error (hopefully not) */
+
+    g_clear_pointer(&stop_variant, g_variant_unref);
 
-            return true;
-        }))
+    if (error != nullptr)
     {
-        g_warning("Unable to stop Upstart instance");
+        g_warning("Unable to stop job %s app_id %s instance_id %s: %s", job.c_str(), appid.c_str(), instance.c_str(),
+                  error->message);
+        g_error_free(error);
+        return false;
     }
+
+    return true;
 }
 
 /** Sets the OOM adjustment by getting the list of PIDs and writing
@@ -394,7 +500,56 @@ void UpstartInstance::stop()
 */
 void UpstartInstance::setOomAdjustment(const oom::Score score)
 {
-    forAllPids(registry_, appId_, upstartJobPath(), [this, score](pid_t pid) { oomValueToPid(registry_, pid, score); });
+    /* The function is kept for new children when the PIDs are tracked,
+       so it can't hold on to the registry */
+    std::weak_ptr<Registry> weakReg = registry_;
+    forAllPids(registry_, appId_, upstartJobPath(), ProcWatcher::Handler::OOM, [weakReg, score](pid_t pid) {
+        auto registry = weakReg.lock();
+        if (registry)
+            oomValueToPid(registry, pid, score);
+    });
+}
+
+/** Moves the instance into a scheduling class, using the weights on its
+    cgroups if we can and otherwise going through all the PIDs and setting
+    their nice value and I/O priority.
+
+    \param schedClass Class to move the instance to
+*/
+void UpstartInstance::setSchedulingClass(SchedulingClass schedClass)
+{
+    g_debug("Setting scheduling class of '%s' to %s", std::string(appId_).c_str(),
+            schedClass == SchedulingClass::FOREGROUND ? "foreground" : "background");
+
+    auto registry = registry_;
+    auto appid = appId_;
+    auto jobpath = upstartJobPath();
+
+    registry->impl->thread.executeOnThread([registry, appid, jobpath, schedClass] {
+        if (schedulingToCGroup(registry, jobpath, schedClass))
+        {
+            return;
+        }
+
+        forAllPids(registry, appid, jobpath, ProcWatcher::Handler::SCHEDULING,
+                   [schedClass](pid_t pid) { PriorityControl::applyToPid(pid, schedClass); });
+    });
+}
+
+/** Set the scheduling class on the cgroups of the job, returns whether
+    it was able to so the caller can fall back to setting it on each PID.
+
+    \param reg Registry to get the cgroups from
+    \param jobpath Name of the job's cgroup
+    \param schedClass Class to move the job to
+*/
+bool UpstartInstance::schedulingToCGroup(const std::shared_ptr<Registry>& reg,
+                                         const std::string& jobpath,
+                                         SchedulingClass schedClass)
+{
+    auto cgroups = reg->impl->getCGroupUsage();
+    return PriorityControl::applyToCGroup(cgroups->cpuPath(jobpath), cgroups->ioPath(jobpath), cgroups->isUnified(),
+                                          schedClass);
 }
 
 /** Figures out the path to the primary PID of the application and
@@ -428,16 +583,46 @@ const oom::Score UpstartInstance::getOomAdjustment()
     return score;
 }
 
+/** Reads the accounting counters from the cgroup of the instance */
+Application::Instance::ResourceUsage UpstartInstance::resourceUsage()
+{
+    return registry_->impl->getCGroupUsage()->forJob(upstartJobPath());
+}
+
 /** Go through the list of PIDs calling a function and handling
     the issue with getting PIDs being a racey condition.
 
+    When PID tracking is available we get an accurate snapshot and only
+    need one pass, the function is then kept and run on new children of
+    the job as they are created. So it shouldn't hold a reference to the
+    registry.
+
+    \param kind What the function is for, it replaces the earlier
+                function of the same kind on new children
     \param eachPid Function to run on each PID
 */
 std::vector<pid_t> UpstartInstance::forAllPids(const std::shared_ptr<Registry>& reg,
                                                const AppID& appid,
                                                const std::string& jobpath,
+                                               ProcWatcher::Handler kind,
                                                std::function<void(pid_t)> eachPid)
 {
+    auto watcher = reg->impl->getProcWatcher();
+    if (watcher)
+    {
+        auto pidlist = reg->impl->thread.executeOnThread<std::vector<pid_t>>([&]() {
+            return watcher->track(jobpath, [&]() { return reg->impl->pidsFromCgroup(jobpath); }, kind, eachPid);
+        });
+        g_debug("Got %d tracked PIDs for AppID '%s'", int(pidlist.size()), std::string(appid).c_str());
+
+        for (auto pid : pidlist)
+        {
+            eachPid(pid);
+        }
+
+        return pidlist;
+    }
+
     std::set<pid_t> seenPids;
     bool added = true;
 
@@ -586,6 +771,182 @@ void UpstartInstance::oomValueToPidHelper(const std::shared_ptr<Registry>& reg,
     }
 }
 
+/** Data passed through the reclaim task */
+struct ReclaimData
+{
+    std::weak_ptr<Registry> registry;
+    AppID appid;
+    std::string memorypath;
+    bool unified;
+    std::vector<pid_t> pids;
+    std::uint64_t budget;
+    MemoryReclaim::Result result;
+};
+
+/** Pushes the memory of a job that was just paused out to swap. Reclaim
+    blocks while the kernel writes out pages so it is done in the GLib
+    thread pool and the result is reported back on the registry thread
+    with the ApplicationReclaimed signal. Only done when there is a budget
+    set in UBUNTU_APP_LAUNCH_RECLAIM_BUDGET.
+
+    \param reg Registry to get the cgroups and connection from
+    \param appid Application ID of the job
+    \param jobpath Name of the job's cgroup
+    \param pids Processes that were paused
+*/
+void UpstartInstance::reclaimMemory(const std::shared_ptr<Registry>& reg,
+                                    const AppID& appid,
+                                    const std::string& jobpath,
+                                    const std::vector<pid_t>& pids)
+{
+    auto budget = MemoryReclaim::budget();
+    if (budget == 0)
+    {
+        return;
+    }
+
+    auto cgroups = reg->impl->getCGroupUsage();
+    auto data = new ReclaimData{reg, appid, cgroups->memoryPath(jobpath), cgroups->isUnified(), pids, budget, {}};
+
+    /* The callback is run in the thread default context when the task is
+       created, which is the registry thread */
+    auto task = g_task_new(nullptr, nullptr,
+                           [](GObject* obj, GAsyncResult* res, gpointer user_data) {
+                               auto data = reinterpret_cast<ReclaimData*>(g_task_get_task_data(G_TASK(res)));
+                               auto appidstr = std::string(data->appid);
+
+                               tracepoint(ubuntu_app_launch, reclaim_finished, appidstr.c_str(), data->result.bytes,
+                                          data->result.time.count());
+                               g_debug("Reclaimed %llu bytes from '%s' in %lld us using %s",
+                                       (unsigned long long)data->result.bytes, appidstr.c_str(),
+                                       (long long)data->result.time.count(), data->result.method.c_str());
+
+                               auto registry = data->registry.lock();
+                               if (!registry)
+                                   return;
+
+                               GError* error = nullptr;
+                               g_dbus_connection_emit_signal(
+                                   registry->impl->_dbus.get(),     /* bus */
+                                   nullptr,                         /* destination */
+                                   "/",                             /* path */
+                                   "com.canonical.UbuntuAppLaunch", /* interface */
+                                   "ApplicationReclaimed",          /* signal */
+                                   g_variant_new("(stt)", appidstr.c_str(), guint64(data->result.bytes),
+                                                 guint64(data->result.time.count())), /* params */
+                                   &error);                                           /* error */
+
+                               if (error != nullptr)
+                               {
+                                   g_warning("Unable to emit reclaim signal for appid '%s': %s", appidstr.c_str(),
+                                             error->message);
+                                   g_error_free(error);
+                               }
+                           },
+                           nullptr);
+    g_task_set_task_data(task, data, [](gpointer data) { delete reinterpret_cast<ReclaimData*>(data); });
+
+    tracepoint(ubuntu_app_launch, reclaim_start, std::string(appid).c_str());
+
+    g_task_run_in_thread(task, [](GTask* task, gpointer obj, gpointer task_data, GCancellable* cancel) {
+        auto data = reinterpret_cast<ReclaimData*>(task_data);
+        data->result = MemoryReclaim::reclaim(data->memorypath, data->unified, data->pids, data->budget);
+        g_task_return_boolean(task, TRUE);
+    });
+    g_object_unref(task);
+}
+
+/** Data passed through the readahead task */
+struct ReadaheadData
+{
+    std::weak_ptr<Registry> registry;
+    std::shared_ptr<ReadaheadRecorder> readahead;
+    std::string appid;
+    std::string appdir;
+    bool record;
+};
+
+/** Save what the application has in the page cache in the GLib thread
+    pool, as it opens and maps every file in the application directory.
+
+    \param readahead Recorder to save the list with
+    \param appid Application ID, including the version
+    \param appdir Directory with the application's files
+*/
+static void recordReadahead(const std::shared_ptr<ReadaheadRecorder>& readahead,
+                            const std::string& appid,
+                            const std::string& appdir)
+{
+    auto data = new ReadaheadData{{}, readahead, appid, appdir, true};
+
+    auto task = g_task_new(nullptr, nullptr, nullptr, nullptr);
+    g_task_set_task_data(task, data, [](gpointer data) { delete reinterpret_cast<ReadaheadData*>(data); });
+    g_task_run_in_thread(task, [](GTask* task, gpointer obj, gpointer task_data, GCancellable* cancel) {
+        auto data = reinterpret_cast<ReadaheadData*>(task_data);
+        auto totals = data->readahead->record(data->appid, data->appdir);
+        tracepoint(ubuntu_app_launch, readahead_record, data->appid.c_str(), totals.files, totals.bytes);
+        g_task_return_boolean(task, TRUE);
+    });
+    g_object_unref(task);
+}
+
+/** Get the files the application used last time on their way into
+    memory. Reading the list and queuing the reads happens in the GLib
+    thread pool so that the launch doesn't wait on them. If the list is
+    missing or stale the application gets recorded again once it has had
+    a chance to start. Does nothing unless UBUNTU_APP_LAUNCH_READAHEAD
+    is set.
+
+    \param reg Registry to get the recorder from
+    \param appid Application ID, including the version
+    \param appdir Directory with the application's files
+*/
+void UpstartInstance::readahead(const std::shared_ptr<Registry>& reg,
+                                const std::string& appid,
+                                const std::string& appdir)
+{
+    auto readahead = reg->impl->getReadahead();
+    if (readahead->window().count() == 0 || appdir.empty())
+    {
+        return;
+    }
+
+    auto data = new ReadaheadData{reg, readahead, appid, appdir, false};
+
+    /* The callback is run in the thread default context when the task is
+       created, which is the registry thread */
+    auto task = g_task_new(nullptr, nullptr,
+                           [](GObject* obj, GAsyncResult* res, gpointer user_data) {
+                               auto data = reinterpret_cast<ReadaheadData*>(g_task_get_task_data(G_TASK(res)));
+                               auto registry = data->registry.lock();
+                               if (!data->record || !registry)
+                                   return;
+
+                               auto readahead = data->readahead;
+                               auto appid = data->appid;
+                               auto appdir = data->appdir;
+                               registry->impl->thread.timeoutSeconds(
+                                   readahead->window(),
+                                   [readahead, appid, appdir]() { recordReadahead(readahead, appid, appdir); });
+                           },
+                           nullptr);
+    g_task_set_task_data(task, data, [](gpointer data) { delete reinterpret_cast<ReadaheadData*>(data); });
+
+    g_task_run_in_thread(task, [](GTask* task, gpointer obj, gpointer task_data, GCancellable* cancel) {
+        auto data = reinterpret_cast<ReadaheadData*>(task_data);
+
+        if (data->readahead->hasList(data->appid))
+        {
+            auto totals = data->readahead->replay(data->appid);
+            tracepoint(ubuntu_app_launch, readahead_replay, data->appid.c_str(), totals.files, totals.bytes);
+        }
+
+        data->record = data->readahead->needsRecording(data->appid, data->appdir);
+        g_task_return_boolean(task, TRUE);
+    });
+    g_object_unref(task);
+}
+
 /** Send a signal that we've change the application. Do this on the
     registry thread in an idle so that we don't block anyone.
 
@@ -666,6 +1027,8 @@ UpstartInstance::UpstartInstance(const AppID& appId,
     , instance_(instance)
     , urls_(urls)
     , registry_(registry)
+    , pid_(0)
+    , pidSerial_(0)
 {
     g_debug("Creating a new UpstartInstance for '%s' instance '%s'", std::string(appId_).c_str(), instance.c_str());
 }
@@ -730,11 +1093,34 @@ void UpstartInstance::application_start_cb(GObject* obj, GAsyncResult* res, gpoi
             if (g_strcmp0(remote_error, "com.ubuntu.Upstart0_6.Error.AlreadyStarted") == 0)
             {
                 auto urls = urlsToStrv(data->ptr->urls_);
+                auto pid = data->ptr->primaryPid();
+
+                /* If the index has finished its scan we can give second exec
+                   the names, otherwise it has to ask the bus for all of them.
+                   No names could be a connection the index is still asking
+                   about, so that gets the full search too. */
+                std::vector<std::string> names;
+                std::vector<const gchar*> cnames;
+                auto index = data->ptr->registry_->impl->getBusNameIndex();
+                if (pid != 0 && index->isReady())
+                {
+                    names = index->namesForPid(pid);
+                }
+                if (!names.empty())
+                {
+                    for (const auto& name : names)
+                    {
+                        cnames.push_back(name.c_str());
+                    }
+                    cnames.push_back(nullptr);
+                }
+
                 second_exec(data->ptr->registry_->impl->_dbus.get(),                   /* DBus */
                             data->ptr->registry_->impl->thread.getCancellable().get(), /* cancellable */
-                            data->ptr->primaryPid(),                                   /* primary pid */
+                            pid,                                                       /* primary pid */
                             std::string(data->ptr->appId_).c_str(),                    /* appid */
-                            urls.get());                                               /* urls */
+                            urls.get(),                                                /* urls */
+                            cnames.empty() ? nullptr : cnames.data());                 /* bus names */
             }
 
             g_free(remote_error);
@@ -749,6 +1135,70 @@ void UpstartInstance::application_start_cb(GObject* obj, GAsyncResult* res, gpoi
     delete data;
 }
 
+/** Build the parameters for Upstart's Start method
+
+    \param env Environment variables for the job
+    \param wait Whether Upstart should reply only once the job has started
+*/
+GVariant* UpstartInstance::startParams(const std::list<std::pair<std::string, std::string>>& env, bool wait)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_TUPLE);
+
+    g_variant_builder_open(&builder, G_VARIANT_TYPE_ARRAY);
+
+    for (const auto& envvar : env)
+    {
+        g_variant_builder_add_value(
+            &builder, g_variant_new_take_string(g_strdup_printf("%s=%s", envvar.first.c_str(), envvar.second.c_str())));
+    }
+
+    g_variant_builder_close(&builder);
+    g_variant_builder_add_value(&builder, g_variant_new_boolean(wait ? TRUE : FALSE));
+
+    return g_variant_builder_end(&builder);
+}
+
+/** Wake up a parked job so that it execs the application. The caller
+    does the starting handshake just like a regular launch so the shell
+    knows that it is coming. Returns an empty pointer if the job couldn't
+    be woken up and it needs a regular launch.
+
+    \param appId Application ID
+    \param job Upstart job name
+    \param instance Upstart instance name
+    \param registry Registry of persistent connections to use
+    \param parkedAt When the job was prelaunched
+*/
+std::shared_ptr<UpstartInstance> UpstartInstance::unpark(const AppID& appId,
+                                                         const std::string& job,
+                                                         const std::string& instance,
+                                                         const std::shared_ptr<Registry>& registry,
+                                                         std::chrono::steady_clock::time_point parkedAt)
+{
+    std::string appIdStr{appId};
+    auto retval = std::make_shared<UpstartInstance>(appId, job, instance, std::vector<Application::URL>{}, registry);
+
+    /* It could have timed out or been killed while parked */
+    auto pid = retval->primaryPid();
+    if (pid == 0)
+    {
+        g_debug("Parked job for '%s' has gone away", appIdStr.c_str());
+        return {};
+    }
+
+    if (kill(pid, SIGUSR1) != 0)
+    {
+        g_warning("Unable to wake parked job for '%s': %s", appIdStr.c_str(), std::strerror(errno));
+        return {};
+    }
+
+    auto parked = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - parkedAt);
+    tracepoint(ubuntu_app_launch, prelaunch_hit, appIdStr.c_str(), parked.count());
+
+    return retval;
+}
+
 /** Launch an application and create a new UpstartInstance object to track
     its progress.
 
@@ -772,27 +1222,59 @@ std::shared_ptr<UpstartInstance> UpstartInstance::launch(
     if (appId.empty())
         return {};
 
-    return registry->impl->thread.executeOnThread<std::shared_ptr<UpstartInstance>>(
+    std::string appIdStr{appId};
+    std::shared_ptr<Registry::Impl::StartingHandshake> handshake;
+
+    auto retval = registry->impl->thread.executeOnThread<std::shared_ptr<UpstartInstance>>(
         [&]() -> std::shared_ptr<UpstartInstance> {
-            std::string appIdStr{appId};
             g_debug("Initializing params for an new UpstartInstance for: %s", appIdStr.c_str());
 
             tracepoint(ubuntu_app_launch, libual_start, appIdStr.c_str());
+            auto timeline = registry->impl->getLaunchTimeline();
+            auto launch = timeline->start(appIdStr);
 
-            int timeout = 1;
-            if (ubuntu::app_launch::Registry::Impl::isWatchingAppStarting())
+            registry->impl->predictorLaunch(registry, appId);
+
+            /* Let the shell know it is coming, we wait for the answer once
+               we're off the registry thread so other work can go on */
+            handshake = registry->impl->startingHandshakeStart(appIdStr, launch);
+            if (!handshake)
             {
-                timeout = 0;
+                g_warning("Unable to setup starting handshake");
             }
 
-            auto handshake = starting_handshake_start(appIdStr.c_str(), timeout);
-            if (handshake == nullptr)
+            /* A parked job was started without URLs or the testing
+               environment, so it can only be used for launches without them */
+            auto pool = registry->impl->getPrelaunchPool();
+            PrelaunchPool::Entry parked;
+            if (pool->take(appIdStr, parked))
             {
-                g_warning("Unable to setup starting handshake");
+                if (urls.empty() && mode == launchMode::STANDARD)
+                {
+                    auto retval = unpark(appId, parked.job, parked.instance, registry, parked.parkedAt);
+                    if (retval)
+                    {
+                        pool->countHit();
+                        return retval;
+                    }
+                }
+                else
+                {
+                    /* It needs to be gone before we can start it again */
+                    stopJob(registry, appIdStr, parked.job, parked.instance, true);
+                }
+            }
+
+            if (pool->size() > 0)
+            {
+                pool->countMiss();
+                tracepoint(ubuntu_app_launch, prelaunch_miss, appIdStr.c_str());
             }
 
             /* Figure out the DBus path for the job */
             auto jobpath = registry->impl->upstartJobPath(job);
+            tracepoint(ubuntu_app_launch, libual_job_path_determined, appIdStr.c_str(), jobpath.c_str());
+            timeline->stamp(appIdStr, launch, LaunchTimeline::Milestone::JOB_PATH);
 
             /* Build up our environment */
             auto env = getenv();
@@ -834,21 +1316,13 @@ std::shared_ptr<UpstartInstance> UpstartInstance::launch(
                 env.emplace_back(std::make_pair("QT_LOAD_TESTABILITY", "1"));
             }
 
-            /* Convert to GVariant */
-            GVariantBuilder builder;
-            g_variant_builder_init(&builder, G_VARIANT_TYPE_TUPLE);
-
-            g_variant_builder_open(&builder, G_VARIANT_TYPE_ARRAY);
-
-            for (const auto& envvar : env)
+            /* With URLs we might need to send them to a running copy, so
+               get the bus name index scanning for when we do */
+            if (!urls.empty())
             {
-                g_variant_builder_add_value(&builder, g_variant_new_take_string(g_strdup_printf(
-                                                          "%s=%s", envvar.first.c_str(), envvar.second.c_str())));
+                registry->impl->getBusNameIndex();
             }
 
-            g_variant_builder_close(&builder);
-            g_variant_builder_add_value(&builder, g_variant_new_boolean(TRUE));
-
             auto retval = std::make_shared<UpstartInstance>(appId, job, instance, urls, registry);
             auto chelper = new StartCHelper{};
             chelper->ptr = retval;
@@ -860,7 +1334,7 @@ std::shared_ptr<UpstartInstance> UpstartInstance::launch(
                                    jobpath.c_str(),                               /* Path */
                                    DBUS_INTERFACE_UPSTART_JOB,                    /* interface */
                                    "Start",                                       /* method */
-                                   g_variant_builder_end(&builder),               /* params */
+                                   startParams(env, true),                        /* params */
                                    nullptr,                                       /* return */
                                    G_DBUS_CALL_FLAGS_NONE,                        /* flags */
                                    -1,                                            /* default timeout */
@@ -870,13 +1344,144 @@ std::shared_ptr<UpstartInstance> UpstartInstance::launch(
                                    );
 
             tracepoint(ubuntu_app_launch, libual_start_message_sent, appIdStr.c_str());
-
-            tracepoint(ubuntu_app_launch, handshake_wait, appIdStr.c_str());
-            starting_handshake_wait(handshake);
-            tracepoint(ubuntu_app_launch, handshake_complete, appIdStr.c_str());
+            timeline->stamp(appIdStr, launch, LaunchTimeline::Milestone::MESSAGE_SENT);
+
+            /* While Upstart gets the job going we can get the files the
+               application used last time on their way into memory */
+            auto appdir = std::find_if(env.begin(), env.end(), [](const std::pair<std::string, std::string>& envvar) {
+                return envvar.first == "APP_DIR";
+            });
+            if (appdir != env.end())
+            {
+                readahead(registry, appIdStr, appdir->second);
+            }
 
             return retval;
         });
+
+    tracepoint(ubuntu_app_launch, handshake_wait, appIdStr.c_str());
+    registry->impl->startingHandshakeWait(handshake);
+    tracepoint(ubuntu_app_launch, handshake_complete, appIdStr.c_str());
+
+    return retval;
+}
+
+/** Small helper to know which entry to drop if a prelaunch fails */
+struct PrelaunchCHelper
+{
+    std::weak_ptr<Registry> registry;
+    std::string appid;
+};
+
+/** Callback from starting a parked job. If it didn't start there is
+    nothing to wake up, so we take it out of the pool.
+
+    \param obj The GDBusConnection object
+    \param res Async result object
+    \param user_data A pointer to a PrelaunchCHelper structure
+*/
+void UpstartInstance::prelaunch_start_cb(GObject* obj, GAsyncResult* res, gpointer user_data)
+{
+    auto data = static_cast<PrelaunchCHelper*>(user_data);
+    GError* error{nullptr};
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+    g_clear_pointer(&result, g_variant_unref);
+
+    if (error != nullptr)
+    {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+            g_warning("Unable to prelaunch '%s': %s", data->appid.c_str(), error->message);
+
+            auto reg = data->registry.lock();
+            if (reg)
+            {
+                reg->impl->getPrelaunchPool()->remove(data->appid);
+            }
+        }
+        g_error_free(error);
+    }
+
+    delete data;
+}
+
+/** Start an application's job with APP_PRELAUNCH set so that it gets
+    everything setup and then parks itself before the exec. The job is
+    put in the prelaunch pool, and anything the pool evicts to make room
+    for it is stopped.
+
+    \param appId Application ID
+    \param job Upstart job name
+    \param instance Upstart instance name
+    \param registry Registry of persistent connections to use
+    \param getenv A function to get additional environment variable when appropriate
+*/
+bool UpstartInstance::prelaunch(const AppID& appId,
+                                const std::string& job,
+                                const std::string& instance,
+                                const std::shared_ptr<Registry>& registry,
+                                std::function<std::list<std::pair<std::string, std::string>>(void)>& getenv)
+{
+    if (appId.empty())
+        return false;
+
+    return registry->impl->thread.executeOnThread<bool>([&]() -> bool {
+        std::string appIdStr{appId};
+
+        auto pool = registry->impl->getPrelaunchPool();
+        if (pool->size() == 0)
+        {
+            return false;
+        }
+
+        if (pool->contains(appIdStr))
+        {
+            return true;
+        }
+
+        auto jobpath = registry->impl->upstartJobPath(job);
+        if (jobpath.empty())
+        {
+            g_warning("Unable to get job path for Upstart job '%s'", job.c_str());
+            return false;
+        }
+
+        tracepoint(ubuntu_app_launch, prelaunch_start, appIdStr.c_str());
+
+        auto env = getenv();
+
+        env.emplace_back(std::make_pair("APP_ID", appIdStr));
+        env.emplace_back(std::make_pair("APP_LAUNCHER_PID", std::to_string(getpid())));
+        env.emplace_back(std::make_pair("APP_PRELAUNCH", "1"));
+
+        auto chelper = new PrelaunchCHelper{registry, appIdStr};
+
+        /* Not waiting as the job won't finish starting until it is woken up */
+        g_debug("Asking Upstart to prelaunch: %s", appIdStr.c_str());
+        g_dbus_connection_call(registry->impl->_dbus.get(),                   /* bus */
+                               DBUS_SERVICE_UPSTART,                          /* service name */
+                               jobpath.c_str(),                               /* Path */
+                               DBUS_INTERFACE_UPSTART_JOB,                    /* interface */
+                               "Start",                                       /* method */
+                               startParams(env, false),                       /* params */
+                               nullptr,                                       /* return */
+                               G_DBUS_CALL_FLAGS_NONE,                        /* flags */
+                               -1,                                            /* default timeout */
+                               registry->impl->thread.getCancellable().get(), /* cancellable */
+                               prelaunch_start_cb,                            /* callback */
+                               chelper                                        /* object */
+                               );
+
+        auto evicted = pool->add(PrelaunchPool::Entry{appIdStr, job, instance, std::chrono::steady_clock::now()});
+        for (const auto& entry : evicted)
+        {
+            g_debug("Evicting parked job for '%s'", entry.appid.c_str());
+            stopJob(registry, entry.appid, entry.job, entry.instance, false);
+        }
+
+        return true;
+    });
 }
 
 }  // namespace app_impls
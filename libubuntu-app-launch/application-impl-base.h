@@ -18,6 +18,11 @@
  */
 
 #include "application.h"
+#include "proc-watcher.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
 
 extern "C" {
 #include "ubuntu-app-launch.h"
@@ -43,6 +48,14 @@ public:
 
     bool hasInstances() override;
 
+    /** Start the application's job parked, so that a later launch without
+        URLs only needs to wake it up. Returns whether a job was parked,
+        backends that can't be prelaunched return false. */
+    virtual bool prelaunch()
+    {
+        return false;
+    }
+
 protected:
     /** Pointer to the registry so we can ask it for things */
     std::shared_ptr<Registry> _registry;
@@ -80,6 +93,12 @@ public:
     void setOomAdjustment(const oom::Score score) override;
     const oom::Score getOomAdjustment() override;
 
+    /* Scheduling */
+    void setSchedulingClass(SchedulingClass schedClass) override;
+
+    /* Resource Usage */
+    ResourceUsage resourceUsage() override;
+
     /** Flag for whether we should include the testing environment variables */
     enum class launchMode
     {
@@ -94,6 +113,17 @@ public:
         const std::shared_ptr<Registry>& registry,
         launchMode mode,
         std::function<std::list<std::pair<std::string, std::string>>(void)>& getenv);
+    static bool prelaunch(const AppID& appId,
+                          const std::string& job,
+                          const std::string& instance,
+                          const std::shared_ptr<Registry>& registry,
+                          std::function<std::list<std::pair<std::string, std::string>>(void)>& getenv);
+    static bool stopJob(const std::shared_ptr<Registry>& reg,
+                        const std::string& appid,
+                        const std::string& job,
+                        const std::string& instance,
+                        bool wait);
+    static void readahead(const std::shared_ptr<Registry>& reg, const std::string& appid, const std::string& appdir);
 
 private:
     /** Application ID */
@@ -108,11 +138,22 @@ private:
     /** A link to the registry we're using for connections */
     std::shared_ptr<Registry> registry_;
 
+    /** Protects the cached instance path and PID */
+    std::mutex pidLock_;
+    /** Upstart object path of the instance, empty until we've found it */
+    std::string instancePath_;
+    /** Primary PID from the last lookup, zero if we don't have one */
+    pid_t pid_;
+    /** Instance state serial when the PID was looked up, a state change
+        after that means it needs to be looked up again */
+    std::uint64_t pidSerial_;
+
     std::string upstartJobPath();
 
     static std::vector<pid_t> forAllPids(const std::shared_ptr<Registry>& reg,
                                          const AppID& appid,
                                          const std::string& jobpath,
+                                         ProcWatcher::Handler kind,
                                          std::function<void(pid_t)> eachPid);
     static std::vector<pid_t> pids(const std::shared_ptr<Registry>& reg,
                                    const AppID& appid,
@@ -121,12 +162,26 @@ private:
                               const AppID& appid,
                               const std::vector<pid_t>& pids,
                               const std::string& signal);
+    static bool schedulingToCGroup(const std::shared_ptr<Registry>& reg,
+                                   const std::string& jobpath,
+                                   SchedulingClass schedClass);
+    static void reclaimMemory(const std::shared_ptr<Registry>& reg,
+                              const AppID& appid,
+                              const std::string& jobpath,
+                              const std::vector<pid_t>& pids);
     static void signalToPid(pid_t pid, int signal);
     static void oomValueToPid(const std::shared_ptr<Registry>& reg, pid_t pid, const oom::Score oomvalue);
     static void oomValueToPidHelper(const std::shared_ptr<Registry>& reg, pid_t pid, const oom::Score oomvalue);
     static std::string pidToOomPath(pid_t pid);
     static std::shared_ptr<gchar*> urlsToStrv(const std::vector<Application::URL>& urls);
+    static GVariant* startParams(const std::list<std::pair<std::string, std::string>>& env, bool wait);
+    static std::shared_ptr<UpstartInstance> unpark(const AppID& appId,
+                                                   const std::string& job,
+                                                   const std::string& instance,
+                                                   const std::shared_ptr<Registry>& registry,
+                                                   std::chrono::steady_clock::time_point parkedAt);
     static void application_start_cb(GObject* obj, GAsyncResult* res, gpointer user_data);
+    static void prelaunch_start_cb(GObject* obj, GAsyncResult* res, gpointer user_data);
 };
 
 }  // namespace app_impls
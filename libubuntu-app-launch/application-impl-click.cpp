@@ -372,6 +372,12 @@ std::shared_ptr<Application::Instance> Click::launchTest(const std::vector<Appli
                                    envfunc);
 }
 
+bool Click::prelaunch()
+{
+    std::function<std::list<std::pair<std::string, std::string>>(void)> envfunc = [this]() { return launchEnv(); };
+    return UpstartInstance::prelaunch(appId(), "application-click", {}, _registry, envfunc);
+}
+
 }  // namespace app_impls
 }  // namespace app_launch
 }  // namespace ubuntu
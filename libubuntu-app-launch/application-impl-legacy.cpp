@@ -413,6 +413,17 @@ std::shared_ptr<Application::Instance> Legacy::launchTest(const std::vector<Appl
                                    UpstartInstance::launchMode::TEST, envfunc);
 }
 
+/** Start an UpstartInstance for this AppID parked, so that a later
+    launch only needs to wake it up. */
+bool Legacy::prelaunch()
+{
+    std::string instance = getInstance();
+    std::function<std::list<std::pair<std::string, std::string>>(void)> envfunc = [this, instance]() {
+        return launchEnv(instance);
+    };
+    return UpstartInstance::prelaunch(appId(), "application-legacy", instance, _registry, envfunc);
+}
+
 }  // namespace app_impls
 }  // namespace app_launch
 }  // namespace ubuntu
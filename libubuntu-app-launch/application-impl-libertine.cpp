@@ -338,6 +338,12 @@ std::shared_ptr<Application::Instance> Libertine::launchTest(const std::vector<A
                                    UpstartInstance::launchMode::TEST, envfunc);
 }
 
+bool Libertine::prelaunch()
+{
+    std::function<std::list<std::pair<std::string, std::string>>(void)> envfunc = [this]() { return launchEnv(); };
+    return UpstartInstance::prelaunch(appId(), "application-legacy", {}, _registry, envfunc);
+}
+
 }  // namespace app_impls
 }  // namespace app_launch
 }  // namespace ubuntu
@@ -68,6 +68,8 @@ public:
     std::shared_ptr<Instance> launch(const std::vector<Application::URL>& urls = {}) override;
     std::shared_ptr<Instance> launchTest(const std::vector<Application::URL>& urls = {}) override;
 
+    bool prelaunch() override;
+
     static bool hasAppId(const AppID& appId, const std::shared_ptr<Registry>& registry);
 
     static bool verifyPackage(const AppID::Package& package, const std::shared_ptr<Registry>& registry);
@@ -464,6 +464,14 @@ std::shared_ptr<Application::Instance> Snap::launchTest(const std::vector<Applic
                                    envfunc);
 }
 
+/** Start this Snap parked, so that a later launch only needs to wake
+    it up. */
+bool Snap::prelaunch()
+{
+    std::function<std::list<std::pair<std::string, std::string>>(void)> envfunc = [this]() { return launchEnv(); };
+    return UpstartInstance::prelaunch(appid_, "application-snap", {}, _registry, envfunc);
+}
+
 }  // namespace app_impls
 }  // namespace app_launch
 }  // namespace ubuntu
@@ -17,6 +17,8 @@
  *     Ted Gould <ted.gould@canonical.com>
  */
 
+#include <chrono>
+#include <cstdint>
 #include <list>
 #include <memory>
 #include <sys/types.h>
@@ -251,6 +253,42 @@ public:
         /** Stop, or send SIGTERM, to the PIDs in this Application::Instance, if
             the PIDs do not respond to the SIGTERM they will be SIGKILL'd */
         virtual void stop() = 0;
+
+        /* Resource Usage */
+        /** Accounting for the resources used by all the processes in an
+            Application::Instance, read from the kernel's cgroup counters.
+            Counters that aren't available on the system are zero. */
+        struct ResourceUsage
+        {
+            std::chrono::steady_clock::time_point timestamp; /**< When the counters were read */
+            std::chrono::nanoseconds cpuTime;                 /**< Total CPU time used by the instance */
+            std::uint64_t rss;                                /**< Resident anonymous memory in bytes */
+            std::uint64_t swap;                               /**< Swap used in bytes */
+            std::uint32_t pidCount;                           /**< Number of processes in the instance */
+        };
+
+        /** Read the resource usage of this instance from its cgroup. This
+            does not do any IPC, just a few reads of kernel files. */
+        virtual ResourceUsage resourceUsage() = 0;
+
+        /* Scheduling */
+        /** How much of the CPU and disk an instance should get compared to
+            the other running instances */
+        enum class SchedulingClass
+        {
+            FOREGROUND, /**< The instance the user is interacting with, normal priority */
+            BACKGROUND  /**< Still running but not visible, like a music player or a download */
+        };
+
+        /** Moves all the processes of the instance into a scheduling class.
+            This uses the CPU weight of the instance's cgroup when it can be
+            set, otherwise the nice value and I/O priority of each process.
+
+            \note An unprivileged process can't lower the nice value of a
+                  process, so when falling back to the per-process values
+                  going back to FOREGROUND may not be possible.
+        */
+        virtual void setSchedulingClass(SchedulingClass schedClass) = 0;
     };
 
     /** A quick check to see if this application has any running instances */
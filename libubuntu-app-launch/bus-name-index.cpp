@@ -0,0 +1,293 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "bus-name-index.h"
+#include "ubuntu-app-launch-trace.h"
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Subscribes to name changes and then starts the scan of the names
+    that are already on the bus. Subscribing first means we can't miss
+    a name that shows up while the scan is running.
+
+    \param bus Connection to index, must be used on the registry thread
+*/
+BusNameIndex::BusNameIndex(const std::shared_ptr<GDBusConnection>& bus)
+    : bus_(bus)
+    , cancel_(g_cancellable_new(), [](GCancellable* cancel) {
+        g_cancellable_cancel(cancel);
+        g_object_unref(cancel);
+    })
+    , signal_(0)
+    , ready_(false)
+    , scanPending_(0)
+    , scanStart_(g_get_monotonic_time())
+{
+    signal_ = g_dbus_connection_signal_subscribe(
+        bus_.get(),                   /* bus */
+        "org.freedesktop.DBus",       /* sender */
+        "org.freedesktop.DBus",       /* interface */
+        "NameOwnerChanged",           /* signal */
+        "/org/freedesktop/DBus",      /* path */
+        nullptr,                      /* arg0 */
+        G_DBUS_SIGNAL_FLAGS_NONE,     /* flags */
+        [](GDBusConnection* conn, const gchar* sender, const gchar* object, const gchar* interface,
+           const gchar* signal, GVariant* params, gpointer user_data) {
+            auto index = static_cast<BusNameIndex*>(user_data);
+
+            const gchar* name = nullptr;
+            const gchar* oldOwner = nullptr;
+            const gchar* newOwner = nullptr;
+            g_variant_get(params, "(&s&s&s)", &name, &oldOwner, &newOwner);
+
+            /* Well known names all have a unique name behind them,
+               so those are all we care about */
+            if (!g_dbus_is_unique_name(name))
+            {
+                return;
+            }
+
+            if (newOwner[0] == '\0')
+            {
+                index->nameRemoved(name);
+            }
+            else if (oldOwner[0] == '\0')
+            {
+                index->requestPid(name, false);
+            }
+        },       /* callback */
+        this,    /* user data */
+        nullptr); /* user data destroy */
+
+    g_dbus_connection_call(bus_.get(),                 /* bus */
+                           "org.freedesktop.DBus",      /* name */
+                           "/",                         /* path */
+                           "org.freedesktop.DBus",      /* interface */
+                           "ListNames",                 /* method */
+                           nullptr,                     /* params */
+                           G_VARIANT_TYPE("(as)"),      /* return type */
+                           G_DBUS_CALL_FLAGS_NONE,      /* flags */
+                           -1,                          /* timeout */
+                           cancel_.get(),               /* cancellable */
+                           listNamesCb,                 /* callback */
+                           this);                       /* user data */
+}
+
+BusNameIndex::~BusNameIndex()
+{
+    if (signal_ != 0)
+    {
+        g_dbus_connection_signal_unsubscribe(bus_.get(), signal_);
+    }
+
+    /* Cancels the calls, their callbacks won't touch us */
+    cancel_.reset();
+}
+
+/** Whether the initial scan is done, and so namesForPid() can be
+    trusted when it returns nothing */
+bool BusNameIndex::isReady()
+{
+    return ready_;
+}
+
+/** Get all the unique names that are owned by a process
+
+    \param pid Process to look for
+*/
+std::vector<std::string> BusNameIndex::namesForPid(pid_t pid)
+{
+    std::vector<std::string> names;
+
+    auto range = pids_.equal_range(pid);
+    for (auto it = range.first; it != range.second; it++)
+    {
+        names.push_back(it->second);
+    }
+
+    return names;
+}
+
+/** Ask the bus which process owns a name
+
+    \param name Unique name of the connection
+    \param scan Whether this is part of the initial scan
+*/
+void BusNameIndex::requestPid(const std::string& name, bool scan)
+{
+    if (names_.find(name) != names_.end() || pending_.find(name) != pending_.end())
+    {
+        return;
+    }
+
+    pending_.insert(name);
+    if (scan)
+    {
+        scanPending_++;
+    }
+
+    g_dbus_connection_call(bus_.get(),                           /* bus */
+                           "org.freedesktop.DBus",                /* name */
+                           "/",                                   /* path */
+                           "org.freedesktop.DBus",                /* interface */
+                           "GetConnectionUnixProcessID",          /* method */
+                           g_variant_new("(s)", name.c_str()),    /* params */
+                           G_VARIANT_TYPE("(u)"),                 /* return type */
+                           G_DBUS_CALL_FLAGS_NONE,                /* flags */
+                           -1,                                    /* timeout */
+                           cancel_.get(),                         /* cancellable */
+                           pidCb,                                 /* callback */
+                           new PidRequest{this, name, scan});     /* user data */
+}
+
+/** Add a name to the index */
+void BusNameIndex::nameAdded(const std::string& name, pid_t pid)
+{
+    names_[name] = pid;
+    pids_.emplace(pid, name);
+}
+
+/** Remove a name from the index, or stop waiting for its PID if we
+    haven't heard back yet */
+void BusNameIndex::nameRemoved(const std::string& name)
+{
+    pending_.erase(name);
+
+    auto nameit = names_.find(name);
+    if (nameit == names_.end())
+    {
+        return;
+    }
+
+    auto range = pids_.equal_range(nameit->second);
+    for (auto it = range.first; it != range.second; it++)
+    {
+        if (it->second == name)
+        {
+            pids_.erase(it);
+            break;
+        }
+    }
+
+    names_.erase(nameit);
+}
+
+/** All the names that were on the bus when we started are in */
+void BusNameIndex::scanComplete()
+{
+    ready_ = true;
+    g_debug("Bus name index ready with %d names", int(names_.size()));
+    tracepoint(ubuntu_app_launch, bus_name_index_ready, names_.size(), g_get_monotonic_time() - scanStart_);
+}
+
+/** Got the list of names on the bus, ask for the PID of each of
+    the unique ones */
+void BusNameIndex::listNamesCb(GObject* obj, GAsyncResult* res, gpointer user_data)
+{
+    GError* error = nullptr;
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free(error);
+        return;
+    }
+
+    auto index = static_cast<BusNameIndex*>(user_data);
+
+    if (error != nullptr)
+    {
+        /* Never becomes ready, so everyone falls back to scanning */
+        g_warning("Unable to get list of names from DBus: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    GVariantIter* iter = nullptr;
+    const gchar* name = nullptr;
+    g_variant_get(result, "(as)", &iter);
+    while (g_variant_iter_loop(iter, "&s", &name))
+    {
+        if (g_dbus_is_unique_name(name))
+        {
+            index->requestPid(name, true);
+        }
+    }
+    g_variant_iter_free(iter);
+    g_variant_unref(result);
+
+    if (index->scanPending_ == 0)
+    {
+        index->scanComplete();
+    }
+}
+
+/** Got the PID for a name, add it if the name is still around */
+void BusNameIndex::pidCb(GObject* obj, GAsyncResult* res, gpointer user_data)
+{
+    auto request = static_cast<PidRequest*>(user_data);
+    GError* error = nullptr;
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free(error);
+        delete request;
+        return;
+    }
+
+    auto index = request->index;
+
+    if (error != nullptr)
+    {
+        /* Normally the name left before we asked */
+        g_debug("Unable to get PID for '%s': %s", request->name.c_str(), error->message);
+        g_error_free(error);
+    }
+    else
+    {
+        guint32 pid = 0;
+        g_variant_get(result, "(u)", &pid);
+        g_variant_unref(result);
+
+        if (index->pending_.find(request->name) != index->pending_.end())
+        {
+            index->nameAdded(request->name, pid);
+        }
+    }
+
+    index->pending_.erase(request->name);
+
+    if (request->scan)
+    {
+        index->scanPending_--;
+        if (index->scanPending_ == 0)
+        {
+            index->scanComplete();
+        }
+    }
+
+    delete request;
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Keeps a map of which process owns each unique name on the bus
+
+    Finding the connections of an application used to mean asking the
+    bus for every name and then asking for the PID of each one. Here we
+    do that once when we're created and then follow NameOwnerChanged to
+    keep it current, so looking up a PID is free.
+
+    Until the first scan finishes the index isn't complete, so isReady()
+    needs to be checked before trusting an empty result.
+
+    All functions must be called on the registry thread, which is also
+    where the signals are processed.
+*/
+class BusNameIndex
+{
+public:
+    explicit BusNameIndex(const std::shared_ptr<GDBusConnection>& bus);
+    virtual ~BusNameIndex();
+
+    bool isReady();
+    std::vector<std::string> namesForPid(pid_t pid);
+
+private:
+    /** Data for the async PID requests */
+    struct PidRequest
+    {
+        BusNameIndex* index;
+        std::string name;
+        bool scan; /**< Part of the initial scan */
+    };
+
+    /** Connection we're indexing */
+    std::shared_ptr<GDBusConnection> bus_;
+    /** Cancels the outstanding calls when we're destroyed */
+    std::shared_ptr<GCancellable> cancel_;
+    /** Subscription to NameOwnerChanged */
+    guint signal_;
+    /** PID for each unique name */
+    std::map<std::string, pid_t> names_;
+    /** Unique names for each PID */
+    std::multimap<pid_t, std::string> pids_;
+    /** Names we've asked for the PID of but haven't heard back on */
+    std::set<std::string> pending_;
+    /** Whether the initial scan has finished */
+    bool ready_;
+    /** Number of PID requests from the initial scan still out */
+    unsigned int scanPending_;
+    /** When the initial scan started, for the tracepoint */
+    gint64 scanStart_;
+
+    void requestPid(const std::string& name, bool scan);
+    void nameAdded(const std::string& name, pid_t pid);
+    void nameRemoved(const std::string& name);
+    void scanComplete();
+
+    static void listNamesCb(GObject* obj, GAsyncResult* res, gpointer user_data);
+    static void pidCb(GObject* obj, GAsyncResult* res, gpointer user_data);
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,213 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "cgroup-usage.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+
+#include <gio/gio.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Figure out where the job cgroups live. We look at our own cgroups
+    in /proc/self/cgroup as Upstart puts the jobs below the session. */
+CGroupUsage::CGroupUsage()
+{
+    std::string root;
+    std::map<std::string, std::string> selfpaths;
+
+    auto envroot = g_getenv("UBUNTU_APP_LAUNCH_CGROUP_ROOT");
+    if (envroot == nullptr)
+    {
+        root = "/sys/fs/cgroup";
+
+        /* Lines look like "4:cpu,cpuacct:/user/1000.user/1.session" or
+           "0::/user.slice" for the unified hierarchy */
+        std::istringstream self(readFile("/proc/self/cgroup"));
+        std::string line;
+        while (std::getline(self, line))
+        {
+            auto first = line.find(':');
+            auto second = line.find(':', first + 1);
+            if (first == std::string::npos || second == std::string::npos)
+            {
+                continue;
+            }
+
+            auto path = line.substr(second + 1);
+            std::istringstream controllers(line.substr(first + 1, second - first - 1));
+            std::string controller;
+            while (std::getline(controllers, controller, ','))
+            {
+                selfpaths[controller] = path;
+            }
+            if (second == first + 1)
+            {
+                selfpaths[""] = path;
+            }
+        }
+    }
+    else
+    {
+        root = envroot;
+    }
+
+    unified_ = g_file_test((root + "/cgroup.controllers").c_str(), G_FILE_TEST_EXISTS);
+
+    auto basefor = [&root, &selfpaths, this](const std::string& controller) -> std::string {
+        std::string dir = unified_ ? root : root + "/" + controller;
+        auto self = selfpaths.find(unified_ ? "" : controller);
+        if (self != selfpaths.end() && self->second != "/")
+        {
+            dir += self->second;
+        }
+        return dir + "/upstart";
+    };
+
+    cpuBase_ = basefor("cpuacct");
+    memoryBase_ = basefor("memory");
+    cpuControlBase_ = basefor("cpu");
+    ioBase_ = basefor("blkio");
+    procsBase_ = basefor("freezer");
+
+    g_debug("CGroup usage from %s hierarchy, processes at '%s'", unified_ ? "unified" : "legacy", procsBase_.c_str());
+}
+
+/** Read all the counters for a single job
+
+    \param jobpath The name of the job's cgroup
+*/
+Application::Instance::ResourceUsage CGroupUsage::forJob(const std::string& jobpath)
+{
+    Application::Instance::ResourceUsage usage;
+    usage.timestamp = std::chrono::steady_clock::now();
+
+    if (unified_)
+    {
+        auto dir = cpuBase_ + "/" + jobpath;
+        usage.cpuTime = std::chrono::microseconds(statValue(readFile(dir + "/cpu.stat"), "usage_usec"));
+        usage.rss = statValue(readFile(dir + "/memory.stat"), "anon");
+        usage.swap = readValue(dir + "/memory.swap.current");
+    }
+    else
+    {
+        usage.cpuTime = std::chrono::nanoseconds(readValue(cpuBase_ + "/" + jobpath + "/cpuacct.usage"));
+        auto memstat = readFile(memoryBase_ + "/" + jobpath + "/memory.stat");
+        usage.rss = statValue(memstat, "total_rss");
+        usage.swap = statValue(memstat, "total_swap");
+    }
+
+    auto procs = readFile(procsBase_ + "/" + jobpath + "/cgroup.procs");
+    usage.pidCount = std::count(procs.begin(), procs.end(), '\n');
+
+    return usage;
+}
+
+/** Get the names of all the job cgroups that currently exist */
+std::list<std::string> CGroupUsage::jobs()
+{
+    std::list<std::string> jobs;
+
+    GDir* dir = g_dir_open(procsBase_.c_str(), 0, nullptr);
+    if (dir == nullptr)
+    {
+        return jobs;
+    }
+
+    const gchar* name = nullptr;
+    while ((name = g_dir_read_name(dir)) != nullptr)
+    {
+        if (g_file_test((procsBase_ + "/" + name).c_str(), G_FILE_TEST_IS_DIR))
+        {
+            jobs.emplace_back(name);
+        }
+    }
+
+    g_dir_close(dir);
+    return jobs;
+}
+
+/** Directory of the job's cgroup in the memory controller */
+std::string CGroupUsage::memoryPath(const std::string& jobpath)
+{
+    return memoryBase_ + "/" + jobpath;
+}
+
+/** Directory of the job's cgroup in the CPU controller */
+std::string CGroupUsage::cpuPath(const std::string& jobpath)
+{
+    return cpuControlBase_ + "/" + jobpath;
+}
+
+/** Directory of the job's cgroup in the block I/O controller */
+std::string CGroupUsage::ioPath(const std::string& jobpath)
+{
+    return ioBase_ + "/" + jobpath;
+}
+
+/** Whether the system uses the unified (v2) hierarchy */
+bool CGroupUsage::isUnified()
+{
+    return unified_;
+}
+
+/** Read a whole file, returning an empty string if it can't be read */
+std::string CGroupUsage::readFile(const std::string& path)
+{
+    gchar* contents = nullptr;
+    if (!g_file_get_contents(path.c_str(), &contents, nullptr, nullptr))
+    {
+        return {};
+    }
+
+    std::string retval(contents);
+    g_free(contents);
+    return retval;
+}
+
+/** Read a file that is a single number */
+std::uint64_t CGroupUsage::readValue(const std::string& path)
+{
+    return std::strtoull(readFile(path).c_str(), nullptr, 10);
+}
+
+/** Find a value in a file of "key value" lines */
+std::uint64_t CGroupUsage::statValue(const std::string& stat, const std::string& key)
+{
+    std::istringstream lines(stat);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        if (line.compare(0, key.size(), key) == 0 && line.size() > key.size() && line[key.size()] == ' ')
+        {
+            return std::strtoull(line.c_str() + key.size() + 1, nullptr, 10);
+        }
+    }
+
+    return 0;
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
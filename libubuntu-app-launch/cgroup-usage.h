@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#pragma once
+
+#include "application.h"
+#include <list>
+#include <string>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Reads the accounting counters of the Upstart job cgroups
+
+    Upstart puts each job in a cgroup named "upstart/<job>" below the
+    cgroup of the session, which is also where we live. This figures out
+    where those are for each controller once and then reads the counter
+    files directly. Both the legacy per-controller hierarchies and the
+    unified hierarchy are supported.
+
+    The root of the hierarchy can be overridden for testing with the
+    UBUNTU_APP_LAUNCH_CGROUP_ROOT environment variable, in which case the
+    jobs are expected directly under that root.
+*/
+class CGroupUsage
+{
+public:
+    CGroupUsage();
+    virtual ~CGroupUsage() = default;
+
+    Application::Instance::ResourceUsage forJob(const std::string& jobpath);
+    std::list<std::string> jobs();
+
+    std::string memoryPath(const std::string& jobpath);
+    std::string cpuPath(const std::string& jobpath);
+    std::string ioPath(const std::string& jobpath);
+    bool isUnified();
+
+private:
+    /** Whether we're using the unified (v2) hierarchy */
+    bool unified_;
+    /** Directory holding the job cgroups for the CPU counters */
+    std::string cpuBase_;
+    /** Directory holding the job cgroups for the memory counters */
+    std::string memoryBase_;
+    /** Directory holding the job cgroups for the CPU weights */
+    std::string cpuControlBase_;
+    /** Directory holding the job cgroups for the I/O weights */
+    std::string ioBase_;
+    /** Directory holding the job cgroups for the process lists */
+    std::string procsBase_;
+
+    static std::string readFile(const std::string& path);
+    static std::uint64_t readValue(const std::string& path);
+    static std::uint64_t statValue(const std::string& stat, const std::string& key);
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -114,6 +114,11 @@ bool ContextThread::isCancelled()
     return g_cancellable_is_cancelled(_cancel.get()) == TRUE;
 }
 
+bool ContextThread::isCurrentThread()
+{
+    return std::this_thread::get_id() == _thread.get_id();
+}
+
 std::shared_ptr<GCancellable> ContextThread::getCancellable()
 {
     return _cancel;
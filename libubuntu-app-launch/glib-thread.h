@@ -44,6 +44,7 @@ public:
 
     void quit();
     bool isCancelled();
+    bool isCurrentThread();
     std::shared_ptr<GCancellable> getCancellable();
 
     void executeOnThread(std::function<void()> work);
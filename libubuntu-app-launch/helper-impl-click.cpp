@@ -18,6 +18,7 @@
  */
 
 #include "helper-impl-click.h"
+#include "helper-instance-table.h"
 #include "registry-impl.h"
 
 #include "ubuntu-app-launch.h"
@@ -32,6 +33,12 @@ namespace helper_impls
 bool Click::hasInstances()
 {
     return _registry->impl->thread.executeOnThread<bool>([this]() {
+        auto table = _registry->impl->getHelperInstances();
+        if (table)
+        {
+            return !table->instances(_type.value(), (std::string)_appid).empty();
+        }
+
         auto instances = ubuntu_app_launch_list_helper_instances(_type.value().c_str(), ((std::string)_appid).c_str());
         auto retval = (g_strv_length(instances) != 0);
 
@@ -63,6 +70,12 @@ public: /* all one file, no one to hide from */
     bool isRunning() override
     {
         return _registry->impl->thread.executeOnThread<bool>([this]() {
+            auto table = _registry->impl->getHelperInstances();
+            if (table)
+            {
+                return table->hasInstance(_type.value(), (std::string)_appid, _instanceid);
+            }
+
             bool found = false;
 
             auto instances =
@@ -96,6 +109,17 @@ std::vector<std::shared_ptr<Click::Instance>> Click::instances()
     return _registry->impl->thread.executeOnThread<std::vector<std::shared_ptr<Click::Instance>>>(
         [this]() -> std::vector<std::shared_ptr<Click::Instance>> {
             std::vector<std::shared_ptr<Click::Instance>> vect;
+
+            auto table = _registry->impl->getHelperInstances();
+            if (table)
+            {
+                for (const auto& instanceid : table->instances(_type.value(), (std::string)_appid))
+                {
+                    vect.push_back(std::make_shared<ClickInstance>(_appid, _type, instanceid, _registry));
+                }
+                return vect;
+            }
+
             auto instances =
                 ubuntu_app_launch_list_helper_instances(_type.value().c_str(), ((std::string)_appid).c_str());
             for (int i = 0; instances[i] != nullptr; i++)
@@ -132,13 +156,21 @@ std::shared_ptr<Click::Instance> Click::launch(std::vector<Helper::URL> urls)
 {
     auto urlstrv = urlsToStrv(urls);
 
-    return _registry->impl->thread.executeOnThread<std::shared_ptr<Click::Instance>>([this, urlstrv]() {
-        auto instanceid = ubuntu_app_launch_start_multiple_helper(_type.value().c_str(), ((std::string)_appid).c_str(),
-                                                                  urlstrv.get());
-        auto ret = std::make_shared<ClickInstance>(_appid, _type, instanceid, _registry);
-        g_free(instanceid);
-        return ret;
-    });
+    return _registry->impl->thread.executeOnThread<std::shared_ptr<Click::Instance>>(
+        [this, urlstrv]() -> std::shared_ptr<Click::Instance> {
+            auto parked =
+                _registry->impl->helperPoolLaunch(_type.value(), (std::string)_appid, urlstrv.get() != nullptr);
+            if (!parked.empty())
+            {
+                return std::make_shared<ClickInstance>(_appid, _type, parked, _registry);
+            }
+
+            auto instanceid = ubuntu_app_launch_start_multiple_helper(_type.value().c_str(),
+                                                                      ((std::string)_appid).c_str(), urlstrv.get());
+            auto ret = std::make_shared<ClickInstance>(_appid, _type, instanceid, _registry);
+            g_free(instanceid);
+            return ret;
+        });
 }
 
 std::shared_ptr<Click::Instance> Click::launch(MirPromptSession* session, std::vector<Helper::URL> urls)
@@ -158,6 +190,16 @@ std::list<std::shared_ptr<Helper>> Click::running(Helper::Type type, std::shared
     return registry->impl->thread.executeOnThread<std::list<std::shared_ptr<Helper>>>([type, registry]() {
         std::list<std::shared_ptr<Helper>> helpers;
 
+        auto table = registry->impl->getHelperInstances();
+        if (table)
+        {
+            for (const auto& appid : table->appIds(type.value()))
+            {
+                helpers.push_back(std::make_shared<Click>(type, AppID::parse(appid), registry));
+            }
+            return helpers;
+        }
+
         auto appidv = ubuntu_app_launch_list_helpers(type.value().c_str());
         for (int i = 0; appidv[i] != nullptr; i++)
         {
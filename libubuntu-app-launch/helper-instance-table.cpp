@@ -0,0 +1,587 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "helper-instance-table.h"
+#include "ubuntu-app-launch-trace.h"
+#include <stdexcept>
+#include <upstart.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Subscribes to the instance signals of the job and then gets the
+    instances that are already there. Subscribing first means we can't
+    miss one that starts while we're looking. Throws if Upstart can't
+    tell us the instances, so the caller can ask it directly instead.
+
+    \param bus Connection Upstart is on, must be used on the registry thread
+    \param jobpath Object path of the untrusted-helper job
+    \param cancel Cancellable for the DBus calls
+*/
+HelperInstanceTable::HelperInstanceTable(const std::shared_ptr<GDBusConnection>& bus,
+                                         const std::string& jobpath,
+                                         const std::shared_ptr<GCancellable>& cancel)
+    : bus_(bus)
+    , jobpath_(jobpath)
+    , cancel_(cancel)
+    , calls_(g_cancellable_new(),
+             [](GCancellable* calls) {
+                 g_cancellable_cancel(calls);
+                 g_object_unref(calls);
+             })
+    , generation_(0)
+{
+    if (!bus_ || jobpath_.empty())
+    {
+        throw std::runtime_error("Unable to build helper table without the untrusted-helper job");
+    }
+
+    auto start = g_get_monotonic_time();
+
+    signals_.push_back(g_dbus_connection_signal_subscribe(
+        bus_.get(),                 /* bus */
+        nullptr,                    /* sender */
+        DBUS_INTERFACE_UPSTART_JOB, /* interface */
+        "InstanceAdded",            /* signal */
+        jobpath_.c_str(),           /* path */
+        nullptr,                    /* arg0 */
+        G_DBUS_SIGNAL_FLAGS_NONE,   /* flags */
+        [](GDBusConnection* conn, const gchar* sender, const gchar* object, const gchar* interface,
+           const gchar* signal, GVariant* params, gpointer user_data) {
+            auto table = static_cast<HelperInstanceTable*>(user_data);
+
+            const gchar* path = nullptr;
+            g_variant_get(params, "(&o)", &path);
+            table->instanceAdded(path);
+        },        /* callback */
+        this,     /* user data */
+        nullptr)); /* user data destroy */
+
+    signals_.push_back(g_dbus_connection_signal_subscribe(
+        bus_.get(),                 /* bus */
+        nullptr,                    /* sender */
+        DBUS_INTERFACE_UPSTART_JOB, /* interface */
+        "InstanceRemoved",          /* signal */
+        jobpath_.c_str(),           /* path */
+        nullptr,                    /* arg0 */
+        G_DBUS_SIGNAL_FLAGS_NONE,   /* flags */
+        [](GDBusConnection* conn, const gchar* sender, const gchar* object, const gchar* interface,
+           const gchar* signal, GVariant* params, gpointer user_data) {
+            auto table = static_cast<HelperInstanceTable*>(user_data);
+
+            const gchar* path = nullptr;
+            g_variant_get(params, "(&o)", &path);
+            table->instanceRemoved(path);
+        },        /* callback */
+        this,     /* user data */
+        nullptr)); /* user data destroy */
+
+    signals_.push_back(g_dbus_connection_signal_subscribe(
+        bus_.get(),               /* bus */
+        "org.freedesktop.DBus",   /* sender */
+        "org.freedesktop.DBus",   /* interface */
+        "NameOwnerChanged",       /* signal */
+        "/org/freedesktop/DBus",  /* path */
+        DBUS_SERVICE_UPSTART,     /* arg0 */
+        G_DBUS_SIGNAL_FLAGS_NONE, /* flags */
+        [](GDBusConnection* conn, const gchar* sender, const gchar* object, const gchar* interface,
+           const gchar* signal, GVariant* params, gpointer user_data) {
+            auto table = static_cast<HelperInstanceTable*>(user_data);
+
+            const gchar* name = nullptr;
+            const gchar* oldOwner = nullptr;
+            const gchar* newOwner = nullptr;
+            g_variant_get(params, "(&s&s&s)", &name, &oldOwner, &newOwner);
+
+            g_debug("Upstart owner changed from '%s' to '%s', reloading helper table", oldOwner, newOwner);
+            table->resync(newOwner[0] != '\0');
+        },        /* callback */
+        this,     /* user data */
+        nullptr)); /* user data destroy */
+
+    GError* error = nullptr;
+    GVariant* instance_tuple = g_dbus_connection_call_sync(bus_.get(),                 /* connection */
+                                                           DBUS_SERVICE_UPSTART,       /* service */
+                                                           jobpath_.c_str(),           /* object path */
+                                                           DBUS_INTERFACE_UPSTART_JOB, /* iface */
+                                                           "GetAllInstances",          /* method */
+                                                           nullptr,                    /* params */
+                                                           G_VARIANT_TYPE("(ao)"),     /* return type */
+                                                           G_DBUS_CALL_FLAGS_NONE,     /* flags */
+                                                           -1,                         /* timeout: default */
+                                                           cancel_.get(),              /* cancellable */
+                                                           &error);
+
+    if (error != nullptr)
+    {
+        std::string message = std::string{"Unable to get instances of the untrusted helper job: "} + error->message;
+        g_error_free(error);
+
+        /* The destructor won't run for us */
+        for (auto handle : signals_)
+        {
+            g_dbus_connection_signal_unsubscribe(bus_.get(), handle);
+        }
+        throw std::runtime_error(message);
+    }
+
+    GVariant* instance_list = g_variant_get_child_value(instance_tuple, 0);
+    g_variant_unref(instance_tuple);
+
+    GVariantIter instance_iter;
+    g_variant_iter_init(&instance_iter, instance_list);
+    const gchar* instance_path = nullptr;
+
+    /* These are looked up before we return so that the first questions
+       get the full answer */
+    while (g_variant_iter_loop(&instance_iter, "&o", &instance_path))
+    {
+        GVariant* props_tuple = g_dbus_connection_call_sync(
+            bus_.get(),                                            /* connection */
+            DBUS_SERVICE_UPSTART,                                  /* service */
+            instance_path,                                         /* object path */
+            "org.freedesktop.DBus.Properties",                     /* interface */
+            "GetAll",                                              /* method */
+            g_variant_new("(s)", DBUS_INTERFACE_UPSTART_INSTANCE), /* params */
+            G_VARIANT_TYPE("(a{sv})"),                             /* return type */
+            G_DBUS_CALL_FLAGS_NONE,                                /* flags */
+            -1,                                                    /* timeout: default */
+            cancel_.get(),                                         /* cancellable */
+            &error);
+
+        if (error != nullptr)
+        {
+            g_warning("Unable to name of instance '%s': %s", instance_path, error->message);
+            g_clear_error(&error);
+            continue;
+        }
+
+        addInstance(instance_path, props_tuple);
+        g_variant_unref(props_tuple);
+    }
+
+    g_variant_unref(instance_list);
+
+    g_debug("Helper table ready with %d instances", int(paths_.size()));
+    tracepoint(ubuntu_app_launch, helper_table_ready, paths_.size(), g_get_monotonic_time() - start);
+}
+
+HelperInstanceTable::~HelperInstanceTable()
+{
+    for (auto handle : signals_)
+    {
+        g_dbus_connection_signal_unsubscribe(bus_.get(), handle);
+    }
+
+    /* Cancels the lookups, their callbacks won't touch us */
+    calls_.reset();
+}
+
+/** Get the instance IDs of a helper
+
+    \param type Type of the helper
+    \param appid AppID of the helper
+*/
+std::vector<std::string> HelperInstanceTable::instances(const std::string& type, const std::string& appid)
+{
+    auto it = helpers_.find(std::make_pair(type, appid));
+    if (it == helpers_.end())
+    {
+        return {};
+    }
+
+    return std::vector<std::string>(it->second.begin(), it->second.end());
+}
+
+/** Check whether a specific instance of a helper is running
+
+    \param type Type of the helper
+    \param appid AppID of the helper
+    \param instanceid Instance to look for, empty for single instance helpers
+*/
+bool HelperInstanceTable::hasInstance(const std::string& type,
+                                      const std::string& appid,
+                                      const std::string& instanceid)
+{
+    auto it = helpers_.find(std::make_pair(type, appid));
+    if (it == helpers_.end())
+    {
+        return false;
+    }
+
+    for (const auto& instance : it->second)
+    {
+        if (instance == instanceid)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/** Get the AppIDs of all the helpers of a type that have instances
+
+    \param type Type of the helpers
+*/
+std::vector<std::string> HelperInstanceTable::appIds(const std::string& type)
+{
+    std::vector<std::string> appids;
+
+    for (auto it = helpers_.lower_bound(std::make_pair(type, std::string{}));
+         it != helpers_.end() && it->first.first == type; it++)
+    {
+        appids.push_back(it->first.second);
+    }
+
+    return appids;
+}
+
+/** Get every running helper, sorted by type and then AppID, with
+    the IDs of its instances */
+const HelperInstanceTable::HelperMap& HelperInstanceTable::all()
+{
+    return helpers_;
+}
+
+/** Look up the name of a new instance without waiting on Upstart,
+    it is added to the table when the answer comes back
+
+    \param path Object path of the instance
+*/
+void HelperInstanceTable::instanceAdded(const std::string& path)
+{
+    if (paths_.find(path) != paths_.end() || !pending_.insert(path).second)
+    {
+        return;
+    }
+
+    auto request = new LookupRequest{this, path, generation_};
+
+    g_dbus_connection_call(bus_.get(),                                            /* connection */
+                           DBUS_SERVICE_UPSTART,                                  /* service */
+                           path.c_str(),                                          /* object path */
+                           "org.freedesktop.DBus.Properties",                     /* interface */
+                           "GetAll",                                              /* method */
+                           g_variant_new("(s)", DBUS_INTERFACE_UPSTART_INSTANCE), /* params */
+                           G_VARIANT_TYPE("(a{sv})"),                             /* return type */
+                           G_DBUS_CALL_FLAGS_NONE,                                /* flags */
+                           -1,                                                    /* timeout: default */
+                           calls_.get(),                                          /* cancellable */
+                           lookupCb,                                              /* callback */
+                           request);                                              /* user data */
+}
+
+/** Answer to the lookup of a new instance. It is dropped if the instance
+    was removed or the table reloaded while we were waiting. */
+void HelperInstanceTable::lookupCb(GObject* obj, GAsyncResult* res, gpointer user_data)
+{
+    auto request = static_cast<LookupRequest*>(user_data);
+    GError* error = nullptr;
+    GVariant* props_tuple = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free(error);
+        delete request;
+        return;
+    }
+
+    auto table = request->table;
+    if (request->generation != table->generation_ || table->pending_.erase(request->path) == 0)
+    {
+        g_clear_error(&error);
+        g_clear_pointer(&props_tuple, g_variant_unref);
+        delete request;
+        return;
+    }
+
+    if (error != nullptr)
+    {
+        g_warning("Unable to name of instance '%s': %s", request->path.c_str(), error->message);
+        g_error_free(error);
+        delete request;
+        return;
+    }
+
+    table->addInstance(request->path, props_tuple);
+    g_variant_unref(props_tuple);
+    delete request;
+}
+
+/** Add an instance from its Upstart properties
+
+    \param path Object path of the instance
+    \param props_tuple Result of GetAll on the instance
+*/
+void HelperInstanceTable::addInstance(const std::string& path, GVariant* props_tuple)
+{
+    GVariant* props_dict = g_variant_get_child_value(props_tuple, 0);
+    GVariant* namev = g_variant_lookup_value(props_dict, "name", G_VARIANT_TYPE_STRING);
+    g_variant_unref(props_dict);
+
+    if (namev == nullptr)
+    {
+        g_warning("Instance '%s' doesn't have a name", path.c_str());
+        return;
+    }
+
+    Entry entry;
+    bool parsed = parseName(g_variant_get_string(namev, nullptr), entry);
+    g_variant_unref(namev);
+
+    if (!parsed)
+    {
+        return;
+    }
+
+    if (parked_.find(instanceName(entry)) == parked_.end())
+    {
+        helpers_[std::make_pair(entry.type, entry.appid)].push_back(entry.instanceid);
+    }
+    paths_.emplace(path, std::move(entry));
+}
+
+/** Drop an instance from the table
+
+    \param path Object path of the instance
+*/
+void HelperInstanceTable::instanceRemoved(const std::string& path)
+{
+    pending_.erase(path);
+
+    auto pathit = paths_.find(path);
+    if (pathit == paths_.end())
+    {
+        return;
+    }
+
+    const auto& entry = pathit->second;
+    auto helperit = helpers_.find(std::make_pair(entry.type, entry.appid));
+    if (helperit != helpers_.end())
+    {
+        helperit->second.remove(entry.instanceid);
+        if (helperit->second.empty())
+        {
+            helpers_.erase(helperit);
+        }
+    }
+
+    auto removed = entry;
+    bool parked = parked_.erase(instanceName(entry)) > 0;
+    paths_.erase(pathit);
+
+    if (parked && parkedRemoved_)
+    {
+        parkedRemoved_(removed.type, removed.appid, removed.instanceid);
+    }
+}
+
+/** Drop everything we know when Upstart changes owners on the bus, and
+    if it has come back get all the instances of the job again. Parked
+    instances are kept as a re-exec'd Upstart keeps its jobs.
+
+    \param running Whether Upstart has a new owner
+*/
+void HelperInstanceTable::resync(bool running)
+{
+    paths_.clear();
+    helpers_.clear();
+    pending_.clear();
+    generation_++;
+
+    if (!running)
+    {
+        return;
+    }
+
+    auto request = new LookupRequest{this, jobpath_, generation_};
+
+    g_dbus_connection_call(bus_.get(),                 /* connection */
+                           DBUS_SERVICE_UPSTART,       /* service */
+                           jobpath_.c_str(),           /* object path */
+                           DBUS_INTERFACE_UPSTART_JOB, /* iface */
+                           "GetAllInstances",          /* method */
+                           nullptr,                    /* params */
+                           G_VARIANT_TYPE("(ao)"),     /* return type */
+                           G_DBUS_CALL_FLAGS_NONE,     /* flags */
+                           -1,                         /* timeout: default */
+                           calls_.get(),               /* cancellable */
+                           resyncCb,                   /* callback */
+                           request);                   /* user data */
+}
+
+/** Answer to getting all the instances after Upstart came back */
+void HelperInstanceTable::resyncCb(GObject* obj, GAsyncResult* res, gpointer user_data)
+{
+    auto request = static_cast<LookupRequest*>(user_data);
+    GError* error = nullptr;
+    GVariant* instance_tuple = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free(error);
+        delete request;
+        return;
+    }
+
+    auto table = request->table;
+    if (request->generation != table->generation_)
+    {
+        g_clear_error(&error);
+        g_clear_pointer(&instance_tuple, g_variant_unref);
+        delete request;
+        return;
+    }
+
+    if (error != nullptr)
+    {
+        g_warning("Unable to get instances of the untrusted helper job: %s", error->message);
+        g_error_free(error);
+        delete request;
+        return;
+    }
+
+    GVariant* instance_list = g_variant_get_child_value(instance_tuple, 0);
+    g_variant_unref(instance_tuple);
+
+    GVariantIter instance_iter;
+    g_variant_iter_init(&instance_iter, instance_list);
+    const gchar* instance_path = nullptr;
+
+    while (g_variant_iter_loop(&instance_iter, "&o", &instance_path))
+    {
+        table->instanceAdded(instance_path);
+    }
+
+    g_variant_unref(instance_list);
+    delete request;
+}
+
+/** Mark an instance as parked in the helper pool, or as woken up. This
+    can be done before Upstart tells us about the instance.
+
+    \param type Type of the helper
+    \param appid AppID of the helper
+    \param instanceid Instance of the helper
+    \param parked Whether it is parked
+*/
+void HelperInstanceTable::setParked(const std::string& type,
+                                    const std::string& appid,
+                                    const std::string& instanceid,
+                                    bool parked)
+{
+    auto name = instanceName(Entry{type, instanceid, appid});
+    bool known = !instancePath(type, appid, instanceid).empty();
+    auto key = std::make_pair(type, appid);
+
+    if (parked)
+    {
+        if (!parked_.insert(name).second || !known)
+        {
+            return;
+        }
+
+        auto helperit = helpers_.find(key);
+        if (helperit != helpers_.end())
+        {
+            helperit->second.remove(instanceid);
+            if (helperit->second.empty())
+            {
+                helpers_.erase(helperit);
+            }
+        }
+    }
+    else
+    {
+        if (parked_.erase(name) == 0 || !known)
+        {
+            return;
+        }
+
+        helpers_[key].push_back(instanceid);
+    }
+}
+
+/** Set the function to call when a parked instance goes away without
+    being woken up
+
+    \param func Function to call, on the registry thread
+*/
+void HelperInstanceTable::setParkedRemoved(const ParkedRemoved& func)
+{
+    parkedRemoved_ = func;
+}
+
+/** Get the object path of an instance, parked or not, or an empty
+    string if Upstart doesn't have it
+
+    \param type Type of the helper
+    \param appid AppID of the helper
+    \param instanceid Instance of the helper
+*/
+std::string HelperInstanceTable::instancePath(const std::string& type,
+                                              const std::string& appid,
+                                              const std::string& instanceid)
+{
+    for (const auto& path : paths_)
+    {
+        if (path.second.type == type && path.second.appid == appid && path.second.instanceid == instanceid)
+        {
+            return path.first;
+        }
+    }
+
+    return {};
+}
+
+/** Split an untrusted-helper instance name, which is the type, the
+    instance ID and the AppID separated by colons. The instance ID is
+    empty for single instance helpers.
+
+    \param name Upstart instance name
+    \param entry Place to put the parts
+*/
+bool HelperInstanceTable::parseName(const std::string& name, Entry& entry)
+{
+    auto typeend = name.find(':');
+    auto appidstart = name.rfind(':');
+    if (typeend == std::string::npos || typeend == appidstart)
+    {
+        g_warning("Unable to parse helper instance name: %s", name.c_str());
+        return false;
+    }
+
+    entry.type = name.substr(0, typeend);
+    entry.instanceid = name.substr(typeend + 1, appidstart - typeend - 1);
+    entry.appid = name.substr(appidstart + 1);
+    return true;
+}
+
+/** Build the Upstart instance name for an entry */
+std::string HelperInstanceTable::instanceName(const Entry& entry)
+{
+    return entry.type + ":" + entry.instanceid + ":" + entry.appid;
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
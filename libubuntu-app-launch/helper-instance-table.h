@@ -0,0 +1,134 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#pragma once
+
+#include <functional>
+#include <gio/gio.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Table of the running untrusted helpers by type and AppID
+
+    Asking whether a helper is running used to mean getting every
+    instance of the untrusted-helper job from Upstart and then asking
+    for the name of each one, for all the helpers on the system. Here
+    we do that once when we're created and then follow the job's
+    InstanceAdded and InstanceRemoved signals, so the questions are
+    answered from memory. New instances are looked up without blocking
+    the registry thread, and everything is fetched again if Upstart gets
+    a new owner on the bus. Helpers that are parked in the helper pool
+    are left out until they're woken up.
+
+    All functions must be called on the registry thread, which is also
+    where the signals are processed.
+*/
+class HelperInstanceTable
+{
+public:
+    HelperInstanceTable(const std::shared_ptr<GDBusConnection>& bus,
+                        const std::string& jobpath,
+                        const std::shared_ptr<GCancellable>& cancel);
+    virtual ~HelperInstanceTable();
+
+    std::vector<std::string> instances(const std::string& type, const std::string& appid);
+    bool hasInstance(const std::string& type, const std::string& appid, const std::string& instanceid);
+    std::vector<std::string> appIds(const std::string& type);
+
+    /** Instance IDs of each helper by type and AppID */
+    typedef std::map<std::pair<std::string, std::string>, std::list<std::string>> HelperMap;
+    const HelperMap& all();
+
+    void setParked(const std::string& type, const std::string& appid, const std::string& instanceid, bool parked);
+
+    /** Called with the type, AppID and instance ID of a parked helper
+        when Upstart drops it, as it timed out or was killed */
+    typedef std::function<void(const std::string&, const std::string&, const std::string&)> ParkedRemoved;
+    void setParkedRemoved(const ParkedRemoved& func);
+    std::string instancePath(const std::string& type, const std::string& appid, const std::string& instanceid);
+
+private:
+    /** An Upstart instance name split into its parts */
+    struct Entry
+    {
+        std::string type;
+        std::string instanceid;
+        std::string appid;
+    };
+
+    /** Data for the async lookups */
+    struct LookupRequest
+    {
+        HelperInstanceTable* table;
+        std::string path;
+        unsigned int generation; /**< Generation of the table when it was sent */
+    };
+
+    /** Connection Upstart is on */
+    std::shared_ptr<GDBusConnection> bus_;
+    /** Object path of the untrusted-helper job */
+    std::string jobpath_;
+    /** Cancellable for the calls, from the registry thread */
+    std::shared_ptr<GCancellable> cancel_;
+    /** Cancels the outstanding lookups when we're destroyed */
+    std::shared_ptr<GCancellable> calls_;
+    /** Subscriptions to InstanceAdded, InstanceRemoved and NameOwnerChanged */
+    std::list<guint> signals_;
+    /** What each instance object is, needed as the removal signal only
+        has the path. Includes the parked instances. */
+    std::map<std::string, Entry> paths_;
+    /** Instance IDs of each helper, in the order they started */
+    HelperMap helpers_;
+    /** Instances that are parked in the helper pool, by Upstart
+        instance name. They're not running as far as anyone is concerned,
+        so they're left out of the helpers. */
+    std::set<std::string> parked_;
+    /** Told about parked instances that go away */
+    ParkedRemoved parkedRemoved_;
+    /** Paths of new instances that are being looked up */
+    std::set<std::string> pending_;
+    /** Bumped each time the table is reloaded so that lookups from
+        before are dropped */
+    unsigned int generation_;
+
+    void instanceAdded(const std::string& path);
+    void instanceRemoved(const std::string& path);
+    void addInstance(const std::string& path, GVariant* props_tuple);
+    void resync(bool running);
+
+    static void lookupCb(GObject* obj, GAsyncResult* res, gpointer user_data);
+    static void resyncCb(GObject* obj, GAsyncResult* res, gpointer user_data);
+    static bool parseName(const std::string& name, Entry& entry);
+    static std::string instanceName(const Entry& entry);
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
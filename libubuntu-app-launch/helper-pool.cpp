@@ -0,0 +1,257 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "helper-pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <glib.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Most parked helpers we allow for each AppID, they hold on to their
+    memory while they wait */
+static const unsigned int MAX_POOL_SIZE = 4;
+
+/** Build an empty pool with nothing allowed */
+HelperPool::HelperPool()
+    : stats_({0, 0, 0})
+{
+}
+
+/** Set which helpers of a type are kept warm and how many of each.
+    Returns the entries that are no longer allowed or don't fit, which
+    need to be stopped.
+
+    \param type Helper type
+    \param appids AppIDs that are allowed, none turns the type off
+    \param size Number of parked helpers for each AppID, zero turns the type off
+*/
+std::list<HelperPool::Entry> HelperPool::configure(const std::string& type,
+                                                   const std::list<std::string>& appids,
+                                                   unsigned int size)
+{
+    size = std::min(size, MAX_POOL_SIZE);
+
+    if (appids.empty() || size == 0)
+    {
+        config_.erase(type);
+    }
+    else
+    {
+        config_[type] = std::make_pair(appids, size);
+    }
+
+    std::list<Entry> evicted;
+
+    /* Oldest first, so those are the ones that get dropped */
+    for (auto it = entries_.begin(); it != entries_.end();)
+    {
+        if (it->type == type && (!allowed(type, it->appid) || count(type, it->appid) > size))
+        {
+            evicted.push_back(*it);
+            it = entries_.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    return evicted;
+}
+
+/** Whether a helper is on the allow list of its type */
+bool HelperPool::allowed(const std::string& type, const std::string& appid) const
+{
+    auto it = config_.find(type);
+    if (it == config_.end())
+    {
+        return false;
+    }
+
+    const auto& appids = it->second.first;
+    return std::find(appids.begin(), appids.end(), appid) != appids.end();
+}
+
+/** Get the helpers that need to be started to fill the pool, each
+    type and AppID is in the list once for each helper that is needed */
+std::list<std::pair<std::string, std::string>> HelperPool::missing() const
+{
+    std::list<std::pair<std::string, std::string>> list;
+
+    for (const auto& type : config_)
+    {
+        for (const auto& appid : type.second.first)
+        {
+            for (auto i = count(type.first, appid); i < type.second.second; i++)
+            {
+                list.emplace_back(type.first, appid);
+            }
+        }
+    }
+
+    return list;
+}
+
+/** Add a parked helper
+
+    \param entry The helper that was started
+*/
+void HelperPool::add(Entry&& entry)
+{
+    entries_.emplace_back(std::move(entry));
+    stats_.parked++;
+}
+
+/** Take the oldest parked helper for an AppID out of the pool so that
+    it can be launched.
+
+    \param type Helper type
+    \param appid Application ID to look for
+    \param entry Filled in with the parked helper
+*/
+bool HelperPool::take(const std::string& type, const std::string& appid, Entry& entry)
+{
+    auto it = std::find_if(entries_.begin(), entries_.end(),
+                           [&type, &appid](const Entry& entry) { return entry.type == type && entry.appid == appid; });
+    if (it == entries_.end())
+    {
+        return false;
+    }
+
+    entry = *it;
+    entries_.erase(it);
+    return true;
+}
+
+/** Drop a parked helper without counting it, used when the job went
+    away on its own or couldn't be started */
+void HelperPool::remove(const std::string& type, const std::string& appid, const std::string& instanceid)
+{
+    entries_.remove_if([&type, &appid, &instanceid](const Entry& entry) {
+        return entry.type == type && entry.appid == appid && entry.instanceid == instanceid;
+    });
+}
+
+/** Take all the parked helpers of a type out of the pool, they need to
+    be stopped. The configuration is kept for the next launch.
+
+    \param type Helper type
+*/
+std::list<HelperPool::Entry> HelperPool::clear(const std::string& type)
+{
+    std::list<Entry> cleared;
+
+    for (auto it = entries_.begin(); it != entries_.end();)
+    {
+        if (it->type == type)
+        {
+            cleared.push_back(*it);
+            it = entries_.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    return cleared;
+}
+
+/** A launch that used a parked helper */
+void HelperPool::countHit()
+{
+    stats_.hits++;
+}
+
+/** A launch of an allowed helper that couldn't use the pool */
+void HelperPool::countMiss()
+{
+    stats_.misses++;
+}
+
+/** Get the counters */
+HelperPool::Stats HelperPool::stats() const
+{
+    return stats_;
+}
+
+/** Read the allow list from UBUNTU_APP_LAUNCH_HELPER_POOL, which is a
+    comma separated list of type:appid pairs. The number of helpers
+    kept for each comes from UBUNTU_APP_LAUNCH_HELPER_POOL_SIZE and is
+    one if that isn't set. */
+void HelperPool::configureFromEnv()
+{
+    auto envpool = g_getenv("UBUNTU_APP_LAUNCH_HELPER_POOL");
+    if (envpool == nullptr || envpool[0] == '\0')
+    {
+        return;
+    }
+
+    unsigned int size = 1;
+    auto envsize = g_getenv("UBUNTU_APP_LAUNCH_HELPER_POOL_SIZE");
+    if (envsize != nullptr)
+    {
+        auto parsed = std::atoi(envsize);
+        if (parsed < 0)
+        {
+            g_warning("Invalid helper pool size '%s'", envsize);
+            return;
+        }
+        size = parsed;
+    }
+
+    std::map<std::string, std::list<std::string>> types;
+
+    auto entries = g_strsplit(envpool, ",", -1);
+    for (int i = 0; entries[i] != nullptr; i++)
+    {
+        auto colon = strchr(entries[i], ':');
+        if (colon == nullptr || colon == entries[i] || colon[1] == '\0')
+        {
+            g_warning("Invalid helper pool entry '%s'", entries[i]);
+            continue;
+        }
+
+        types[std::string(entries[i], colon - entries[i])].emplace_back(colon + 1);
+    }
+    g_strfreev(entries);
+
+    for (const auto& type : types)
+    {
+        configure(type.first, type.second, size);
+    }
+}
+
+/** Number of parked helpers for an AppID */
+unsigned int HelperPool::count(const std::string& type, const std::string& appid) const
+{
+    return std::count_if(entries_.begin(), entries_.end(),
+                         [&type, &appid](const Entry& entry) { return entry.type == type && entry.appid == appid; });
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,99 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Book keeping for the untrusted helpers kept warm
+
+    A warm helper has had its untrusted-helper job started with
+    APP_PRELAUNCH set, so the exec tool has run, the job is confined
+    and exec-line-exec is parked waiting for a signal before it execs
+    the helper. Launching it then only needs that signal.
+
+    The job is confined to its AppID when it starts, so the pool can
+    only keep helpers for the AppIDs on the allow list of each type.
+    This object only tracks the entries and the counters, the registry
+    starts and stops the jobs.
+*/
+class HelperPool
+{
+public:
+    /** A parked helper */
+    struct Entry
+    {
+        std::string type;       /**< Helper type */
+        std::string appid;      /**< Application ID */
+        std::string instanceid; /**< Instance ID of the job */
+        std::chrono::steady_clock::time_point parkedAt;
+    };
+
+    /** Counters for how well the pool is doing */
+    struct Stats
+    {
+        std::uint64_t parked; /**< Helpers that were parked */
+        std::uint64_t hits;   /**< Launches that used a parked helper */
+        std::uint64_t misses; /**< Launches of allowed helpers that had to start from scratch */
+    };
+
+    HelperPool();
+    virtual ~HelperPool() = default;
+
+    std::list<Entry> configure(const std::string& type, const std::list<std::string>& appids, unsigned int size);
+    bool allowed(const std::string& type, const std::string& appid) const;
+    std::list<std::pair<std::string, std::string>> missing() const;
+
+    void add(Entry&& entry);
+    bool take(const std::string& type, const std::string& appid, Entry& entry);
+    void remove(const std::string& type, const std::string& appid, const std::string& instanceid);
+    std::list<Entry> clear(const std::string& type);
+
+    void countHit();
+    void countMiss();
+    Stats stats() const;
+
+    void configureFromEnv();
+
+private:
+    /** The allowed AppIDs and number of parked helpers for each of them,
+        by helper type */
+    std::map<std::string, std::pair<std::list<std::string>, unsigned int>> config_;
+    /** Parked helpers, oldest first */
+    std::list<Entry> entries_;
+    /** Counters */
+    Stats stats_;
+
+    unsigned int count(const std::string& type, const std::string& appid) const;
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,211 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "launch-predictor.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+
+#include <glib.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Most applications we'll prewarm, each one holds on to memory */
+static const unsigned int MAX_CANDIDATES = 8;
+
+/** Local hour of the day for a time */
+static int localHour(std::chrono::system_clock::time_point when)
+{
+    auto time = std::chrono::system_clock::to_time_t(when);
+    struct tm local;
+    localtime_r(&time, &local);
+    return local.tm_hour;
+}
+
+/** Build a predictor with no history
+
+    \param candidates How many applications to predict
+*/
+LaunchPredictor::LaunchPredictor(unsigned int candidates)
+    : candidates_(std::min(candidates, MAX_CANDIDATES))
+    , total_(0)
+    , stats_({0, 0, 0, 0})
+{
+}
+
+/** How many applications are predicted, zero means prediction is off */
+unsigned int LaunchPredictor::candidates() const
+{
+    return candidates_;
+}
+
+/** Change how many applications are predicted
+
+    \param candidates How many applications to predict
+*/
+void LaunchPredictor::setCandidates(unsigned int candidates)
+{
+    candidates_ = std::min(candidates, MAX_CANDIDATES);
+}
+
+/** Add a launch to the history
+
+    \param app Application name without the version
+    \param when Time of the launch
+*/
+void LaunchPredictor::addLaunch(const std::string& app, std::chrono::system_clock::time_point when)
+{
+    auto it = usage_.find(app);
+    if (it == usage_.end())
+    {
+        Usage usage;
+        usage.count = 0;
+        usage.hours.fill(0);
+        it = usage_.emplace(app, usage).first;
+    }
+
+    it->second.count++;
+    it->second.hours[localHour(when)]++;
+    total_++;
+}
+
+/** Launches in this hour, with the hours on either side counting half so
+    that 8:55 and 9:05 aren't in different worlds */
+double LaunchPredictor::hourWeight(const Usage& usage, int hour)
+{
+    return usage.hours[hour] + 0.5 * (usage.hours[(hour + 23) % 24] + usage.hours[(hour + 1) % 24]);
+}
+
+/** Get the applications most likely to be launched next, most likely
+    first.
+
+    \param now Time to predict for
+*/
+std::vector<std::string> LaunchPredictor::predict(std::chrono::system_clock::time_point now) const
+{
+    if (candidates_ == 0 || total_ == 0)
+    {
+        return {};
+    }
+
+    auto hour = localHour(now);
+    double hourTotal = 0.0;
+    for (const auto& usage : usage_)
+    {
+        hourTotal += hourWeight(usage.second, hour);
+    }
+
+    /* Equal parts overall share and share of this time of day */
+    std::vector<std::pair<double, std::string>> scores;
+    for (const auto& usage : usage_)
+    {
+        double frequency = double(usage.second.count) / double(total_);
+        double timeofday = hourTotal > 0.0 ? hourWeight(usage.second, hour) / hourTotal : 0.0;
+        scores.emplace_back(std::make_pair((frequency + timeofday) / 2.0, usage.first));
+    }
+
+    std::sort(scores.begin(), scores.end(),
+              [](const std::pair<double, std::string>& a, const std::pair<double, std::string>& b) {
+                  return a.first != b.first ? a.first > b.first : a.second < b.second;
+              });
+
+    std::vector<std::string> retval;
+    for (const auto& score : scores)
+    {
+        if (retval.size() >= candidates_)
+        {
+            break;
+        }
+        retval.push_back(score.second);
+    }
+
+    return retval;
+}
+
+/** Note that an application has been prewarmed
+
+    \param app Application name without the version
+    \param cost How long prewarming it took
+*/
+void LaunchPredictor::prewarmed(const std::string& app, std::chrono::microseconds cost)
+{
+    warm_[app] = cost;
+    stats_.prewarmed++;
+}
+
+/** Forget about the prewarmed applications, their caches have been dropped */
+void LaunchPredictor::clearPrewarmed()
+{
+    warm_.clear();
+}
+
+/** Count a launch against the predictions, returns whether it was a hit.
+    This doesn't add the launch to the history, use addLaunch() for that.
+
+    \param app Application name without the version
+*/
+bool LaunchPredictor::launched(const std::string& app)
+{
+    stats_.launches++;
+
+    auto it = warm_.find(app);
+    if (it == warm_.end())
+    {
+        return false;
+    }
+
+    stats_.hits++;
+    stats_.savedUsec += it->second.count();
+    warm_.erase(it);
+    return true;
+}
+
+/** Get the counters */
+LaunchPredictor::Stats LaunchPredictor::stats() const
+{
+    return stats_;
+}
+
+/** The number of candidates comes from UBUNTU_APP_LAUNCH_PREDICT, off
+    when it isn't set */
+unsigned int LaunchPredictor::candidatesFromEnv()
+{
+    auto envcandidates = g_getenv("UBUNTU_APP_LAUNCH_PREDICT");
+    if (envcandidates == nullptr)
+    {
+        return 0;
+    }
+
+    auto candidates = std::atoi(envcandidates);
+    if (candidates < 0)
+    {
+        g_warning("Invalid number of launch predictions '%s'", envcandidates);
+        return 0;
+    }
+
+    return std::min(static_cast<unsigned int>(candidates), MAX_CANDIDATES);
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
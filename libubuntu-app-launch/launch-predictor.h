@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Guesses which applications are going to be launched next
+
+    Keeps a count of the launches of each application along with which
+    hour of the day they happened in. Predictions mix how often an
+    application is used overall with how often it is used at this time
+    of day, so the phone app in the morning and the music player on the
+    commute both make it to the top.
+
+    Applications are named the way Zeitgeist has them, the package and
+    application name without the version, so the history survives
+    upgrades.
+
+    It also keeps track of which applications were prewarmed, so that
+    launches can be counted as hits or misses.
+*/
+class LaunchPredictor
+{
+public:
+    /** How well the predictions are working out */
+    struct Stats
+    {
+        std::uint64_t launches;  /**< Launches seen while predicting */
+        std::uint64_t hits;      /**< Launches of an application that was prewarmed */
+        std::uint64_t prewarmed; /**< Applications that were prewarmed */
+        std::uint64_t savedUsec; /**< Time spent prewarming the applications that were hits */
+    };
+
+    explicit LaunchPredictor(unsigned int candidates);
+    virtual ~LaunchPredictor() = default;
+
+    unsigned int candidates() const;
+    void setCandidates(unsigned int candidates);
+
+    void addLaunch(const std::string& app, std::chrono::system_clock::time_point when);
+    std::vector<std::string> predict(std::chrono::system_clock::time_point now) const;
+
+    void prewarmed(const std::string& app, std::chrono::microseconds cost);
+    void clearPrewarmed();
+    bool launched(const std::string& app);
+
+    Stats stats() const;
+
+    static unsigned int candidatesFromEnv();
+
+private:
+    /** History for one application */
+    struct Usage
+    {
+        std::uint64_t count;                 /**< All launches */
+        std::array<std::uint32_t, 24> hours; /**< Launches by local hour of the day */
+    };
+
+    /** How many applications to predict */
+    unsigned int candidates_;
+    /** History by application */
+    std::map<std::string, Usage> usage_;
+    /** Launches of all the applications */
+    std::uint64_t total_;
+    /** Applications that are prewarmed and what it cost to do it */
+    std::map<std::string, std::chrono::microseconds> warm_;
+    /** Counters */
+    Stats stats_;
+
+    static double hourWeight(const Usage& usage, int hour);
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,558 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "launch-timeline.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <glib-unix.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern "C" {
+#include "helpers.h"
+#include "ubuntu-app-launch-trace.h"
+}
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Interface for reading the timelines */
+static const char* STATS_INTERFACE =
+    "<node>"
+    "  <interface name='com.canonical.UbuntuAppLaunch.Stats'>"
+    "    <method name='GetTimelines'>"
+    "      <arg type='a(stxa(sx))' name='launches' direction='out' />"
+    "    </method>"
+    "    <method name='GetPercentiles'>"
+    "      <arg type='a(ssuxxx)' name='percentiles' direction='out' />"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+/** Build an empty timeline, it isn't listening or exported until
+    listen() and exportOnBus() are called
+
+    \param history Number of launches kept for each AppID
+*/
+LaunchTimeline::LaunchTimeline(std::size_t history)
+    : history_(std::max(history, std::size_t{1}))
+    , serial_(0)
+    , fd_(-1)
+    , object_(0)
+    , name_(0)
+{
+}
+
+LaunchTimeline::~LaunchTimeline()
+{
+    if (name_ != 0)
+    {
+        g_bus_unown_name(name_);
+    }
+
+    if (object_ != 0)
+    {
+        g_dbus_connection_unregister_object(bus_.get(), object_);
+    }
+
+    source_.reset();
+
+    if (fd_ >= 0)
+    {
+        close(fd_);
+    }
+}
+
+/** Name used in the DBus interface and by the tool for a milestone,
+    the same as the tracepoint where there is one */
+const char* LaunchTimeline::milestoneName(Milestone milestone)
+{
+    switch (milestone)
+    {
+        case Milestone::START:
+            return "libual_start";
+        case Milestone::JOB_PATH:
+            return "libual_job_path_determined";
+        case Milestone::MESSAGE_SENT:
+            return "libual_start_message_sent";
+        case Milestone::HANDSHAKE_WAIT:
+            return "handshake_wait";
+        case Milestone::HANDSHAKE_COMPLETE:
+            return "handshake_complete";
+        case Milestone::EXEC_START:
+            return "exec_start";
+        case Milestone::EXEC_PARSED:
+            return "exec_parse_complete";
+        case Milestone::EXEC_PRE_EXEC:
+            return "exec_pre_exec";
+    }
+
+    return "unknown";
+}
+
+/** Name of the abstract socket that the launcher with the PID
+    listens on, without the leading nul */
+std::string LaunchTimeline::socketName(pid_t pid)
+{
+    return std::string{LAUNCH_TIMELINE_SOCKET} + std::to_string(pid);
+}
+
+/** Start the timeline of a launch, dropping the oldest launch of the
+    AppID if there are already enough of them
+
+    \param appid Application being launched
+    \param now Time of the start
+*/
+std::uint64_t LaunchTimeline::start(const std::string& appid, gint64 now)
+{
+    auto& launches = launches_[appid];
+
+    Launch launch;
+    launch.appid = appid;
+    launch.id = ++serial_;
+    launch.stamps.fill(0);
+    launch.stamps[std::size_t(Milestone::START)] = now;
+    launches.emplace_back(std::move(launch));
+
+    while (launches.size() > history_)
+    {
+        launches.pop_front();
+    }
+
+    return serial_;
+}
+
+/** Note that a launch reached a milestone. Only the first time counts,
+    and launches that have already been dropped are ignored.
+
+    \param appid Application being launched
+    \param id Launch from start()
+    \param milestone Milestone reached
+    \param now Time it was reached
+*/
+void LaunchTimeline::stamp(const std::string& appid, std::uint64_t id, Milestone milestone, gint64 now)
+{
+    auto launches = launches_.find(appid);
+    if (launches == launches_.end())
+    {
+        return;
+    }
+
+    for (auto launch = launches->second.rbegin(); launch != launches->second.rend(); launch++)
+    {
+        if (launch->id == id)
+        {
+            auto& stamp = launch->stamps[std::size_t(milestone)];
+            if (stamp == 0)
+            {
+                stamp = now;
+            }
+            return;
+        }
+    }
+}
+
+/** Put the times that exec-line-exec sent on the launch it belongs to.
+    That's the newest launch of the AppID that started before the
+    application was exec'd and doesn't have exec times yet. A parked
+    job parsed its Exec line before the launch, so those can be before
+    the start.
+
+    \param appid Application that was exec'd
+    \param execStart When exec-line-exec started
+    \param parsed When it had parsed the Exec line
+    \param preExec When it was about to exec
+*/
+bool LaunchTimeline::execReport(const std::string& appid, gint64 execStart, gint64 parsed, gint64 preExec)
+{
+    auto launches = launches_.find(appid);
+    if (launches == launches_.end())
+    {
+        return false;
+    }
+
+    for (auto launch = launches->second.rbegin(); launch != launches->second.rend(); launch++)
+    {
+        if (launch->stamps[std::size_t(Milestone::START)] > preExec)
+        {
+            continue;
+        }
+
+        if (launch->stamps[std::size_t(Milestone::EXEC_PRE_EXEC)] != 0)
+        {
+            /* Newer launches are taken, so older ones will be too */
+            return false;
+        }
+
+        launch->stamps[std::size_t(Milestone::EXEC_START)] = execStart;
+        launch->stamps[std::size_t(Milestone::EXEC_PARSED)] = parsed;
+        launch->stamps[std::size_t(Milestone::EXEC_PRE_EXEC)] = preExec;
+
+        tracepoint(ubuntu_app_launch, timeline_exec_report, appid.c_str(),
+                   (preExec - launch->stamps[std::size_t(Milestone::START)]) / G_TIME_SPAN_MILLISECOND);
+        return true;
+    }
+
+    return false;
+}
+
+/** Parse a report as exec-line-exec sends it, the AppID and the
+    three times separated by spaces
+
+    \param report Text of the datagram
+*/
+bool LaunchTimeline::execReport(const std::string& report)
+{
+    gchar** fields = g_strsplit(report.c_str(), " ", -1);
+    if (g_strv_length(fields) != 4)
+    {
+        g_debug("Bad launch timeline report: '%s'", report.c_str());
+        g_strfreev(fields);
+        return false;
+    }
+
+    std::string appid = fields[0];
+    std::array<gint64, 3> times;
+    bool valid = true;
+    for (std::size_t i = 0; i < times.size(); i++)
+    {
+        gchar* end = nullptr;
+        times[i] = g_ascii_strtoll(fields[i + 1], &end, 10);
+        if (end == fields[i + 1] || *end != '\0' || times[i] <= 0)
+        {
+            valid = false;
+        }
+    }
+    g_strfreev(fields);
+
+    if (!valid)
+    {
+        g_debug("Bad times in launch timeline report for '%s'", appid.c_str());
+        return false;
+    }
+
+    return execReport(appid, times[0], times[1], times[2]);
+}
+
+/** Copy of all the launches that are kept, grouped by AppID */
+std::list<LaunchTimeline::Launch> LaunchTimeline::launches() const
+{
+    std::list<Launch> retval;
+
+    for (const auto& launches : launches_)
+    {
+        retval.insert(retval.end(), launches.second.begin(), launches.second.end());
+    }
+
+    return retval;
+}
+
+/** Percentiles of how long after the start each milestone was reached,
+    for each AppID and milestone that has been reached at least once.
+    Uses the nearest rank, so with few launches the high percentiles
+    are the slowest launch. */
+std::list<LaunchTimeline::Percentiles> LaunchTimeline::percentiles() const
+{
+    std::list<Percentiles> retval;
+
+    for (const auto& launches : launches_)
+    {
+        for (std::size_t milestone = std::size_t(Milestone::START) + 1; milestone < MILESTONES; milestone++)
+        {
+            std::vector<gint64> offsets;
+            for (const auto& launch : launches.second)
+            {
+                if (launch.stamps[milestone] != 0)
+                {
+                    offsets.push_back(launch.stamps[milestone] - launch.stamps[std::size_t(Milestone::START)]);
+                }
+            }
+
+            if (offsets.empty())
+            {
+                continue;
+            }
+
+            std::sort(offsets.begin(), offsets.end());
+            auto rank = [&offsets](std::size_t percent) {
+                return offsets[(percent * offsets.size() + 99) / 100 - 1];
+            };
+
+            retval.emplace_back(
+                Percentiles{launches.first, Milestone(milestone), offsets.size(), rank(50), rank(90), rank(99)});
+        }
+    }
+
+    return retval;
+}
+
+/** Bind the abstract socket that exec-line-exec sends its times to. If
+    another registry in this process has it already that one gets them.
+
+    \param pid PID to name the socket after, what the jobs get in
+               APP_LAUNCHER_PID
+*/
+bool LaunchTimeline::listen(pid_t pid)
+{
+    if (fd_ >= 0)
+    {
+        return true;
+    }
+
+    auto name = socketName(pid);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (name.size() + 1 > sizeof(addr.sun_path))
+    {
+        return false;
+    }
+    /* Abstract, so the first byte of the path stays nul */
+    memcpy(addr.sun_path + 1, name.c_str(), name.size());
+    socklen_t addrlen = offsetof(struct sockaddr_un, sun_path) + 1 + name.size();
+
+    fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd_ < 0)
+    {
+        g_debug("Unable to create launch timeline socket: %s", std::strerror(errno));
+        return false;
+    }
+
+    /* Anyone can send to an abstract socket, so we need to know who
+       each report is from */
+    int passcred = 1;
+    if (setsockopt(fd_, SOL_SOCKET, SO_PASSCRED, &passcred, sizeof(passcred)) != 0)
+    {
+        g_debug("Unable to get credentials on launch timeline socket: %s", std::strerror(errno));
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    if (bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), addrlen) != 0)
+    {
+        g_debug("Unable to bind launch timeline socket '%s': %s", name.c_str(), std::strerror(errno));
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    /* NOTE: We're building this on the registry thread so we grab its context */
+    source_ = std::shared_ptr<GSource>(g_unix_fd_source_new(fd_, G_IO_IN), [](GSource* source) {
+        g_source_destroy(source);
+        g_source_unref(source);
+    });
+    g_source_set_callback(source_.get(),
+                          reinterpret_cast<GSourceFunc>(
+                              +[](gint fd, GIOCondition condition, gpointer user_data) -> gboolean {
+                                  static_cast<LaunchTimeline*>(user_data)->readReports();
+                                  return G_SOURCE_CONTINUE;
+                              }),
+                          this, nullptr);
+    g_source_attach(source_.get(), g_main_context_get_thread_default());
+
+    return true;
+}
+
+/** Drain the socket, each datagram is one report. Only reports from
+    processes running as our user are taken, our jobs always are. */
+void LaunchTimeline::readReports()
+{
+    char buffer[1024];
+
+    while (true)
+    {
+        struct iovec iov;
+        iov.iov_base = buffer;
+        iov.iov_len = sizeof(buffer) - 1;
+
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(struct ucred))];
+        } control;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        auto len = recvmsg(fd_, &msg, 0);
+        if (len < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                g_warning("Unable to read launch timeline reports: %s", std::strerror(errno));
+            }
+            return;
+        }
+
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_CREDENTIALS ||
+            cmsg->cmsg_len != CMSG_LEN(sizeof(struct ucred)))
+        {
+            g_debug("Launch timeline report without credentials");
+            continue;
+        }
+
+        struct ucred cred;
+        memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+        if (cred.uid != getuid())
+        {
+            g_debug("Ignoring launch timeline report from PID %d with UID %d", int(cred.pid), int(cred.uid));
+            continue;
+        }
+
+        buffer[len] = '\0';
+        execReport(std::string{buffer});
+    }
+}
+
+/** Put the timeline on the bus so the tool can read it. The object is
+    on our connection no matter what, only one process on the bus gets
+    the name and the others are in line for it.
+
+    \param bus Session bus
+*/
+bool LaunchTimeline::exportOnBus(const std::shared_ptr<GDBusConnection>& bus)
+{
+    if (object_ != 0)
+    {
+        return true;
+    }
+
+    GError* error = nullptr;
+    auto nodeinfo = std::shared_ptr<GDBusNodeInfo>(g_dbus_node_info_new_for_xml(STATS_INTERFACE, &error),
+                                                   [](GDBusNodeInfo* info) {
+                                                       if (info != nullptr)
+                                                       {
+                                                           g_dbus_node_info_unref(info);
+                                                       }
+                                                   });
+    if (error != nullptr)
+    {
+        g_warning("Unable to parse launch stats interface: %s", error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    static const GDBusInterfaceVTable vtable = {handleMethod, nullptr, nullptr, {nullptr}};
+
+    object_ = g_dbus_connection_register_object(bus.get(), OBJECT_PATH, nodeinfo->interfaces[0], &vtable, this,
+                                                nullptr, &error);
+    if (error != nullptr)
+    {
+        /* Another registry on the same connection has it */
+        g_debug("Unable to export launch stats: %s", error->message);
+        g_error_free(error);
+        object_ = 0;
+        return false;
+    }
+
+    bus_ = bus;
+    name_ = g_bus_own_name_on_connection(bus.get(), BUS_NAME, G_BUS_NAME_OWNER_FLAGS_NONE, nullptr, nullptr, nullptr,
+                                         nullptr);
+
+    return true;
+}
+
+/** Answer the tool, the offsets are from the start of each launch and
+    all the times are in microseconds. Each launch's milestones are in
+    the order they were reached. */
+void LaunchTimeline::handleMethod(GDBusConnection* connection,
+                                  const gchar* sender,
+                                  const gchar* path,
+                                  const gchar* interface,
+                                  const gchar* method,
+                                  GVariant* params,
+                                  GDBusMethodInvocation* invocation,
+                                  gpointer user_data)
+{
+    auto timeline = static_cast<LaunchTimeline*>(user_data);
+
+    if (g_strcmp0(method, "GetTimelines") == 0)
+    {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a(stxa(sx))"));
+
+        for (const auto& launch : timeline->launches())
+        {
+            auto start = launch.stamps[std::size_t(Milestone::START)];
+
+            /* In the order they happened, the handshake goes along with
+               the rest of the launch */
+            std::vector<std::pair<gint64, Milestone>> reached;
+            for (std::size_t milestone = 0; milestone < MILESTONES; milestone++)
+            {
+                if (launch.stamps[milestone] != 0)
+                {
+                    reached.emplace_back(launch.stamps[milestone] - start, Milestone(milestone));
+                }
+            }
+            std::stable_sort(reached.begin(), reached.end(),
+                             [](const std::pair<gint64, Milestone>& a, const std::pair<gint64, Milestone>& b) {
+                                 return a.first < b.first;
+                             });
+
+            GVariantBuilder stamps;
+            g_variant_builder_init(&stamps, G_VARIANT_TYPE("a(sx)"));
+            for (const auto& stamp : reached)
+            {
+                g_variant_builder_add(&stamps, "(sx)", milestoneName(stamp.second), stamp.first);
+            }
+
+            g_variant_builder_add(&builder, "(stxa(sx))", launch.appid.c_str(), launch.id, start, &stamps);
+        }
+
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(stxa(sx)))", &builder));
+    }
+    else if (g_strcmp0(method, "GetPercentiles") == 0)
+    {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a(ssuxxx)"));
+
+        for (const auto& percentiles : timeline->percentiles())
+        {
+            g_variant_builder_add(&builder, "(ssuxxx)", percentiles.appid.c_str(),
+                                  milestoneName(percentiles.milestone), guint32(percentiles.count), percentiles.p50,
+                                  percentiles.p90, percentiles.p99);
+        }
+
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(ssuxxx))", &builder));
+    }
+    else
+    {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                              "Unknown method '%s'", method);
+    }
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,150 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <gio/gio.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Records when each launch reached its milestones
+
+    The milestones are the same places that have tracepoints, but
+    reading those needs an LTTng session. Here each launch gets the
+    CLOCK_MONOTONIC time, as g_get_monotonic_time() gives it, of each
+    milestone it reaches so that the timeline of the last few launches
+    of each application is always around. The exec-line-exec milestones
+    happen in the job, it sends them back to the process that launched
+    it in a datagram on an abstract socket named for our PID. Reports
+    from other users are dropped. As the clock is the same across
+    processes they line up with ours.
+
+    The timelines and the percentiles of each milestone's offset from
+    the start of the launch, per AppID, can be read over DBus with
+    the ubuntu-app-launch-stats tool.
+
+    All functions must be called on the registry thread.
+*/
+class LaunchTimeline
+{
+public:
+    /** Points in a launch that get a time */
+    enum class Milestone
+    {
+        START,              /**< libual_start, the launch was asked for */
+        JOB_PATH,           /**< The Upstart job path was determined */
+        MESSAGE_SENT,       /**< libual_start_message_sent, Upstart was asked to start the job */
+        HANDSHAKE_WAIT,     /**< The starting broadcast was sent to Unity */
+        HANDSHAKE_COMPLETE, /**< Unity answered, or we stopped waiting */
+        EXEC_START,         /**< exec_start, exec-line-exec is running */
+        EXEC_PARSED,        /**< exec_parse_complete, the Exec line is parsed */
+        EXEC_PRE_EXEC,      /**< exec_pre_exec, right before the application is exec'd */
+    };
+    /** Number of milestones */
+    static constexpr std::size_t MILESTONES = 8;
+
+    /** A launch and the times it reached its milestones */
+    struct Launch
+    {
+        std::string appid;                     /**< Application launched */
+        std::uint64_t id;                      /**< Serial of the launch */
+        std::array<gint64, MILESTONES> stamps; /**< Monotonic time in microseconds, 0 if not reached */
+    };
+
+    /** Spread of one milestone's offset from the start for an AppID,
+        all in microseconds */
+    struct Percentiles
+    {
+        std::string appid;   /**< Application ID */
+        Milestone milestone; /**< Milestone measured */
+        std::size_t count;   /**< Launches that reached it */
+        gint64 p50;          /**< Median */
+        gint64 p90;          /**< 90th percentile */
+        gint64 p99;          /**< 99th percentile */
+    };
+
+    explicit LaunchTimeline(std::size_t history);
+    virtual ~LaunchTimeline();
+
+    std::uint64_t start(const std::string& appid, gint64 now = g_get_monotonic_time());
+    void stamp(const std::string& appid, std::uint64_t id, Milestone milestone, gint64 now = g_get_monotonic_time());
+    bool execReport(const std::string& appid, gint64 execStart, gint64 parsed, gint64 preExec);
+    bool execReport(const std::string& report);
+
+    std::list<Launch> launches() const;
+    std::list<Percentiles> percentiles() const;
+
+    bool listen(pid_t pid);
+    bool exportOnBus(const std::shared_ptr<GDBusConnection>& bus);
+
+    static const char* milestoneName(Milestone milestone);
+    static std::string socketName(pid_t pid);
+
+    /** Bus name the timeline owns when it is exported */
+    static constexpr const char* BUS_NAME = "com.canonical.UbuntuAppLaunch.Stats";
+    /** Object path the timeline is exported on */
+    static constexpr const char* OBJECT_PATH = "/com/canonical/UbuntuAppLaunch/Stats";
+
+private:
+    /** Number of launches kept for each AppID */
+    std::size_t history_;
+    /** Serial for the next launch */
+    std::uint64_t serial_;
+    /** Recent launches by AppID, oldest first */
+    std::map<std::string, std::deque<Launch>> launches_;
+
+    /** Socket the exec-line-exec reports come in on */
+    int fd_;
+    /** Watch on the socket */
+    std::shared_ptr<GSource> source_;
+
+    /** Bus we're exported on */
+    std::shared_ptr<GDBusConnection> bus_;
+    /** Exported object registration */
+    guint object_;
+    /** Bus name ownership */
+    guint name_;
+
+    void readReports();
+
+    static void handleMethod(GDBusConnection* connection,
+                             const gchar* sender,
+                             const gchar* path,
+                             const gchar* interface,
+                             const gchar* method,
+                             GVariant* params,
+                             GDBusMethodInvocation* invocation,
+                             gpointer user_data);
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
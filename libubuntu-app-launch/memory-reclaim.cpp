@@ -0,0 +1,309 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "memory-reclaim.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Read a whole file, returning an empty string if it can't be read */
+static std::string readFile(const std::string& path)
+{
+    gchar* contents = nullptr;
+    if (!g_file_get_contents(path.c_str(), &contents, nullptr, nullptr))
+    {
+        return {};
+    }
+
+    std::string retval(contents);
+    g_free(contents);
+    return retval;
+}
+
+/** Write a value to a cgroup file, we can't use g_file_set_contents()
+    as that replaces the file instead of writing to it */
+static bool writeFile(const std::string& path, const std::string& value)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    bool success = fwrite(value.c_str(), 1, value.size(), file) == value.size();
+    /* cgroup files report their errors on the flush */
+    success = (fclose(file) == 0) && success;
+    return success;
+}
+
+/** How much memory the memory controller thinks the job is using */
+static std::uint64_t currentUsage(const std::string& memorypath)
+{
+    return std::strtoull(readFile(memorypath + "/memory.current").c_str(), nullptr, 10);
+}
+
+/** Get the amount that we should reclaim from each paused application
+    from the UBUNTU_APP_LAUNCH_RECLAIM_BUDGET environment variable. It is
+    a number of bytes with an optional K, M or G suffix. Zero, which is
+    the default, means that we don't reclaim at all. */
+std::uint64_t MemoryReclaim::budget()
+{
+    auto envbudget = g_getenv("UBUNTU_APP_LAUNCH_RECLAIM_BUDGET");
+    if (envbudget == nullptr)
+    {
+        return 0;
+    }
+
+    gchar* suffix = nullptr;
+    std::uint64_t value = g_ascii_strtoull(envbudget, &suffix, 10);
+
+    switch (g_ascii_toupper(suffix[0]))
+    {
+        case 'G':
+            value *= 1024;
+        /* fall through */
+        case 'M':
+            value *= 1024;
+        /* fall through */
+        case 'K':
+            value *= 1024;
+        /* fall through */
+        case '\0':
+            break;
+        default:
+            g_warning("Unable to parse reclaim budget '%s'", envbudget);
+            return 0;
+    }
+
+    return value;
+}
+
+/** Push out up to the budget of memory from a paused application
+
+    \param memorypath Directory of the job in the memory controller
+    \param unified Whether the memory controller is on the unified hierarchy
+    \param pids Processes in the job, used if the cgroup can't do it for us
+    \param budget Most bytes we should try to reclaim
+*/
+MemoryReclaim::Result MemoryReclaim::reclaim(const std::string& memorypath,
+                                             bool unified,
+                                             const std::vector<pid_t>& pids,
+                                             std::uint64_t budget)
+{
+    Result result{0, std::chrono::microseconds{0}, "none"};
+    auto start = std::chrono::steady_clock::now();
+
+    if (unified && reclaimFile(memorypath, budget, result.bytes))
+    {
+        result.method = "memory.reclaim";
+    }
+    else if (unified && lowerHigh(memorypath, budget, result.bytes))
+    {
+        result.method = "memory.high";
+    }
+    else if (pageout(pids, budget, result.bytes))
+    {
+        result.method = "process_madvise";
+    }
+
+    result.time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    return result;
+}
+
+/** Use the memory.reclaim file that newer kernels have, which does
+    exactly what we want. */
+bool MemoryReclaim::reclaimFile(const std::string& memorypath, std::uint64_t budget, std::uint64_t& bytes)
+{
+    auto path = memorypath + "/memory.reclaim";
+    if (!g_file_test(path.c_str(), G_FILE_TEST_EXISTS))
+    {
+        return false;
+    }
+
+    auto before = currentUsage(memorypath);
+    /* Returns EAGAIN when it couldn't get the whole amount, but it still
+       got what it could so we just measure it. */
+    writeFile(path, std::to_string(budget));
+    auto after = currentUsage(memorypath);
+
+    bytes = before > after ? before - after : 0;
+    return true;
+}
+
+/** Older unified kernels don't have memory.reclaim, but lowering the
+    high limit below the current usage makes the kernel reclaim down to it
+    synchronously. We put it back when we're done. */
+bool MemoryReclaim::lowerHigh(const std::string& memorypath, std::uint64_t budget, std::uint64_t& bytes)
+{
+    auto path = memorypath + "/memory.high";
+    auto oldhigh = readFile(path);
+    if (oldhigh.empty())
+    {
+        return false;
+    }
+
+    auto before = currentUsage(memorypath);
+    if (before == 0)
+    {
+        return false;
+    }
+
+    auto target = before > budget ? before - budget : 0;
+    if (!writeFile(path, std::to_string(target)))
+    {
+        return false;
+    }
+    auto after = currentUsage(memorypath);
+
+    if (!writeFile(path, oldhigh))
+    {
+        g_warning("Unable to restore memory.high for '%s'", memorypath.c_str());
+    }
+
+    bytes = before > after ? before - after : 0;
+    return true;
+}
+
+/** Total of the resident sizes of a set of processes */
+std::uint64_t MemoryReclaim::residentSize(const std::vector<pid_t>& pids)
+{
+    std::uint64_t total = 0;
+
+    for (auto pid : pids)
+    {
+        std::istringstream status(readFile("/proc/" + std::to_string(pid) + "/status"));
+        std::string line;
+        while (std::getline(status, line))
+        {
+            unsigned long long kb = 0;
+            if (std::sscanf(line.c_str(), "VmRSS: %llu kB", &kb) == 1)
+            {
+                total += kb * 1024;
+                break;
+            }
+        }
+    }
+
+    return total;
+}
+
+/** When we can't go through the cgroup we can ask the kernel to page out
+    the private anonymous mappings of each process. */
+bool MemoryReclaim::pageout(const std::vector<pid_t>& pids, std::uint64_t budget, std::uint64_t& bytes)
+{
+#if defined(SYS_process_madvise) && defined(SYS_pidfd_open) && defined(MADV_PAGEOUT)
+    if (pids.empty())
+    {
+        return false;
+    }
+
+    auto before = residentSize(pids);
+    std::uint64_t requested = 0;
+    bool worked = false;
+
+    for (auto pid : pids)
+    {
+        if (requested >= budget)
+        {
+            break;
+        }
+
+        int pidfd = syscall(SYS_pidfd_open, pid, 0);
+        if (pidfd < 0)
+        {
+            g_debug("Unable to open pidfd for %d: %s", pid, std::strerror(errno));
+            continue;
+        }
+
+        /* Anonymous mappings have no file, and aren't the special ones
+           like [stack] or [vdso] */
+        std::vector<struct iovec> ranges;
+        std::istringstream maps(readFile("/proc/" + std::to_string(pid) + "/maps"));
+        std::string line;
+        while (std::getline(maps, line) && requested < budget)
+        {
+            unsigned long start = 0, end = 0;
+            char perms[5] = {0};
+            unsigned long long inode = 0;
+            int pathoffset = 0;
+
+            if (std::sscanf(line.c_str(), "%lx-%lx %4s %*x %*x:%*x %llu %n", &start, &end, perms, &inode,
+                            &pathoffset) < 4)
+            {
+                continue;
+            }
+            if (inode != 0 || perms[3] != 'p' || (pathoffset > 0 && line[pathoffset] != '\0' &&
+                                                  line.compare(pathoffset, 6, "[heap]") != 0))
+            {
+                continue;
+            }
+
+            auto len = std::min<std::uint64_t>(end - start, budget - requested);
+            ranges.push_back({reinterpret_cast<void*>(start), static_cast<size_t>(len)});
+            requested += len;
+        }
+
+        /* The kernel limits how many we can send at once */
+        for (std::size_t i = 0; i < ranges.size(); i += IOV_MAX)
+        {
+            auto count = std::min<std::size_t>(IOV_MAX, ranges.size() - i);
+            if (syscall(SYS_process_madvise, pidfd, &ranges[i], count, MADV_PAGEOUT, 0) >= 0)
+            {
+                worked = true;
+            }
+            else
+            {
+                g_debug("Unable to page out memory of %d: %s", pid, std::strerror(errno));
+                break;
+            }
+        }
+
+        close(pidfd);
+    }
+
+    auto after = residentSize(pids);
+    bytes = before > after ? before - after : 0;
+    return worked;
+#else
+    (void)pids;
+    (void)budget;
+    (void)bytes;
+    return false;
+#endif
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
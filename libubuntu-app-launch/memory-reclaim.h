@@ -0,0 +1,70 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Pushes the memory of a paused application out to swap
+
+    A paused application isn't going to touch its pages until it is
+    resumed, so we can ask the kernel to page them out before we get
+    into memory pressure. In order of preference this uses the cgroup's
+    memory.reclaim file, temporarily lowering memory.high, or
+    process_madvise(MADV_PAGEOUT) on each process.
+
+    All of these can block while the kernel writes out pages, so this
+    shouldn't be used on the registry thread.
+*/
+class MemoryReclaim
+{
+public:
+    /** What happened when reclaiming */
+    struct Result
+    {
+        std::uint64_t bytes;            /**< Memory that was freed */
+        std::chrono::microseconds time; /**< How long it took */
+        std::string method;             /**< Which mechanism was used */
+    };
+
+    static std::uint64_t budget();
+    static Result reclaim(const std::string& memorypath,
+                          bool unified,
+                          const std::vector<pid_t>& pids,
+                          std::uint64_t budget);
+
+private:
+    static bool reclaimFile(const std::string& memorypath, std::uint64_t budget, std::uint64_t& bytes);
+    static bool lowerHigh(const std::string& memorypath, std::uint64_t budget, std::uint64_t& bytes);
+    static bool pageout(const std::vector<pid_t>& pids, std::uint64_t budget, std::uint64_t& bytes);
+    static std::uint64_t residentSize(const std::vector<pid_t>& pids);
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
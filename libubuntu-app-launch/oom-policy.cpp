@@ -0,0 +1,214 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "oom-policy.h"
+#include "oom.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/* Thresholds on the ten second averages. We go up a level as soon as
+   we cross the higher value, but don't come back down until we're under
+   the lower one, so that we don't flap while hovering around a value. */
+static const double MODERATE_ENTER_SOME = 10.0;
+static const double MODERATE_LEAVE_SOME = 5.0;
+static const double CRITICAL_ENTER_SOME = 40.0;
+static const double CRITICAL_ENTER_FULL = 5.0;
+static const double CRITICAL_LEAVE_SOME = 25.0;
+static const double CRITICAL_LEAVE_FULL = 2.0;
+
+/* How far above the paused score we spread for each level. The kernel
+   maxes out at 1000, which paused plus critical should reach. */
+static const std::int32_t MODERATE_SPREAD = 50;
+static const std::int32_t CRITICAL_SPREAD = 100;
+
+OomPolicy::OomPolicy()
+    : level_(Level::NONE)
+{
+}
+
+/** Add a job that was paused, it starts out with the standard paused
+    score as that's what the pause sets.
+
+    \param jobpath Name of the job
+    \param when Time that it was paused
+*/
+void OomPolicy::paused(const std::string& jobpath, std::chrono::steady_clock::time_point when)
+{
+    paused_[jobpath] = Entry{when, static_cast<std::int32_t>(oom::paused())};
+}
+
+/** Remove a job that's no longer paused */
+void OomPolicy::resumed(const std::string& jobpath)
+{
+    paused_.erase(jobpath);
+}
+
+/** Whether there are any paused jobs to grade */
+bool OomPolicy::empty() const
+{
+    return paused_.empty();
+}
+
+/** The current pressure level */
+OomPolicy::Level OomPolicy::level() const
+{
+    return level_;
+}
+
+/** Figure out the pressure level taking into account where we are now */
+OomPolicy::Level OomPolicy::levelFor(const Pressure& pressure) const
+{
+    bool critical = pressure.some10 >= CRITICAL_ENTER_SOME || pressure.full10 >= CRITICAL_ENTER_FULL;
+    bool moderate = pressure.some10 >= MODERATE_ENTER_SOME;
+
+    switch (level_)
+    {
+        case Level::CRITICAL:
+            if (pressure.some10 >= CRITICAL_LEAVE_SOME || pressure.full10 >= CRITICAL_LEAVE_FULL)
+                return Level::CRITICAL;
+            return pressure.some10 >= MODERATE_LEAVE_SOME ? Level::MODERATE : Level::NONE;
+        case Level::MODERATE:
+            if (critical)
+                return Level::CRITICAL;
+            return pressure.some10 >= MODERATE_LEAVE_SOME ? Level::MODERATE : Level::NONE;
+        case Level::NONE:
+        default:
+            if (critical)
+                return Level::CRITICAL;
+            return moderate ? Level::MODERATE : Level::NONE;
+    }
+}
+
+/** Recompute the scores of all the paused jobs. Returns only the jobs
+    whose score has changed since the last update so that the caller can
+    write them all out in one batch.
+
+    \param pressure Current memory pressure
+    \param footprints Memory used by each of the paused jobs
+*/
+std::map<std::string, std::int32_t> OomPolicy::update(const Pressure& pressure,
+                                                      const std::map<std::string, std::uint64_t>& footprints)
+{
+    level_ = levelFor(pressure);
+
+    std::int32_t spread = 0;
+    switch (level_)
+    {
+        case Level::CRITICAL:
+            spread = CRITICAL_SPREAD;
+            break;
+        case Level::MODERATE:
+            spread = MODERATE_SPREAD;
+            break;
+        case Level::NONE:
+            spread = 0;
+            break;
+    }
+
+    std::vector<std::string> jobs;
+    for (const auto& entry : paused_)
+    {
+        jobs.push_back(entry.first);
+    }
+
+    auto footprint = [&footprints](const std::string& job) -> std::uint64_t {
+        auto found = footprints.find(job);
+        return found == footprints.end() ? 0 : found->second;
+    };
+
+    /* Rank by how long ago the job was paused and by how big it is, the
+       best candidates to kill are first in each list */
+    std::vector<std::string> byAge(jobs);
+    std::stable_sort(byAge.begin(), byAge.end(), [this](const std::string& a, const std::string& b) {
+        return paused_[a].pausedAt < paused_[b].pausedAt;
+    });
+    std::vector<std::string> bySize(jobs);
+    std::stable_sort(bySize.begin(), bySize.end(), [&footprint](const std::string& a, const std::string& b) {
+        return footprint(a) > footprint(b);
+    });
+
+    std::map<std::string, std::size_t> rank;
+    for (std::size_t i = 0; i < jobs.size(); i++)
+    {
+        rank[byAge[i]] += i;
+        rank[bySize[i]] += i;
+    }
+
+    /* Ties go to the job name so that we're deterministic */
+    std::stable_sort(jobs.begin(), jobs.end(),
+                     [&rank](const std::string& a, const std::string& b) { return rank[a] < rank[b]; });
+
+    std::map<std::string, std::int32_t> changes;
+    auto base = static_cast<std::int32_t>(oom::paused());
+    auto count = static_cast<std::int32_t>(jobs.size());
+
+    for (std::int32_t i = 0; i < count; i++)
+    {
+        auto score = base + (spread * (count - i)) / count;
+        auto& entry = paused_[jobs[i]];
+
+        if (entry.applied != score)
+        {
+            entry.applied = score;
+            changes[jobs[i]] = score;
+        }
+    }
+
+    return changes;
+}
+
+/** Parse the contents of /proc/pressure/memory. Lines look like:
+
+    some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+
+    \param psi Contents of the file
+*/
+OomPolicy::Pressure OomPolicy::parsePressure(const std::string& psi)
+{
+    Pressure pressure{0.0, 0.0};
+
+    std::istringstream lines(psi);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        double avg10 = 0.0;
+        if (std::sscanf(line.c_str(), "some avg10=%lf", &avg10) == 1)
+        {
+            pressure.some10 = avg10;
+        }
+        else if (std::sscanf(line.c_str(), "full avg10=%lf", &avg10) == 1)
+        {
+            pressure.full10 = avg10;
+        }
+    }
+
+    return pressure;
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
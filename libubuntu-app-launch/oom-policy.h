@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Grades the OOM scores of paused applications based on memory
+           pressure
+
+    Normally every paused application gets the same score, which leaves
+    the kernel to pick between them on size alone. When the system is
+    under memory pressure this spreads the paused applications out above
+    the paused score so that the ones that were used longest ago, and the
+    ones using the most memory, get killed first.
+
+    This object only has the logic, it doesn't read any files or write
+    any scores. That way it can be driven by recorded pressure traces.
+*/
+class OomPolicy
+{
+public:
+    /** Memory pressure as reported by the kernel in /proc/pressure/memory,
+        the values are the ten second averages as a percentage */
+    struct Pressure
+    {
+        double some10; /**< Time some tasks were stalled on memory */
+        double full10; /**< Time all tasks were stalled on memory */
+    };
+
+    /** How much pressure we think the system is under */
+    enum class Level
+    {
+        NONE,     /**< Everyone gets the standard paused score */
+        MODERATE, /**< Paused apps are spread a bit */
+        CRITICAL  /**< Paused apps are spread over the whole range */
+    };
+
+    OomPolicy();
+    virtual ~OomPolicy() = default;
+
+    void paused(const std::string& jobpath, std::chrono::steady_clock::time_point when);
+    void resumed(const std::string& jobpath);
+    bool empty() const;
+    Level level() const;
+
+    std::map<std::string, std::int32_t> update(const Pressure& pressure,
+                                               const std::map<std::string, std::uint64_t>& footprints);
+
+    static Pressure parsePressure(const std::string& psi);
+
+private:
+    /** A paused job and the last score that it was given */
+    struct Entry
+    {
+        std::chrono::steady_clock::time_point pausedAt;
+        std::int32_t applied;
+    };
+
+    /** All the paused jobs, by job path */
+    std::map<std::string, Entry> paused_;
+    /** Current pressure level, kept for the hysteresis */
+    Level level_;
+
+    Level levelFor(const Pressure& pressure) const;
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
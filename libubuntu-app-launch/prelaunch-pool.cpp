@@ -0,0 +1,227 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "prelaunch-pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <glib.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Largest pool we allow, a parked job holds on to all of its memory */
+static const unsigned int MAX_POOL_SIZE = 8;
+
+/** Build an empty pool
+
+    \param size Number of parked jobs to allow for each job type
+*/
+PrelaunchPool::PrelaunchPool(unsigned int size)
+    : size_(std::min(size, MAX_POOL_SIZE))
+    , stats_({0, 0, 0, 0})
+{
+}
+
+/** Number of parked jobs allowed for each job type, zero means
+    prelaunching is off */
+unsigned int PrelaunchPool::size() const
+{
+    return size_;
+}
+
+/** Change the size of the pool, returns the entries that no longer
+    fit which need to be stopped
+
+    \param size Number of parked jobs to allow for each job type
+*/
+std::list<PrelaunchPool::Entry> PrelaunchPool::setSize(unsigned int size)
+{
+    size_ = std::min(size, MAX_POOL_SIZE);
+
+    std::list<Entry> evicted;
+    std::list<std::string> jobs;
+    for (const auto& entry : entries_)
+    {
+        if (std::find(jobs.begin(), jobs.end(), entry.job) == jobs.end())
+        {
+            jobs.push_back(entry.job);
+        }
+    }
+
+    for (const auto& job : jobs)
+    {
+        evicted.splice(evicted.end(), trim(job));
+    }
+
+    return evicted;
+}
+
+/** Whether there is a parked job for the application */
+bool PrelaunchPool::contains(const std::string& appid) const
+{
+    return std::any_of(entries_.begin(), entries_.end(),
+                       [&appid](const Entry& entry) { return entry.appid == appid; });
+}
+
+/** Whether an Upstart instance is one of the parked jobs
+
+    \param job Upstart job
+    \param name Instance name as Upstart reports it
+*/
+bool PrelaunchPool::parked(const std::string& job, const std::string& name) const
+{
+    return std::any_of(entries_.begin(), entries_.end(),
+                       [&job, &name](const Entry& entry) { return matches(entry, job, name); });
+}
+
+/** A job stopped, if it was parked it can't be used any more so its
+    entry is dropped. Returns whether there was one.
+
+    \param job Upstart job name
+    \param name Upstart instance name
+*/
+bool PrelaunchPool::stopped(const std::string& job, const std::string& name)
+{
+    auto size = entries_.size();
+    entries_.remove_if([&job, &name](const Entry& entry) { return matches(entry, job, name); });
+    return entries_.size() != size;
+}
+
+/** Whether an Upstart instance is the parked job of an entry. Click
+    jobs are named after the application, the others add the instance
+    ID even when it is empty.
+
+    \param entry Parked job
+    \param job Upstart job name
+    \param name Upstart instance name
+*/
+bool PrelaunchPool::matches(const Entry& entry, const std::string& job, const std::string& name)
+{
+    return entry.job == job && (name == entry.appid || name == entry.appid + "-" + entry.instance);
+}
+
+/** Add a parked job, returns the entries that were evicted to make
+    room for it which need to be stopped
+
+    \param entry The job that was started
+*/
+std::list<PrelaunchPool::Entry> PrelaunchPool::add(Entry&& entry)
+{
+    auto job = entry.job;
+    entries_.emplace_back(std::move(entry));
+    stats_.prelaunched++;
+    return trim(job);
+}
+
+/** Take the parked job for an application out of the pool so that it
+    can be launched.
+
+    \param appid Application ID to look for
+    \param entry Filled in with the parked job
+*/
+bool PrelaunchPool::take(const std::string& appid, Entry& entry)
+{
+    auto it = std::find_if(entries_.begin(), entries_.end(),
+                           [&appid](const Entry& entry) { return entry.appid == appid; });
+    if (it == entries_.end())
+    {
+        return false;
+    }
+
+    entry = *it;
+    entries_.erase(it);
+    return true;
+}
+
+/** Drop the entry for an application without counting it, used when the
+    job went away on its own or couldn't be used */
+void PrelaunchPool::remove(const std::string& appid)
+{
+    entries_.remove_if([&appid](const Entry& entry) { return entry.appid == appid; });
+}
+
+/** A launch that used a parked job */
+void PrelaunchPool::countHit()
+{
+    stats_.hits++;
+}
+
+/** A launch that couldn't use the pool */
+void PrelaunchPool::countMiss()
+{
+    stats_.misses++;
+}
+
+/** Get the counters */
+PrelaunchPool::Stats PrelaunchPool::stats() const
+{
+    return stats_;
+}
+
+/** The default size comes from UBUNTU_APP_LAUNCH_PRELAUNCH_POOL, off
+    when it isn't set */
+unsigned int PrelaunchPool::sizeFromEnv()
+{
+    auto envsize = g_getenv("UBUNTU_APP_LAUNCH_PRELAUNCH_POOL");
+    if (envsize == nullptr)
+    {
+        return 0;
+    }
+
+    auto size = std::atoi(envsize);
+    if (size < 0)
+    {
+        g_warning("Invalid prelaunch pool size '%s'", envsize);
+        return 0;
+    }
+
+    return std::min(static_cast<unsigned int>(size), MAX_POOL_SIZE);
+}
+
+/** Evict the oldest entries of a job type until it fits */
+std::list<PrelaunchPool::Entry> PrelaunchPool::trim(const std::string& job)
+{
+    std::list<Entry> evicted;
+
+    auto count = std::count_if(entries_.begin(), entries_.end(), [&job](const Entry& entry) { return entry.job == job; });
+
+    for (auto it = entries_.begin(); it != entries_.end() && count > size_;)
+    {
+        if (it->job != job)
+        {
+            it++;
+            continue;
+        }
+
+        auto next = std::next(it);
+        evicted.splice(evicted.end(), entries_, it);
+        it = next;
+        count--;
+        stats_.evicted++;
+    }
+
+    return evicted;
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
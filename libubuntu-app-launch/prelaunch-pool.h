@@ -0,0 +1,99 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <string>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Book keeping for the applications that have been prelaunched
+
+    A prelaunched application has had its Upstart job started with
+    APP_PRELAUNCH set, so the job has been forked, confined and has its
+    environment built, but exec-line-exec is parked waiting for a signal
+    before it execs the application. Launching it then only needs that
+    signal.
+
+    Each job type gets its own pool, when a pool is full the oldest entry
+    is evicted to make room. This object only tracks the entries and the
+    counters, the registry starts and stops the jobs.
+*/
+class PrelaunchPool
+{
+public:
+    /** A parked job */
+    struct Entry
+    {
+        std::string appid;    /**< Application ID */
+        std::string job;      /**< Upstart job */
+        std::string instance; /**< Instance ID, empty for click */
+        std::chrono::steady_clock::time_point parkedAt;
+    };
+
+    /** Counters for how well the pool is doing */
+    struct Stats
+    {
+        std::uint64_t prelaunched; /**< Jobs that were parked */
+        std::uint64_t hits;        /**< Launches that used a parked job */
+        std::uint64_t misses;      /**< Launches that had to start from scratch */
+        std::uint64_t evicted;     /**< Parked jobs that were stopped without being used */
+    };
+
+    explicit PrelaunchPool(unsigned int size);
+    virtual ~PrelaunchPool() = default;
+
+    unsigned int size() const;
+    std::list<Entry> setSize(unsigned int size);
+
+    bool contains(const std::string& appid) const;
+    bool parked(const std::string& job, const std::string& name) const;
+    bool stopped(const std::string& job, const std::string& name);
+    std::list<Entry> add(Entry&& entry);
+    bool take(const std::string& appid, Entry& entry);
+    void remove(const std::string& appid);
+
+    void countHit();
+    void countMiss();
+    Stats stats() const;
+
+    static unsigned int sizeFromEnv();
+
+private:
+    /** Maximum number of parked jobs for each job type */
+    unsigned int size_;
+    /** Parked jobs, oldest first */
+    std::list<Entry> entries_;
+    /** Counters */
+    Stats stats_;
+
+    std::list<Entry> trim(const std::string& job);
+
+    static bool matches(const Entry& entry, const std::string& job, const std::string& name);
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,135 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "priority-control.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/* Values for each class. The foreground ones are the kernel defaults so
+   that going back to foreground undoes everything. */
+static const int CPU_WEIGHT_FOREGROUND = 100; /* cpu.weight, 1 - 10000 */
+static const int CPU_WEIGHT_BACKGROUND = 10;
+static const int CPU_SHARES_FOREGROUND = 1024; /* cpu.shares */
+static const int CPU_SHARES_BACKGROUND = 128;
+static const int IO_WEIGHT_FOREGROUND = 100; /* io.weight, 1 - 10000 */
+static const int IO_WEIGHT_BACKGROUND = 10;
+static const int BLKIO_WEIGHT_FOREGROUND = 500; /* blkio.weight, 10 - 1000 */
+static const int BLKIO_WEIGHT_BACKGROUND = 100;
+static const int NICE_FOREGROUND = 0;
+static const int NICE_BACKGROUND = 10;
+
+/* From linux/ioprio.h which isn't exported to userspace */
+static const int IOPRIO_CLASS_SHIFT = 13;
+static const int IOPRIO_CLASS_BE = 2;
+static const int IOPRIO_WHO_PROCESS = 1;
+static const int IOPRIO_LEVEL_FOREGROUND = 4;
+static const int IOPRIO_LEVEL_BACKGROUND = 7;
+
+/** Write a value to a cgroup file */
+static bool writeValue(const std::string& path, const std::string& value)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    bool success = fwrite(value.c_str(), 1, value.size(), file) == value.size();
+    /* cgroup files report their errors on the flush */
+    success = (fclose(file) == 0) && success;
+    return success;
+}
+
+/** Set the weights on the cgroups of a job. The CPU weight is required
+    for this to succeed, the I/O weight depends on the I/O scheduler
+    supporting it so we don't worry if we can't set it.
+
+    \param cpupath Directory of the job in the CPU controller
+    \param iopath Directory of the job in the I/O controller
+    \param unified Whether the controllers are on the unified hierarchy
+    \param schedClass Class to put the job in
+*/
+bool PriorityControl::applyToCGroup(const std::string& cpupath,
+                                    const std::string& iopath,
+                                    bool unified,
+                                    SchedulingClass schedClass)
+{
+    bool foreground = schedClass == SchedulingClass::FOREGROUND;
+
+    bool cpuset = false;
+    if (unified)
+    {
+        cpuset = writeValue(cpupath + "/cpu.weight",
+                            std::to_string(foreground ? CPU_WEIGHT_FOREGROUND : CPU_WEIGHT_BACKGROUND));
+        writeValue(iopath + "/io.weight",
+                   "default " + std::to_string(foreground ? IO_WEIGHT_FOREGROUND : IO_WEIGHT_BACKGROUND));
+    }
+    else
+    {
+        cpuset = writeValue(cpupath + "/cpu.shares",
+                            std::to_string(foreground ? CPU_SHARES_FOREGROUND : CPU_SHARES_BACKGROUND));
+        writeValue(iopath + "/blkio.weight",
+                   std::to_string(foreground ? BLKIO_WEIGHT_FOREGROUND : BLKIO_WEIGHT_BACKGROUND));
+    }
+
+    if (!cpuset)
+    {
+        g_debug("Unable to set CPU weight on '%s': %s", cpupath.c_str(), std::strerror(errno));
+    }
+
+    return cpuset;
+}
+
+/** Set the nice value and the I/O priority of a single process
+
+    \param pid Process to change
+    \param schedClass Class to put the process in
+*/
+void PriorityControl::applyToPid(pid_t pid, SchedulingClass schedClass)
+{
+    bool foreground = schedClass == SchedulingClass::FOREGROUND;
+
+    if (setpriority(PRIO_PROCESS, pid, foreground ? NICE_FOREGROUND : NICE_BACKGROUND) != 0)
+    {
+        g_debug("Unable to set nice value of PID %d: %s", pid, std::strerror(errno));
+    }
+
+    int ioprio =
+        (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | (foreground ? IOPRIO_LEVEL_FOREGROUND : IOPRIO_LEVEL_BACKGROUND);
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, ioprio) != 0)
+    {
+        g_debug("Unable to set I/O priority of PID %d: %s", pid, std::strerror(errno));
+    }
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,52 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#pragma once
+
+#include "application.h"
+#include <string>
+#include <sys/types.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Sets the CPU and I/O priorities for a scheduling class
+
+    The preferred way is to set the weights on the job's cgroups as that
+    covers all the processes, including ones that haven't been created
+    yet, and can be changed in both directions. When that isn't possible
+    we set the nice value and I/O priority on each process instead.
+*/
+class PriorityControl
+{
+public:
+    using SchedulingClass = Application::Instance::SchedulingClass;
+
+    static bool applyToCGroup(const std::string& cpupath,
+                              const std::string& iopath,
+                              bool unified,
+                              SchedulingClass schedClass);
+    static void applyToPid(pid_t pid, SchedulingClass schedClass);
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
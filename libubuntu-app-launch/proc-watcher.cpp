@@ -0,0 +1,369 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "proc-watcher.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <glib-unix.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Opens the netlink socket and asks the kernel to start sending
+    us process events. Throws if any of that fails, which is the
+    common case for processes without CAP_NET_ADMIN. */
+ProcWatcher::ProcWatcher()
+    : ProcWatcher(openConnector())
+{
+    g_debug("Process event connector setup");
+}
+
+/** Watch a socket that is already setup, the events on it are read
+    just like the ones from the connector. Takes ownership of the socket.
+
+    \param fd Non-blocking datagram socket
+*/
+ProcWatcher::ProcWatcher(int fd)
+    : fd_(fd)
+{
+    /* NOTE: We're building this on the registry thread so we grab its context */
+    source_ = std::shared_ptr<GSource>(g_unix_fd_source_new(fd_, G_IO_IN), [](GSource* source) {
+        g_source_destroy(source);
+        g_source_unref(source);
+    });
+    g_source_set_callback(source_.get(),
+                          reinterpret_cast<GSourceFunc>(
+                              +[](gint fd, GIOCondition condition, gpointer user_data) -> gboolean {
+                                  static_cast<ProcWatcher*>(user_data)->readEvents();
+                                  return G_SOURCE_CONTINUE;
+                              }),
+                          this, nullptr);
+    g_source_attach(source_.get(), g_main_context_get_thread_default());
+}
+
+/** Open the netlink socket and subscribe to the process events */
+int ProcWatcher::openConnector()
+{
+    int fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (fd < 0)
+    {
+        throw std::runtime_error(std::string{"Unable to create connector socket: "} + std::strerror(errno));
+    }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    addr.nl_pid = 0; /* Let the kernel pick */
+
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        int binderr = errno;
+        close(fd);
+        throw std::runtime_error(std::string{"Unable to bind connector socket: "} + std::strerror(binderr));
+    }
+
+    /* Build up the subscribe message */
+    char buffer[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+    memset(buffer, 0, sizeof(buffer));
+
+    auto nlhdr = reinterpret_cast<struct nlmsghdr*>(buffer);
+    nlhdr->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+    nlhdr->nlmsg_type = NLMSG_DONE;
+    nlhdr->nlmsg_pid = 0;
+
+    auto cnmsg = static_cast<struct cn_msg*>(NLMSG_DATA(nlhdr));
+    cnmsg->id.idx = CN_IDX_PROC;
+    cnmsg->id.val = CN_VAL_PROC;
+    cnmsg->len = sizeof(enum proc_cn_mcast_op);
+
+    enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+    memcpy(cnmsg->data, &op, sizeof(op));
+
+    if (send(fd, nlhdr, nlhdr->nlmsg_len, 0) < 0)
+    {
+        int senderr = errno;
+        close(fd);
+        throw std::runtime_error(std::string{"Unable to subscribe to process events: "} + std::strerror(senderr));
+    }
+
+    return fd;
+}
+
+ProcWatcher::~ProcWatcher()
+{
+    source_.reset();
+
+    if (fd_ >= 0)
+    {
+        close(fd_);
+    }
+}
+
+/** Start tracking a job, or update a handler on one that we're
+    already tracking. Returns the current PIDs for the job.
+
+    \param jobpath The cgroup name of the job
+    \param seed Function to get the PIDs from the cgroup if we're not
+                tracking the job yet
+    \param kind What the handler is for, the handlers of other kinds
+                are kept
+    \param onFork Handler to run on every new child of the job, it is
+                  retained until it is replaced by the next call of the
+                  same kind
+*/
+std::vector<pid_t> ProcWatcher::track(const std::string& jobpath,
+                                      std::function<std::vector<pid_t>()> seed,
+                                      Handler kind,
+                                      std::function<void(pid_t)> onFork)
+{
+    /* Make sure that we've got anything that was queued up before
+       we look at the set, or seed it */
+    readEvents();
+
+    auto setit = sets_.find(jobpath);
+    if (setit == sets_.end())
+    {
+        /* The socket is already listening, so anything that forks after
+           the cgroup gets read will show up as an event */
+        PidSet set;
+        for (auto pid : seed())
+        {
+            set.pids.insert(pid);
+            owners_[pid] = jobpath;
+        }
+
+        if (set.pids.empty())
+        {
+            /* Nothing to track, probably not running */
+            return {};
+        }
+
+        g_debug("Tracking %d PIDs for job '%s'", int(set.pids.size()), jobpath.c_str());
+        setit = sets_.emplace(jobpath, std::move(set)).first;
+    }
+
+    setit->second.onFork[kind] = onFork;
+
+    return std::vector<pid_t>(setit->second.pids.begin(), setit->second.pids.end());
+}
+
+/** Drop one of the handlers of a job, leaving the others
+
+    \param jobpath The cgroup name of the job
+    \param kind Handler to drop
+*/
+void ProcWatcher::clearHandler(const std::string& jobpath, Handler kind)
+{
+    auto setit = sets_.find(jobpath);
+    if (setit != sets_.end())
+    {
+        setit->second.onFork.erase(kind);
+    }
+}
+
+/** Check to see if we've got a set of PIDs for the job */
+bool ProcWatcher::isTracking(const std::string& jobpath)
+{
+    readEvents();
+    return sets_.find(jobpath) != sets_.end();
+}
+
+/** Stop tracking a job, dropping its PIDs and the handler for its
+    new children. Called when the job stops, as the exits of its last
+    processes may not all have been seen.
+
+    \param jobpath The cgroup name of the job
+*/
+void ProcWatcher::untrack(const std::string& jobpath)
+{
+    auto setit = sets_.find(jobpath);
+    if (setit == sets_.end())
+    {
+        return;
+    }
+
+    for (auto pid : setit->second.pids)
+    {
+        auto ownerit = owners_.find(pid);
+        if (ownerit != owners_.end() && ownerit->second == jobpath)
+        {
+            owners_.erase(ownerit);
+        }
+    }
+
+    g_debug("Job '%s' stopped, no longer tracking", jobpath.c_str());
+    sets_.erase(setit);
+}
+
+/** Get the current snapshot of PIDs for a job, empty if we
+    aren't tracking it. */
+std::vector<pid_t> ProcWatcher::pids(const std::string& jobpath)
+{
+    readEvents();
+
+    auto setit = sets_.find(jobpath);
+    if (setit == sets_.end())
+    {
+        return {};
+    }
+
+    return std::vector<pid_t>(setit->second.pids.begin(), setit->second.pids.end());
+}
+
+/** Drain the socket, processing all the events that are pending */
+void ProcWatcher::readEvents()
+{
+    /* Event messages are small, this gets a bunch of them per read */
+    char buffer[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+    while (true)
+    {
+        auto len = recv(fd_, buffer, sizeof(buffer), 0);
+        if (len < 0)
+        {
+            if (errno == ENOBUFS)
+            {
+                /* We've lost events, so we can't trust any of our sets.
+                   They'll get reseeded from the cgroup on next use. */
+                g_warning("Process event connector overflowed, resetting PID tracking");
+                dropAll();
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                g_warning("Unable to read process events: %s", std::strerror(errno));
+            }
+            return;
+        }
+
+        for (auto nlhdr = reinterpret_cast<struct nlmsghdr*>(buffer); NLMSG_OK(nlhdr, len);
+             nlhdr = NLMSG_NEXT(nlhdr, len))
+        {
+            if (nlhdr->nlmsg_type == NLMSG_ERROR || nlhdr->nlmsg_type == NLMSG_NOOP)
+            {
+                continue;
+            }
+
+            auto cnmsg = static_cast<struct cn_msg*>(NLMSG_DATA(nlhdr));
+            if (cnmsg->id.idx != CN_IDX_PROC || cnmsg->id.val != CN_VAL_PROC)
+            {
+                continue;
+            }
+
+            auto event = reinterpret_cast<struct proc_event*>(cnmsg->data);
+            switch (event->what)
+            {
+                case proc_event::PROC_EVENT_FORK:
+                    /* Threads share the PID set of their process */
+                    if (event->event_data.fork.child_pid == event->event_data.fork.child_tgid)
+                    {
+                        processFork(event->event_data.fork.parent_tgid, event->event_data.fork.child_tgid);
+                    }
+                    break;
+                case proc_event::PROC_EVENT_EXIT:
+                    if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid)
+                    {
+                        processExit(event->event_data.exit.process_tgid);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+/** Handle a new process being created. If its parent is in one of
+    our sets, add it and run the handler on it. */
+void ProcWatcher::processFork(pid_t parent, pid_t child)
+{
+    auto ownerit = owners_.find(parent);
+    if (ownerit == owners_.end())
+    {
+        return;
+    }
+
+    auto jobpath = ownerit->second;
+    auto& set = sets_[jobpath];
+    if (!set.pids.insert(child).second)
+    {
+        return;
+    }
+    owners_[child] = jobpath;
+
+    g_debug("New PID %d in job '%s' from parent %d", int(child), jobpath.c_str(), int(parent));
+
+    /* Copied as a handler could end up changing them */
+    auto handlers = set.onFork;
+    for (const auto& handler : handlers)
+    {
+        if (handler.second)
+        {
+            handler.second(child);
+        }
+    }
+}
+
+/** Remove a process that has exited from its set, dropping the
+    set if it is the last one. */
+void ProcWatcher::processExit(pid_t pid)
+{
+    auto ownerit = owners_.find(pid);
+    if (ownerit == owners_.end())
+    {
+        return;
+    }
+
+    auto setit = sets_.find(ownerit->second);
+    owners_.erase(ownerit);
+
+    if (setit == sets_.end())
+    {
+        return;
+    }
+
+    setit->second.pids.erase(pid);
+    if (setit->second.pids.empty())
+    {
+        g_debug("No more PIDs in job '%s', no longer tracking", setit->first.c_str());
+        sets_.erase(setit);
+    }
+}
+
+/** Forget everything we know */
+void ProcWatcher::dropAll()
+{
+    sets_.clear();
+    owners_.clear();
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
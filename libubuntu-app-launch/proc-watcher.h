@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+#include <sys/types.h>
+
+#pragma once
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Tracks the PIDs of application jobs using the kernel's process
+           events connector
+
+    Getting the PIDs from the cgroup is an IPC call to CGManager and is racy
+    with the application forking. The watcher gets seeded once from the cgroup
+    and then follows fork and exit events so that we always have a current
+    snapshot. Each tracked set can have handlers that are run on new children
+    so that they get the same treatment as their parents.
+
+    The connector requires CAP_NET_ADMIN so the constructor will throw if the
+    socket can't be setup, the caller should fall back to the cgroup.
+
+    All functions must be called on the registry thread, which is also where
+    the events are processed.
+*/
+class ProcWatcher
+{
+public:
+    /** What a handler for new children is for. A job has at most one
+        of each, a new one replaces the old one of the same kind, and
+        they are run in this order. */
+    enum class Handler
+    {
+        LIFECYCLE,  /**< Pausing or resuming */
+        OOM,        /**< Setting the OOM score */
+        SCHEDULING, /**< Setting the scheduling class */
+    };
+
+    ProcWatcher();
+    explicit ProcWatcher(int fd);
+    virtual ~ProcWatcher();
+
+    std::vector<pid_t> track(const std::string& jobpath,
+                             std::function<std::vector<pid_t>()> seed,
+                             Handler kind,
+                             std::function<void(pid_t)> onFork);
+    void clearHandler(const std::string& jobpath, Handler kind);
+    void untrack(const std::string& jobpath);
+    bool isTracking(const std::string& jobpath);
+    std::vector<pid_t> pids(const std::string& jobpath);
+
+private:
+    /** The PIDs for a single job along with what should happen to
+        new children of them */
+    struct PidSet
+    {
+        std::set<pid_t> pids;
+        std::map<Handler, std::function<void(pid_t)>> onFork;
+    };
+
+    /** Netlink socket for the connector */
+    int fd_;
+    /** Source on the registry thread watching the socket */
+    std::shared_ptr<GSource> source_;
+    /** PID sets indexed by the job path of the cgroup */
+    std::map<std::string, PidSet> sets_;
+    /** Reverse index to find which set a PID belongs to */
+    std::map<pid_t, std::string> owners_;
+
+    static int openConnector();
+    void readEvents();
+    void processFork(pid_t parent, pid_t child);
+    void processExit(pid_t pid);
+    void dropAll();
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,334 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "readahead-recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <glib.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Don't look at more files than this, big apps rarely touch them all */
+static const unsigned int MAX_FILES = 4096;
+/** Longest window we'll wait before recording */
+static const std::chrono::seconds MAX_WINDOW{60};
+/** Lists older than this get recorded again */
+static const std::chrono::hours MAX_AGE{24 * 7};
+/** First line of the list files, lets us change the format later */
+static const char* LIST_HEADER = "# ubuntu-app-launch readahead 1";
+
+/** Build a recorder
+
+    \param cacheDir Directory to store the lists in
+    \param window How long after a launch to record, zero means off
+*/
+ReadaheadRecorder::ReadaheadRecorder(const std::string& cacheDir, std::chrono::seconds window)
+    : cacheDir_(cacheDir)
+    , window_(std::min(window, MAX_WINDOW))
+{
+}
+
+/** How long after the launch to record, zero means readahead is off */
+std::chrono::seconds ReadaheadRecorder::window() const
+{
+    return window_;
+}
+
+/** Path of the list for an application */
+std::string ReadaheadRecorder::listPath(const std::string& appid) const
+{
+    auto path = g_build_filename(cacheDir_.c_str(), appid.c_str(), nullptr);
+    std::string retval{path};
+    g_free(path);
+    return retval;
+}
+
+/** Whether this version of the application has been recorded
+
+    \param appid Application ID, including the version
+*/
+bool ReadaheadRecorder::hasList(const std::string& appid) const
+{
+    return g_file_test(listPath(appid).c_str(), G_FILE_TEST_EXISTS);
+}
+
+/** Whether the application should be recorded on this launch, because
+    there isn't a list, the list is more than a week old or the
+    application directory has changed since it was recorded.
+
+    \param appid Application ID, including the version
+    \param appdir Directory with the application's files
+*/
+bool ReadaheadRecorder::needsRecording(const std::string& appid, const std::string& appdir) const
+{
+    struct stat list;
+    if (stat(listPath(appid).c_str(), &list) != 0)
+    {
+        return true;
+    }
+
+    auto recorded = std::chrono::system_clock::from_time_t(list.st_mtime);
+    if (std::chrono::system_clock::now() - recorded > MAX_AGE)
+    {
+        return true;
+    }
+
+    struct stat dir;
+    return stat(appdir.c_str(), &dir) == 0 && dir.st_mtime > list.st_mtime;
+}
+
+/** Look at which pages of the files under the application directory are
+    in the page cache and save them as the list for the application.
+
+    \param appid Application ID, including the version
+    \param appdir Directory with the application's files
+*/
+ReadaheadRecorder::Totals ReadaheadRecorder::record(const std::string& appid, const std::string& appdir)
+{
+    Totals totals{0, 0};
+    std::ostringstream list;
+    list << LIST_HEADER << std::endl;
+
+    auto pagesize = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+    unsigned int seen = 0;
+
+    std::function<void(const std::string&)> walk = [&](const std::string& dir) {
+        GDir* gdir = g_dir_open(dir.c_str(), 0, nullptr);
+        if (gdir == nullptr)
+        {
+            return;
+        }
+
+        const gchar* name;
+        while ((name = g_dir_read_name(gdir)) != nullptr && seen < MAX_FILES)
+        {
+            std::string path = dir + "/" + name;
+
+            struct stat info;
+            if (lstat(path.c_str(), &info) != 0)
+            {
+                continue;
+            }
+
+            /* Symlinks are skipped so we don't loop or leave the directory */
+            if (S_ISDIR(info.st_mode))
+            {
+                walk(path);
+                continue;
+            }
+
+            if (!S_ISREG(info.st_mode) || info.st_size == 0 || path.find_first_of("\t\n") != std::string::npos)
+            {
+                continue;
+            }
+
+            seen++;
+
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                continue;
+            }
+
+            auto size = static_cast<std::uint64_t>(info.st_size);
+            void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+
+            if (map == MAP_FAILED)
+            {
+                continue;
+            }
+
+            std::vector<unsigned char> pages((size + pagesize - 1) / pagesize);
+            if (mincore(map, size, pages.data()) != 0)
+            {
+                g_debug("Unable to check page cache for '%s': %s", path.c_str(), std::strerror(errno));
+                munmap(map, size);
+                continue;
+            }
+            munmap(map, size);
+
+            /* Turn the runs of resident pages into extents */
+            std::ostringstream extents;
+            std::uint64_t filebytes = 0;
+            for (std::size_t i = 0; i < pages.size();)
+            {
+                if ((pages[i] & 1) == 0)
+                {
+                    i++;
+                    continue;
+                }
+
+                auto start = i;
+                while (i < pages.size() && (pages[i] & 1) != 0)
+                {
+                    i++;
+                }
+
+                auto offset = start * pagesize;
+                auto length = std::min(size, i * pagesize) - offset;
+                extents << " " << offset << ":" << length;
+                filebytes += length;
+            }
+
+            if (filebytes > 0)
+            {
+                list << path << "\t" << extents.str().substr(1) << std::endl;
+                totals.files++;
+                totals.bytes += filebytes;
+            }
+        }
+
+        g_dir_close(gdir);
+    };
+
+    walk(appdir);
+
+    if (g_mkdir_with_parents(cacheDir_.c_str(), 0700) != 0)
+    {
+        g_warning("Unable to create readahead directory '%s': %s", cacheDir_.c_str(), std::strerror(errno));
+        return Totals{0, 0};
+    }
+
+    GError* error = nullptr;
+    auto contents = list.str();
+    if (!g_file_set_contents(listPath(appid).c_str(), contents.c_str(), contents.size(), &error))
+    {
+        g_warning("Unable to save readahead list for '%s': %s", appid.c_str(), error->message);
+        g_error_free(error);
+        return Totals{0, 0};
+    }
+
+    g_debug("Recorded readahead for '%s': %u files, %llu bytes", appid.c_str(), totals.files,
+            static_cast<unsigned long long>(totals.bytes));
+
+    return totals;
+}
+
+/** Ask the kernel to read in everything on the application's list. This
+    only queues the reads, so it returns before they finish.
+
+    \param appid Application ID, including the version
+*/
+ReadaheadRecorder::Totals ReadaheadRecorder::replay(const std::string& appid)
+{
+    Totals totals{0, 0};
+
+    gchar* contents = nullptr;
+    if (!g_file_get_contents(listPath(appid).c_str(), &contents, nullptr, nullptr))
+    {
+        return totals;
+    }
+
+    std::istringstream list{contents};
+    g_free(contents);
+
+    std::string line;
+    if (!std::getline(list, line) || line != LIST_HEADER)
+    {
+        g_warning("Readahead list for '%s' is in an unknown format", appid.c_str());
+        return totals;
+    }
+
+    while (std::getline(list, line))
+    {
+        auto tab = line.find('\t');
+        if (tab == std::string::npos)
+        {
+            continue;
+        }
+
+        auto path = line.substr(0, tab);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        std::istringstream extents{line.substr(tab + 1)};
+        std::string extent;
+        while (extents >> extent)
+        {
+            auto colon = extent.find(':');
+            if (colon == std::string::npos)
+            {
+                continue;
+            }
+
+            auto offset = std::strtoull(extent.c_str(), nullptr, 10);
+            auto length = std::strtoull(extent.c_str() + colon + 1, nullptr, 10);
+            if (posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED) == 0)
+            {
+                totals.bytes += length;
+            }
+        }
+
+        close(fd);
+        totals.files++;
+    }
+
+    return totals;
+}
+
+/** Lists go in the user's cache directory */
+std::string ReadaheadRecorder::defaultCacheDir()
+{
+    auto path = g_build_filename(g_get_user_cache_dir(), "ubuntu-app-launch", "readahead", nullptr);
+    std::string retval{path};
+    g_free(path);
+    return retval;
+}
+
+/** The window comes from UBUNTU_APP_LAUNCH_READAHEAD in seconds, when it
+    isn't set readahead is off */
+std::chrono::seconds ReadaheadRecorder::windowFromEnv()
+{
+    auto envwindow = g_getenv("UBUNTU_APP_LAUNCH_READAHEAD");
+    if (envwindow == nullptr)
+    {
+        return std::chrono::seconds{0};
+    }
+
+    auto window = std::atoi(envwindow);
+    if (window < 0)
+    {
+        g_warning("Invalid readahead window '%s'", envwindow);
+        return std::chrono::seconds{0};
+    }
+
+    return std::min(std::chrono::seconds{window}, MAX_WINDOW);
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Records which parts of an application's files it uses while
+    starting so the next launch can read them ahead
+
+    On a cold start most of the time goes to page faults on the binary,
+    libraries and QML files in the application's directory. After the
+    first launch of a version we look at which pages of the files under
+    its directory are in the page cache once it has had a little while
+    to start, and save those extents. Later launches ask the kernel to
+    read them in while Upstart is still getting the job going.
+
+    Lists are kept in the cache directory, one per AppID. The AppID
+    includes the version, so a new version gets recorded again. Legacy
+    applications don't have a version, so lists are also recorded again
+    when they get old or the application directory changes.
+
+    Recording and replaying both do file IO, so they shouldn't be used on
+    the registry thread.
+*/
+class ReadaheadRecorder
+{
+public:
+    /** How much was recorded or read ahead */
+    struct Totals
+    {
+        unsigned int files;  /**< Files in the list */
+        std::uint64_t bytes; /**< Bytes in all of their extents */
+    };
+
+    ReadaheadRecorder(const std::string& cacheDir, std::chrono::seconds window);
+    virtual ~ReadaheadRecorder() = default;
+
+    std::chrono::seconds window() const;
+
+    bool hasList(const std::string& appid) const;
+    bool needsRecording(const std::string& appid, const std::string& appdir) const;
+    Totals record(const std::string& appid, const std::string& appdir);
+    Totals replay(const std::string& appid);
+
+    static std::string defaultCacheDir();
+    static std::chrono::seconds windowFromEnv();
+
+private:
+    /** Where the lists are stored */
+    std::string cacheDir_;
+    /** How long after the launch we look at the page cache */
+    std::chrono::seconds window_;
+
+    std::string listPath(const std::string& appid) const;
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -19,29 +19,130 @@
 
 #include "registry-impl.h"
 #include "application-icon-finder.h"
+#include "application-impl-base.h"
+#include "bus-name-index.h"
+#include "cgroup-usage.h"
+#include "helper-instance-table.h"
+#include "helper-pool.h"
+#include "launch-predictor.h"
+#include "launch-timeline.h"
+#include "oom-policy.h"
+#include "prelaunch-pool.h"
+#include "proc-watcher.h"
+#include "readahead-recorder.h"
+#include "ubuntu-app-launch.h"
+#include "upstart-job-paths.h"
+#include "zg-event-queue.h"
 #include <cgmanager/cgmanager.h>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
 #include <upstart.h>
 
+extern "C" {
+#include "ubuntu-app-launch-trace.h"
+#include "usage-store.h"
+}
+
 namespace ubuntu
 {
 namespace app_launch
 {
 
+/** How long without a launch before we consider the device idle */
+static const std::chrono::seconds PREWARM_IDLE{30};
+/** How often to update the predictions while idle, the time of day moves on */
+static const std::chrono::seconds PREWARM_REFRESH{15 * 60};
+/** How far back to look in Zeitgeist for launches */
+static const std::chrono::hours PREDICTION_HISTORY{24 * 28};
+/** Longest a Zeitgeist event waits to be sent */
+static const std::chrono::milliseconds ZG_FLUSH_INTERVAL{1000};
+/** Number of Zeitgeist events that are sent without waiting */
+static const unsigned int ZG_FLUSH_THRESHOLD{32};
+/** How long after a helper launch before the helper pool is refilled */
+static const std::chrono::milliseconds HELPER_POOL_FILL_DELAY{2000};
+/** Number of launches of each application that the timeline keeps */
+static const std::size_t LAUNCH_TIMELINE_HISTORY{32};
+
 Registry::Impl::Impl(Registry* registry)
     : thread([]() {},
              [this]() {
                  _clickUser.reset();
                  _clickDB.reset();
 
+                 /* Sends what is left, the flush below gets it on the bus */
+                 zgQueue_.reset();
                  zgLog_.reset();
                  cgManager_.reset();
+                 procWatcher_.reset();
+                 busNameIndex_.reset();
+                 helperPool_.reset();
+                 helperInstances_.reset();
+                 std::atomic_store(&upstartJobPaths_, std::shared_ptr<UpstartJobPaths>{});
+                 prelaunchPool_.reset();
+                 readahead_.reset();
+                 launchTimeline_.reset();
+                 launchPredictor_.reset();
+                 warmManifests_.clear();
+                 oomPolicyAppliers_.clear();
+                 lifecycleCache_.clear();
+                 appEventQueue_.clear();
+
+                 /* Nobody is going to answer now, let the launches go */
+                 auto waiters = std::move(startingWaiters_);
+                 startingWaiters_.clear();
+                 for (const auto& appwaiters : waiters)
+                 {
+                     for (const auto& handshake : appwaiters.second)
+                     {
+                         startingHandshakeFinish(handshake, false);
+                     }
+                 }
+
+                 if (_dbus)
+                 {
+                     for (auto handle : lifecycleSubscriptions_)
+                     {
+                         g_dbus_connection_signal_unsubscribe(_dbus.get(), handle);
+                     }
+
+                     if (startingSubscription_ != 0)
+                     {
+                         g_dbus_connection_signal_unsubscribe(_dbus.get(), startingSubscription_);
+                     }
+
+                     if (instanceStateSubscription_ != 0)
+                     {
+                         g_dbus_connection_signal_unsubscribe(_dbus.get(), instanceStateSubscription_);
+                     }
+                 }
+                 lifecycleSubscriptions_.clear();
+                 startingSubscription_ = 0;
+                 instanceStateSubscription_ = 0;
 
                  if (_dbus)
                      g_dbus_connection_flush_sync(_dbus.get(), nullptr, nullptr);
                  _dbus.reset();
              })
     , _registry(registry)
+    , procWatcherTried_(false)
+    , helperPoolScheduled_(false)
+    , helperPoolSerial_(0)
+    , predictorSeeded_(false)
+    , prewarmGeneration_(0)
+    , oomPolicyScheduled_(false)
     , _iconFinders()
+    , appEventWindow_(std::chrono::milliseconds{200})
+    , appEventScheduled_(false)
+    , appEventCoalesce_(false)
+    , appEventStats_{0, 0, 0}
+    , startingSubscription_(0)
+    , startingTimeout_(std::chrono::seconds{1})
+    , startingStats_{0, 0, 0}
+    , startingDeferred_(nullptr)
+    , instanceStateSubscription_(0)
+    , instanceStateSerial_(0)
+    , instanceStateForgotten_(0)
 // _manager(nullptr)
 {
     auto session_cancel = thread.getCancellable();
@@ -54,6 +155,26 @@ Registry::Impl::Impl(Registry* registry)
         return std::shared_ptr<GDBusConnection>(g_bus_get_sync(G_BUS_TYPE_SYSTEM, system_cancel.get(), nullptr),
                                                 [](GDBusConnection* bus) { g_clear_object(&bus); });
     });
+
+    /* Get the paths of our jobs on their way now, so that the first
+       launch of each doesn't have to wait on Upstart for them */
+    if (_dbus)
+    {
+        thread.executeOnThread<bool>([this]() {
+            std::atomic_store(&upstartJobPaths_,
+                              std::make_shared<UpstartJobPaths>(
+                                  _dbus, std::list<std::string>{"application-click", "application-legacy",
+                                                                "application-snap", "untrusted-helper"}));
+            return true;
+        });
+    }
+
+    /* Let the job scripts hand us their events instead of running
+       zg-report-app for each of them */
+    if (g_getenv("UBUNTU_APP_LAUNCH_ZG_SINK") != nullptr && _dbus)
+    {
+        thread.executeOnThread<bool>([this]() { return getZgQueue()->exportOnBus(_dbus); });
+    }
 }
 
 void Registry::Impl::initClick()
@@ -144,6 +265,22 @@ std::shared_ptr<JsonObject> Registry::Impl::getClickManifest(const std::string&
     initClick();
 
     auto retval = thread.executeOnThread<std::shared_ptr<JsonObject>>([this, package]() {
+        /* Prewarming keeps the manifests of the apps it expects to be
+           launched, they're good as long as that version is installed */
+        auto warm = warmManifests_.find(package);
+        if (warm != warmManifests_.end())
+        {
+            auto version = click_user_get_version(_clickUser.get(), package.c_str(), nullptr);
+            bool current = (version != nullptr && warm->second.first == version);
+            g_free(version);
+
+            if (current)
+            {
+                return warm->second.second;
+            }
+            warmManifests_.erase(warm);
+        }
+
         GError* error = nullptr;
         auto mani = click_user_get_manifest(_clickUser.get(), package.c_str(), &error);
 
@@ -322,243 +459,2192 @@ std::vector<pid_t> Registry::Impl::pidsFromCgroup(const std::string& jobpath)
     });
 }
 
-/** Looks to find the Upstart object path for a specific Upstart job. This first
-    checks the cache, and otherwise does the lookup on DBus. */
-std::string Registry::Impl::upstartJobPath(const std::string& job)
+/** Get the process event watcher if PID tracking is enabled with the
+    UBUNTU_APP_LAUNCH_PID_TRACKING environment variable and the kernel
+    allows us to subscribe to the events. Returns nullptr otherwise,
+    in which case the cgroup should be used directly. */
+std::shared_ptr<ProcWatcher> Registry::Impl::getProcWatcher()
 {
-    try
+    return thread.executeOnThread<std::shared_ptr<ProcWatcher>>([this]() {
+        if (procWatcherTried_)
+        {
+            return procWatcher_;
+        }
+        procWatcherTried_ = true;
+
+        if (g_getenv("UBUNTU_APP_LAUNCH_PID_TRACKING") == nullptr)
+        {
+            return procWatcher_;
+        }
+
+        try
+        {
+            procWatcher_ = std::make_shared<ProcWatcher>();
+        }
+        catch (std::runtime_error& e)
+        {
+            g_debug("PID tracking unavailable, using cgroups: %s", e.what());
+            return procWatcher_;
+        }
+
+        /* Drop the PIDs and handlers of jobs once they stop, the job's
+           cgroup name is the job and instance put together */
+        if (_dbus)
+        {
+            subscribeSignal(DBUS_INTERFACE_UPSTART, "EventEmitted", DBUS_PATH_UPSTART, "stopped",
+                            [this](const gchar* sender, GVariant* params) {
+                                if (!procWatcher_)
+                                    return;
+
+                                std::string job;
+                                std::string instance;
+
+                                GVariantIter iter;
+                                const gchar* env = nullptr;
+                                GVariant* envs = g_variant_get_child_value(params, 1);
+                                g_variant_iter_init(&iter, envs);
+                                while (g_variant_iter_loop(&iter, "&s", &env))
+                                {
+                                    if (g_str_has_prefix(env, "JOB="))
+                                    {
+                                        job = env + strlen("JOB=");
+                                    }
+                                    else if (g_str_has_prefix(env, "INSTANCE="))
+                                    {
+                                        instance = env + strlen("INSTANCE=");
+                                    }
+                                }
+                                g_variant_unref(envs);
+
+                                if (!job.empty() && !instance.empty())
+                                {
+                                    procWatcher_->untrack(job + "-" + instance);
+                                }
+                            });
+        }
+
+        return procWatcher_;
+    });
+}
+
+/** Get the reader for the cgroup accounting counters, building it
+    the first time it is used. */
+std::shared_ptr<CGroupUsage> Registry::Impl::getCGroupUsage()
+{
+    return thread.executeOnThread<std::shared_ptr<CGroupUsage>>([this]() {
+        if (!cgroupUsage_)
+        {
+            cgroupUsage_ = std::make_shared<CGroupUsage>();
+        }
+        return cgroupUsage_;
+    });
+}
+
+/** Get the index of bus names to PIDs, building it the first time it
+    is used. The index scans the bus when it is created, so it isn't
+    ready right away. */
+std::shared_ptr<BusNameIndex> Registry::Impl::getBusNameIndex()
+{
+    return thread.executeOnThread<std::shared_ptr<BusNameIndex>>([this]() {
+        if (!busNameIndex_)
+        {
+            busNameIndex_ = std::make_shared<BusNameIndex>(_dbus);
+        }
+        return busNameIndex_;
+    });
+}
+
+/** Get the table of running helpers, building it the first time it
+    is used. Returns nullptr if we can't find the untrusted-helper job,
+    in which case Upstart needs to be asked directly. */
+std::shared_ptr<HelperInstanceTable> Registry::Impl::getHelperInstances()
+{
+    return thread.executeOnThread<std::shared_ptr<HelperInstanceTable>>([this]() {
+        if (!helperInstances_)
+        {
+            try
+            {
+                helperInstances_ = std::make_shared<HelperInstanceTable>(_dbus, upstartJobPath("untrusted-helper"),
+                                                                         thread.getCancellable());
+
+                /* Parked helpers exit if they aren't used in time, the pool
+                   needs to start new ones for them */
+                helperInstances_->setParkedRemoved(
+                    [this](const std::string& type, const std::string& appid, const std::string& instanceid) {
+                        if (!helperPool_)
+                            return;
+
+                        g_debug("Parked helper '%s' for '%s' went away", instanceid.c_str(), appid.c_str());
+                        helperPool_->remove(type, appid, instanceid);
+                        scheduleHelperPoolFill();
+                    });
+            }
+            catch (std::runtime_error& e)
+            {
+                g_warning("Unable to build helper table: %s", e.what());
+            }
+        }
+        return helperInstances_;
+    });
+}
+
+/** Build the parameters for a Start or Stop call on the untrusted
+    helper job
+
+    \param type Helper type
+    \param appid AppID of the helper
+    \param instanceid Instance ID, empty for single instance helpers
+    \param prelaunch Whether the helper should park itself
+    \param wait Whether Upstart should wait for the job to change state
+*/
+static GVariant* helperJobParams(const std::string& type,
+                                 const std::string& appid,
+                                 const std::string& instanceid,
+                                 bool prelaunch,
+                                 bool wait)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_TUPLE);
+    g_variant_builder_open(&builder, G_VARIANT_TYPE_ARRAY);
+    g_variant_builder_add_value(&builder, g_variant_new_take_string(g_strdup_printf("APP_ID=%s", appid.c_str())));
+    g_variant_builder_add_value(&builder, g_variant_new_take_string(g_strdup_printf("HELPER_TYPE=%s", type.c_str())));
+    if (!instanceid.empty())
     {
-        return upstartJobPathCache_.at(job);
+        g_variant_builder_add_value(&builder,
+                                    g_variant_new_take_string(g_strdup_printf("INSTANCE_ID=%s", instanceid.c_str())));
     }
-    catch (std::out_of_range& e)
+    if (prelaunch)
     {
-        auto path = thread.executeOnThread<std::string>([this, &job]() -> std::string {
-            GError* error = nullptr;
-            GVariant* job_path_variant = g_dbus_connection_call_sync(_dbus.get(),                       /* connection */
-                                                                     DBUS_SERVICE_UPSTART,              /* service */
-                                                                     DBUS_PATH_UPSTART,                 /* path */
-                                                                     DBUS_INTERFACE_UPSTART,            /* iface */
-                                                                     "GetJobByName",                    /* method */
-                                                                     g_variant_new("(s)", job.c_str()), /* params */
-                                                                     G_VARIANT_TYPE("(o)"),             /* return */
-                                                                     G_DBUS_CALL_FLAGS_NONE,            /* flags */
-                                                                     -1, /* timeout: default */
-                                                                     thread.getCancellable().get(), /* cancellable */
-                                                                     &error);                       /* error */
+        g_variant_builder_add_value(&builder, g_variant_new_string("APP_PRELAUNCH=1"));
+    }
+    g_variant_builder_close(&builder);
+    g_variant_builder_add_value(&builder, g_variant_new_boolean(wait));
 
-            if (error != nullptr)
+    return g_variant_builder_end(&builder);
+}
+
+/** Stop all the instances of the helpers of a type, including any that
+    are parked in the helper pool. All the Stop calls go out together
+    and then we wait for all the answers, instead of a round trip for
+    each one. The instances come from the helper table, or from asking
+    Upstart for each one if we don't have the table.
+
+    The answers are waited on with a context of our own on the calling
+    thread, so the registry thread keeps handling everything else.
+
+    \param type Helper type to stop
+*/
+unsigned int Registry::Impl::stopHelpers(const std::string& type)
+{
+    std::string jobpath;
+    auto instances = thread.executeOnThread<std::list<std::pair<std::string, std::string>>>(
+        [this, &type, &jobpath]() -> std::list<std::pair<std::string, std::string>> {
+            std::list<std::pair<std::string, std::string>> instances;
+
+            jobpath = upstartJobPath("untrusted-helper");
+            if (jobpath.empty())
             {
-                g_warning("Unable to find job '%s': %s", job.c_str(), error->message);
-                g_error_free(error);
-                return {};
+                return instances;
             }
 
-            gchar* job_path = nullptr;
-            g_variant_get(job_path_variant, "(o)", &job_path);
-            g_variant_unref(job_path_variant);
-
-            if (job_path != nullptr)
+            auto table = getHelperInstances();
+            if (table)
             {
-                std::string path(job_path);
-                g_free(job_path);
-                return path;
+                for (const auto& helper : table->all())
+                {
+                    if (helper.first.first != type)
+                    {
+                        continue;
+                    }
+
+                    for (const auto& instanceid : helper.second)
+                    {
+                        instances.emplace_back(helper.first.second, instanceid);
+                    }
+                }
             }
             else
             {
-                return {};
+                auto appidv = ubuntu_app_launch_list_helpers(type.c_str());
+                for (int i = 0; appidv[i] != nullptr; i++)
+                {
+                    auto instancev = ubuntu_app_launch_list_helper_instances(type.c_str(), appidv[i]);
+                    for (int j = 0; instancev[j] != nullptr; j++)
+                    {
+                        instances.emplace_back(appidv[i], instancev[j]);
+                    }
+                    g_strfreev(instancev);
+                }
+                g_strfreev(appidv);
+            }
+
+            for (const auto& entry : getHelperPool()->clear(type))
+            {
+                if (table)
+                {
+                    table->setParked(entry.type, entry.appid, entry.instanceid, false);
+                }
+                instances.emplace_back(entry.appid, entry.instanceid);
             }
+
+            return instances;
         });
 
-        upstartJobPathCache_[job] = path;
-        return path;
+    if (instances.empty())
+    {
+        return 0;
     }
-}
 
-/** Queries Upstart to get all the instances of a given job. This
-    can take a while as the number of dbus calls is n+1. It is
-    rare that apps have many instances though. */
-std::list<std::string> Registry::Impl::upstartInstancesForJob(const std::string& job)
-{
-    std::string jobpath = upstartJobPath(job);
-    if (jobpath.empty())
+    struct StopBatch
     {
-        return {};
-    }
+        unsigned int pending;
+        unsigned int stopped;
+    };
+    StopBatch batch{0, 0};
 
-    return thread.executeOnThread<std::list<std::string>>([this, &job, &jobpath]() -> std::list<std::string> {
-        GError* error = nullptr;
-        GVariant* instance_tuple = g_dbus_connection_call_sync(_dbus.get(),                   /* connection */
-                                                               DBUS_SERVICE_UPSTART,          /* service */
-                                                               jobpath.c_str(),               /* object path */
-                                                               DBUS_INTERFACE_UPSTART_JOB,    /* iface */
-                                                               "GetAllInstances",             /* method */
-                                                               nullptr,                       /* params */
-                                                               G_VARIANT_TYPE("(ao)"),        /* return type */
-                                                               G_DBUS_CALL_FLAGS_NONE,        /* flags */
-                                                               -1,                            /* timeout: default */
-                                                               thread.getCancellable().get(), /* cancellable */
-                                                               &error);
+    auto context = g_main_context_new();
+    g_main_context_push_thread_default(context);
 
-        if (error != nullptr)
-        {
-            g_warning("Unable to get instances of job '%s': %s", job.c_str(), error->message);
-            g_error_free(error);
-            return {};
-        }
+    for (const auto& instance : instances)
+    {
+        auto params = helperJobParams(type, instance.first, instance.second, false, true);
+
+        batch.pending++;
+        g_dbus_connection_call(_dbus.get(),                   /* connection */
+                               DBUS_SERVICE_UPSTART,          /* service */
+                               jobpath.c_str(),               /* object path */
+                               DBUS_INTERFACE_UPSTART_JOB,    /* iface */
+                               "Stop",                        /* method */
+                               params,                        /* params */
+                               nullptr,                       /* return type */
+                               G_DBUS_CALL_FLAGS_NONE,        /* flags */
+                               -1,                            /* timeout: default */
+                               thread.getCancellable().get(), /* cancellable */
+                               [](GObject* obj, GAsyncResult* res, gpointer user_data) {
+                                   auto batch = static_cast<StopBatch*>(user_data);
+                                   GError* error = nullptr;
+                                   GVariant* reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+
+                                   if (error != nullptr)
+                                   {
+                                       g_warning("Unable to stop helper: %s", error->message);
+                                       g_error_free(error);
+                                   }
+                                   else
+                                   {
+                                       batch->stopped++;
+                                       g_variant_unref(reply);
+                                   }
+
+                                   batch->pending--;
+                               },       /* callback */
+                               &batch); /* user data */
+    }
 
-        if (instance_tuple == nullptr)
-        {
-            return {};
-        }
+    g_debug("Stopping %d instances of helper type '%s'", batch.pending, type.c_str());
 
-        GVariant* instance_list = g_variant_get_child_value(instance_tuple, 0);
-        g_variant_unref(instance_tuple);
+    /* The replies come in on our context as it was the thread default
+       when the calls were made */
+    while (batch.pending > 0)
+    {
+        g_main_context_iteration(context, TRUE);
+    }
 
-        GVariantIter instance_iter;
-        g_variant_iter_init(&instance_iter, instance_list);
-        const gchar* instance_path = nullptr;
-        std::list<std::string> instances;
+    g_main_context_pop_thread_default(context);
+    g_main_context_unref(context);
 
-        while (g_variant_iter_loop(&instance_iter, "&o", &instance_path))
-        {
-            GVariant* props_tuple =
-                g_dbus_connection_call_sync(_dbus.get(),                                           /* connection */
-                                            DBUS_SERVICE_UPSTART,                                  /* service */
-                                            instance_path,                                         /* object path */
-                                            "org.freedesktop.DBus.Properties",                     /* interface */
-                                            "GetAll",                                              /* method */
-                                            g_variant_new("(s)", DBUS_INTERFACE_UPSTART_INSTANCE), /* params */
-                                            G_VARIANT_TYPE("(a{sv})"),                             /* return type */
-                                            G_DBUS_CALL_FLAGS_NONE,                                /* flags */
-                                            -1,                            /* timeout: default */
-                                            thread.getCancellable().get(), /* cancellable */
-                                            &error);
+    return batch.stopped;
+}
 
-            if (error != nullptr)
+/** Get the pool of warm helpers, building it the first time it is
+    used. The allow list comes from UBUNTU_APP_LAUNCH_HELPER_POOL and
+    nothing is kept warm if it isn't set, or if the untrusted helper job
+    wasn't built to be parked. */
+std::shared_ptr<HelperPool> Registry::Impl::getHelperPool()
+{
+    return thread.executeOnThread<std::shared_ptr<HelperPool>>([this]() {
+        if (!helperPool_)
+        {
+            helperPool_ = std::make_shared<HelperPool>();
+#ifdef ENABLE_HELPER_POOL
+            helperPool_->configureFromEnv();
+#endif
+            if (!helperPool_->missing().empty())
             {
-                g_warning("Unable to name of instance '%s': %s", instance_path, error->message);
-                g_error_free(error);
-                error = nullptr;
-                continue;
+                scheduleHelperPoolFill();
             }
+        }
+        return helperPool_;
+    });
+}
 
-            GVariant* props_dict = g_variant_get_child_value(props_tuple, 0);
+/** Change which helpers of a type are kept warm, stopping the ones
+    that aren't wanted anymore and starting any new ones.
 
-            GVariant* namev = g_variant_lookup_value(props_dict, "name", G_VARIANT_TYPE_STRING);
-            if (namev != nullptr)
+    \param type Helper type
+    \param appids AppIDs that are allowed
+    \param size Number of parked helpers for each AppID
+*/
+void Registry::Impl::setHelperPool(const std::string& type, const std::list<std::string>& appids, unsigned int size)
+{
+    thread.executeOnThread([this, &type, &appids, size]() {
+        auto table = getHelperInstances();
+        for (const auto& entry : getHelperPool()->configure(type, appids, size))
+        {
+            helperPoolStop(entry.type, entry.appid, entry.instanceid);
+            if (table)
             {
-                auto name = g_variant_get_string(namev, NULL);
-                g_debug("Adding instance for job '%s': %s", job.c_str(), name);
-                instances.push_back(name);
-                g_variant_unref(namev);
+                table->setParked(entry.type, entry.appid, entry.instanceid, false);
             }
-
-            g_variant_unref(props_dict);
-            g_variant_unref(props_tuple);
         }
 
-        g_variant_unref(instance_list);
-
-        return instances;
+        scheduleHelperPoolFill();
     });
 }
 
-/** Send an event to Zietgeist using the registry thread so that
-        the callback comes back in the right place. */
-void Registry::Impl::zgSendEvent(AppID appid, const std::string& eventtype)
+/** Launch a helper from the pool if there is a parked one for it.
+    Returns the instance ID of the helper that was woken up, or an
+    empty string if it needs to be started normally. The pool is
+    refilled in the background either way.
+
+    \param type Helper type
+    \param appid AppID of the helper
+    \param urls Whether the launch has URLs, a parked helper was started
+                 without them so it can't be used
+*/
+std::string Registry::Impl::helperPoolLaunch(const std::string& type, const std::string& appid, bool urls)
 {
-    thread.executeOnThread([this, appid, eventtype] {
-        std::string uri;
-
-        if (appid.package.value().empty())
+    return thread.executeOnThread<std::string>([this, &type, &appid, urls]() -> std::string {
+        auto pool = getHelperPool();
+        if (!pool->allowed(type, appid))
         {
-            uri = "application://" + appid.appname.value() + ".desktop";
+            return {};
         }
-        else
+
+        auto table = getHelperInstances();
+        HelperPool::Entry parked;
+        if (urls || !table || !pool->take(type, appid, parked))
         {
-            uri = "application://" + appid.package.value() + "_" + appid.appname.value() + ".desktop";
+            pool->countMiss();
+            tracepoint(ubuntu_app_launch, helper_pool_miss, type.c_str(), appid.c_str());
+            scheduleHelperPoolFill();
+            return {};
         }
 
-        g_debug("Sending ZG event for '%s': %s", uri.c_str(), eventtype.c_str());
+        /* It could have timed out or been killed while parked */
+        pid_t pid = 0;
+        auto path = table->instancePath(type, appid, parked.instanceid);
+        if (!path.empty())
+        {
+            pid = helperMainPid(path);
+        }
 
-        if (!zgLog_)
+        if (pid == 0 || kill(pid, SIGUSR1) != 0)
         {
-            zgLog_ =
-                std::shared_ptr<ZeitgeistLog>(zeitgeist_log_new(), /* create a new log for us */
-                                              [](ZeitgeistLog* log) { g_clear_object(&log); }); /* Free as a GObject */
+            g_debug("Parked helper '%s' for '%s' couldn't be woken up", parked.instanceid.c_str(), appid.c_str());
+            helperPoolStop(type, appid, parked.instanceid);
+            table->setParked(type, appid, parked.instanceid, false);
+
+            pool->countMiss();
+            tracepoint(ubuntu_app_launch, helper_pool_miss, type.c_str(), appid.c_str());
+            scheduleHelperPoolFill();
+            return {};
         }
 
-        ZeitgeistEvent* event = zeitgeist_event_new();
-        zeitgeist_event_set_actor(event, "application://ubuntu-app-launch.desktop");
-        zeitgeist_event_set_interpretation(event, eventtype.c_str());
-        zeitgeist_event_set_manifestation(event, ZEITGEIST_ZG_USER_ACTIVITY);
+        table->setParked(type, appid, parked.instanceid, false);
+        pool->countHit();
+
+        auto parkedFor =
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - parked.parkedAt);
+        tracepoint(ubuntu_app_launch, helper_pool_hit, type.c_str(), appid.c_str(), parkedFor.count());
+
+        scheduleHelperPoolFill();
+        return parked.instanceid;
+    });
+}
+
+/** Fill the helper pool after a short delay, so that the helper that
+    was just launched doesn't have to share the CPU with the new ones */
+void Registry::Impl::scheduleHelperPoolFill()
+{
+    if (helperPoolScheduled_)
+    {
+        return;
+    }
+
+    helperPoolScheduled_ = true;
+    thread.timeout(HELPER_POOL_FILL_DELAY, [this]() {
+        helperPoolScheduled_ = false;
+        helperPoolFill();
+    });
+}
+
+/** Start parked helpers for everything the pool is missing */
+void Registry::Impl::helperPoolFill()
+{
+    auto table = getHelperInstances();
+    if (!table || !helperPool_)
+    {
+        return;
+    }
+
+    auto jobpath = upstartJobPath("untrusted-helper");
+    if (jobpath.empty())
+    {
+        return;
+    }
 
-        ZeitgeistSubject* subject = zeitgeist_subject_new();
-        zeitgeist_subject_set_interpretation(subject, ZEITGEIST_NFO_SOFTWARE);
-        zeitgeist_subject_set_manifestation(subject, ZEITGEIST_NFO_SOFTWARE_ITEM);
-        zeitgeist_subject_set_mimetype(subject, "application/x-desktop");
-        zeitgeist_subject_set_uri(subject, uri.c_str());
+    for (const auto& missing : helperPool_->missing())
+    {
+        const auto& type = missing.first;
+        const auto& appid = missing.second;
 
-        zeitgeist_event_add_subject(event, subject);
+        /* Same as ubuntu_app_launch_start_multiple_helper() uses, with a
+           bump so two in the same microsecond don't collide */
+        auto instanceid = std::to_string(g_get_real_time() + helperPoolSerial_++);
 
-        zeitgeist_log_insert_event(zgLog_.get(), /* log */
-                                   event,        /* event */
-                                   nullptr,      /* cancellable */
-                                   [](GObject* obj, GAsyncResult* res, gpointer user_data) -> void {
-                                       GError* error = nullptr;
-                                       GArray* result = nullptr;
+        g_debug("Parking helper '%s' for '%s'", instanceid.c_str(), appid.c_str());
+        tracepoint(ubuntu_app_launch, helper_pool_park, type.c_str(), appid.c_str());
 
-                                       result = zeitgeist_log_insert_event_finish(ZEITGEIST_LOG(obj), res, &error);
+        HelperPool::Entry entry{type, appid, instanceid, std::chrono::steady_clock::now()};
+        table->setParked(type, appid, instanceid, true);
+        helperPool_->add(HelperPool::Entry(entry));
 
-                                       if (error != nullptr)
+        struct ParkData
+        {
+            std::weak_ptr<HelperPool> pool;
+            std::weak_ptr<HelperInstanceTable> table;
+            HelperPool::Entry entry;
+        };
+
+        /* Not waiting as the job won't finish starting until it is woken up */
+        g_dbus_connection_call(_dbus.get(),                                          /* bus */
+                               DBUS_SERVICE_UPSTART,                                 /* service name */
+                               jobpath.c_str(),                                      /* Path */
+                               DBUS_INTERFACE_UPSTART_JOB,                           /* interface */
+                               "Start",                                              /* method */
+                               helperJobParams(type, appid, instanceid, true, false), /* params */
+                               nullptr,                                              /* return */
+                               G_DBUS_CALL_FLAGS_NONE,                               /* flags */
+                               -1,                                                   /* default timeout */
+                               thread.getCancellable().get(),                        /* cancellable */
+                               [](GObject* obj, GAsyncResult* res, gpointer user_data) {
+                                   auto data = static_cast<ParkData*>(user_data);
+                                   GError* error = nullptr;
+
+                                   GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+                                   g_clear_pointer(&result, g_variant_unref);
+
+                                   if (error != nullptr)
+                                   {
+                                       if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
                                        {
-                                           g_warning("Unable to submit Zeitgeist Event: %s", error->message);
-                                           g_error_free(error);
+                                           g_warning("Unable to park helper for '%s': %s", data->entry.appid.c_str(),
+                                                     error->message);
+
+                                           auto pool = data->pool.lock();
+                                           if (pool)
+                                           {
+                                               pool->remove(data->entry.type, data->entry.appid,
+                                                            data->entry.instanceid);
+                                           }
+                                           auto table = data->table.lock();
+                                           if (table)
+                                           {
+                                               table->setParked(data->entry.type, data->entry.appid,
+                                                                data->entry.instanceid, false);
+                                           }
                                        }
+                                       g_error_free(error);
+                                   }
 
-                                       g_array_free(result, TRUE);
-                                   },        /* callback */
-                                   nullptr); /* userdata */
-
-        g_object_unref(event);
-        g_object_unref(subject);
-    });
+                                   delete data;
+                               }, /* callback */
+                               new ParkData{helperPool_, table, entry}); /* user data */
+    }
 }
 
-std::shared_ptr<IconFinder> Registry::Impl::getIconFinder(std::string basePath)
+/** Stop a helper job without waiting for it
+
+    \param type Helper type
+    \param appid AppID of the helper
+    \param instanceid Instance ID of the job
+*/
+void Registry::Impl::helperPoolStop(const std::string& type, const std::string& appid, const std::string& instanceid)
 {
-    if (_iconFinders.find(basePath) == _iconFinders.end())
+    auto jobpath = upstartJobPath("untrusted-helper");
+    if (jobpath.empty())
     {
-        _iconFinders[basePath] = std::make_shared<IconFinder>(basePath);
+        return;
     }
-    return _iconFinders[basePath];
+
+    g_dbus_connection_call(_dbus.get(),                                            /* bus */
+                           DBUS_SERVICE_UPSTART,                                   /* service name */
+                           jobpath.c_str(),                                        /* Path */
+                           DBUS_INTERFACE_UPSTART_JOB,                             /* interface */
+                           "Stop",                                                 /* method */
+                           helperJobParams(type, appid, instanceid, false, false), /* params */
+                           nullptr,                                                /* return */
+                           G_DBUS_CALL_FLAGS_NONE,                                 /* flags */
+                           -1,                                                     /* default timeout */
+                           thread.getCancellable().get(),                          /* cancellable */
+                           nullptr,                                                /* callback */
+                           nullptr);                                               /* user data */
 }
 
-#if 0
-void
-Registry::Impl::setManager (Registry::Manager* manager)
+/** Find the main process of an Upstart instance, zero if it doesn't
+    have one
+
+    \param path Object path of the instance
+*/
+pid_t Registry::Impl::helperMainPid(const std::string& path)
 {
-    if (_manager != nullptr)
+    GError* error = nullptr;
+    GVariant* props_tuple =
+        g_dbus_connection_call_sync(_dbus.get(),                                           /* connection */
+                                    DBUS_SERVICE_UPSTART,                                  /* service */
+                                    path.c_str(),                                          /* object path */
+                                    "org.freedesktop.DBus.Properties",                     /* interface */
+                                    "GetAll",                                              /* method */
+                                    g_variant_new("(s)", DBUS_INTERFACE_UPSTART_INSTANCE), /* params */
+                                    G_VARIANT_TYPE("(a{sv})"),                             /* return type */
+                                    G_DBUS_CALL_FLAGS_NONE,                                /* flags */
+                                    -1,                                                    /* timeout: default */
+                                    thread.getCancellable().get(),                         /* cancellable */
+                                    &error);
+
+    if (error != nullptr)
     {
-        throw std::runtime_error("Already have a manager and trying to set another");
+        g_warning("Unable to get processes of instance '%s': %s", path.c_str(), error->message);
+        g_error_free(error);
+        return 0;
     }
 
-    _manager = manager;
+    GVariant* props_dict = g_variant_get_child_value(props_tuple, 0);
+    GVariant* processes = g_variant_lookup_value(props_dict, "processes", G_VARIANT_TYPE("a(si)"));
+    g_variant_unref(props_dict);
+    g_variant_unref(props_tuple);
+
+    if (processes == nullptr)
+    {
+        return 0;
+    }
+
+    pid_t pid = 0;
+    GVariantIter iter;
+    g_variant_iter_init(&iter, processes);
+    const gchar* name = nullptr;
+    gint32 process = 0;
+    while (g_variant_iter_loop(&iter, "(&si)", &name, &process))
+    {
+        if (g_strcmp0(name, "main") == 0)
+        {
+            pid = process;
+        }
+    }
+
+    g_variant_unref(processes);
+    return pid;
 }
 
-void
-Registry::Impl::clearManager ()
+/** Get the pool of prelaunched jobs, building it the first time it
+    is used. The size comes from UBUNTU_APP_LAUNCH_PRELAUNCH_POOL and
+    prelaunching is off if it isn't set, or if the application jobs
+    weren't built to be parked. Parked jobs that time out or get killed
+    are dropped from the pool when Upstart says they stopped. */
+std::shared_ptr<PrelaunchPool> Registry::Impl::getPrelaunchPool()
 {
-    _manager = nullptr;
-}
+    return thread.executeOnThread<std::shared_ptr<PrelaunchPool>>([this]() {
+        if (!prelaunchPool_)
+        {
+#ifdef ENABLE_PRELAUNCH_POOL
+            prelaunchPool_ = std::make_shared<PrelaunchPool>(PrelaunchPool::sizeFromEnv());
+
+            if (_dbus)
+            {
+                subscribeSignal(DBUS_INTERFACE_UPSTART, "EventEmitted", DBUS_PATH_UPSTART, "stopped",
+                                [this](const gchar* sender, GVariant* params) {
+                                    if (!prelaunchPool_)
+                                        return;
+
+                                    std::string job;
+                                    std::string instance;
+
+                                    GVariantIter iter;
+                                    const gchar* env = nullptr;
+                                    GVariant* envs = g_variant_get_child_value(params, 1);
+                                    g_variant_iter_init(&iter, envs);
+                                    while (g_variant_iter_loop(&iter, "&s", &env))
+                                    {
+                                        if (g_str_has_prefix(env, "JOB="))
+                                        {
+                                            job = env + strlen("JOB=");
+                                        }
+                                        else if (g_str_has_prefix(env, "INSTANCE="))
+                                        {
+                                            instance = env + strlen("INSTANCE=");
+                                        }
+                                    }
+                                    g_variant_unref(envs);
+
+                                    if (prelaunchPool_->stopped(job, instance))
+                                    {
+                                        g_debug("Parked job '%s' of '%s' stopped", instance.c_str(), job.c_str());
+                                    }
+                                });
+            }
+#else
+            prelaunchPool_ = std::make_shared<PrelaunchPool>(0);
 #endif
+        }
+        return prelaunchPool_;
+    });
+}
 
-/** App start watching, if we're registered for the signal we
-    can't wait on it. We are making this static right now because
-    we need it to go across the C and C++ APIs smoothly, and those
-    can end up with different registry objects. Long term, this
-    should become a member variable. */
-static bool watchingAppStarting_ = false;
+/** Get the readahead recorder, building it the first time it is used.
+    The window comes from UBUNTU_APP_LAUNCH_READAHEAD and readahead is
+    off if it isn't set. */
+std::shared_ptr<ReadaheadRecorder> Registry::Impl::getReadahead()
+{
+    return thread.executeOnThread<std::shared_ptr<ReadaheadRecorder>>([this]() {
+        if (!readahead_)
+        {
+            readahead_ = std::make_shared<ReadaheadRecorder>(ReadaheadRecorder::defaultCacheDir(),
+                                                             ReadaheadRecorder::windowFromEnv());
+        }
+        return readahead_;
+    });
+}
+
+/** Get the launch timeline, building it the first time. It listens for
+    the exec-line-exec reports and goes on the bus along with being made
+    so that it is there for the first launch. */
+std::shared_ptr<LaunchTimeline> Registry::Impl::getLaunchTimeline()
+{
+    return thread.executeOnThread<std::shared_ptr<LaunchTimeline>>([this]() {
+        if (!launchTimeline_)
+        {
+            launchTimeline_ = std::make_shared<LaunchTimeline>(LAUNCH_TIMELINE_HISTORY);
+            launchTimeline_->listen(getpid());
+            if (_dbus)
+            {
+                launchTimeline_->exportOnBus(_dbus);
+            }
+        }
+        return launchTimeline_;
+    });
+}
+
+/** Tell the OOM policy that a job has been paused so that it can grade
+    its score along with the other paused jobs. Does nothing unless the
+    policy is enabled with UBUNTU_APP_LAUNCH_OOM_POLICY.
+
+    \param jobpath Name of the job
+    \param apply Function to write a new OOM score to all the job's PIDs,
+                 it shouldn't hold a reference to the registry
+*/
+void Registry::Impl::oomPolicyPaused(const std::string& jobpath, std::function<void(std::int32_t)> apply)
+{
+    if (g_getenv("UBUNTU_APP_LAUNCH_OOM_POLICY") == nullptr)
+    {
+        return;
+    }
+
+    thread.executeOnThread([this, jobpath, apply]() {
+        if (!oomPolicy_)
+        {
+            oomPolicy_ = std::make_shared<OomPolicy>();
+        }
+
+        oomPolicy_->paused(jobpath, std::chrono::steady_clock::now());
+        oomPolicyAppliers_[jobpath] = apply;
+
+        if (!oomPolicyScheduled_)
+        {
+            oomPolicyScheduled_ = true;
+            thread.timeoutSeconds(std::chrono::seconds{2}, [this]() { oomPolicyUpdate(); });
+        }
+    });
+}
+
+/** Remove a job from the OOM policy as it is no longer paused */
+void Registry::Impl::oomPolicyResumed(const std::string& jobpath)
+{
+    thread.executeOnThread([this, jobpath]() {
+        if (!oomPolicy_)
+        {
+            return;
+        }
+
+        oomPolicy_->resumed(jobpath);
+        oomPolicyAppliers_.erase(jobpath);
+    });
+}
+
+/** Looks at the memory pressure and the size of the paused jobs and
+    writes out any scores that the policy changes. Reschedules itself
+    as long as there are paused jobs. */
+void Registry::Impl::oomPolicyUpdate()
+{
+    oomPolicyScheduled_ = false;
+
+    if (!oomPolicy_ || oomPolicy_->empty())
+    {
+        return;
+    }
+
+    /* Set by the test suite, probably not anyone else */
+    const gchar* psipath = g_getenv("UBUNTU_APP_LAUNCH_PSI_PATH");
+    if (psipath == nullptr)
+    {
+        psipath = "/proc/pressure/memory";
+    }
+
+    /* Kernels without PSI just look like no pressure */
+    gchar* psi = nullptr;
+    g_file_get_contents(psipath, &psi, nullptr, nullptr);
+    auto pressure = OomPolicy::parsePressure(psi != nullptr ? psi : "");
+    g_free(psi);
+
+    auto usage = getCGroupUsage();
+    std::map<std::string, std::uint64_t> footprints;
+    std::list<std::string> gone;
+    for (const auto& applier : oomPolicyAppliers_)
+    {
+        auto jobusage = usage->forJob(applier.first);
+        if (jobusage.pidCount == 0)
+        {
+            gone.push_back(applier.first);
+            continue;
+        }
+        footprints[applier.first] = jobusage.rss + jobusage.swap;
+    }
+
+    for (const auto& jobpath : gone)
+    {
+        oomPolicy_->resumed(jobpath);
+        oomPolicyAppliers_.erase(jobpath);
+    }
+
+    auto changes = oomPolicy_->update(pressure, footprints);
+    if (!changes.empty())
+    {
+        g_debug("OOM policy at pressure %.2f/%.2f updating %d jobs", pressure.some10, pressure.full10,
+                int(changes.size()));
+    }
+
+    for (const auto& change : changes)
+    {
+        oomPolicyAppliers_[change.first](change.second);
+    }
+
+    if (!oomPolicy_->empty())
+    {
+        oomPolicyScheduled_ = true;
+        thread.timeoutSeconds(std::chrono::seconds{2}, [this]() { oomPolicyUpdate(); });
+    }
+}
+
+/** Looks to find the Upstart object path for a specific Upstart job. The
+    paths are cached, and the ones for our jobs are fetched when the
+    registry is created. Can be called on any thread. */
+std::string Registry::Impl::upstartJobPath(const std::string& job)
+{
+    auto paths = std::atomic_load(&upstartJobPaths_);
+    if (!paths)
+    {
+        return {};
+    }
+
+    return paths->get(job);
+}
+
+/** Follow the StateChanged signals of all the Upstart instances so that
+    anything cached about an instance can be dropped when it changes.
+    One subscription covers all of them. Must be called on the registry
+    thread. */
+void Registry::Impl::watchInstanceStates()
+{
+    if (instanceStateSubscription_ != 0 || !_dbus)
+    {
+        return;
+    }
+
+    instanceStateSubscription_ = g_dbus_connection_signal_subscribe(
+        _dbus.get(),                      /* bus */
+        nullptr,                          /* sender */
+        DBUS_INTERFACE_UPSTART_INSTANCE,  /* interface */
+        "StateChanged",                   /* signal */
+        nullptr,                          /* path */
+        nullptr,                          /* arg0 */
+        G_DBUS_SIGNAL_FLAGS_NONE,         /* flags */
+        [](GDBusConnection*, const gchar*, const gchar* path, const gchar*, const gchar*, GVariant* params,
+           gpointer user_data) -> void {
+            auto impl = static_cast<Registry::Impl*>(user_data);
+
+            const gchar* state = nullptr;
+            if (g_variant_is_of_type(params, G_VARIANT_TYPE("(s)")))
+            {
+                g_variant_get(params, "(&s)", &state);
+            }
+
+            std::lock_guard<std::mutex> guard(impl->instanceStateLock_);
+            auto serial = ++impl->instanceStateSerial_;
+
+            /* Waiting is where an instance ends up before Upstart drops
+               it, so we don't need to remember it any more */
+            if (g_strcmp0(state, "waiting") == 0)
+            {
+                impl->instanceStateChanges_.erase(path);
+                impl->instanceStateForgotten_ = serial;
+            }
+            else
+            {
+                impl->instanceStateChanges_[path] = serial;
+            }
+        },        /* callback */
+        this,     /* user data */
+        nullptr); /* user data free */
+}
+
+/** Get the serial of the latest instance state change, to compare with
+    instanceStateChangedSince() later. Can be called on any thread. */
+std::uint64_t Registry::Impl::instanceStateSerial()
+{
+    std::lock_guard<std::mutex> guard(instanceStateLock_);
+    return instanceStateSerial_;
+}
+
+/** Whether an instance has changed state since a serial from
+    instanceStateSerial(). Can be called on any thread.
+
+    \param path Upstart object path of the instance
+    \param serial Serial from when the instance was last looked at
+*/
+bool Registry::Impl::instanceStateChangedSince(const std::string& path, std::uint64_t serial)
+{
+    std::lock_guard<std::mutex> guard(instanceStateLock_);
+
+    auto change = instanceStateChanges_.find(path);
+    if (change == instanceStateChanges_.end())
+    {
+        /* It could be one we've forgotten */
+        return instanceStateForgotten_ > serial;
+    }
+
+    return change->second > serial;
+}
+
+/** Queries Upstart to get all the instances of a given job. This
+    can take a while as the number of dbus calls is n+1. It is
+    rare that apps have many instances though. */
+std::list<std::string> Registry::Impl::upstartInstancesForJob(const std::string& job)
+{
+    std::string jobpath = upstartJobPath(job);
+    if (jobpath.empty())
+    {
+        return {};
+    }
+
+    return thread.executeOnThread<std::list<std::string>>([this, &job, &jobpath]() -> std::list<std::string> {
+        GError* error = nullptr;
+        GVariant* instance_tuple = g_dbus_connection_call_sync(_dbus.get(),                   /* connection */
+                                                               DBUS_SERVICE_UPSTART,          /* service */
+                                                               jobpath.c_str(),               /* object path */
+                                                               DBUS_INTERFACE_UPSTART_JOB,    /* iface */
+                                                               "GetAllInstances",             /* method */
+                                                               nullptr,                       /* params */
+                                                               G_VARIANT_TYPE("(ao)"),        /* return type */
+                                                               G_DBUS_CALL_FLAGS_NONE,        /* flags */
+                                                               -1,                            /* timeout: default */
+                                                               thread.getCancellable().get(), /* cancellable */
+                                                               &error);
+
+        if (error != nullptr)
+        {
+            g_warning("Unable to get instances of job '%s': %s", job.c_str(), error->message);
+            g_error_free(error);
+            return {};
+        }
+
+        if (instance_tuple == nullptr)
+        {
+            return {};
+        }
+
+        GVariant* instance_list = g_variant_get_child_value(instance_tuple, 0);
+        g_variant_unref(instance_tuple);
+
+        GVariantIter instance_iter;
+        g_variant_iter_init(&instance_iter, instance_list);
+        const gchar* instance_path = nullptr;
+        std::list<std::string> instances;
+        auto pool = getPrelaunchPool();
+
+        while (g_variant_iter_loop(&instance_iter, "&o", &instance_path))
+        {
+            GVariant* props_tuple =
+                g_dbus_connection_call_sync(_dbus.get(),                                           /* connection */
+                                            DBUS_SERVICE_UPSTART,                                  /* service */
+                                            instance_path,                                         /* object path */
+                                            "org.freedesktop.DBus.Properties",                     /* interface */
+                                            "GetAll",                                              /* method */
+                                            g_variant_new("(s)", DBUS_INTERFACE_UPSTART_INSTANCE), /* params */
+                                            G_VARIANT_TYPE("(a{sv})"),                             /* return type */
+                                            G_DBUS_CALL_FLAGS_NONE,                                /* flags */
+                                            -1,                            /* timeout: default */
+                                            thread.getCancellable().get(), /* cancellable */
+                                            &error);
+
+            if (error != nullptr)
+            {
+                g_warning("Unable to name of instance '%s': %s", instance_path, error->message);
+                g_error_free(error);
+                error = nullptr;
+                continue;
+            }
+
+            GVariant* props_dict = g_variant_get_child_value(props_tuple, 0);
+
+            /* Prelaunched jobs are waiting to be woken up, they aren't
+               running as far as anyone is concerned. Other jobs can be in
+               the spawned state too, so only skip the ones we parked. */
+            GVariant* namev = g_variant_lookup_value(props_dict, "name", G_VARIANT_TYPE_STRING);
+            if (namev != nullptr && pool->parked(job, g_variant_get_string(namev, NULL)))
+            {
+                g_debug("Skipping parked instance for job '%s': %s", job.c_str(), g_variant_get_string(namev, NULL));
+                g_variant_unref(namev);
+            }
+            else if (namev != nullptr)
+            {
+                auto name = g_variant_get_string(namev, NULL);
+                g_debug("Adding instance for job '%s': %s", job.c_str(), name);
+                instances.push_back(name);
+                g_variant_unref(namev);
+            }
+
+            g_variant_unref(props_dict);
+            g_variant_unref(props_tuple);
+        }
+
+        g_variant_unref(instance_list);
+
+        return instances;
+    });
+}
+
+/** Queue an event for Zeitgeist on the registry thread, it gets sent
+    with any others that come in around the same time. */
+void Registry::Impl::zgSendEvent(AppID appid, const std::string& eventtype)
+{
+    thread.executeOnThread([this, appid, eventtype] {
+        g_debug("Queuing ZG event for '%s': %s", std::string(appid).c_str(), eventtype.c_str());
+        getZgQueue()->push(zgAppName(appid), eventtype);
+    });
+}
+
+/** Send any queued Zeitgeist events now, used when shutting down so
+    that they aren't lost with the registry. */
+void Registry::Impl::flushZgEvents()
+{
+    thread.executeOnThread<bool>([this]() {
+        if (zgQueue_)
+        {
+            zgQueue_->flush();
+        }
+        return true;
+    });
+}
+
+/** The name Zeitgeist has for an application, which is the desktop
+    file name without the version
+
+    \param appid Application ID
+*/
+std::string Registry::Impl::zgAppName(const AppID& appid)
+{
+    if (appid.package.value().empty())
+    {
+        return appid.appname.value();
+    }
+    else
+    {
+        return appid.package.value() + "_" + appid.appname.value();
+    }
+}
+
+/** Get the Zeitgeist log, creating it the first time. Must be called
+    on the registry thread. */
+std::shared_ptr<ZeitgeistLog> Registry::Impl::getZgLog()
+{
+    if (!zgLog_)
+    {
+        zgLog_ = std::shared_ptr<ZeitgeistLog>(zeitgeist_log_new(), /* create a new log for us */
+                                               [](ZeitgeistLog* log) { g_clear_object(&log); }); /* Free as a GObject */
+    }
+
+    return zgLog_;
+}
+
+/** Get the queue for Zeitgeist events, creating it the first time.
+    Must be called on the registry thread. */
+std::shared_ptr<ZgEventQueue> Registry::Impl::getZgQueue()
+{
+    if (!zgQueue_)
+    {
+        auto usagePath = usage_store_default_path();
+        zgQueue_ = std::make_shared<ZgEventQueue>(getZgLog(), ZG_FLUSH_INTERVAL, ZG_FLUSH_THRESHOLD, usagePath);
+        g_free(usagePath);
+    }
+
+    return zgQueue_;
+}
+
+/** Get the launch predictor, building it the first time it is used. The
+    number of predictions comes from UBUNTU_APP_LAUNCH_PREDICT and it is
+    off when that isn't set. When it is on the history is loaded from
+    Zeitgeist.
+
+    \param reg Registry to use for prewarming
+*/
+std::shared_ptr<LaunchPredictor> Registry::Impl::getLaunchPredictor(const std::shared_ptr<Registry>& reg)
+{
+    return thread.executeOnThread<std::shared_ptr<LaunchPredictor>>([this, &reg]() {
+        if (!launchPredictor_)
+        {
+            launchPredictor_ = std::make_shared<LaunchPredictor>(LaunchPredictor::candidatesFromEnv());
+            if (launchPredictor_->candidates() > 0)
+            {
+                predictorSeed(reg);
+            }
+        }
+        return launchPredictor_;
+    });
+}
+
+/** Change how many applications are predicted and prewarmed, zero
+    turns it off and drops what has been prewarmed.
+
+    \param reg Registry to use for prewarming
+    \param candidates How many applications to prewarm
+*/
+void Registry::Impl::setLaunchPrediction(const std::shared_ptr<Registry>& reg, unsigned int candidates)
+{
+    thread.executeOnThread<bool>([this, &reg, candidates]() {
+        auto predictor = getLaunchPredictor(reg);
+        predictor->setCandidates(candidates);
+
+        if (predictor->candidates() == 0)
+        {
+            /* Stops any timers that are out there */
+            prewarmGeneration_++;
+            predictor->clearPrewarmed();
+            warmManifests_.clear();
+        }
+        else if (!predictorSeeded_)
+        {
+            predictorSeed(reg);
+        }
+        else
+        {
+            schedulePrewarm(reg, PREWARM_IDLE);
+        }
+
+        return true;
+    });
+}
+
+/** Tell the predictor that an application is being launched, which counts
+    whether it was predicted, adds it to the history and pushes back
+    prewarming until things are idle again.
+
+    \param reg Registry to use for prewarming
+    \param appid Application being launched
+*/
+void Registry::Impl::predictorLaunch(const std::shared_ptr<Registry>& reg, const AppID& appid)
+{
+    thread.executeOnThread<bool>([this, &reg, &appid]() {
+        auto predictor = getLaunchPredictor(reg);
+        if (predictor->candidates() == 0)
+        {
+            return false;
+        }
+
+        auto name = zgAppName(appid);
+        auto hit = predictor->launched(name);
+        predictor->addLaunch(name, std::chrono::system_clock::now());
+
+        tracepoint(ubuntu_app_launch, prediction_launch, std::string(appid).c_str(), hit ? 1 : 0);
+
+        schedulePrewarm(reg, PREWARM_IDLE);
+        return hit;
+    });
+}
+
+/** Load the recent launches from Zeitgeist into the predictor and then
+    prewarm once things are idle. Must be called on the registry thread.
+
+    \param reg Registry to use for prewarming
+*/
+void Registry::Impl::predictorSeed(const std::shared_ptr<Registry>& reg)
+{
+    predictorSeeded_ = true;
+
+    GPtrArray* templates = g_ptr_array_new_with_free_func(g_object_unref);
+    ZeitgeistEvent* event = zeitgeist_event_new();
+    zeitgeist_event_set_actor(event, "application://ubuntu-app-launch.desktop");
+    zeitgeist_event_set_interpretation(event, ZEITGEIST_ZG_ACCESS_EVENT);
+    zeitgeist_event_set_manifestation(event, ZEITGEIST_ZG_USER_ACTIVITY);
+    g_ptr_array_add(templates, event);
+
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    auto history = std::chrono::duration_cast<std::chrono::milliseconds>(PREDICTION_HISTORY);
+    ZeitgeistTimeRange* range = zeitgeist_time_range_new((now - history).count(), now.count());
+
+    zeitgeist_log_find_events(
+        getZgLog().get(),                      /* log */
+        range,                                 /* time range */
+        templates,                             /* event templates */
+        ZEITGEIST_STORAGE_STATE_ANY,           /* storage state */
+        1000,                                  /* num events */
+        ZEITGEIST_RELEVANT_RESULT_TYPE_RECENT, /* result type */
+        thread.getCancellable().get(),         /* cancellable */
+        [](GObject* obj, GAsyncResult* res, gpointer user_data) -> void {
+            auto weakreg = static_cast<std::weak_ptr<Registry>*>(user_data);
+            auto reg = weakreg->lock();
+            delete weakreg;
+
+            GError* error = nullptr;
+            ZeitgeistResultSet* results = zeitgeist_log_find_events_finish(ZEITGEIST_LOG(obj), res, &error);
+
+            if (error != nullptr)
+            {
+                if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                {
+                    g_warning("Unable to get launch history from Zeitgeist: %s", error->message);
+                }
+                g_error_free(error);
+                return;
+            }
+
+            if (!reg)
+            {
+                g_object_unref(results);
+                return;
+            }
+
+            auto predictor = reg->impl->launchPredictor_;
+            unsigned int count = 0;
+
+            while (zeitgeist_result_set_has_next(results))
+            {
+                ZeitgeistEvent* event = zeitgeist_result_set_next_value(results);
+                if (zeitgeist_event_num_subjects(event) == 0)
+                {
+                    g_object_unref(event);
+                    continue;
+                }
+
+                ZeitgeistSubject* subject = zeitgeist_event_get_subject(event, 0);
+                std::string uri{zeitgeist_subject_get_uri(subject) != nullptr ? zeitgeist_subject_get_uri(subject)
+                                                                               : ""};
+
+                static const std::string prefix{"application://"};
+                static const std::string suffix{".desktop"};
+                if (predictor && uri.size() > prefix.size() + suffix.size() && uri.find(prefix) == 0 &&
+                    uri.compare(uri.size() - suffix.size(), suffix.size(), suffix) == 0)
+                {
+                    auto name = uri.substr(prefix.size(), uri.size() - prefix.size() - suffix.size());
+                    auto when = std::chrono::system_clock::time_point{
+                        std::chrono::milliseconds{zeitgeist_event_get_timestamp(event)}};
+                    predictor->addLaunch(name, when);
+                    count++;
+                }
+
+                g_object_unref(subject);
+                g_object_unref(event);
+            }
+
+            g_object_unref(results);
+
+            g_debug("Loaded %u launches from Zeitgeist for prediction", count);
+            tracepoint(ubuntu_app_launch, prediction_seeded, count);
+
+            reg->impl->schedulePrewarm(reg, PREWARM_IDLE);
+        },                                   /* callback */
+        new std::weak_ptr<Registry>(reg)); /* userdata */
+
+    g_ptr_array_unref(templates);
+    g_object_unref(range);
+}
+
+/** Prewarm after a delay, as long as nothing else gets scheduled
+    in the meantime. Must be called on the registry thread.
+
+    \param reg Registry to use for prewarming
+    \param delay How long to wait
+*/
+void Registry::Impl::schedulePrewarm(const std::shared_ptr<Registry>& reg, std::chrono::seconds delay)
+{
+    auto generation = ++prewarmGeneration_;
+    std::weak_ptr<Registry> weakreg = reg;
+
+    thread.timeoutSeconds(delay, [this, weakreg, generation]() {
+        auto reg = weakreg.lock();
+        if (!reg || generation != prewarmGeneration_)
+        {
+            return;
+        }
+
+        prewarm(reg);
+        schedulePrewarm(reg, PREWARM_REFRESH);
+    });
+}
+
+/** Data passed through the prewarm task */
+struct PrewarmData
+{
+    std::weak_ptr<Registry> registry;
+    /** Applications that are expected to be launched */
+    std::vector<std::string> names;
+    /** Applications that were prewarmed and what it cost */
+    std::list<std::pair<std::string, std::chrono::microseconds>> warmed;
+};
+
+/** Get the predicted applications ready to launch. The Click manifest is
+    kept so the launch doesn't need to ask Click again, and the desktop
+    file and icon are looked up so they're in the page cache. If there is
+    a readahead list or a prelaunch pool those are used too.
+
+    All of that reads files and asks Upstart about instances, so it is
+    done in the GLib thread pool. Only telling the predictor what was
+    prewarmed happens on the registry thread. Must be called on the
+    registry thread.
+
+    \param reg Registry to create the applications with
+*/
+void Registry::Impl::prewarm(const std::shared_ptr<Registry>& reg)
+{
+    auto predictor = launchPredictor_;
+    if (!predictor || predictor->candidates() == 0)
+    {
+        return;
+    }
+
+    /* Start fresh, the predictions and the packages may have changed */
+    warmManifests_.clear();
+
+    auto data = new PrewarmData{reg, predictor->predict(std::chrono::system_clock::now()), {}};
+
+    /* The callback is run in the thread default context when the task is
+       created, which is the registry thread */
+    auto task = g_task_new(nullptr, thread.getCancellable().get(),
+                           [](GObject* obj, GAsyncResult* res, gpointer user_data) {
+                               auto data = reinterpret_cast<PrewarmData*>(g_task_get_task_data(G_TASK(res)));
+                               auto reg = data->registry.lock();
+                               if (!reg)
+                                   return;
+
+                               /* Turned off while we were working */
+                               auto predictor = reg->impl->launchPredictor_;
+                               if (!predictor || predictor->candidates() == 0)
+                                   return;
+
+                               predictor->clearPrewarmed();
+                               for (const auto& warm : data->warmed)
+                               {
+                                   predictor->prewarmed(warm.first, warm.second);
+                               }
+                           },
+                           nullptr);
+    g_task_set_task_data(task, data, [](gpointer data) { delete reinterpret_cast<PrewarmData*>(data); });
+
+    g_task_run_in_thread(task, [](GTask* task, gpointer obj, gpointer task_data, GCancellable* cancel) {
+        auto data = reinterpret_cast<PrewarmData*>(task_data);
+        auto reg = data->registry.lock();
+
+        for (const auto& name : data->names)
+        {
+            if (!reg || g_cancellable_is_cancelled(cancel))
+            {
+                break;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+
+            try
+            {
+                /* Click applications are named package_app, getting the
+                   manifest first means finding the AppID uses it too */
+                auto underscore = name.find('_');
+                if (underscore != std::string::npos)
+                {
+                    reg->impl->warmClickManifest(name.substr(0, underscore));
+                }
+
+                auto appid = AppID::find(reg, name);
+                if (appid.empty())
+                {
+                    continue;
+                }
+
+                auto app = Application::create(appid, reg);
+
+                /* Already running means the launch will just be a focus */
+                if (app->hasInstances())
+                {
+                    continue;
+                }
+
+                auto info = app->info();
+                info->name();
+                info->iconPath();
+
+                auto readahead = reg->impl->getReadahead();
+                if (readahead->window().count() > 0 && readahead->hasList(std::string(appid)))
+                {
+                    readahead->replay(std::string(appid));
+                }
+
+                Registry::prelaunch(app, reg);
+
+                auto cost =
+                    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+                data->warmed.emplace_back(name, cost);
+                tracepoint(ubuntu_app_launch, prewarm, std::string(appid).c_str(), cost.count());
+            }
+            catch (std::runtime_error& e)
+            {
+                g_debug("Unable to prewarm '%s': %s", name.c_str(), e.what());
+            }
+        }
+
+        g_task_return_boolean(task, TRUE);
+    });
+    g_object_unref(task);
+}
+
+/** Read the Click manifest of a package that is expected to be launched
+    and keep it for getClickManifest(). The Click database is opened
+    separately so that the reading isn't done on the registry thread,
+    only storing the result is.
+
+    \param package Name of the package
+*/
+void Registry::Impl::warmClickManifest(const std::string& package)
+{
+    GError* error = nullptr;
+    auto db = std::shared_ptr<ClickDB>(click_db_new(), [](ClickDB* db) { g_clear_object(&db); });
+    click_db_read(db.get(), g_getenv("TEST_CLICK_DB"), &error);
+
+    std::shared_ptr<ClickUser> user;
+    if (error == nullptr)
+    {
+        user = std::shared_ptr<ClickUser>(click_user_new_for_user(db.get(), g_getenv("TEST_CLICK_USER"), &error),
+                                          [](ClickUser* user) { g_clear_object(&user); });
+    }
+
+    JsonObject* mani = nullptr;
+    if (error == nullptr)
+    {
+        mani = click_user_get_manifest(user.get(), package.c_str(), &error);
+    }
+
+    if (error != nullptr)
+    {
+        g_debug("Unable to get manifest to prewarm package '%s': %s", package.c_str(), error->message);
+        g_error_free(error);
+        return;
+    }
+
+    auto node = json_node_alloc();
+    json_node_init_object(node, mani);
+    auto manifest = std::shared_ptr<JsonObject>(json_node_dup_object(node), json_object_unref);
+    json_node_free(node);
+
+    const gchar* cversion = nullptr;
+    if (!json_object_has_member(manifest.get(), "version") ||
+        (cversion = json_object_get_string_member(manifest.get(), "version")) == nullptr)
+    {
+        return;
+    }
+    std::string version{cversion};
+
+    thread.executeOnThread<bool>([this, &package, &version, &manifest]() {
+        warmManifests_[package] = std::make_pair(version, manifest);
+        return true;
+    });
+}
+
+std::shared_ptr<IconFinder> Registry::Impl::getIconFinder(std::string basePath)
+{
+    if (_iconFinders.find(basePath) == _iconFinders.end())
+    {
+        _iconFinders[basePath] = std::make_shared<IconFinder>(basePath);
+    }
+    return _iconFinders[basePath];
+}
+
+#if 0
+void
+Registry::Impl::setManager (Registry::Manager* manager)
+{
+    if (_manager != nullptr)
+    {
+        throw std::runtime_error("Already have a manager and trying to set another");
+    }
+
+    _manager = manager;
+}
+
+void
+Registry::Impl::clearManager ()
+{
+    _manager = nullptr;
+}
+#endif
+
+/** Subscribe to a signal on the session bus with a function. Needs to
+    be called on the registry thread so that the callbacks happen there.
+
+    \param interface Interface of the signal
+    \param signal Name of the signal
+    \param path Object path the signal is on
+    \param arg0 Value of the first argument to match, or nullptr for any
+    \param func Function to call with the sender and parameters
+*/
+guint Registry::Impl::subscribeSignal(const gchar* interface,
+                                      const gchar* signal,
+                                      const gchar* path,
+                                      const gchar* arg0,
+                                      std::function<void(const gchar*, GVariant*)> func)
+{
+    auto heapFunc = new std::function<void(const gchar*, GVariant*)>(func);
+
+    auto handle = g_dbus_connection_signal_subscribe(
+        _dbus.get(),              /* bus */
+        nullptr,                  /* sender */
+        interface,                /* interface */
+        signal,                   /* signal */
+        path,                     /* path */
+        arg0,                     /* arg0 */
+        G_DBUS_SIGNAL_FLAGS_NONE, /* flags */
+        [](GDBusConnection* conn, const gchar* sender, const gchar* object, const gchar* interface,
+           const gchar* signal, GVariant* params, gpointer user_data) {
+            auto func = static_cast<std::function<void(const gchar*, GVariant*)>*>(user_data);
+            (*func)(sender, params);
+        },             /* callback */
+        heapFunc,      /* user data */
+        [](gpointer user_data) {
+            auto func = static_cast<std::function<void(const gchar*, GVariant*)>*>(user_data);
+            delete func;
+        }); /* user data destroy */
+
+    lifecycleSubscriptions_.push_back(handle);
+    return handle;
+}
+
+/** Get the application object for an AppID, reusing the one that we
+    handed out last time if someone is still holding it.
+
+    \param reg Registry to build the application with
+    \param appid Application ID string from the event
+*/
+std::shared_ptr<Application> Registry::Impl::lifecycleApp(const std::shared_ptr<Registry>& reg,
+                                                          const std::string& appid)
+{
+    auto& entry = lifecycleCache_[appid];
+    auto app = entry.app.lock();
+    if (app)
+    {
+        return app;
+    }
+
+    try
+    {
+        auto id = AppID::parse(appid);
+        if (id.empty())
+        {
+            id = AppID::find(reg, appid);
+        }
+        if (id.empty())
+        {
+            throw std::runtime_error("Unable to find AppID");
+        }
+
+        app = Application::create(id, reg);
+        entry.app = app;
+        return app;
+    }
+    catch (std::runtime_error& e)
+    {
+        g_warning("Unable to build application for lifecycle event on '%s': %s", appid.c_str(), e.what());
+        lifecycleCache_.erase(appid);
+        return {};
+    }
+}
+
+/** Find the instance that one of our signals is about. They only have the
+    AppID, so if there are multiple instances we use the PIDs to pick one.
+
+    \param app Application the signal was about
+    \param pids PIDs in the signal, may be empty
+*/
+std::shared_ptr<Application::Instance> Registry::Impl::lifecycleInstance(const std::shared_ptr<Application>& app,
+                                                                         const std::vector<pid_t>& pids)
+{
+    std::vector<std::shared_ptr<Application::Instance>> instances;
+
+    auto entry = lifecycleCache_.find(std::string(app->appId()));
+    if (entry != lifecycleCache_.end())
+    {
+        for (const auto& cached : entry->second.instances)
+        {
+            auto instance = cached.second.lock();
+            if (instance)
+            {
+                instances.push_back(instance);
+            }
+        }
+    }
+
+    /* Started before we were watching, or no one kept it, ask Upstart */
+    if (instances.empty())
+    {
+        try
+        {
+            instances = app->instances();
+        }
+        catch (std::runtime_error& e)
+        {
+            g_warning("Unable to get instances of '%s': %s", std::string(app->appId()).c_str(), e.what());
+        }
+    }
+
+    if (instances.size() > 1 && !pids.empty())
+    {
+        for (const auto& instance : instances)
+        {
+            if (instance->hasPid(pids.front()))
+            {
+                return instance;
+            }
+        }
+    }
+
+    if (instances.empty())
+    {
+        return {};
+    }
+
+    return instances.front();
+}
+
+/** Subscribe to one of the Upstart events for the application jobs.
+    The instance name is the AppID for click, and has the instance ID
+    appended for the others.
+
+    \param reg Registry to build the objects with
+    \param event Either "started" or "stopped"
+*/
+void Registry::Impl::subscribeUpstartEvent(const std::shared_ptr<Registry>& reg, const std::string& event)
+{
+    std::weak_ptr<Registry> weakReg = reg;
+    bool started = event == "started";
+
+    thread.executeOnThread<bool>([this, weakReg, started, event]() {
+        subscribeSignal(DBUS_INTERFACE_UPSTART, "EventEmitted", DBUS_PATH_UPSTART, event.c_str(),
+                        [this, weakReg, started](const gchar* sender, GVariant* params) {
+                            auto reg = weakReg.lock();
+                            if (!reg)
+                                return;
+
+                            std::string job;
+                            std::string upstartInstance;
+
+                            GVariantIter iter;
+                            const gchar* env = nullptr;
+                            GVariant* envs = g_variant_get_child_value(params, 1);
+                            g_variant_iter_init(&iter, envs);
+                            while (g_variant_iter_loop(&iter, "&s", &env))
+                            {
+                                if (g_str_has_prefix(env, "JOB="))
+                                {
+                                    job = env + strlen("JOB=");
+                                }
+                                else if (g_str_has_prefix(env, "INSTANCE="))
+                                {
+                                    upstartInstance = env + strlen("INSTANCE=");
+                                }
+                            }
+                            g_variant_unref(envs);
+
+                            if (job != "application-click" && job != "application-legacy" &&
+                                job != "application-snap")
+                            {
+                                return;
+                            }
+
+                            std::string appid = upstartInstance;
+                            std::string instanceid;
+                            if (job != "application-click")
+                            {
+                                auto dash = upstartInstance.rfind('-');
+                                if (dash == std::string::npos)
+                                {
+                                    g_warning("Unable to find instance ID in '%s'", upstartInstance.c_str());
+                                    return;
+                                }
+                                appid = upstartInstance.substr(0, dash);
+                                instanceid = upstartInstance.substr(dash + 1);
+                            }
+
+                            auto app = lifecycleApp(reg, appid);
+                            if (!app)
+                                return;
+
+                            auto& cached = lifecycleCache_[appid].instances[upstartInstance];
+                            auto instance = cached.lock();
+                            if (!instance)
+                            {
+                                instance = std::make_shared<app_impls::UpstartInstance>(
+                                    app->appId(), job, instanceid, std::vector<Application::URL>{}, reg);
+                                cached = instance;
+                            }
+
+                            if (started)
+                            {
+                                sig_appStarted(app, instance);
+                            }
+                            else
+                            {
+                                sig_appStopped(app, instance);
+
+                                auto entry = lifecycleCache_.find(appid);
+                                if (entry != lifecycleCache_.end())
+                                {
+                                    entry->second.instances.erase(upstartInstance);
+                                    if (entry->second.instances.empty())
+                                    {
+                                        lifecycleCache_.erase(entry);
+                                    }
+                                }
+                            }
+                        });
+        return true;
+    });
+}
+
+/** Subscribe to the signals we send when pausing and resuming
+
+    \param reg Registry to build the objects with
+    \param signal Either "ApplicationPaused" or "ApplicationResumed"
+    \param paused Which of our signals to send
+*/
+void Registry::Impl::subscribePausedResumed(const std::shared_ptr<Registry>& reg,
+                                            const std::string& signal,
+                                            bool paused)
+{
+    std::weak_ptr<Registry> weakReg = reg;
+
+    thread.executeOnThread<bool>([this, weakReg, signal, paused]() {
+        subscribeSignal("com.canonical.UbuntuAppLaunch", signal.c_str(), "/", nullptr,
+                        [this, weakReg, paused](const gchar* sender, GVariant* params) {
+                            auto reg = weakReg.lock();
+                            if (!reg)
+                                return;
+
+                            const gchar* appid = nullptr;
+                            GVariant* vpids = nullptr;
+                            g_variant_get(params, "(&s@at)", &appid, &vpids);
+
+                            std::vector<pid_t> pids;
+                            GVariantIter iter;
+                            guint64 pid;
+                            g_variant_iter_init(&iter, vpids);
+                            while (g_variant_iter_loop(&iter, "t", &pid))
+                            {
+                                pids.push_back(pid);
+                            }
+                            g_variant_unref(vpids);
+
+                            auto app = lifecycleApp(reg, appid);
+                            if (!app)
+                                return;
+                            auto instance = lifecycleInstance(app, pids);
+
+                            if (paused)
+                            {
+                                sig_appPaused(app, instance, pids);
+                            }
+                            else
+                            {
+                                sig_appResumed(app, instance, pids);
+                            }
+                        });
+        return true;
+    });
+}
+
+/** Signal for applications starting, subscribes on first use */
+core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&>&
+    Registry::Impl::appStarted(const std::shared_ptr<Registry>& reg)
+{
+    std::call_once(flag_appStarted, [this, reg]() { subscribeUpstartEvent(reg, "started"); });
+    return sig_appStarted;
+}
+
+/** Signal for applications stopping, subscribes on first use */
+core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&>&
+    Registry::Impl::appStopped(const std::shared_ptr<Registry>& reg)
+{
+    std::call_once(flag_appStopped, [this, reg]() { subscribeUpstartEvent(reg, "stopped"); });
+    return sig_appStopped;
+}
+
+/** Signal for applications failing, subscribes on first use */
+core::Signal<const std::shared_ptr<Application>&,
+             const std::shared_ptr<Application::Instance>&,
+             Registry::FailureType>&
+    Registry::Impl::appFailed(const std::shared_ptr<Registry>& reg)
+{
+    std::call_once(flag_appFailed, [this, reg]() {
+        std::weak_ptr<Registry> weakReg = reg;
+
+        thread.executeOnThread<bool>([this, weakReg]() {
+            subscribeSignal("com.canonical.UbuntuAppLaunch", "ApplicationFailed", "/", nullptr,
+                            [this, weakReg](const gchar* sender, GVariant* params) {
+                                auto reg = weakReg.lock();
+                                if (!reg)
+                                    return;
+
+                                const gchar* appid = nullptr;
+                                const gchar* typestr = nullptr;
+                                g_variant_get(params, "(&s&s)", &appid, &typestr);
+
+                                FailureType type = FailureType::CRASH;
+                                if (g_strcmp0("start-failure", typestr) == 0)
+                                {
+                                    type = FailureType::START_FAILURE;
+                                }
+                                else if (g_strcmp0("crash", typestr) != 0)
+                                {
+                                    g_warning("Application failure type '%s' unknown, reporting as a crash",
+                                              typestr);
+                                }
+
+                                auto app = lifecycleApp(reg, appid);
+                                if (!app)
+                                    return;
+
+                                sig_appFailed(app, lifecycleInstance(app, {}), type);
+                            });
+            return true;
+        });
+    });
+    return sig_appFailed;
+}
+
+/** Signal for applications being paused, subscribes on first use */
+core::Signal<const std::shared_ptr<Application>&,
+             const std::shared_ptr<Application::Instance>&,
+             const std::vector<pid_t>&>&
+    Registry::Impl::appPaused(const std::shared_ptr<Registry>& reg)
+{
+    std::call_once(flag_appPaused, [this, reg]() { subscribePausedResumed(reg, "ApplicationPaused", true); });
+    return sig_appPaused;
+}
+
+/** Signal for applications being resumed, subscribes on first use */
+core::Signal<const std::shared_ptr<Application>&,
+             const std::shared_ptr<Application::Instance>&,
+             const std::vector<pid_t>&>&
+    Registry::Impl::appResumed(const std::shared_ptr<Registry>& reg)
+{
+    std::call_once(flag_appResumed, [this, reg]() { subscribePausedResumed(reg, "ApplicationResumed", false); });
+    return sig_appResumed;
+}
+
+/** Signal with batches of all the lifecycle events. Connects to all of
+    the individual signals the first time it is requested. */
+core::Signal<const std::list<Registry::AppEvent>&>& Registry::Impl::appEventBatch(const std::shared_ptr<Registry>& reg)
+{
+    std::call_once(flag_appEventBatch, [this, reg]() {
+        appStarted(reg).connect([this](const std::shared_ptr<Application>& app,
+                                       const std::shared_ptr<Application::Instance>& instance) {
+            queueAppEvent({AppEvent::Type::STARTED, app, instance, FailureType::CRASH, {}});
+        });
+        appStopped(reg).connect([this](const std::shared_ptr<Application>& app,
+                                       const std::shared_ptr<Application::Instance>& instance) {
+            queueAppEvent({AppEvent::Type::STOPPED, app, instance, FailureType::CRASH, {}});
+        });
+        appFailed(reg).connect([this](const std::shared_ptr<Application>& app,
+                                      const std::shared_ptr<Application::Instance>& instance, FailureType type) {
+            queueAppEvent({AppEvent::Type::FAILED, app, instance, type, {}});
+        });
+        appPaused(reg).connect([this](const std::shared_ptr<Application>& app,
+                                      const std::shared_ptr<Application::Instance>& instance,
+                                      const std::vector<pid_t>& pids) {
+            queueAppEvent({AppEvent::Type::PAUSED, app, instance, FailureType::CRASH, pids});
+        });
+        appResumed(reg).connect([this](const std::shared_ptr<Application>& app,
+                                       const std::shared_ptr<Application::Instance>& instance,
+                                       const std::vector<pid_t>& pids) {
+            queueAppEvent({AppEvent::Type::RESUMED, app, instance, FailureType::CRASH, pids});
+        });
+    });
+    return sig_appEventBatch;
+}
+
+/** Change the length of the batch window, takes effect on the next batch */
+void Registry::Impl::setAppEventBatchWindow(std::chrono::milliseconds window)
+{
+    thread.executeOnThread([this, window]() { appEventWindow_ = window; });
+}
+
+/** Turn coalescing of the batches on or off */
+void Registry::Impl::setAppEventCoalescing(bool coalesce)
+{
+    thread.executeOnThread([this, coalesce]() { appEventCoalesce_ = coalesce; });
+}
+
+/** Get a copy of the batch counters from the registry thread */
+Registry::AppEventStats Registry::Impl::appEventStats()
+{
+    return thread.executeOnThread<Registry::AppEventStats>([this]() { return appEventStats_; });
+}
+
+/** Whether the second event undoes the first one */
+static bool appEventCancels(Registry::AppEvent::Type first, Registry::AppEvent::Type second)
+{
+    switch (first)
+    {
+        case Registry::AppEvent::Type::STARTED:
+            return second == Registry::AppEvent::Type::STOPPED;
+        case Registry::AppEvent::Type::PAUSED:
+            return second == Registry::AppEvent::Type::RESUMED;
+        case Registry::AppEvent::Type::RESUMED:
+            return second == Registry::AppEvent::Type::PAUSED;
+        default:
+            return false;
+    }
+}
+
+/** Look at the last event queued for the same instance and see if the
+    new one can be folded into it. Returns true if the new event should
+    be dropped. */
+bool Registry::Impl::foldAppEvent(const Registry::AppEvent& event)
+{
+    for (auto prev = appEventQueue_.rbegin(); prev != appEventQueue_.rend(); prev++)
+    {
+        if (std::string(prev->app->appId()) != std::string(event.app->appId()))
+        {
+            continue;
+        }
+        /* The instance can be empty if we couldn't figure out which one
+           it was, in that case match on the application */
+        if (prev->instance && event.instance && prev->instance != event.instance)
+        {
+            continue;
+        }
+
+        if (appEventCancels(prev->type, event.type))
+        {
+            appEventQueue_.erase(std::next(prev).base());
+            appEventStats_.folded += 2;
+            return true;
+        }
+
+        if (prev->type == event.type &&
+            (event.type == AppEvent::Type::PAUSED || event.type == AppEvent::Type::RESUMED))
+        {
+            appEventStats_.folded++;
+            return true;
+        }
+
+        return false;
+    }
+
+    return false;
+}
+
+/** Add an event to the batch, starting the window if this is the first
+    one. Always called on the registry thread from the signals. */
+void Registry::Impl::queueAppEvent(Registry::AppEvent&& event)
+{
+    appEventStats_.received++;
+
+    if (appEventCoalesce_ && foldAppEvent(event))
+    {
+        return;
+    }
+
+    appEventQueue_.emplace_back(std::move(event));
+
+    if (appEventScheduled_)
+    {
+        return;
+    }
+
+    appEventScheduled_ = true;
+    thread.timeout(appEventWindow_, [this]() {
+        appEventScheduled_ = false;
+
+        std::list<Registry::AppEvent> batch;
+        batch.swap(appEventQueue_);
+
+        /* Everything could have cancelled out */
+        if (batch.empty())
+        {
+            return;
+        }
+
+        g_debug("Sending batch of %d lifecycle events", int(batch.size()));
+        appEventStats_.batches++;
+        sig_appEventBatch(batch);
+    });
+}
+
+/** App start watching, if we're registered for the signal we
+    can't wait on it. We are making this static right now because
+    we need it to go across the C and C++ APIs smoothly, and those
+    can end up with different registry objects. Long term, this
+    should become a member variable. */
+static bool watchingAppStarting_ = false;
+
+/** A launch waiting for Unity to say that it can start */
+struct Registry::Impl::StartingHandshake
+{
+    std::string appid;                              /**< Application being started */
+    std::uint64_t launch;                           /**< Launch on the timeline, 0 for none */
+    std::chrono::steady_clock::time_point started;  /**< When the broadcast was sent */
+    std::chrono::steady_clock::time_point deadline; /**< When to stop waiting */
+    bool finished;                                  /**< Whether it was answered or timed out */
+    std::promise<void> promise;                     /**< Set once it is finished */
+    std::shared_future<void> future;                /**< What the launch waits on */
+};
+
+/** Ask Unity whether an application can start. The answers come in on
+    a single subscription that is made the first time, so starting an
+    application doesn't add a match rule to the bus. Each handshake has
+    its own deadline on the registry thread, nothing blocks here. Must
+    be called on the registry thread.
+
+    \param appid Application ID being started
+    \param launch Launch on the timeline to note the handshake on
+*/
+std::shared_ptr<Registry::Impl::StartingHandshake> Registry::Impl::startingHandshakeStart(const std::string& appid,
+                                                                                        std::uint64_t launch)
+{
+    if (!_dbus)
+    {
+        return {};
+    }
+
+    if (startingSubscription_ == 0)
+    {
+        startingSubscription_ = g_dbus_connection_signal_subscribe(
+            _dbus.get(),                      /* bus */
+            nullptr,                          /* sender */
+            "com.canonical.UbuntuAppLaunch",  /* interface */
+            "UnityStartingSignal",            /* signal */
+            "/",                              /* path */
+            nullptr,                          /* arg0 */
+            G_DBUS_SIGNAL_FLAGS_NONE,         /* flags */
+            [](GDBusConnection*, const gchar*, const gchar*, const gchar*, const gchar*, GVariant* params,
+               gpointer user_data) -> void {
+                auto impl = static_cast<Registry::Impl*>(user_data);
+
+                if (!g_variant_is_of_type(params, G_VARIANT_TYPE("(s)")))
+                {
+                    return;
+                }
+
+                const gchar* appid = nullptr;
+                g_variant_get(params, "(&s)", &appid);
+
+                auto waiters = impl->startingWaiters_.find(appid);
+                if (waiters == impl->startingWaiters_.end())
+                {
+                    return;
+                }
+
+                auto handshakes = std::move(waiters->second);
+                impl->startingWaiters_.erase(waiters);
+
+                for (const auto& handshake : handshakes)
+                {
+                    impl->startingHandshakeFinish(handshake, true);
+                }
+            },        /* callback */
+            this,     /* user data */
+            nullptr); /* user data free */
+    }
+
+    std::chrono::milliseconds timeout = startingTimeout_;
+    if (isWatchingAppStarting())
+    {
+        timeout = std::chrono::milliseconds{0};
+    }
+
+    auto handshake = std::make_shared<StartingHandshake>();
+    handshake->appid = appid;
+    handshake->launch = launch;
+    handshake->started = std::chrono::steady_clock::now();
+    handshake->deadline = handshake->started + timeout;
+    handshake->finished = false;
+    handshake->future = handshake->promise.get_future().share();
+
+    if (startingDeferred_ != nullptr)
+    {
+        *startingDeferred_ = handshake;
+    }
+
+    GError* error = nullptr;
+    g_dbus_connection_emit_signal(_dbus.get(),                         /* bus */
+                                  nullptr,                             /* destination */
+                                  "/",                                 /* path */
+                                  "com.canonical.UbuntuAppLaunch",     /* interface */
+                                  "UnityStartingBroadcast",            /* signal */
+                                  g_variant_new("(s)", appid.c_str()), /* params */
+                                  &error);                             /* error */
+
+    if (error != nullptr)
+    {
+        g_warning("Unable to emit starting broadcast for '%s': %s", appid.c_str(), error->message);
+        g_error_free(error);
+    }
+
+    if (launch != 0)
+    {
+        getLaunchTimeline()->stamp(appid, launch, LaunchTimeline::Milestone::HANDSHAKE_WAIT);
+    }
+
+    if (timeout.count() == 0)
+    {
+        startingHandshakeFinish(handshake, false);
+        return handshake;
+    }
+
+    startingWaiters_[appid].push_back(handshake);
+    thread.timeout(timeout, [this, handshake]() { startingHandshakeFinish(handshake, false); });
+
+    return handshake;
+}
+
+/** Finish a handshake, either because Unity answered or the deadline
+    passed. Whichever comes second does nothing. Must be called on the
+    registry thread.
+
+    \param handshake Handshake from startingHandshakeStart()
+    \param answered Whether Unity answered it
+*/
+void Registry::Impl::startingHandshakeFinish(const std::shared_ptr<StartingHandshake>& handshake, bool answered)
+{
+    if (handshake->finished)
+    {
+        return;
+    }
+    handshake->finished = true;
+
+    auto waiters = startingWaiters_.find(handshake->appid);
+    if (waiters != startingWaiters_.end())
+    {
+        waiters->second.remove(handshake);
+        if (waiters->second.empty())
+        {
+            startingWaiters_.erase(waiters);
+        }
+    }
+
+    auto latency =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - handshake->started);
+
+    startingStats_.handshakes++;
+    if (answered)
+    {
+        startingStats_.answered++;
+    }
+    else if (handshake->deadline > handshake->started)
+    {
+        startingStats_.timeouts++;
+        g_debug("Timed out waiting for Unity to answer the starting handshake for '%s'", handshake->appid.c_str());
+    }
+
+    tracepoint(ubuntu_app_launch, handshake_latency, handshake->appid.c_str(), latency.count(), answered ? 1 : 0);
+
+    if (handshake->launch != 0 && launchTimeline_)
+    {
+        launchTimeline_->stamp(handshake->appid, handshake->launch, LaunchTimeline::Milestone::HANDSHAKE_COMPLETE);
+    }
+
+    handshake->promise.set_value();
+}
+
+/** Wait for Unity to answer a handshake, or for its deadline to pass.
+    This blocks the calling thread only, so it must not be called on the
+    registry thread. If it is, we don't wait and the answer is handled
+    whenever it comes in.
+
+    \param handshake Handshake from startingHandshakeStart()
+*/
+void Registry::Impl::startingHandshakeWait(const std::shared_ptr<StartingHandshake>& handshake)
+{
+    if (!handshake)
+    {
+        return;
+    }
+
+    if (thread.isCurrentThread())
+    {
+        g_debug("Not waiting on the starting handshake for '%s' from the registry thread", handshake->appid.c_str());
+        return;
+    }
+
+    handshake->future.wait();
+}
+
+/** Run a launch on the registry thread and hand back its handshake so
+    the caller can wait on it later, letting several launches get their
+    handshakes going before waiting on any of them. Returns an empty
+    pointer if the launch didn't start a handshake.
+
+    \param launch Function that does the launch
+*/
+std::shared_ptr<Registry::Impl::StartingHandshake> Registry::Impl::startingHandshakeDefer(
+    const std::function<void()>& launch)
+{
+    return thread.executeOnThread<std::shared_ptr<StartingHandshake>>([this, &launch]() {
+        std::shared_ptr<StartingHandshake> handshake;
+        startingDeferred_ = &handshake;
+
+        try
+        {
+            launch();
+        }
+        catch (...)
+        {
+            startingDeferred_ = nullptr;
+            throw;
+        }
+
+        startingDeferred_ = nullptr;
+        return handshake;
+    });
+}
+
+/** Change how long launches wait for Unity, takes effect on the next launch */
+void Registry::Impl::setStartingHandshakeTimeout(std::chrono::milliseconds timeout)
+{
+    thread.executeOnThread([this, timeout]() { startingTimeout_ = timeout; });
+}
+
+/** Get a copy of the handshake counters from the registry thread */
+Registry::StartingHandshakeStats Registry::Impl::startingHandshakeStats()
+{
+    return thread.executeOnThread<Registry::StartingHandshakeStats>([this]() { return startingStats_; });
+}
 
 /** Variable to track if this program is watching app startup
     so that we can know to not wait on the response to that. */
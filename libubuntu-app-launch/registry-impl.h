@@ -24,6 +24,7 @@
 #include <gio/gio.h>
 #include <json-glib/json-glib.h>
 #include <map>
+#include <mutex>
 #include <unordered_map>
 #include <zeitgeist.h>
 
@@ -34,7 +35,19 @@ namespace ubuntu
 namespace app_launch
 {
 
+class BusNameIndex;
+class CGroupUsage;
+class HelperInstanceTable;
+class HelperPool;
 class IconFinder;
+class LaunchPredictor;
+class LaunchTimeline;
+class OomPolicy;
+class PrelaunchPool;
+class ReadaheadRecorder;
+class ProcWatcher;
+class UpstartJobPaths;
+class ZgEventQueue;
 
 /** \private
     \brief Private implementation of the Registry object
@@ -46,6 +59,7 @@ public:
     Impl(Registry* registry);
     virtual ~Impl()
     {
+        flushZgEvents();
         thread.quit();
     }
 
@@ -74,13 +88,70 @@ public:
     std::shared_ptr<IconFinder> getIconFinder(std::string basePath);
 
     void zgSendEvent(AppID appid, const std::string& eventtype);
+    static std::string zgAppName(const AppID& appid);
+    void flushZgEvents();
 
     std::vector<pid_t> pidsFromCgroup(const std::string& jobpath);
+    std::shared_ptr<ProcWatcher> getProcWatcher();
+    std::shared_ptr<CGroupUsage> getCGroupUsage();
+    std::shared_ptr<BusNameIndex> getBusNameIndex();
+    std::shared_ptr<HelperInstanceTable> getHelperInstances();
+    unsigned int stopHelpers(const std::string& type);
+
+    /* Helper pool */
+    std::shared_ptr<HelperPool> getHelperPool();
+    void setHelperPool(const std::string& type, const std::list<std::string>& appids, unsigned int size);
+    std::string helperPoolLaunch(const std::string& type, const std::string& appid, bool urls);
+    std::shared_ptr<PrelaunchPool> getPrelaunchPool();
+    std::shared_ptr<ReadaheadRecorder> getReadahead();
+    std::shared_ptr<LaunchTimeline> getLaunchTimeline();
+
+    /* Launch prediction */
+    std::shared_ptr<LaunchPredictor> getLaunchPredictor(const std::shared_ptr<Registry>& reg);
+    void setLaunchPrediction(const std::shared_ptr<Registry>& reg, unsigned int candidates);
+    void predictorLaunch(const std::shared_ptr<Registry>& reg, const AppID& appid);
+
+    /* OOM Policy */
+    void oomPolicyPaused(const std::string& jobpath, std::function<void(std::int32_t)> apply);
+    void oomPolicyResumed(const std::string& jobpath);
+
+    /* Lifecycle signals */
+    core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&>& appStarted(
+        const std::shared_ptr<Registry>& reg);
+    core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&>& appStopped(
+        const std::shared_ptr<Registry>& reg);
+    core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&, FailureType>&
+        appFailed(const std::shared_ptr<Registry>& reg);
+    core::Signal<const std::shared_ptr<Application>&,
+                 const std::shared_ptr<Application::Instance>&,
+                 const std::vector<pid_t>&>&
+        appPaused(const std::shared_ptr<Registry>& reg);
+    core::Signal<const std::shared_ptr<Application>&,
+                 const std::shared_ptr<Application::Instance>&,
+                 const std::vector<pid_t>&>&
+        appResumed(const std::shared_ptr<Registry>& reg);
+    core::Signal<const std::list<Registry::AppEvent>&>& appEventBatch(const std::shared_ptr<Registry>& reg);
+    void setAppEventBatchWindow(std::chrono::milliseconds window);
+    void setAppEventCoalescing(bool coalesce);
+    Registry::AppEventStats appEventStats();
+
+    /* Starting handshake */
+    struct StartingHandshake;
+    std::shared_ptr<StartingHandshake> startingHandshakeStart(const std::string& appid, std::uint64_t launch = 0);
+    void startingHandshakeWait(const std::shared_ptr<StartingHandshake>& handshake);
+    std::shared_ptr<StartingHandshake> startingHandshakeDefer(const std::function<void()>& launch);
+    void setStartingHandshakeTimeout(std::chrono::milliseconds timeout);
+    Registry::StartingHandshakeStats startingHandshakeStats();
 
     /* Upstart Jobs */
     std::list<std::string> upstartInstancesForJob(const std::string& job);
     std::string upstartJobPath(const std::string& job);
 
+    /* Upstart instance states */
+    void watchInstanceStates();
+    std::uint64_t instanceStateSerial();
+    bool instanceStateChangedSince(const std::string& path, std::uint64_t serial);
+
     static std::string printJson(std::shared_ptr<JsonObject> jsonobj);
     static std::string printJson(std::shared_ptr<JsonNode> jsonnode);
 
@@ -103,15 +174,179 @@ private:
 
     std::shared_ptr<ZeitgeistLog> zgLog_;
 
+    std::shared_ptr<ZeitgeistLog> getZgLog();
+
+    /** Zeitgeist events waiting to be sent together */
+    std::shared_ptr<ZgEventQueue> zgQueue_;
+
+    std::shared_ptr<ZgEventQueue> getZgQueue();
+
     std::shared_ptr<GDBusConnection> cgManager_;
 
     void initCGManager();
 
+    /** Tracker for PIDs using process events, only created when
+        enabled and the kernel lets us have the events. */
+    std::shared_ptr<ProcWatcher> procWatcher_;
+    /** Set once we've tried to build the watcher so we only try once */
+    bool procWatcherTried_;
+
+    /** Reader for the cgroup counters, figures out the hierarchy once */
+    std::shared_ptr<CGroupUsage> cgroupUsage_;
+
+    /** Which process owns each connection on the session bus, used to
+        find the connections of an application for second exec */
+    std::shared_ptr<BusNameIndex> busNameIndex_;
+
+    /** Running untrusted helpers, kept current from the Upstart job's
+        instance signals */
+    std::shared_ptr<HelperInstanceTable> helperInstances_;
+
+    /** Untrusted helpers that are started and parked, only used when
+        UBUNTU_APP_LAUNCH_HELPER_POOL is set or setHelperPool() is called */
+    std::shared_ptr<HelperPool> helperPool_;
+    /** Whether a fill of the helper pool is scheduled */
+    bool helperPoolScheduled_;
+    /** Keeps the instance IDs of the parked helpers unique */
+    unsigned int helperPoolSerial_;
+
+    void scheduleHelperPoolFill();
+    void helperPoolFill();
+    void helperPoolStop(const std::string& type, const std::string& appid, const std::string& instanceid);
+    pid_t helperMainPid(const std::string& path);
+
+    /** Applications that have been started and parked, waiting to be
+        launched */
+    std::shared_ptr<PrelaunchPool> prelaunchPool_;
+
+    /** Lists of the files applications used while starting, only
+        used when UBUNTU_APP_LAUNCH_READAHEAD is set */
+    std::shared_ptr<ReadaheadRecorder> readahead_;
+
+    /** Milestones of the recent launches, always kept */
+    std::shared_ptr<LaunchTimeline> launchTimeline_;
+
+    /** History based guesses at what will be launched next, only used
+        when UBUNTU_APP_LAUNCH_PREDICT is set */
+    std::shared_ptr<LaunchPredictor> launchPredictor_;
+    /** Whether the history has been loaded from Zeitgeist */
+    bool predictorSeeded_;
+    /** Bumped each time prewarming is scheduled so only the last timer runs */
+    unsigned int prewarmGeneration_;
+    /** Click manifests of the prewarmed applications along with their
+        version, keyed by package */
+    std::map<std::string, std::pair<std::string, std::shared_ptr<JsonObject>>> warmManifests_;
+
+    void predictorSeed(const std::shared_ptr<Registry>& reg);
+    void schedulePrewarm(const std::shared_ptr<Registry>& reg, std::chrono::seconds delay);
+    void prewarm(const std::shared_ptr<Registry>& reg);
+    void warmClickManifest(const std::string& package);
+
+    /** Policy grading the OOM scores of paused apps, only used when
+        UBUNTU_APP_LAUNCH_OOM_POLICY is set */
+    std::shared_ptr<OomPolicy> oomPolicy_;
+    /** How to write a score to each of the paused jobs */
+    std::map<std::string, std::function<void(std::int32_t)>> oomPolicyAppliers_;
+    /** Whether there is an update scheduled */
+    bool oomPolicyScheduled_;
+
+    void oomPolicyUpdate();
+
     std::unordered_map<std::string, std::shared_ptr<IconFinder>> _iconFinders;
 
+    /* Lifecycle signals, we only subscribe on DBus the first time
+       someone asks for each of them */
+    core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&> sig_appStarted;
+    core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&> sig_appStopped;
+    core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&, FailureType>
+        sig_appFailed;
+    core::Signal<const std::shared_ptr<Application>&,
+                 const std::shared_ptr<Application::Instance>&,
+                 const std::vector<pid_t>&>
+        sig_appPaused;
+    core::Signal<const std::shared_ptr<Application>&,
+                 const std::shared_ptr<Application::Instance>&,
+                 const std::vector<pid_t>&>
+        sig_appResumed;
+    core::Signal<const std::list<Registry::AppEvent>&> sig_appEventBatch;
+
+    std::once_flag flag_appStarted;
+    std::once_flag flag_appStopped;
+    std::once_flag flag_appFailed;
+    std::once_flag flag_appPaused;
+    std::once_flag flag_appResumed;
+    std::once_flag flag_appEventBatch;
+
+    /** Handles for all the DBus subscriptions so we can drop them */
+    std::list<guint> lifecycleSubscriptions_;
+
+    /** The objects that we've handed out in signals. They're weak as the
+        objects hold the registry, but as long as the subscriber holds on
+        to them we can use the same ones for the next event. */
+    struct LifecycleEntry
+    {
+        std::weak_ptr<Application> app;
+        /** Instances that we've seen start, by Upstart instance name */
+        std::map<std::string, std::weak_ptr<Application::Instance>> instances;
+    };
+    /** Cache of lifecycle objects by AppID */
+    std::map<std::string, LifecycleEntry> lifecycleCache_;
+
+    /** Events waiting to be sent in the next batch */
+    std::list<Registry::AppEvent> appEventQueue_;
+    /** Length of the batch window */
+    std::chrono::milliseconds appEventWindow_;
+    /** Whether the batch timer is running */
+    bool appEventScheduled_;
+    /** Whether to remove events that cancel out from the batches */
+    bool appEventCoalesce_;
+    /** Counters for the batches */
+    Registry::AppEventStats appEventStats_;
+
+    guint subscribeSignal(const gchar* interface,
+                          const gchar* signal,
+                          const gchar* path,
+                          const gchar* arg0,
+                          std::function<void(const gchar*, GVariant*)> func);
+    void subscribeUpstartEvent(const std::shared_ptr<Registry>& reg, const std::string& event);
+    void subscribePausedResumed(const std::shared_ptr<Registry>& reg, const std::string& signal, bool paused);
+    std::shared_ptr<Application> lifecycleApp(const std::shared_ptr<Registry>& reg, const std::string& appid);
+    std::shared_ptr<Application::Instance> lifecycleInstance(const std::shared_ptr<Application>& app,
+                                                             const std::vector<pid_t>& pids);
+    bool foldAppEvent(const Registry::AppEvent& event);
+    void queueAppEvent(Registry::AppEvent&& event);
+
     /** Getting the Upstart job path is relatively expensive in
-        that it requires a DBus call. Worth keeping a cache of. */
-    std::map<std::string, std::string> upstartJobPathCache_;
+        that it requires a DBus call. Worth keeping a cache of. Read
+        from any thread, so only use it with std::atomic_load() and
+        std::atomic_store(). */
+    std::shared_ptr<UpstartJobPaths> upstartJobPaths_;
+
+    /** Subscription for Unity's answers to the starting handshake */
+    guint startingSubscription_;
+    /** Launches waiting for Unity to answer, by AppID */
+    std::map<std::string, std::list<std::shared_ptr<StartingHandshake>>> startingWaiters_;
+    /** How long a launch waits for Unity to answer */
+    std::chrono::milliseconds startingTimeout_;
+    /** Counters for the handshakes */
+    Registry::StartingHandshakeStats startingStats_;
+    /** Where to put the handshake of a launch that waits for it later */
+    std::shared_ptr<StartingHandshake>* startingDeferred_;
+
+    /** Subscription to the instances' StateChanged signals */
+    guint instanceStateSubscription_;
+    /** Protects the instance state serials */
+    std::mutex instanceStateLock_;
+    /** Serial of the last state change for each instance path, instances
+        are dropped when they go to waiting */
+    std::map<std::string, std::uint64_t> instanceStateChanges_;
+    /** Bumped on every state change */
+    std::uint64_t instanceStateSerial_;
+    /** Serial of the last instance that was dropped, anything older than
+        it that we don't have an entry for could have changed */
+    std::uint64_t instanceStateForgotten_;
+
+    void startingHandshakeFinish(const std::shared_ptr<StartingHandshake>& handshake, bool answered);
 };
 
 }  // namespace app_launch
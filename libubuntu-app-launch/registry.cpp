@@ -21,9 +21,15 @@
 #include <numeric>
 #include <regex>
 
+#include "cgroup-usage.h"
+#include "helper-instance-table.h"
+#include "helper-pool.h"
+#include "launch-predictor.h"
+#include "prelaunch-pool.h"
 #include "registry-impl.h"
 #include "registry.h"
 
+#include "application-impl-base.h"
 #include "application-impl-click.h"
 #include "application-impl-legacy.h"
 #include "application-impl-libertine.h"
@@ -118,6 +124,79 @@ std::list<std::shared_ptr<Application>> Registry::installedApps(std::shared_ptr<
     return list;
 }
 
+std::list<std::future<std::shared_ptr<Application::Instance>>> Registry::launchMany(
+    const std::list<LaunchRequest>& requests, std::shared_ptr<Registry> connection)
+{
+    struct Launch
+    {
+        std::shared_ptr<Application> app;
+        std::shared_ptr<Application::Instance> instance;
+        std::shared_ptr<Impl::StartingHandshake> handshake;
+        std::exception_ptr error;
+    };
+
+    /* Find all the applications before starting any of them, so that
+       the launches go out together */
+    std::vector<Launch> launches;
+    for (const auto& request : requests)
+    {
+        Launch launch{};
+        try
+        {
+            launch.app = Application::create(request.appid, connection);
+        }
+        catch (...)
+        {
+            launch.error = std::current_exception();
+        }
+        launches.emplace_back(std::move(launch));
+    }
+
+    connection->impl->thread.executeOnThread<bool>([&launches, &requests, &connection]() {
+        auto request = requests.begin();
+        for (auto& launch : launches)
+        {
+            const auto& urls = (request++)->urls;
+            if (!launch.app)
+            {
+                continue;
+            }
+
+            try
+            {
+                launch.handshake = connection->impl->startingHandshakeDefer(
+                    [&launch, &urls]() { launch.instance = launch.app->launch(urls); });
+            }
+            catch (...)
+            {
+                launch.error = std::current_exception();
+            }
+        }
+        return true;
+    });
+
+    std::list<std::future<std::shared_ptr<Application::Instance>>> futures;
+    for (auto& launch : launches)
+    {
+        if (launch.error)
+        {
+            std::promise<std::shared_ptr<Application::Instance>> promise;
+            promise.set_exception(launch.error);
+            futures.emplace_back(promise.get_future());
+            continue;
+        }
+
+        auto handshake = launch.handshake;
+        auto instance = launch.instance;
+        futures.emplace_back(std::async(std::launch::deferred, [connection, handshake, instance]() {
+            connection->impl->startingHandshakeWait(handshake);
+            return instance;
+        }));
+    }
+
+    return futures;
+}
+
 std::list<std::shared_ptr<Helper>> Registry::runningHelpers(Helper::Type type, std::shared_ptr<Registry> connection)
 {
     std::list<std::shared_ptr<Helper>> list;
@@ -127,6 +206,269 @@ std::list<std::shared_ptr<Helper>> Registry::runningHelpers(Helper::Type type, s
     return list;
 }
 
+std::list<Registry::HelperInstances> Registry::runningHelperInstances(std::shared_ptr<Registry> connection)
+{
+    return connection->impl->thread.executeOnThread<std::list<HelperInstances>>([connection]() {
+        std::list<HelperInstances> list;
+
+        /* Without the table we'd need the types to ask Upstart about them
+           one by one, so the caller needs to know we couldn't look */
+        auto table = connection->impl->getHelperInstances();
+        if (!table)
+        {
+            throw std::runtime_error("Unable to get the instances of the untrusted helper job");
+        }
+
+        for (const auto& helper : table->all())
+        {
+            list.emplace_back(HelperInstances{Helper::Type::from_raw(helper.first.first),
+                                              AppID::parse(helper.first.second),
+                                              std::vector<std::string>(helper.second.begin(), helper.second.end())});
+        }
+
+        return list;
+    });
+}
+
+unsigned int Registry::stopHelpers(Helper::Type type, std::shared_ptr<Registry> connection)
+{
+    return connection->impl->stopHelpers(type.value());
+}
+
+void Registry::setHelperPool(Helper::Type type,
+                             const std::list<AppID>& appids,
+                             unsigned int size,
+                             std::shared_ptr<Registry> connection)
+{
+#ifndef ENABLE_HELPER_POOL
+    if (size > 0 && !appids.empty())
+    {
+        g_warning("Keeping helpers warm isn't supported by the untrusted helper job");
+        return;
+    }
+#endif
+
+    std::list<std::string> appidstrs;
+    for (const auto& appid : appids)
+    {
+        appidstrs.push_back(appid);
+    }
+
+    connection->impl->setHelperPool(type.value(), appidstrs, size);
+}
+
+Registry::HelperPoolStats Registry::helperPoolStats(std::shared_ptr<Registry> connection)
+{
+    return connection->impl->thread.executeOnThread<HelperPoolStats>([&connection]() {
+        auto stats = connection->impl->getHelperPool()->stats();
+        return HelperPoolStats{stats.parked, stats.hits, stats.misses};
+    });
+}
+
+std::list<Registry::InstanceResources> Registry::resourceSnapshot(std::shared_ptr<Registry> connection)
+{
+    static const std::regex jobregex("^(application-click|application-legacy|application-snap)-(.*)$");
+    static const std::regex instanceregex("^(.*)-([0-9]*)$");
+
+    auto usage = connection->impl->getCGroupUsage();
+    std::map<std::string, std::shared_ptr<Application>> apps;
+    std::list<InstanceResources> list;
+
+    for (const auto& jobpath : usage->jobs())
+    {
+        std::smatch jobmatch;
+        if (!std::regex_match(jobpath, jobmatch, jobregex))
+        {
+            continue;
+        }
+
+        std::string job = jobmatch[1].str();
+        std::string appname = jobmatch[2].str();
+        std::string instance;
+
+        /* Click doesn't have multiple instances */
+        if (job != "application-click")
+        {
+            std::smatch instancematch;
+            std::string fullname = appname;
+            if (!std::regex_match(fullname, instancematch, instanceregex))
+            {
+                g_warning("Unable to match instance name: %s", fullname.c_str());
+                continue;
+            }
+            appname = instancematch[1].str();
+            instance = instancematch[2].str();
+        }
+
+        try
+        {
+            auto& app = apps[appname];
+            if (!app)
+            {
+                auto appid = AppID::find(connection, appname);
+                if (appid.empty())
+                {
+                    g_debug("Unable to find AppID for job '%s'", jobpath.c_str());
+                    continue;
+                }
+                app = Application::create(appid, connection);
+            }
+
+            auto appinstance = std::make_shared<app_impls::UpstartInstance>(
+                app->appId(), job, instance, std::vector<Application::URL>{}, connection);
+            list.emplace_back(InstanceResources{app, appinstance, usage->forJob(jobpath)});
+        }
+        catch (std::runtime_error& e)
+        {
+            g_warning("Unable to get resources for job '%s': %s", jobpath.c_str(), e.what());
+        }
+    }
+
+    return list;
+}
+
+core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&>& Registry::appStarted(
+    const std::shared_ptr<Registry>& reg)
+{
+    return reg->impl->appStarted(reg);
+}
+
+core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&>& Registry::appStopped(
+    const std::shared_ptr<Registry>& reg)
+{
+    return reg->impl->appStopped(reg);
+}
+
+core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&, Registry::FailureType>&
+    Registry::appFailed(const std::shared_ptr<Registry>& reg)
+{
+    return reg->impl->appFailed(reg);
+}
+
+core::Signal<const std::shared_ptr<Application>&,
+             const std::shared_ptr<Application::Instance>&,
+             const std::vector<pid_t>&>&
+    Registry::appPaused(const std::shared_ptr<Registry>& reg)
+{
+    return reg->impl->appPaused(reg);
+}
+
+core::Signal<const std::shared_ptr<Application>&,
+             const std::shared_ptr<Application::Instance>&,
+             const std::vector<pid_t>&>&
+    Registry::appResumed(const std::shared_ptr<Registry>& reg)
+{
+    return reg->impl->appResumed(reg);
+}
+
+core::Signal<const std::list<Registry::AppEvent>&>& Registry::appEventBatch(const std::shared_ptr<Registry>& reg)
+{
+    return reg->impl->appEventBatch(reg);
+}
+
+void Registry::setAppEventBatchWindow(std::chrono::milliseconds window, const std::shared_ptr<Registry>& reg)
+{
+    reg->impl->setAppEventBatchWindow(window);
+}
+
+void Registry::setAppEventCoalescing(bool coalesce, const std::shared_ptr<Registry>& reg)
+{
+    reg->impl->setAppEventCoalescing(coalesce);
+}
+
+Registry::AppEventStats Registry::appEventStats(const std::shared_ptr<Registry>& reg)
+{
+    return reg->impl->appEventStats();
+}
+
+void Registry::setStartingHandshakeTimeout(std::chrono::milliseconds timeout, const std::shared_ptr<Registry>& reg)
+{
+    reg->impl->setStartingHandshakeTimeout(timeout);
+}
+
+Registry::StartingHandshakeStats Registry::startingHandshakeStats(const std::shared_ptr<Registry>& reg)
+{
+    return reg->impl->startingHandshakeStats();
+}
+
+bool Registry::prelaunch(const std::shared_ptr<Application>& app, const std::shared_ptr<Registry>& reg)
+{
+    auto pool = reg->impl->getPrelaunchPool();
+    if (!app || pool->size() == 0)
+    {
+        return false;
+    }
+
+    auto base = std::dynamic_pointer_cast<app_impls::Base>(app);
+    if (!base)
+    {
+        return false;
+    }
+
+    /* Apps that don't support the lifecycle can't be started without
+       the user seeing them */
+    try
+    {
+        if (!app->info()->supportsUbuntuLifecycle().value())
+        {
+            g_debug("Not prelaunching '%s' as it doesn't support the lifecycle", std::string(app->appId()).c_str());
+            return false;
+        }
+    }
+    catch (std::runtime_error& e)
+    {
+        g_warning("Unable to get info to prelaunch '%s': %s", std::string(app->appId()).c_str(), e.what());
+        return false;
+    }
+
+    if (app->hasInstances())
+    {
+        return false;
+    }
+
+    return base->prelaunch();
+}
+
+void Registry::setPrelaunchPoolSize(unsigned int size, const std::shared_ptr<Registry>& reg)
+{
+#ifndef ENABLE_PRELAUNCH_POOL
+    if (size > 0)
+    {
+        g_warning("Prelaunching isn't supported by the application jobs");
+        return;
+    }
+#endif
+
+    reg->impl->thread.executeOnThread<bool>([size, &reg]() {
+        for (const auto& entry : reg->impl->getPrelaunchPool()->setSize(size))
+        {
+            app_impls::UpstartInstance::stopJob(reg, entry.appid, entry.job, entry.instance, false);
+        }
+        return true;
+    });
+}
+
+Registry::PrelaunchStats Registry::prelaunchStats(const std::shared_ptr<Registry>& reg)
+{
+    return reg->impl->thread.executeOnThread<PrelaunchStats>([&reg]() {
+        auto stats = reg->impl->getPrelaunchPool()->stats();
+        return PrelaunchStats{stats.prelaunched, stats.hits, stats.misses, stats.evicted};
+    });
+}
+
+void Registry::setLaunchPrediction(unsigned int candidates, const std::shared_ptr<Registry>& reg)
+{
+    reg->impl->setLaunchPrediction(reg, candidates);
+}
+
+Registry::PredictionStats Registry::predictionStats(const std::shared_ptr<Registry>& reg)
+{
+    return reg->impl->thread.executeOnThread<PredictionStats>([&reg]() {
+        auto stats = reg->impl->getLaunchPredictor(reg)->stats();
+        return PredictionStats{stats.launches, stats.hits, stats.prewarmed, stats.savedUsec};
+    });
+}
+
 std::shared_ptr<Registry> defaultRegistry;
 std::shared_ptr<Registry> Registry::getDefault()
 {
@@ -17,8 +17,11 @@
  *     Ted Gould <ted.gould@canonical.com>
  */
 
+#include <chrono>
 #include <core/signal.h>
+#include <cstdint>
 #include <functional>
+#include <future>
 #include <list>
 #include <memory>
 
@@ -73,14 +76,287 @@ public:
     */
     static std::list<std::shared_ptr<Application>> installedApps(std::shared_ptr<Registry> registry = getDefault());
 
-#if 0 /* TODO -- In next MR */
+    /* Launching a set of applications */
+    /** An application to launch with launchMany() */
+    struct LaunchRequest
+    {
+        AppID appid;                        /**< Application to launch */
+        std::vector<Application::URL> urls; /**< URLs to pass to it, can be empty */
+    };
+
+    /** Launch a set of applications at once, like when restoring a session.
+        All of the applications are found first, then their starting
+        broadcasts and Upstart jobs are sent back to back so that the round
+        trips overlap instead of each launch waiting on the one before it.
+
+        There is a future for each request, in the same order. Getting its
+        value waits for the shell to answer that application's starting
+        handshake, or for it to time out. If the application couldn't be
+        found or launched the future holds the exception.
+
+        \param requests Applications to launch
+        \param registry Shared registry for the tracking
+    */
+    static std::list<std::future<std::shared_ptr<Application::Instance>>> launchMany(
+        const std::list<LaunchRequest>& requests, std::shared_ptr<Registry> registry = getDefault());
+
+    /* Resource usage */
+    /** The resource usage of a single running instance */
+    struct InstanceResources
+    {
+        std::shared_ptr<Application> app;                /**< Application the instance belongs to */
+        std::shared_ptr<Application::Instance> instance; /**< The running instance */
+        Application::Instance::ResourceUsage usage;      /**< Counters for the instance */
+    };
+
+    /** Get the resource usage for all of the running application instances.
+        This looks at the application cgroups directly so it does not need
+        to ask Upstart about each application, and the counters for all of
+        the instances are read in one pass.
+
+        \param registry Shared registry for the tracking
+    */
+    static std::list<InstanceResources> resourceSnapshot(std::shared_ptr<Registry> registry = getDefault());
+
     /* Signals to discover what is happening to apps */
-    core::Signal<std::shared_ptr<Application>, std::shared_ptr<Application::Instance>> appStarted;
-    core::Signal<std::shared_ptr<Application>, std::shared_ptr<Application::Instance>> appStopped;
-    core::Signal<std::shared_ptr<Application>, std::shared_ptr<Application::Instance>, FailureType> appFailed;
-    core::Signal<std::shared_ptr<Application>, std::shared_ptr<Application::Instance>> appPaused;
-    core::Signal<std::shared_ptr<Application>, std::shared_ptr<Application::Instance>> appResumed;
+    /** Get the signal object that is signaled when an application has been
+        started.
+
+        \note This signal handler is activated on the UAL thread, if you want
+            to execute on a different thread you can use
+            core::Connection::dispatch_via() to send it where you'd like.
+
+        \param reg Registry to get the handler from
+    */
+    static core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&>& appStarted(
+        const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Get the signal object that is signaled when an application has stopped.
+
+        \note This signal handler is activated on the UAL thread, if you want
+            to execute on a different thread you can use
+            core::Connection::dispatch_via() to send it where you'd like.
+
+        \param reg Registry to get the handler from
+    */
+    static core::Signal<const std::shared_ptr<Application>&, const std::shared_ptr<Application::Instance>&>& appStopped(
+        const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Get the signal object that is signaled when an application has failed.
+        The instance may be empty if the application failed before it was
+        started.
+
+        \note This signal handler is activated on the UAL thread, if you want
+            to execute on a different thread you can use
+            core::Connection::dispatch_via() to send it where you'd like.
+
+        \param reg Registry to get the handler from
+    */
+    static core::Signal<const std::shared_ptr<Application>&,
+                        const std::shared_ptr<Application::Instance>&,
+                        FailureType>&
+        appFailed(const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Get the signal object that is signaled when an application has been
+        paused, along with the PIDs that were paused.
+
+        \note This signal handler is activated on the UAL thread, if you want
+            to execute on a different thread you can use
+            core::Connection::dispatch_via() to send it where you'd like.
+
+        \param reg Registry to get the handler from
+    */
+    static core::Signal<const std::shared_ptr<Application>&,
+                        const std::shared_ptr<Application::Instance>&,
+                        const std::vector<pid_t>&>&
+        appPaused(const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Get the signal object that is signaled when an application has been
+        resumed, along with the PIDs that were resumed.
+
+        \note This signal handler is activated on the UAL thread, if you want
+            to execute on a different thread you can use
+            core::Connection::dispatch_via() to send it where you'd like.
+
+        \param reg Registry to get the handler from
+    */
+    static core::Signal<const std::shared_ptr<Application>&,
+                        const std::shared_ptr<Application::Instance>&,
+                        const std::vector<pid_t>&>&
+        appResumed(const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** A single lifecycle event, used when delivering them in batches */
+    struct AppEvent
+    {
+        /** What happened to the application */
+        enum class Type
+        {
+            STARTED, /**< Same as appStarted() */
+            STOPPED, /**< Same as appStopped() */
+            FAILED,  /**< Same as appFailed() */
+            PAUSED,  /**< Same as appPaused() */
+            RESUMED  /**< Same as appResumed() */
+        };
+
+        Type type;                                       /**< What happened */
+        std::shared_ptr<Application> app;                /**< The application it happened to */
+        std::shared_ptr<Application::Instance> instance; /**< The instance, may be empty for failures */
+        FailureType failure;                             /**< Why it failed, only valid for FAILED */
+        std::vector<pid_t> pids;                         /**< PIDs for PAUSED and RESUMED */
+    };
+
+    /** Get a signal that delivers all the lifecycle events in batches. The
+        first event starts a window, and everything that happens in that
+        window is delivered together in the order it happened. This is
+        useful for things that would otherwise do a bunch of work for each
+        event during a storm, like all the apps starting at session start.
+
+        \note This signal handler is activated on the UAL thread, if you want
+            to execute on a different thread you can use
+            core::Connection::dispatch_via() to send it where you'd like.
+
+        \param reg Registry to get the handler from
+    */
+    static core::Signal<const std::list<AppEvent>&>& appEventBatch(const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Set how long the window for appEventBatch() is, the default is
+        200 milliseconds.
+
+        \param window Length of the window
+        \param reg Registry to set the window on
+    */
+    static void setAppEventBatchWindow(std::chrono::milliseconds window,
+                                       const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Turn on coalescing for appEventBatch(), off by default. When it is
+        on, events in a batch for the same instance that cancel each other
+        out are removed. A start followed by a stop, or a pause followed by
+        a resume (or the other way around) are both dropped, and a repeated
+        pause or resume is only sent once. Batches that end up empty are
+        not sent.
+
+        \param coalesce Whether to remove events that cancel out
+        \param reg Registry to set coalescing on
+    */
+    static void setAppEventCoalescing(bool coalesce, const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Counters for the events that have gone through appEventBatch() */
+    struct AppEventStats
+    {
+        std::uint64_t received; /**< Events put into batches */
+        std::uint64_t folded;   /**< Events removed by coalescing */
+        std::uint64_t batches;  /**< Batches sent */
+    };
+
+    /** Get the counters for appEventBatch() since the registry was created
+
+        \param reg Registry to get the counters from
+    */
+    static AppEventStats appEventStats(const std::shared_ptr<Registry>& reg = getDefault());
+
+    /* Starting handshake */
+    /** Set how long a launch waits for the shell to say that it knows an
+        application is starting, the default is one second. Each launch
+        waits on its own deadline without holding up the registry, so a
+        slow answer doesn't delay other launches. Processes that watch for
+        applications starting themselves don't wait at all.
 
+        \param timeout How long to wait for the answer
+        \param reg Registry to set the timeout on
+    */
+    static void setStartingHandshakeTimeout(std::chrono::milliseconds timeout,
+                                            const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Counters for the starting handshakes */
+    struct StartingHandshakeStats
+    {
+        std::uint64_t handshakes; /**< Launches that did the handshake */
+        std::uint64_t answered;   /**< Handshakes the shell answered before the deadline */
+        std::uint64_t timeouts;   /**< Handshakes that gave up waiting for the shell */
+    };
+
+    /** Get the starting handshake counters since the registry was created
+
+        \param reg Registry to get the counters from
+    */
+    static StartingHandshakeStats startingHandshakeStats(const std::shared_ptr<Registry>& reg = getDefault());
+
+    /* Prelaunching */
+    /** Start an application ahead of time so that launching it later is
+        faster. The application's job is started and gets everything setup,
+        including its confinement, then waits before running the application.
+        A later launch without URLs just tells it to go, a launch with URLs
+        stops it and launches normally.
+
+        Only applications that support the Ubuntu lifecycle can be
+        prelaunched, and nothing happens unless the pool has a size, either
+        from UBUNTU_APP_LAUNCH_PRELAUNCH_POOL or setPrelaunchPoolSize(),
+        and the application jobs were built with enable_prelaunch_pool.
+        Returns whether the application is now prelaunched.
+
+        \param app Application to prelaunch
+        \param reg Registry to keep the pool on
+    */
+    static bool prelaunch(const std::shared_ptr<Application>& app, const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Set how many applications of each type can be prelaunched at once,
+        when there are more the oldest ones are stopped. Zero turns
+        prelaunching off, and the most allowed is eight.
+
+        \param size Number of prelaunched applications of each type
+        \param reg Registry to set the size on
+    */
+    static void setPrelaunchPoolSize(unsigned int size, const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Counters for how prelaunching is working out */
+    struct PrelaunchStats
+    {
+        std::uint64_t prelaunched; /**< Applications that were prelaunched */
+        std::uint64_t hits;        /**< Launches that used a prelaunched application */
+        std::uint64_t misses;      /**< Launches that started from scratch while prelaunching was on */
+        std::uint64_t evicted;     /**< Prelaunched applications stopped to make room */
+    };
+
+    /** Get the prelaunching counters since the registry was created
+
+        \param reg Registry to get the counters from
+    */
+    static PrelaunchStats prelaunchStats(const std::shared_ptr<Registry>& reg = getDefault());
+
+    /* Launch prediction */
+    /** Set how many applications to prewarm based on the launch history.
+        The history comes from Zeitgeist and is updated as applications
+        are launched. Once there haven't been any launches for a while the
+        most likely applications to be launched next, based on how often
+        they're used and how often at this time of day, get their manifests,
+        desktop files and icons looked up, their files read ahead and are
+        prelaunched if there is a prelaunch pool.
+
+        The default comes from UBUNTU_APP_LAUNCH_PREDICT, and zero turns
+        prediction off. The most allowed is eight.
+
+        \param candidates Number of applications to prewarm
+        \param reg Registry to set the prediction on
+    */
+    static void setLaunchPrediction(unsigned int candidates, const std::shared_ptr<Registry>& reg = getDefault());
+
+    /** Counters for how launch prediction is working out */
+    struct PredictionStats
+    {
+        std::uint64_t launches;  /**< Launches while prediction was on */
+        std::uint64_t hits;      /**< Launches of an application that was prewarmed */
+        std::uint64_t prewarmed; /**< Applications that were prewarmed */
+        std::uint64_t savedUsec; /**< Time spent prewarming the applications that were hits, an estimate of the
+                                    time saved on their launches */
+    };
+
+    /** Get the launch prediction counters since the registry was created
+
+        \param reg Registry to get the counters from
+    */
+    static PredictionStats predictionStats(const std::shared_ptr<Registry>& reg = getDefault());
+
+#if 0 /* TODO -- In next MR */
     /* The Application Manager, almost always if you're not Unity8, don't
        use this API. Testing is a special case. */
     class Manager
@@ -105,6 +381,71 @@ public:
     static std::list<std::shared_ptr<Helper>> runningHelpers(Helper::Type type,
                                                              std::shared_ptr<Registry> registry = getDefault());
 
+    /** The running instances of one helper */
+    struct HelperInstances
+    {
+        Helper::Type type;                    /**< Type of the helper */
+        AppID appid;                          /**< AppID of the helper */
+        std::vector<std::string> instanceIds; /**< Instances, an empty ID is a single instance helper */
+    };
+
+    /** Get every running helper of every type along with its instances,
+        sorted by type and then AppID. This is one lookup, so it's much
+        cheaper than going through the types and helpers one by one.
+        Throws std::runtime_error if Upstart can't tell us the instances.
+
+        \param registry Shared registry for the tracking
+    */
+    static std::list<HelperInstances> runningHelperInstances(std::shared_ptr<Registry> registry = getDefault());
+
+    /** Stop every instance of every helper of a type. The requests are
+        all sent at once and then waited on together, so this returns
+        once Upstart has stopped them. Returns the number of instances
+        that were stopped.
+
+        \param type Helper type string
+        \param registry Shared registry for the tracking
+    */
+    static unsigned int stopHelpers(Helper::Type type, std::shared_ptr<Registry> registry = getDefault());
+
+    /* Helper pool */
+    /** Keep helpers of a type started and parked so that launching them
+        only needs a signal. A helper is confined to its AppID as soon as
+        it starts, so only the AppIDs that are listed are kept, each with
+        size parked helpers. Only launches without URLs can use a parked
+        helper. The pool is refilled in the background after launches.
+
+        The default comes from UBUNTU_APP_LAUNCH_HELPER_POOL, a comma
+        separated list of type:appid pairs, with the size from
+        UBUNTU_APP_LAUNCH_HELPER_POOL_SIZE. An empty list or a zero size
+        turns it off for the type, and the most allowed is four. The pool
+        stays empty unless the library was built with enable_helper_pool,
+        as the untrusted helper job needs to be able to park them.
+
+        \param type Helper type
+        \param appids AppIDs of the helpers to keep parked
+        \param size Number of parked helpers for each AppID
+        \param registry Shared registry for the tracking
+    */
+    static void setHelperPool(Helper::Type type,
+                              const std::list<AppID>& appids,
+                              unsigned int size,
+                              std::shared_ptr<Registry> registry = getDefault());
+
+    /** Counters for how the helper pool is working out */
+    struct HelperPoolStats
+    {
+        std::uint64_t parked; /**< Helpers that were started and parked */
+        std::uint64_t hits;   /**< Launches that used a parked helper */
+        std::uint64_t misses; /**< Launches of listed helpers that started from scratch */
+    };
+
+    /** Get the helper pool counters since the registry was created
+
+        \param registry Registry to get the counters from
+    */
+    static HelperPoolStats helperPoolStats(std::shared_ptr<Registry> registry = getDefault());
+
     /* Default Junk */
     /** Use the Registry as a global singleton, this function will create
         a Registry object if one doesn't exist. Use of this function is
@@ -37,6 +37,8 @@ typedef struct {
 	guint64 unity_starttime;
 	GSource * timer;
 	guint signal;
+	gint64 starttime;
+	gboolean indexed;
 } second_exec_t;
 
 static void second_exec_complete (second_exec_t * data);
@@ -354,8 +356,26 @@ find_appid_pid (GDBusConnection * session, second_exec_t * data)
 	return;
 }
 
+/* We already know the connections of the application, so we can just
+   send to each of them */
+static void
+contact_app_names (GDBusConnection * session, const gchar * const * bus_names, second_exec_t * data)
+{
+	int i;
+	for (i = 0; bus_names[i] != NULL; i++) {
+		data->connections_open++;
+		contact_app(session, bus_names[i], data);
+	}
+
+	g_debug("Got %d bus names from the index", i);
+	ual_tracepoint(second_exec_names_indexed, data->appid, i);
+}
+
+/* If the caller has an index of which bus names belong to the PID it can
+   pass them in @bus_names, otherwise (NULL) we ask the bus about every
+   connection on it to find them */
 gboolean
-second_exec (GDBusConnection * session, GCancellable * cancel, GPid pid, const gchar * app_id, gchar ** appuris)
+second_exec (GDBusConnection * session, GCancellable * cancel, GPid pid, const gchar * app_id, gchar ** appuris, const gchar * const * bus_names)
 {
 	ual_tracepoint(second_exec_start, app_id);
 	GError * error = NULL;
@@ -366,6 +386,8 @@ second_exec (GDBusConnection * session, GCancellable * cancel, GPid pid, const g
 	data->input_uris = g_strdupv(appuris);
 	data->bus = g_object_ref(session);
 	data->app_pid = pid;
+	data->starttime = g_get_monotonic_time();
+	data->indexed = bus_names != NULL;
 
 	/* Set up listening for the unfrozen signal from Unity */
 	data->signal = g_dbus_connection_signal_subscribe(session,
@@ -405,7 +427,11 @@ second_exec (GDBusConnection * session, GCancellable * cancel, GPid pid, const g
 
 	/* If we've got something to give out, start looking for how */
 	if (data->input_uris != NULL) {
-		find_appid_pid(session, data);
+		if (bus_names != NULL) {
+			contact_app_names(session, bus_names, data);
+		} else {
+			find_appid_pid(session, data);
+		}
 	} else {
 		g_debug("No URIs to send");
 	}
@@ -453,6 +479,7 @@ second_exec_complete (second_exec_t * data)
 	}
 
 	ual_tracepoint(second_exec_finish, data->appid);
+	ual_tracepoint(second_exec_duration, data->appid, g_get_monotonic_time() - data->starttime, data->indexed);
 	g_debug("Second Exec complete");
 
 	/* Clean up */
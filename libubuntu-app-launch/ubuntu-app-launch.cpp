@@ -32,6 +32,7 @@ extern "C" {
 #include "ual-tracepoint.h"
 #include "recoverable-problem.h"
 #include "proxy-socket-demangler.h"
+#include "usage-store.h"
 }
 
 /* C++ Interface */
@@ -67,47 +68,12 @@ app_uris_string (const gchar * const * uris)
 	return urisjoin;
 }
 
-/* Get the path of the job from Upstart, if we've got it already, we'll just
-   use the cache of the value */
-static const gchar *
-get_jobpath (GDBusConnection * con, const gchar * jobname)
+/* Get the path of the job from the registry, which keeps the cache
+   of them for both the C and C++ APIs */
+static std::string
+get_jobpath (const gchar * jobname)
 {
-	gchar * cachepath = g_strdup_printf("ubuntu-app-lauch-job-path-cache-%s", jobname);
-	gpointer cachedata = g_object_get_data(G_OBJECT(con), cachepath);
-
-	if (cachedata != NULL) {
-		g_free(cachepath);
-		return (const gchar*)cachedata;
-	}
-
-	GError * error = NULL;
-	GVariant * job_path_variant = g_dbus_connection_call_sync(con,
-		DBUS_SERVICE_UPSTART,
-		DBUS_PATH_UPSTART,
-		DBUS_INTERFACE_UPSTART,
-		"GetJobByName",
-		g_variant_new("(s)", jobname),
-		G_VARIANT_TYPE("(o)"),
-		G_DBUS_CALL_FLAGS_NONE,
-		-1, /* timeout: default */
-		NULL, /* cancellable */
-		&error);
-
-	if (error != NULL) {	
-		g_warning("Unable to find job '%s': %s", jobname, error->message);
-		g_error_free(error);
-		g_free(cachepath);
-		return NULL;
-	}
-
-	gchar * job_path = NULL;
-	g_variant_get(job_path_variant, "(o)", &job_path);
-	g_variant_unref(job_path_variant);
-
-	g_object_set_data_full(G_OBJECT(con), cachepath, job_path, g_free);
-	g_free(cachepath);
-
-	return job_path;
+	return ubuntu::app_launch::Registry::getDefault()->impl->upstartJobPath(jobname);
 }
 
 gboolean
@@ -253,54 +219,231 @@ gdbus_upstart_ref (void) {
 	return gdbus_upstart;
 }
 
-/* The data we keep for each observer */
+/* The data we keep for each observer. Adding the same observer more
+   than once is counted so it gets called once for each time it was
+   added, like it would with separate subscriptions. */
 typedef struct _observer_t observer_t;
 struct _observer_t {
-	GDBusConnection * conn;
-	guint sighandle;
-	UbuntuAppLaunchAppObserver func;
+	GCallback func;
 	gpointer user_data;
+	gchar * type; /* Helper type, NULL for everyone else */
+	guint count;
 };
 
-/* The data we keep for each failed observer */
-typedef struct _failed_observer_t failed_observer_t;
-struct _failed_observer_t {
-	GDBusConnection * conn;
-	guint sighandle;
-	UbuntuAppLaunchAppFailedObserver func;
-	gpointer user_data;
-};
+typedef struct _observer_table_t observer_table_t;
+
+/* Decodes the parameters of a signal and calls all the observers */
+typedef void (*observer_dispatch_t) (observer_table_t * table, GDBusConnection * conn, const gchar * sender, GVariant * params);
+
+/* Calls a single observer with the decoded event */
+typedef void (*observer_call_t) (observer_t * observer, gpointer event);
+
+/* All the observers of a signal. They share a single subscription so
+   that each signal is only decoded once, and are indexed by their function,
+   user data and type so that removing them doesn't need to search. */
+struct _observer_table_t {
+	const gchar * lttng_signal; /* Name for the tracepoints */
+	gboolean upstart; /* An Upstart event, otherwise one of our signals */
+	const gchar * signal; /* Upstart event or signal name */
+	observer_dispatch_t dispatch;
 
-/* The data we keep for each failed observer */
-typedef struct _paused_resumed_observer_t paused_resumed_observer_t;
-struct _paused_resumed_observer_t {
 	GDBusConnection * conn;
 	guint sighandle;
-	UbuntuAppLaunchAppPausedResumedObserver func;
-	gpointer user_data;
-	const gchar * lttng_signal;
+	GHashTable * index; /* observer_t -> link in order */
+	GQueue order; /* Newest first, the order they get called in */
+	guint dispatching;
+	GList * removed; /* Links that were removed while dispatching */
 };
 
-/* The lists of Observers */
-static GList * starting_array = NULL;
-static GList * started_array = NULL;
-static GList * stop_array = NULL;
-static GList * focus_array = NULL;
-static GList * resume_array = NULL;
-static GList * failed_array = NULL;
-static GList * paused_array = NULL;
-static GList * resumed_array = NULL;
+static guint
+observer_hash (gconstpointer key)
+{
+	const observer_t * observer = (const observer_t *)key;
+	return g_direct_hash(observer->user_data) ^ (observer->type != NULL ? g_str_hash(observer->type) : 0);
+}
+
+static gboolean
+observer_equal (gconstpointer a, gconstpointer b)
+{
+	const observer_t * obsa = (const observer_t *)a;
+	const observer_t * obsb = (const observer_t *)b;
+	return obsa->func == obsb->func && obsa->user_data == obsb->user_data && g_strcmp0(obsa->type, obsb->type) == 0;
+}
+
+static void
+observer_free (observer_t * observer)
+{
+	g_free(observer->type);
+	g_free(observer);
+}
+
+/* Frees the observers that were removed while we were calling them, and
+   drops the subscription if there is no one left */
+static void
+observer_table_cleanup (observer_table_t * table)
+{
+	if (table->dispatching > 0) {
+		return;
+	}
+
+	GList * look;
+	for (look = table->removed; look != NULL; look = g_list_next(look)) {
+		GList * link = (GList *)look->data;
+		observer_free((observer_t *)link->data);
+		g_queue_delete_link(&table->order, link);
+	}
+	g_list_free(table->removed);
+	table->removed = NULL;
+
+	if (table->conn != NULL && g_hash_table_size(table->index) == 0) {
+		g_dbus_connection_signal_unsubscribe(table->conn, table->sighandle);
+		g_clear_object(&table->conn);
+		table->sighandle = 0;
+	}
+}
 
+/* The single subscription for the table, decodes the signal and fans
+   it out to all the observers */
 static void
-observer_cb (GDBusConnection * conn, const gchar * sender, const gchar * object, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data)
+observer_table_cb (GDBusConnection * conn, const gchar * sender, const gchar * object, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data)
 {
-	observer_t * observer = (observer_t *)user_data;
+	observer_table_t * table = (observer_table_t *)user_data;
 
-	const gchar * signalname = NULL;
-	g_variant_get_child(params, 0, "&s", &signalname);
+	ual_tracepoint(observer_start, table->lttng_signal);
+	gint64 start = g_get_monotonic_time();
+	guint observers = g_hash_table_size(table->index);
 
-	ual_tracepoint(observer_start, signalname);
+	table->dispatching++;
+	table->dispatch(table, conn, sender, params);
+	table->dispatching--;
 
+	ual_tracepoint(observer_dispatched, table->lttng_signal, observers, g_get_monotonic_time() - start);
+
+	observer_table_cleanup(table);
+
+	ual_tracepoint(observer_finish, table->lttng_signal);
+}
+
+/* Call all the observers in a table with a decoded event. Observers
+   that are added while dispatching are at the head, so they don't get
+   called until the next signal. Removed ones have a zero count. */
+static void
+observer_table_foreach (observer_table_t * table, observer_call_t call, gpointer event)
+{
+	GList * link;
+	for (link = table->order.head; link != NULL; link = g_list_next(link)) {
+		observer_t * observer = (observer_t *)link->data;
+		guint i;
+
+		for (i = 0; i < observer->count; i++) {
+			call(observer, event);
+		}
+	}
+}
+
+/* Adds an observer to a table, subscribing to the signal if it's the
+   first one */
+static gboolean
+observer_table_add (observer_table_t * table, GCallback func, gpointer user_data, const gchar * type)
+{
+	if (table->index == NULL) {
+		table->index = g_hash_table_new(observer_hash, observer_equal);
+	}
+
+	if (table->conn == NULL) {
+		if (table->upstart) {
+			table->conn = gdbus_upstart_ref();
+		} else {
+			table->conn = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+		}
+
+		if (table->conn == NULL) {
+			return FALSE;
+		}
+
+		if (table->upstart) {
+			table->sighandle = g_dbus_connection_signal_subscribe(table->conn,
+				NULL, /* sender */
+				DBUS_INTERFACE_UPSTART, /* interface */
+				"EventEmitted", /* signal */
+				DBUS_PATH_UPSTART, /* path */
+				table->signal, /* arg0 */
+				G_DBUS_SIGNAL_FLAGS_NONE,
+				observer_table_cb,
+				table,
+				NULL); /* user data destroy */
+		} else {
+			table->sighandle = g_dbus_connection_signal_subscribe(table->conn,
+				NULL, /* sender */
+				"com.canonical.UbuntuAppLaunch", /* interface */
+				table->signal, /* signal */
+				"/", /* path */
+				NULL, /* arg0 */
+				G_DBUS_SIGNAL_FLAGS_NONE,
+				observer_table_cb,
+				table,
+				NULL); /* user data destroy */
+		}
+	}
+
+	observer_t key = { func, user_data, (gchar *)type, 0 };
+	GList * link = (GList *)g_hash_table_lookup(table->index, &key);
+
+	if (link != NULL) {
+		((observer_t *)link->data)->count++;
+		return TRUE;
+	}
+
+	observer_t * observer = g_new0(observer_t, 1);
+	observer->func = func;
+	observer->user_data = user_data;
+	observer->type = g_strdup(type);
+	observer->count = 1;
+
+	g_queue_push_head(&table->order, observer);
+	g_hash_table_insert(table->index, observer, table->order.head);
+
+	return TRUE;
+}
+
+/* Removes an observer from the table */
+static gboolean
+observer_table_delete (observer_table_t * table, GCallback func, gpointer user_data, const gchar * type)
+{
+	if (table->index == NULL) {
+		return FALSE;
+	}
+
+	observer_t key = { func, user_data, (gchar *)type, 0 };
+	GList * link = (GList *)g_hash_table_lookup(table->index, &key);
+
+	if (link == NULL) {
+		return FALSE;
+	}
+
+	observer_t * observer = (observer_t *)link->data;
+	observer->count--;
+
+	if (observer->count == 0) {
+		g_hash_table_remove(table->index, observer);
+		table->removed = g_list_prepend(table->removed, link);
+		observer_table_cleanup(table);
+	}
+
+	return TRUE;
+}
+
+/* Decode an Upstart event for one of the application jobs and call the
+   observers with the application ID */
+static void
+app_call (observer_t * observer, gpointer event)
+{
+	((UbuntuAppLaunchAppObserver)observer->func)((const gchar *)event, observer->user_data);
+}
+
+static void
+app_dispatch (observer_table_t * table, GDBusConnection * conn, const gchar * sender, GVariant * params)
+{
 	gchar * env = NULL;
 	GVariant * envs = g_variant_get_child_value(params, 1);
 	GVariantIter iter;
@@ -320,6 +463,7 @@ observer_cb (GDBusConnection * conn, const gchar * sender, const gchar * object,
 			job_found = TRUE;
 			job_legacy = TRUE;
 		} else if (g_str_has_prefix(env, "INSTANCE=")) {
+			g_free(instance);
 			instance = g_strdup(env + strlen("INSTANCE="));
 		}
 	}
@@ -334,136 +478,49 @@ observer_cb (GDBusConnection * conn, const gchar * sender, const gchar * object,
 	}
 
 	if (job_found && instance != NULL) {
-		observer->func(instance, observer->user_data);
+		observer_table_foreach(table, app_call, instance);
 	}
 
-	ual_tracepoint(observer_finish, signalname);
-
 	g_free(instance);
 }
 
-/* Creates the observer structure and registers for the signal with
-   GDBus so that we can get a callback */
-static gboolean
-add_app_generic (UbuntuAppLaunchAppObserver observer, gpointer user_data, const gchar * signal, GList ** list)
-{
-	GDBusConnection * conn = gdbus_upstart_ref();
-
-	if (conn == NULL) {
-		return FALSE;
-	}
-
-	observer_t * observert = g_new0(observer_t, 1);
-
-	observert->conn = conn;
-	observert->func = observer;
-	observert->user_data = user_data;
-
-	*list = g_list_prepend(*list, observert);
-
-	observert->sighandle = g_dbus_connection_signal_subscribe(conn,
-		NULL, /* sender */
-		DBUS_INTERFACE_UPSTART, /* interface */
-		"EventEmitted", /* signal */
-		DBUS_PATH_UPSTART, /* path */
-		signal, /* arg0 */
-		G_DBUS_SIGNAL_FLAGS_NONE,
-		observer_cb,
-		observert,
-		NULL); /* user data destroy */
-
-	return TRUE;
-}
+/* The lists of Observers */
+static observer_table_t started_table = { "started", TRUE, "started", app_dispatch, NULL, 0, NULL, G_QUEUE_INIT, 0, NULL };
+static observer_table_t stop_table = { "stopped", TRUE, "stopped", app_dispatch, NULL, 0, NULL, G_QUEUE_INIT, 0, NULL };
 
 gboolean
 ubuntu_app_launch_observer_add_app_started (UbuntuAppLaunchAppObserver observer, gpointer user_data)
 {
-	return add_app_generic(observer, user_data, "started", &started_array);
+	return observer_table_add(&started_table, G_CALLBACK(observer), user_data, NULL);
 }
 
 gboolean
 ubuntu_app_launch_observer_add_app_stop (UbuntuAppLaunchAppObserver observer, gpointer user_data)
 {
-	return add_app_generic(observer, user_data, "stopped", &stop_array);
+	return observer_table_add(&stop_table, G_CALLBACK(observer), user_data, NULL);
 }
 
-/* Creates the observer structure and registers for the signal with
-   GDBus so that we can get a callback */
-static gboolean
-add_session_generic (UbuntuAppLaunchAppObserver observer, gpointer user_data, const gchar * signal, GList ** list, GDBusSignalCallback session_cb)
-{
-	GDBusConnection * conn = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
-
-	if (conn == NULL) {
-		return FALSE;
-	}
-
-	observer_t * observert = g_new0(observer_t, 1);
-
-	observert->conn = conn;
-	observert->func = observer;
-	observert->user_data = user_data;
-
-	*list = g_list_prepend(*list, observert);
-
-	observert->sighandle = g_dbus_connection_signal_subscribe(conn,
-		NULL, /* sender */
-		"com.canonical.UbuntuAppLaunch", /* interface */
-		signal, /* signal */
-		"/", /* path */
-		NULL, /* arg0 */
-		G_DBUS_SIGNAL_FLAGS_NONE,
-		session_cb,
-		observert,
-		NULL); /* user data destroy */
-
-	return TRUE;
-}
-
-/* Generic handler for a bunch of our signals */
-static inline void
-generic_signal_cb (GDBusConnection * conn, const gchar * sender, const gchar * object, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data)
-{
-	observer_t * observer = (observer_t *)user_data;
-	const gchar * appid = NULL;
-
-	if (observer->func != NULL) {
-		g_variant_get(params, "(&s)", &appid);
-		observer->func(appid, observer->user_data);
-	}
-}
-
-/* Handle the focus signal when it occurs, call the observer */
+/* Decode one of our signals that only has the application ID and call
+   the observers with it */
 static void
-focus_signal_cb (GDBusConnection * conn, const gchar * sender, const gchar * object, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data)
-{
-	ual_tracepoint(observer_start, "focus");
-
-	generic_signal_cb(conn, sender, object, interface, signal, params, user_data);
-
-	ual_tracepoint(observer_finish, "focus");
-}
-
-gboolean
-ubuntu_app_launch_observer_add_app_focus (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+session_dispatch (observer_table_t * table, GDBusConnection * conn, const gchar * sender, GVariant * params)
 {
-	return add_session_generic(observer, user_data, "UnityFocusRequest", &focus_array, focus_signal_cb);
+	const gchar * appid = NULL;
+	g_variant_get(params, "(&s)", &appid);
+	observer_table_foreach(table, app_call, (gpointer)appid);
 }
 
-/* Handle the resume signal when it occurs, call the observer, then send a signal back when we're done */
+/* Send a signal back to the sender once all the observers have been
+   called, used for the handshakes */
 static void
-resume_signal_cb (GDBusConnection * conn, const gchar * sender, const gchar * object, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data)
+session_response (GDBusConnection * conn, const gchar * sender, GVariant * params, const gchar * response)
 {
-	ual_tracepoint(observer_start, "resume");
-
-	generic_signal_cb(conn, sender, object, interface, signal, params, user_data);
-
 	GError * error = NULL;
 	g_dbus_connection_emit_signal(conn,
 		sender, /* destination */
 		"/", /* path */
 		"com.canonical.UbuntuAppLaunch", /* interface */
-		"UnityResumeResponse", /* signal */
+		response, /* signal */
 		params, /* params, the same */
 		&error);
 
@@ -471,304 +528,472 @@ resume_signal_cb (GDBusConnection * conn, const gchar * sender, const gchar * ob
 		g_warning("Unable to emit response signal: %s", error->message);
 		g_error_free(error);
 	}
-
-	ual_tracepoint(observer_finish, "resume");
 }
 
+static observer_table_t focus_table = { "focus", FALSE, "UnityFocusRequest", session_dispatch, NULL, 0, NULL, G_QUEUE_INIT, 0, NULL };
+
 gboolean
-ubuntu_app_launch_observer_add_app_resume (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+ubuntu_app_launch_observer_add_app_focus (UbuntuAppLaunchAppObserver observer, gpointer user_data)
 {
-	return add_session_generic(observer, user_data, "UnityResumeRequest", &resume_array, resume_signal_cb);
+	return observer_table_add(&focus_table, G_CALLBACK(observer), user_data, NULL);
 }
 
-/* Handle the starting signal when it occurs, call the observer, then send a signal back when we're done */
+/* Handle the resume signal when it occurs, call the observers, then send a signal back when we're done */
 static void
-starting_signal_cb (GDBusConnection * conn, const gchar * sender, const gchar * object, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data)
+resume_dispatch (observer_table_t * table, GDBusConnection * conn, const gchar * sender, GVariant * params)
 {
-	ual_tracepoint(observer_start, "starting");
+	session_dispatch(table, conn, sender, params);
+	session_response(conn, sender, params, "UnityResumeResponse");
+}
 
-	generic_signal_cb(conn, sender, object, interface, signal, params, user_data);
+static observer_table_t resume_table = { "resume", FALSE, "UnityResumeRequest", resume_dispatch, NULL, 0, NULL, G_QUEUE_INIT, 0, NULL };
 
-	GError * error = NULL;
-	g_dbus_connection_emit_signal(conn,
-		sender, /* destination */
-		"/", /* path */
-		"com.canonical.UbuntuAppLaunch", /* interface */
-		"UnityStartingSignal", /* signal */
-		params, /* params, the same */
-		&error);
-
-	if (error != NULL) {
-		g_warning("Unable to emit response signal: %s", error->message);
-		g_error_free(error);
-	}
+gboolean
+ubuntu_app_launch_observer_add_app_resume (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+{
+	return observer_table_add(&resume_table, G_CALLBACK(observer), user_data, NULL);
+}
 
-	ual_tracepoint(observer_finish, "starting");
+/* Handle the starting signal when it occurs, call the observers, then send a signal back when we're done */
+static void
+starting_dispatch (observer_table_t * table, GDBusConnection * conn, const gchar * sender, GVariant * params)
+{
+	session_dispatch(table, conn, sender, params);
+	session_response(conn, sender, params, "UnityStartingSignal");
 }
 
+static observer_table_t starting_table = { "starting", FALSE, "UnityStartingBroadcast", starting_dispatch, NULL, 0, NULL, G_QUEUE_INIT, 0, NULL };
+
 gboolean
 ubuntu_app_launch_observer_add_app_starting (UbuntuAppLaunchAppObserver observer, gpointer user_data)
 {
 	ubuntu::app_launch::Registry::Impl::watchingAppStarting(true);
-	return add_session_generic(observer, user_data, "UnityStartingBroadcast", &starting_array, starting_signal_cb);
+	return observer_table_add(&starting_table, G_CALLBACK(observer), user_data, NULL);
 }
 
-/* Handle the failed signal when it occurs, call the observer */
+/* A decoded failed signal */
+typedef struct _failed_event_t failed_event_t;
+struct _failed_event_t {
+	const gchar * appid;
+	UbuntuAppLaunchAppFailed type;
+};
+
 static void
-failed_signal_cb (GDBusConnection * conn, const gchar * sender, const gchar * object, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data)
+failed_call (observer_t * observer, gpointer event)
 {
-	failed_observer_t * observer = (failed_observer_t *)user_data;
-	const gchar * appid = NULL;
-	const gchar * typestr = NULL;
-
-	ual_tracepoint(observer_start, "failed");
+	failed_event_t * failed = (failed_event_t *)event;
+	((UbuntuAppLaunchAppFailedObserver)observer->func)(failed->appid, failed->type, observer->user_data);
+}
 
-	if (observer->func != NULL) {
-		UbuntuAppLaunchAppFailed type = UBUNTU_APP_LAUNCH_APP_FAILED_CRASH;
-		g_variant_get(params, "(&s&s)", &appid, &typestr);
+/* Handle the failed signal when it occurs, call the observers */
+static void
+failed_dispatch (observer_table_t * table, GDBusConnection * conn, const gchar * sender, GVariant * params)
+{
+	failed_event_t failed = { NULL, UBUNTU_APP_LAUNCH_APP_FAILED_CRASH };
+	const gchar * typestr = NULL;
 
-		if (g_strcmp0("crash", typestr) == 0) {
-			type = UBUNTU_APP_LAUNCH_APP_FAILED_CRASH;
-		} else if (g_strcmp0("start-failure", typestr) == 0) {
-			type = UBUNTU_APP_LAUNCH_APP_FAILED_START_FAILURE;
-		} else {
-			g_warning("Application failure type '%s' unknown, reporting as a crash", typestr);
-		}
+	g_variant_get(params, "(&s&s)", &failed.appid, &typestr);
 
-		observer->func(appid, type, observer->user_data);
+	if (g_strcmp0("crash", typestr) == 0) {
+		failed.type = UBUNTU_APP_LAUNCH_APP_FAILED_CRASH;
+	} else if (g_strcmp0("start-failure", typestr) == 0) {
+		failed.type = UBUNTU_APP_LAUNCH_APP_FAILED_START_FAILURE;
+	} else {
+		g_warning("Application failure type '%s' unknown, reporting as a crash", typestr);
 	}
 
-	ual_tracepoint(observer_finish, "failed");
+	observer_table_foreach(table, failed_call, &failed);
 }
 
+static observer_table_t failed_table = { "failed", FALSE, "ApplicationFailed", failed_dispatch, NULL, 0, NULL, G_QUEUE_INIT, 0, NULL };
+
 gboolean
 ubuntu_app_launch_observer_add_app_failed (UbuntuAppLaunchAppFailedObserver observer, gpointer user_data)
 {
-	GDBusConnection * conn = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
-
-	if (conn == NULL) {
-		return FALSE;
-	}
-
-	failed_observer_t * observert = g_new0(failed_observer_t, 1);
-
-	observert->conn = conn;
-	observert->func = observer;
-	observert->user_data = user_data;
-
-	failed_array = g_list_prepend(failed_array, observert);
+	return observer_table_add(&failed_table, G_CALLBACK(observer), user_data, NULL);
+}
 
-	observert->sighandle = g_dbus_connection_signal_subscribe(conn,
-		NULL, /* sender */
-		"com.canonical.UbuntuAppLaunch", /* interface */
-		"ApplicationFailed", /* signal */
-		"/", /* path */
-		NULL, /* arg0 */
-		G_DBUS_SIGNAL_FLAGS_NONE,
-		failed_signal_cb,
-		observert,
-		NULL); /* user data destroy */
+/* A decoded paused or resumed signal */
+typedef struct _paused_resumed_event_t paused_resumed_event_t;
+struct _paused_resumed_event_t {
+	const gchar * appid;
+	GArray * pids;
+};
 
-	return TRUE;
+static void
+paused_resumed_call (observer_t * observer, gpointer event)
+{
+	paused_resumed_event_t * paused = (paused_resumed_event_t *)event;
+	((UbuntuAppLaunchAppPausedResumedObserver)observer->func)(paused->appid, (GPid *)paused->pids->data, observer->user_data);
 }
 
-/* Handle the paused signal when it occurs, call the observer */
+/* Handle the paused signal when it occurs, call the observers */
 static void
-paused_signal_cb (GDBusConnection * conn, const gchar * sender, const gchar * object, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data)
+paused_resumed_dispatch (observer_table_t * table, GDBusConnection * conn, const gchar * sender, GVariant * params)
 {
-	paused_resumed_observer_t * observer = (paused_resumed_observer_t *)user_data;
+	paused_resumed_event_t paused = { NULL, g_array_new(TRUE, TRUE, sizeof(GPid)) };
+	GVariant * pids = g_variant_get_child_value(params, 1);
+	guint64 pid;
+	GVariantIter thispid;
+	g_variant_iter_init(&thispid, pids);
 
-	ual_tracepoint(observer_start, observer->lttng_signal);
+	g_variant_get_child(params, 0, "&s", &paused.appid);
 
-	if (observer->func != NULL) {
-		GArray * pidarray = g_array_new(TRUE, TRUE, sizeof(GPid));
-		GVariant * appid = g_variant_get_child_value(params, 0);
-		GVariant * pids = g_variant_get_child_value(params, 1);
-		guint64 pid;
-		GVariantIter thispid;
-		g_variant_iter_init(&thispid, pids);
+	while (g_variant_iter_loop(&thispid, "t", &pid)) {
+		GPid gpid = (GPid)pid; /* Should be a no-op for most architectures, but just in case */
+		g_array_append_val(paused.pids, gpid);
+	}
 
-		while (g_variant_iter_loop(&thispid, "t", &pid)) {
-			GPid gpid = (GPid)pid; /* Should be a no-op for most architectures, but just in case */
-			g_array_append_val(pidarray, gpid);
-		}
+	observer_table_foreach(table, paused_resumed_call, &paused);
 
-		observer->func(g_variant_get_string(appid, NULL), (GPid *)pidarray->data, observer->user_data);
+	g_array_free(paused.pids, TRUE);
+	g_variant_unref(pids);
+}
 
-		g_array_free(pidarray, TRUE);
-		g_variant_unref(appid);
-		g_variant_unref(pids);
-	}
+static observer_table_t paused_table = { "paused", FALSE, "ApplicationPaused", paused_resumed_dispatch, NULL, 0, NULL, G_QUEUE_INIT, 0, NULL };
+static observer_table_t resumed_table = { "resumed", FALSE, "ApplicationResumed", paused_resumed_dispatch, NULL, 0, NULL, G_QUEUE_INIT, 0, NULL };
 
-	ual_tracepoint(observer_finish, observer->lttng_signal);
+gboolean
+ubuntu_app_launch_observer_add_app_paused (UbuntuAppLaunchAppPausedResumedObserver observer, gpointer user_data)
+{
+	return observer_table_add(&paused_table, G_CALLBACK(observer), user_data, NULL);
 }
 
-static gboolean
-paused_resumed_generic (UbuntuAppLaunchAppPausedResumedObserver observer, gpointer user_data, GList ** queue, const gchar * signal_name, const gchar * lttng_signal)
+gboolean
+ubuntu_app_launch_observer_add_app_resumed (UbuntuAppLaunchAppPausedResumedObserver observer, gpointer user_data)
 {
-	GDBusConnection * conn = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	return observer_table_add(&resumed_table, G_CALLBACK(observer), user_data, NULL);
+}
 
-	if (conn == NULL) {
-		return FALSE;
-	}
+gboolean
+ubuntu_app_launch_observer_delete_app_started (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+{
+	return observer_table_delete(&started_table, G_CALLBACK(observer), user_data, NULL);
+}
 
-	paused_resumed_observer_t * observert = g_new0(paused_resumed_observer_t, 1);
+gboolean
+ubuntu_app_launch_observer_delete_app_stop (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+{
+	return observer_table_delete(&stop_table, G_CALLBACK(observer), user_data, NULL);
+}
 
-	observert->conn = conn;
-	observert->func = observer;
-	observert->user_data = user_data;
-	observert->lttng_signal = lttng_signal;
+gboolean
+ubuntu_app_launch_observer_delete_app_resume (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+{
+	return observer_table_delete(&resume_table, G_CALLBACK(observer), user_data, NULL);
+}
 
-	*queue = g_list_prepend(*queue, observert);
+gboolean
+ubuntu_app_launch_observer_delete_app_focus (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+{
+	return observer_table_delete(&focus_table, G_CALLBACK(observer), user_data, NULL);
+}
 
-	observert->sighandle = g_dbus_connection_signal_subscribe(conn,
-		NULL, /* sender */
-		"com.canonical.UbuntuAppLaunch", /* interface */
-		signal_name, /* signal */
-		"/", /* path */
-		NULL, /* arg0 */
-		G_DBUS_SIGNAL_FLAGS_NONE,
-		paused_signal_cb,
-		observert,
-		NULL); /* user data destroy */
+gboolean
+ubuntu_app_launch_observer_delete_app_starting (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+{
+	ubuntu::app_launch::Registry::Impl::watchingAppStarting(false);
+	return observer_table_delete(&starting_table, G_CALLBACK(observer), user_data, NULL);
+}
 
-	return TRUE;
+gboolean
+ubuntu_app_launch_observer_delete_app_failed (UbuntuAppLaunchAppFailedObserver observer, gpointer user_data)
+{
+	return observer_table_delete(&failed_table, G_CALLBACK(observer), user_data, NULL);
 }
 
 gboolean
-ubuntu_app_launch_observer_add_app_paused (UbuntuAppLaunchAppPausedResumedObserver observer, gpointer user_data)
+ubuntu_app_launch_observer_delete_app_paused (UbuntuAppLaunchAppPausedResumedObserver observer, gpointer user_data)
 {
-	return paused_resumed_generic(observer, user_data, &paused_array, "ApplicationPaused", "paused");
+	return observer_table_delete(&paused_table, G_CALLBACK(observer), user_data, NULL);
 }
 
 gboolean
-ubuntu_app_launch_observer_add_app_resumed (UbuntuAppLaunchAppPausedResumedObserver observer, gpointer user_data)
+ubuntu_app_launch_observer_delete_app_resumed (UbuntuAppLaunchAppPausedResumedObserver observer, gpointer user_data)
+{
+	return observer_table_delete(&resumed_table, G_CALLBACK(observer), user_data, NULL);
+}
+
+/* Batch observers. These sit on top of the other observer tables, and
+   collect the events for a window so that someone who is rebuilding a
+   list of applications only has to do it once when a lot of them are
+   changing, like when the session starts. */
+typedef struct _batch_event_t batch_event_t;
+struct _batch_event_t {
+	UbuntuAppLaunchAppEventType type;
+	gchar * appid;
+};
+
+typedef struct _batch_t batch_t;
+struct _batch_t {
+	UbuntuAppLaunchAppBatchObserver func;
+	gpointer user_data;
+	guint count;
+	guint window;
+	GMainContext * context;
+	GSource * timeout;
+	GArray * events; /* batch_event_t */
+	guint folded;
+};
+
+static GList * batch_observers = NULL;
+static guint64 batch_received = 0;
+static guint64 batch_folded = 0;
+static guint64 batch_delivered = 0;
+
+static void
+batch_event_clear (gpointer data)
+{
+	batch_event_t * event = (batch_event_t *)data;
+	g_free(event->appid);
+}
+
+/* Whether the second event undoes the first one */
+static gboolean
+batch_event_cancels (UbuntuAppLaunchAppEventType first, UbuntuAppLaunchAppEventType second)
+{
+	switch (first) {
+	case UBUNTU_APP_LAUNCH_APP_EVENT_STARTED:
+		return second == UBUNTU_APP_LAUNCH_APP_EVENT_STOPPED;
+	case UBUNTU_APP_LAUNCH_APP_EVENT_PAUSED:
+		return second == UBUNTU_APP_LAUNCH_APP_EVENT_RESUMED;
+	case UBUNTU_APP_LAUNCH_APP_EVENT_RESUMED:
+		return second == UBUNTU_APP_LAUNCH_APP_EVENT_PAUSED;
+	default:
+		return FALSE;
+	}
+}
+
+/* Whether getting the event twice in a row says anything more than
+   getting it once. Starting twice can be two instances. */
+static gboolean
+batch_event_repeats (UbuntuAppLaunchAppEventType type)
 {
-	return paused_resumed_generic(observer, user_data, &resumed_array, "ApplicationResumed", "resumed");
+	return type == UBUNTU_APP_LAUNCH_APP_EVENT_FOCUS ||
+		type == UBUNTU_APP_LAUNCH_APP_EVENT_PAUSED ||
+		type == UBUNTU_APP_LAUNCH_APP_EVENT_RESUMED;
 }
 
+/* End of the window, give the observer everything that is left */
 static gboolean
-delete_app_generic (UbuntuAppLaunchAppObserver observer, gpointer user_data, GList ** list)
+batch_flush (gpointer user_data)
 {
-	observer_t * observert = NULL;
-	GList * look;
+	batch_t * batch = (batch_t *)user_data;
+
+	g_source_unref(batch->timeout);
+	batch->timeout = NULL;
+
+	/* Take everything out of the batch as the observer may remove
+	   itself while we're calling it */
+	GArray * events = batch->events;
+	batch->events = g_array_new(FALSE, FALSE, sizeof(batch_event_t));
+	g_array_set_clear_func(batch->events, batch_event_clear);
+	UbuntuAppLaunchAppBatchObserver func = batch->func;
+	gpointer func_data = batch->user_data;
+	guint count = batch->count;
+
+	ual_tracepoint(observer_batch, events->len, batch->folded);
+	batch->folded = 0;
 
-	for (look = *list; look != NULL; look = g_list_next(look)) {
-		observert = (observer_t *)look->data;
+	if (events->len > 0) {
+		UbuntuAppLaunchAppEvent * apps = g_new(UbuntuAppLaunchAppEvent, events->len);
+		guint i;
 
-		if (observert->func == observer && observert->user_data == user_data) {
-			break;
+		for (i = 0; i < events->len; i++) {
+			batch_event_t * event = &g_array_index(events, batch_event_t, i);
+			apps[i].type = event->type;
+			apps[i].appid = event->appid;
 		}
+
+		for (i = 0; i < count; i++) {
+			batch_delivered++;
+			func(apps, events->len, func_data);
+		}
+
+		g_free(apps);
 	}
 
-	if (look == NULL) {
-		return FALSE;
+	g_array_free(events, TRUE);
+	return G_SOURCE_REMOVE;
+}
+
+/* Add an event to the batch, folding it into the last event for the
+   same application if they cancel out */
+static void
+batch_queue (batch_t * batch, UbuntuAppLaunchAppEventType type, const gchar * appid)
+{
+	batch_received++;
+
+	gint i;
+	for (i = (gint)batch->events->len - 1; i >= 0; i--) {
+		batch_event_t * event = &g_array_index(batch->events, batch_event_t, i);
+		if (g_strcmp0(event->appid, appid) != 0) {
+			continue;
+		}
+
+		if (batch_event_cancels(event->type, type)) {
+			g_array_remove_index(batch->events, i);
+			batch->folded += 2;
+			batch_folded += 2;
+			return;
+		}
+
+		if (event->type == type && batch_event_repeats(type)) {
+			batch->folded++;
+			batch_folded++;
+			return;
+		}
+
+		break;
 	}
 
-	g_dbus_connection_signal_unsubscribe(observert->conn, observert->sighandle);
-	g_object_unref(observert->conn);
+	batch_event_t event = { type, g_strdup(appid) };
+	g_array_append_val(batch->events, event);
 
-	g_free(observert);
-	*list = g_list_delete_link(*list, look);
+	if (batch->timeout == NULL) {
+		batch->timeout = g_timeout_source_new(batch->window);
+		g_source_set_callback(batch->timeout, batch_flush, batch, NULL);
+		g_source_attach(batch->timeout, batch->context);
+	}
+}
 
-	return TRUE;
+static void
+batch_started (const gchar * appid, gpointer user_data)
+{
+	batch_queue((batch_t *)user_data, UBUNTU_APP_LAUNCH_APP_EVENT_STARTED, appid);
 }
 
-gboolean
-ubuntu_app_launch_observer_delete_app_started (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+static void
+batch_stopped (const gchar * appid, gpointer user_data)
 {
-	return delete_app_generic(observer, user_data, &started_array);
+	batch_queue((batch_t *)user_data, UBUNTU_APP_LAUNCH_APP_EVENT_STOPPED, appid);
 }
 
-gboolean
-ubuntu_app_launch_observer_delete_app_stop (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+static void
+batch_focus (const gchar * appid, gpointer user_data)
 {
-	return delete_app_generic(observer, user_data, &stop_array);
+	batch_queue((batch_t *)user_data, UBUNTU_APP_LAUNCH_APP_EVENT_FOCUS, appid);
 }
 
-gboolean
-ubuntu_app_launch_observer_delete_app_resume (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+static void
+batch_paused (const gchar * appid, GPid * pids, gpointer user_data)
 {
-	return delete_app_generic(observer, user_data, &resume_array);
+	batch_queue((batch_t *)user_data, UBUNTU_APP_LAUNCH_APP_EVENT_PAUSED, appid);
 }
 
-gboolean
-ubuntu_app_launch_observer_delete_app_focus (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+static void
+batch_resumed (const gchar * appid, GPid * pids, gpointer user_data)
 {
-	return delete_app_generic(observer, user_data, &focus_array);
+	batch_queue((batch_t *)user_data, UBUNTU_APP_LAUNCH_APP_EVENT_RESUMED, appid);
 }
 
-gboolean
-ubuntu_app_launch_observer_delete_app_starting (UbuntuAppLaunchAppObserver observer, gpointer user_data)
+static void
+batch_failed (const gchar * appid, UbuntuAppLaunchAppFailed failure_type, gpointer user_data)
 {
-	ubuntu::app_launch::Registry::Impl::watchingAppStarting(false);
-	return delete_app_generic(observer, user_data, &starting_array);
+	batch_queue((batch_t *)user_data, UBUNTU_APP_LAUNCH_APP_EVENT_FAILED, appid);
 }
 
-gboolean
-ubuntu_app_launch_observer_delete_app_failed (UbuntuAppLaunchAppFailedObserver observer, gpointer user_data)
+static gint
+batch_compare (gconstpointer a, gconstpointer b)
 {
-	failed_observer_t * observert = NULL;
-	GList * look;
+	const batch_t * batcha = (const batch_t *)a;
+	const batch_t * batchb = (const batch_t *)b;
+	return (batcha->func == batchb->func && batcha->user_data == batchb->user_data) ? 0 : 1;
+}
 
-	for (look = failed_array; look != NULL; look = g_list_next(look)) {
-		observert = (failed_observer_t *)look->data;
+gboolean
+ubuntu_app_launch_observer_add_app_batch (UbuntuAppLaunchAppBatchObserver observer, guint window_ms, gpointer user_data)
+{
+	g_return_val_if_fail(observer != NULL, FALSE);
 
-		if (observert->func == observer && observert->user_data == user_data) {
-			break;
-		}
+	batch_t key = { observer, user_data, 0, 0, NULL, NULL, NULL, 0 };
+	GList * link = g_list_find_custom(batch_observers, &key, batch_compare);
+	if (link != NULL) {
+		((batch_t *)link->data)->count++;
+		return TRUE;
 	}
 
-	if (look == NULL) {
+	batch_t * batch = g_new0(batch_t, 1);
+	batch->func = observer;
+	batch->user_data = user_data;
+	batch->count = 1;
+	batch->window = window_ms;
+	batch->context = g_main_context_ref_thread_default();
+	batch->events = g_array_new(FALSE, FALSE, sizeof(batch_event_t));
+	g_array_set_clear_func(batch->events, batch_event_clear);
+
+	if (!observer_table_add(&started_table, G_CALLBACK(batch_started), batch, NULL) ||
+			!observer_table_add(&stop_table, G_CALLBACK(batch_stopped), batch, NULL) ||
+			!observer_table_add(&focus_table, G_CALLBACK(batch_focus), batch, NULL) ||
+			!observer_table_add(&paused_table, G_CALLBACK(batch_paused), batch, NULL) ||
+			!observer_table_add(&resumed_table, G_CALLBACK(batch_resumed), batch, NULL) ||
+			!observer_table_add(&failed_table, G_CALLBACK(batch_failed), batch, NULL)) {
+		/* Deleting the ones that didn't get added is harmless */
+		observer_table_delete(&started_table, G_CALLBACK(batch_started), batch, NULL);
+		observer_table_delete(&stop_table, G_CALLBACK(batch_stopped), batch, NULL);
+		observer_table_delete(&focus_table, G_CALLBACK(batch_focus), batch, NULL);
+		observer_table_delete(&paused_table, G_CALLBACK(batch_paused), batch, NULL);
+		observer_table_delete(&resumed_table, G_CALLBACK(batch_resumed), batch, NULL);
+		observer_table_delete(&failed_table, G_CALLBACK(batch_failed), batch, NULL);
+
+		g_array_free(batch->events, TRUE);
+		g_main_context_unref(batch->context);
+		g_free(batch);
 		return FALSE;
 	}
 
-	g_dbus_connection_signal_unsubscribe(observert->conn, observert->sighandle);
-	g_object_unref(observert->conn);
-
-	g_free(observert);
-	failed_array = g_list_delete_link(failed_array, look);
-
+	batch_observers = g_list_prepend(batch_observers, batch);
 	return TRUE;
 }
 
-static gboolean
-paused_resumed_delete (UbuntuAppLaunchAppPausedResumedObserver observer, gpointer user_data, GList ** list)
+gboolean
+ubuntu_app_launch_observer_delete_app_batch (UbuntuAppLaunchAppBatchObserver observer, gpointer user_data)
 {
-	paused_resumed_observer_t * observert = NULL;
-	GList * look;
-
-	for (look = *list; look != NULL; look = g_list_next(look)) {
-		observert = (paused_resumed_observer_t *)look->data;
-
-		if (observert->func == observer && observert->user_data == user_data) {
-			break;
-		}
+	batch_t key = { observer, user_data, 0, 0, NULL, NULL, NULL, 0 };
+	GList * link = g_list_find_custom(batch_observers, &key, batch_compare);
+	if (link == NULL) {
+		return FALSE;
 	}
 
-	if (look == NULL) {
-		return FALSE;
+	batch_t * batch = (batch_t *)link->data;
+	batch->count--;
+	if (batch->count > 0) {
+		return TRUE;
 	}
 
-	g_dbus_connection_signal_unsubscribe(observert->conn, observert->sighandle);
-	g_object_unref(observert->conn);
+	batch_observers = g_list_delete_link(batch_observers, link);
 
-	g_free(observert);
-	*list = g_list_delete_link(*list, look);
+	observer_table_delete(&started_table, G_CALLBACK(batch_started), batch, NULL);
+	observer_table_delete(&stop_table, G_CALLBACK(batch_stopped), batch, NULL);
+	observer_table_delete(&focus_table, G_CALLBACK(batch_focus), batch, NULL);
+	observer_table_delete(&paused_table, G_CALLBACK(batch_paused), batch, NULL);
+	observer_table_delete(&resumed_table, G_CALLBACK(batch_resumed), batch, NULL);
+	observer_table_delete(&failed_table, G_CALLBACK(batch_failed), batch, NULL);
 
-	return TRUE;
-}
+	if (batch->timeout != NULL) {
+		g_source_destroy(batch->timeout);
+		g_source_unref(batch->timeout);
+	}
 
-gboolean
-ubuntu_app_launch_observer_delete_app_paused (UbuntuAppLaunchAppPausedResumedObserver observer, gpointer user_data)
-{
-	return paused_resumed_delete(observer, user_data, &paused_array);
+	g_array_free(batch->events, TRUE);
+	g_main_context_unref(batch->context);
+	g_free(batch);
+
+	return TRUE;
 }
 
-gboolean
-ubuntu_app_launch_observer_delete_app_resumed (UbuntuAppLaunchAppPausedResumedObserver observer, gpointer user_data)
+void
+ubuntu_app_launch_observer_batch_stats (guint64 * received, guint64 * folded, guint64 * batches)
 {
-	return paused_resumed_delete(observer, user_data, &resumed_array);
+	if (received != NULL) {
+		*received = batch_received;
+	}
+	if (folded != NULL) {
+		*folded = batch_folded;
+	}
+	if (batches != NULL) {
+		*batches = batch_delivered;
+	}
 }
 
 typedef void (*per_instance_func_t) (GDBusConnection * con, GVariant * prop_dict, gpointer user_data);
@@ -776,14 +1001,14 @@ typedef void (*per_instance_func_t) (GDBusConnection * con, GVariant * prop_dict
 static void
 foreach_job_instance (GDBusConnection * con, const gchar * jobname, per_instance_func_t func, gpointer user_data)
 {
-	const gchar * job_path = get_jobpath(con, jobname);
-	if (job_path == NULL)
+	auto job_path = get_jobpath(jobname);
+	if (job_path.empty())
 		return;
 
 	GError * error = NULL;
 	GVariant * instance_tuple = g_dbus_connection_call_sync(con,
 		DBUS_SERVICE_UPSTART,
-		job_path,
+		job_path.c_str(),
 		DBUS_INTERFACE_UPSTART_JOB,
 		"GetAllInstances",
 		NULL,
@@ -987,6 +1212,14 @@ start_helper_callback (GObject * obj, GAsyncResult * res, gpointer user_data)
 	}
 }
 
+/* The session bus connection that the default registry keeps open. It
+   isn't referenced for the caller, it lasts as long as the registry. */
+static GDBusConnection *
+registry_session_bus (void)
+{
+	return ubuntu::app_launch::Registry::getDefault()->impl->_dbus.get();
+}
+
 /* Implements sending the "start" command to Upstart for the
    untrusted helper job with the various configuration options
    to define the instance.  In the end there's only one job with
@@ -994,10 +1227,11 @@ start_helper_callback (GObject * obj, GAsyncResult * res, gpointer user_data)
 static gboolean
 start_helper_core (const gchar * type, const gchar * appid, const gchar * const * uris, const gchar * instance, const gchar * mirsocketpath)
 {
-	GDBusConnection * con = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	GDBusConnection * con = registry_session_bus();
 	g_return_val_if_fail(con != NULL, FALSE);
 
-	const gchar * jobpath = get_jobpath(con, "untrusted-helper");
+	auto jobpath = get_jobpath("untrusted-helper");
+	g_return_val_if_fail(!jobpath.empty(), FALSE);
 
 	/* Build up our environment */
 	GVariantBuilder builder;
@@ -1027,7 +1261,7 @@ start_helper_core (const gchar * type, const gchar * appid, const gchar * const
 	/* Call the job start function */
 	g_dbus_connection_call(con,
 	                       DBUS_SERVICE_UPSTART,
-	                       jobpath,
+	                       jobpath.c_str(),
 	                       DBUS_INTERFACE_UPSTART_JOB,
 	                       "Start",
 	                       g_variant_builder_end(&builder),
@@ -1038,8 +1272,6 @@ start_helper_core (const gchar * type, const gchar * appid, const gchar * const
 	                       start_helper_callback,
 	                       NULL);
 
-	g_object_unref(con);
-
 	return TRUE;
 }
 
@@ -1219,10 +1451,9 @@ build_proxy_socket_path (const gchar * appid, int mirfd)
 	}
 
 	GError * error = NULL;
-	GDBusConnection * session = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
-	if (error != NULL) {
-		g_warning("Unable to get session bus: %s", error->message);
-		g_error_free(error);
+	GDBusConnection * session = registry_session_bus();
+	if (session == NULL) {
+		g_warning("Unable to get session bus");
 		return NULL;
 	}
 
@@ -1263,7 +1494,6 @@ build_proxy_socket_path (const gchar * appid, int mirfd)
 	   make sure to clean up the socket. */
 	if (socket_name == NULL) {   
 		g_object_unref(skel);
-		g_object_unref(session);
 		g_critical("Unable to export object to any name");
 		return NULL;
 	}
@@ -1278,8 +1508,6 @@ build_proxy_socket_path (const gchar * appid, int mirfd)
 	                           g_strdup(socket_name),
 	                           g_free);
 
-	g_object_unref(session);
-
 	return socket_name;
 }
 
@@ -1338,10 +1566,11 @@ stop_helper_callback (GObject * obj, GAsyncResult * res, gpointer user_data)
 static gboolean
 stop_helper_core (const gchar * type, const gchar * appid, const gchar * instanceid)
 {
-	GDBusConnection * con = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	GDBusConnection * con = registry_session_bus();
 	g_return_val_if_fail(con != NULL, FALSE);
 
-	const gchar * jobpath = get_jobpath(con, "untrusted-helper");
+	auto jobpath = get_jobpath("untrusted-helper");
+	g_return_val_if_fail(!jobpath.empty(), FALSE);
 
 	/* Build up our environment */
 	GVariantBuilder builder;
@@ -1360,7 +1589,7 @@ stop_helper_core (const gchar * type, const gchar * appid, const gchar * instanc
 	/* Call the job start function */
 	g_dbus_connection_call(con,
 	                       DBUS_SERVICE_UPSTART,
-	                       jobpath,
+	                       jobpath.c_str(),
 	                       DBUS_INTERFACE_UPSTART_JOB,
 	                       "Stop",
 	                       g_variant_builder_end(&builder),
@@ -1371,8 +1600,6 @@ stop_helper_core (const gchar * type, const gchar * appid, const gchar * instanc
 	                       stop_helper_callback,
 	                       NULL);
 
-	g_object_unref(con);
-
 	return TRUE;
 }
 
@@ -1398,6 +1625,22 @@ ubuntu_app_launch_stop_multiple_helper (const gchar * type, const gchar * appid,
 }
 
 
+/* Helpers in the helper pool sit in the spawned state until they're
+   woken up, they aren't running as far as anyone is concerned */
+static gboolean
+helper_is_parked (GVariant * props_dict)
+{
+	GVariant * statev = g_variant_lookup_value(props_dict, "state", G_VARIANT_TYPE_STRING);
+	if (statev == NULL) {
+		return FALSE;
+	}
+
+	gboolean parked = g_strcmp0(g_variant_get_string(statev, NULL), "spawned") == 0;
+	g_variant_unref(statev);
+
+	return parked;
+}
+
 typedef struct {
 	gchar * type_prefix; /* Type with the colon sperator */
 	size_t type_len;     /* Length in characters of the prefix */
@@ -1411,6 +1654,10 @@ list_helpers_helper (GDBusConnection * con, GVariant * props_dict, gpointer user
 {
 	helpers_helper_t * data = (helpers_helper_t *)user_data;
 
+	if (helper_is_parked(props_dict)) {
+		return;
+	}
+
 	GVariant * namev = g_variant_lookup_value(props_dict, "name", G_VARIANT_TYPE_STRING);
 	if (namev == NULL) {
 		return;
@@ -1441,7 +1688,7 @@ ubuntu_app_launch_list_helpers (const gchar * type)
 	g_return_val_if_fail(type != NULL, FALSE);
 	g_return_val_if_fail(g_strstr_len(type, -1, ":") == NULL, FALSE);
 
-	GDBusConnection * con = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	GDBusConnection * con = registry_session_bus();
 	g_return_val_if_fail(con != NULL, FALSE);
 
 	helpers_helper_t helpers_helper_data = {
@@ -1452,7 +1699,6 @@ ubuntu_app_launch_list_helpers (const gchar * type)
 
 	foreach_job_instance(con, "untrusted-helper", list_helpers_helper, &helpers_helper_data);
 
-	g_object_unref(con);
 	g_free(helpers_helper_data.type_prefix);
 
 	return (gchar **)g_array_free(helpers_helper_data.retappids, FALSE);
@@ -1472,6 +1718,10 @@ list_helper_instances (GDBusConnection * con, GVariant * props_dict, gpointer us
 {
 	helper_instances_t * data = (helper_instances_t *)user_data;
 
+	if (helper_is_parked(props_dict)) {
+		return;
+	}
+
 	GVariant * namev = g_variant_lookup_value(props_dict, "name", G_VARIANT_TYPE_STRING);
 	if (namev == NULL) {
 		return;
@@ -1500,7 +1750,7 @@ ubuntu_app_launch_list_helper_instances (const gchar * type, const gchar * appid
 	g_return_val_if_fail(type != NULL, FALSE);
 	g_return_val_if_fail(g_strstr_len(type, -1, ":") == NULL, FALSE);
 
-	GDBusConnection * con = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	GDBusConnection * con = registry_session_bus();
 	g_return_val_if_fail(con != NULL, FALSE);
 
 	helper_instances_t helper_instances_data = {
@@ -1512,32 +1762,69 @@ ubuntu_app_launch_list_helper_instances (const gchar * type, const gchar * appid
 
 	foreach_job_instance(con, "untrusted-helper", list_helper_instances, &helper_instances_data);
 
-	g_object_unref(con);
 	g_free(helper_instances_data.type_prefix);
 	g_free(helper_instances_data.appid_suffix);
 
 	return (gchar **)g_array_free(helper_instances_data.retappids, FALSE);
 }
 
-/* The data we keep for each observer */
-typedef struct _helper_observer_t helper_observer_t;
-struct _helper_observer_t {
-	GDBusConnection * conn;
-	guint sighandle;
-	gchar * type;
-	UbuntuAppLaunchHelperObserver func;
-	gpointer user_data;
-};
+gboolean
+ubuntu_app_launch_foreach_helper_instance (UbuntuAppLaunchHelperObserver func, gpointer user_data)
+{
+	g_return_val_if_fail(func != NULL, FALSE);
 
-/* The lists of helper observers */
-static GList * helper_started_obs = NULL;
-static GList * helper_stopped_obs = NULL;
+	try {
+		for (const auto& helper : ubuntu::app_launch::Registry::runningHelperInstances()) {
+			std::string appid = helper.appid;
+			for (const auto& instanceid : helper.instanceIds) {
+				func(appid.c_str(), instanceid.c_str(), helper.type.value().c_str(), user_data);
+			}
+		}
+
+		return TRUE;
+	} catch (std::runtime_error &e) {
+		g_warning("Unable to list helpers: %s", e.what());
+		return FALSE;
+	}
+}
+
+guint
+ubuntu_app_launch_stop_all_helpers (const gchar * type)
+{
+	g_return_val_if_fail(type != NULL, 0);
+	g_return_val_if_fail(g_strstr_len(type, -1, ":") == NULL, 0);
+
+	try {
+		return ubuntu::app_launch::Registry::stopHelpers(ubuntu::app_launch::Helper::Type::from_raw(type));
+	} catch (std::runtime_error &e) {
+		g_warning("Unable to stop helpers of type '%s': %s", type, e.what());
+		return 0;
+	}
+}
+
+/* A decoded Upstart event for an untrusted helper */
+typedef struct _helper_event_t helper_event_t;
+struct _helper_event_t {
+	const gchar * type;
+	const gchar * instanceid;
+	const gchar * appid;
+};
 
 static void
-helper_observer_cb (GDBusConnection * conn, const gchar * sender, const gchar * object, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data)
+helper_call (observer_t * observer, gpointer event)
 {
-	helper_observer_t * observer = (helper_observer_t *)user_data;
+	helper_event_t * helper = (helper_event_t *)event;
+
+	if (g_strcmp0(observer->type, helper->type) != 0) {
+		return;
+	}
+
+	((UbuntuAppLaunchHelperObserver)observer->func)(helper->appid, helper->instanceid, helper->type, observer->user_data);
+}
 
+static void
+helper_dispatch (observer_table_t * table, GDBusConnection * conn, const gchar * sender, GVariant * params)
+{
 	gchar * env = NULL;
 	GVariant * envs = g_variant_get_child_value(params, 1);
 	GVariantIter iter;
@@ -1550,105 +1837,37 @@ helper_observer_cb (GDBusConnection * conn, const gchar * sender, const gchar *
 		if (g_strcmp0(env, "JOB=untrusted-helper") == 0) {
 			job_found = TRUE;
 		} else if (g_str_has_prefix(env, "INSTANCE=")) {
+			g_free(instance);
 			instance = g_strdup(env + strlen("INSTANCE="));
 		}
 	}
 
 	g_variant_unref(envs);
 
-	if (instance != NULL && !g_str_has_prefix(instance, observer->type)) {
+	if (!job_found || instance == NULL) {
 		g_free(instance);
-		instance = NULL;
+		return;
 	}
 
-	gchar * appid = NULL;
-	gchar * instanceid = NULL;
-	gchar * type = NULL;
-
-	if (instance != NULL) {
-		gchar ** split = g_strsplit(instance, ":", 3);
-		type = split[0];
-		instanceid = split[1];
-		appid = split[2];
-		g_free(split);
-	}
+	gchar ** split = g_strsplit(instance, ":", 3);
 	g_free(instance);
 
-	if (instanceid != NULL && instanceid[0] == '\0') {
-		g_free(instanceid);
-		instanceid = NULL;
-	}
+	if (g_strv_length(split) == 3) {
+		helper_event_t helper = {
+			split[0],
+			split[1][0] == '\0' ? NULL : split[1],
+			split[2]
+		};
 
-	if (job_found && appid != NULL) {
-		observer->func(appid, instanceid, type, observer->user_data);
+		observer_table_foreach(table, helper_call, &helper);
 	}
 
-	g_free(appid);
-	g_free(instanceid);
-	g_free(type);
+	g_strfreev(split);
 }
 
-/* Creates the observer structure and registers for the signal with
-   GDBus so that we can get a callback */
-static gboolean
-add_helper_generic (UbuntuAppLaunchHelperObserver observer, const gchar * helper_type, gpointer user_data, const gchar * signal, GList ** list)
-{
-	GDBusConnection * conn = gdbus_upstart_ref();
-
-	if (conn == NULL) {
-		return FALSE;
-	}
-
-	helper_observer_t * observert = g_new0(helper_observer_t, 1);
-
-	observert->conn = conn;
-	observert->func = observer;
-	observert->user_data = user_data;
-	observert->type = g_strdup_printf("%s:", helper_type);
-
-	*list = g_list_prepend(*list, observert);
-
-	observert->sighandle = g_dbus_connection_signal_subscribe(conn,
-		NULL, /* sender */
-		DBUS_INTERFACE_UPSTART, /* interface */
-		"EventEmitted", /* signal */
-		DBUS_PATH_UPSTART, /* path */
-		signal, /* arg0 */
-		G_DBUS_SIGNAL_FLAGS_NONE,
-		helper_observer_cb,
-		observert,
-		NULL); /* user data destroy */
-
-	return TRUE;
-}
-
-static gboolean
-delete_helper_generic (UbuntuAppLaunchHelperObserver observer, const gchar * type, gpointer user_data, GList ** list)
-{
-	helper_observer_t * observert = NULL;
-	GList * look;
-
-	for (look = *list; look != NULL; look = g_list_next(look)) {
-		observert = (helper_observer_t *)look->data;
-
-		if (observert->func == observer && observert->user_data == user_data && g_str_has_prefix(observert->type, type)) {
-			break;
-		}
-	}
-
-	if (look == NULL) {
-		return FALSE;
-	}
-
-	g_dbus_connection_signal_unsubscribe(observert->conn, observert->sighandle);
-	g_object_unref(observert->conn);
-
-	g_free(observert->type);
-	g_free(observert);
-	*list = g_list_delete_link(*list, look);
-
-	return TRUE;
-}
+/* The lists of helper observers */
+static observer_table_t helper_started_table = { "helper-started", TRUE, "started", helper_dispatch, NULL, 0, NULL, G_QUEUE_INIT, 0, NULL };
+static observer_table_t helper_stopped_table = { "helper-stopped", TRUE, "stopped", helper_dispatch, NULL, 0, NULL, G_QUEUE_INIT, 0, NULL };
 
 gboolean
 ubuntu_app_launch_observer_add_helper_started (UbuntuAppLaunchHelperObserver observer, const gchar * helper_type, gpointer user_data)
@@ -1657,7 +1876,7 @@ ubuntu_app_launch_observer_add_helper_started (UbuntuAppLaunchHelperObserver obs
 	g_return_val_if_fail(helper_type != NULL, FALSE);
 	g_return_val_if_fail(g_strstr_len(helper_type, -1, ":") == NULL, FALSE);
 
-	return add_helper_generic(observer, helper_type, user_data, "started", &helper_started_obs);
+	return observer_table_add(&helper_started_table, G_CALLBACK(observer), user_data, helper_type);
 }
 
 gboolean
@@ -1667,7 +1886,7 @@ ubuntu_app_launch_observer_add_helper_stop (UbuntuAppLaunchHelperObserver observ
 	g_return_val_if_fail(helper_type != NULL, FALSE);
 	g_return_val_if_fail(g_strstr_len(helper_type, -1, ":") == NULL, FALSE);
 
-	return add_helper_generic(observer, helper_type, user_data, "stopped", &helper_stopped_obs);
+	return observer_table_add(&helper_stopped_table, G_CALLBACK(observer), user_data, helper_type);
 }
 
 gboolean
@@ -1677,7 +1896,7 @@ ubuntu_app_launch_observer_delete_helper_started (UbuntuAppLaunchHelperObserver
 	g_return_val_if_fail(helper_type != NULL, FALSE);
 	g_return_val_if_fail(g_strstr_len(helper_type, -1, ":") == NULL, FALSE);
 
-	return delete_helper_generic(observer, helper_type, user_data, &helper_started_obs);
+	return observer_table_delete(&helper_started_table, G_CALLBACK(observer), user_data, helper_type);
 }
 
 gboolean
@@ -1687,50 +1906,23 @@ ubuntu_app_launch_observer_delete_helper_stop (UbuntuAppLaunchHelperObserver obs
 	g_return_val_if_fail(helper_type != NULL, FALSE);
 	g_return_val_if_fail(g_strstr_len(helper_type, -1, ":") == NULL, FALSE);
 
-	return delete_helper_generic(observer, helper_type, user_data, &helper_stopped_obs);
+	return observer_table_delete(&helper_stopped_table, G_CALLBACK(observer), user_data, helper_type);
 }
 
-/* Sets an environment variable in Upstart */
-static void
-set_var (GDBusConnection * bus, const gchar * job_name, const gchar * instance_name, const gchar * envvar)
+gboolean
+ubuntu_app_launch_helper_set_exec (const gchar * execline, const gchar * directory)
 {
-	GVariantBuilder builder; /* Target: (assb) */
-	g_variant_builder_init(&builder, G_VARIANT_TYPE_TUPLE);
-
-	/* Setup the job properties */
-	g_variant_builder_open(&builder, G_VARIANT_TYPE_ARRAY);
-	g_variant_builder_add_value(&builder, g_variant_new_string(job_name));
-	if (instance_name != NULL)
-		g_variant_builder_add_value(&builder, g_variant_new_string(instance_name));
-	g_variant_builder_close(&builder);
-
-	g_variant_builder_add_value(&builder, g_variant_new_string(envvar));
-
-	/* Do we want to replace?  Yes, we do! */
-	g_variant_builder_add_value(&builder, g_variant_new_boolean(TRUE));
-
-	g_dbus_connection_call(bus,
-		"com.ubuntu.Upstart",
-		"/com/ubuntu/Upstart",
-		"com.ubuntu.Upstart0_6",
-		"SetEnv",
-		g_variant_builder_end(&builder),
-		NULL, /* reply */
-		G_DBUS_CALL_FLAGS_NONE,
-		-1, /* timeout */
-		NULL, /* cancellable */
-		NULL, NULL); /* callback */
+	return ubuntu_app_launch_helper_set_exec_env(execline, directory, NULL, FALSE);
 }
 
 gboolean
-ubuntu_app_launch_helper_set_exec (const gchar * execline, const gchar * directory)
+ubuntu_app_launch_helper_set_exec_env (const gchar * execline, const gchar * directory, const gchar * const * env, gboolean confirm)
 {
 	g_return_val_if_fail(execline != NULL, FALSE);
 	g_return_val_if_fail(execline[0] != '\0', FALSE);
 
 	/* Check to see if we can get the job environment */
 	const gchar * job_name = g_getenv("UPSTART_JOB");
-	const gchar * instance_name = g_getenv("UPSTART_INSTANCE");
 	const gchar * demangler = g_getenv("UBUNTU_APP_LAUNCH_DEMANGLE_NAME");
 	g_return_val_if_fail(job_name != NULL, FALSE);
 
@@ -1743,29 +1935,173 @@ ubuntu_app_launch_helper_set_exec (const gchar * execline, const gchar * directo
 		return FALSE;
 	}
 
+	/* Everything goes to Upstart in one call */
+	EnvHandle * handle = env_handle_start();
+
 	/* The exec value */
-	gchar * envstr = NULL;
 	if (demangler) {
-		envstr = g_strdup_printf("APP_EXEC=%s %s", DEMANGLER_PATH, execline);
+		gchar * execstr = g_strdup_printf("%s %s", DEMANGLER_PATH, execline);
+		env_handle_add(handle, "APP_EXEC", execstr);
+		g_free(execstr);
 	} else {
-		envstr = g_strdup_printf("APP_EXEC=%s", execline);
+		env_handle_add(handle, "APP_EXEC", execline);
 	}
 
-	set_var(bus, job_name, instance_name, envstr);
-	g_free(envstr);
-
 	/* The directory value */
 	if (directory != NULL) {
-		gchar * direnv = g_strdup_printf("APP_DIR=%s", directory);
-		set_var(bus, job_name, instance_name, direnv);
-		g_free(direnv);
+		env_handle_add(handle, "APP_DIR", directory);
+	}
+
+	/* Anything else the exec tool wants */
+	guint i;
+	for (i = 0; env != NULL && env[i] != NULL; i++) {
+		const gchar * equal = strchr(env[i], '=');
+		if (equal == NULL || equal == env[i]) {
+			g_warning("Ignoring environment variable without a name and value: %s", env[i]);
+			continue;
+		}
+
+		gchar * name = g_strndup(env[i], equal - env[i]);
+		env_handle_add(handle, name, equal + 1);
+		g_free(name);
 	}
 
+	gboolean retval = env_handle_send(handle, bus, confirm);
+
 	g_object_unref(bus);
 
+	return retval;
+}
+
+/* Look up an application in the usage store, taking the full
+   Application ID or the short name that the store uses */
+static gboolean
+usage_lookup (const gchar * app, usage_record_t * record)
+{
+	gchar * pkg = NULL;
+	gchar * appname = NULL;
+	gchar * name = NULL;
+
+	if (ubuntu_app_launch_app_id_parse(app, &pkg, &appname, NULL)) {
+		if (pkg[0] == '\0') {
+			name = g_strdup(appname);
+		} else {
+			name = g_strdup_printf("%s_%s", pkg, appname);
+		}
+		g_free(pkg);
+		g_free(appname);
+	} else {
+		name = g_strdup(app);
+	}
+
+	gchar * path = usage_store_default_path();
+	GKeyFile * store = usage_store_load(path);
+	gboolean found = usage_store_get(store, name, record);
+
+	g_key_file_free(store);
+	g_free(path);
+	g_free(name);
+
+	return found;
+}
+
+typedef struct {
+	gchar * name;
+	guint64 seconds;
+} usage_sort_t;
+
+static gint
+usage_sort (gconstpointer a, gconstpointer b)
+{
+	guint64 sa = ((const usage_sort_t *)a)->seconds;
+	guint64 sb = ((const usage_sort_t *)b)->seconds;
+
+	return sa < sb ? 1 : (sa > sb ? -1 : 0);
+}
+
+gchar **
+ubuntu_app_launch_usage_list (void)
+{
+	gchar * path = usage_store_default_path();
+	GKeyFile * store = usage_store_load(path);
+	gsize count = 0;
+	gchar ** groups = g_key_file_get_groups(store, &count);
+
+	GArray * sorter = g_array_sized_new(FALSE, FALSE, sizeof(usage_sort_t), count);
+	gsize i;
+	for (i = 0; i < count; i++) {
+		usage_sort_t entry = {
+			groups[i],
+			g_key_file_get_uint64(store, groups[i], "Seconds", NULL)
+		};
+		g_array_append_val(sorter, entry);
+	}
+	g_array_sort(sorter, usage_sort);
+
+	gchar ** retval = g_new0(gchar *, count + 1);
+	for (i = 0; i < count; i++) {
+		retval[i] = g_strdup(g_array_index(sorter, usage_sort_t, i).name);
+	}
+
+	g_array_free(sorter, TRUE);
+	g_strfreev(groups);
+	g_key_file_free(store);
+	g_free(path);
+
+	return retval;
+}
+
+gboolean
+ubuntu_app_launch_usage_get (const gchar * app, guint64 * seconds, guint * launches, gint64 * last_used)
+{
+	g_return_val_if_fail(app != NULL, FALSE);
+
+	usage_record_t record;
+	if (!usage_lookup(app, &record)) {
+		return FALSE;
+	}
+
+	if (seconds != NULL) {
+		*seconds = record.seconds;
+	}
+
+	if (launches != NULL) {
+		*launches = record.launches;
+	}
+
+	if (last_used != NULL) {
+		*last_used = record.last_used / 1000;
+	}
+
 	return TRUE;
 }
 
+gboolean
+ubuntu_app_launch_usage_get_days (const gchar * app, guint days, guint64 * seconds)
+{
+	g_return_val_if_fail(app != NULL, FALSE);
+	g_return_val_if_fail(days == 0 || seconds != NULL, FALSE);
+
+	usage_record_t record;
+	if (!usage_lookup(app, &record)) {
+		return FALSE;
+	}
+
+	/* The totals start at the last day something was recorded, which
+	   might not be today */
+	gint64 today = usage_store_day(g_get_real_time() / 1000);
+	guint i;
+	for (i = 0; i < days; i++) {
+		gint64 index = record.day - (today - i);
+		if (index >= 0 && index < USAGE_STORE_DAYS) {
+			seconds[i] = record.day_seconds[index];
+		} else {
+			seconds[i] = 0;
+		}
+	}
+
+	return TRUE;
+}
 
 /* ensure that all characters are valid in the dbus output string */
 static gchar *
@@ -62,6 +62,42 @@ typedef void (*UbuntuAppLaunchAppFailedObserver) (const gchar * appid, UbuntuApp
  */
 typedef void (*UbuntuAppLaunchAppPausedResumedObserver) (const gchar * appid, GPid * pids, gpointer user_data);
 
+/**
+ * UbuntuAppLaunchAppEventType:
+ *
+ * The events that can be delivered in a batch.
+ */
+typedef enum { /*< prefix=UBUNTU_APP_LAUNCH_APP_EVENT */
+	UBUNTU_APP_LAUNCH_APP_EVENT_STARTED,  /*< nick=started */
+	UBUNTU_APP_LAUNCH_APP_EVENT_STOPPED,  /*< nick=stopped */
+	UBUNTU_APP_LAUNCH_APP_EVENT_FOCUS,    /*< nick=focus */
+	UBUNTU_APP_LAUNCH_APP_EVENT_PAUSED,   /*< nick=paused */
+	UBUNTU_APP_LAUNCH_APP_EVENT_RESUMED,  /*< nick=resumed */
+	UBUNTU_APP_LAUNCH_APP_EVENT_FAILED    /*< nick=failed */
+} UbuntuAppLaunchAppEventType;
+
+/**
+ * UbuntuAppLaunchAppEvent:
+ * @type: What happened to the application
+ * @appid: App ID of the application
+ *
+ * A single event in a batch.
+ */
+typedef struct _UbuntuAppLaunchAppEvent UbuntuAppLaunchAppEvent;
+struct _UbuntuAppLaunchAppEvent {
+	UbuntuAppLaunchAppEventType type;
+	const gchar * appid;
+};
+
+/**
+ * UbuntuAppLaunchAppBatchObserver:
+ * @events: (array length=num_events): Events in the order they happened
+ * @num_events: Number of events in @events
+ *
+ * Function prototype for application batch observers.
+ */
+typedef void (*UbuntuAppLaunchAppBatchObserver) (const UbuntuAppLaunchAppEvent * events, guint num_events, gpointer user_data);
+
 /**
  * UbuntuAppLaunchHelperObserver:
  *
@@ -364,6 +400,54 @@ gboolean   ubuntu_app_launch_observer_delete_app_paused (UbuntuAppLaunchAppPause
 gboolean   ubuntu_app_launch_observer_delete_app_resumed (UbuntuAppLaunchAppPausedResumedObserver  observer,
                                                           gpointer                                 user_data);
 
+/**
+ * ubuntu_app_launch_observer_add_app_batch:
+ * @observer: (scope notified): Callback with each batch of events
+ * @window_ms: How long to collect events for, in milliseconds
+ * @user_data: (allow-none) (closure): Data to pass to the observer
+ *
+ * Sets up a callback that gets all of the started, stopped, focus,
+ * paused, resumed and failed events together. The first event starts
+ * a window of @window_ms and everything that happens in the window is
+ * delivered in a single call at the end of it. Transitions for an
+ * application that cancel each other out, like a start followed by
+ * a stop or a pause followed by a resume, are removed from the batch
+ * along with repeated focus, paused and resumed events. If all of
+ * the events in a window cancel out the observer is not called.
+ *
+ * Return value: Whether adding the observer was successful.
+ */
+gboolean   ubuntu_app_launch_observer_add_app_batch    (UbuntuAppLaunchAppBatchObserver  observer,
+                                                        guint                            window_ms,
+                                                        gpointer                         user_data);
+
+/**
+ * ubuntu_app_launch_observer_delete_app_batch:
+ * @observer: (scope notified): Callback to remove
+ * @user_data: (closure) (allow-none): Data that was passed to the observer
+ *
+ * Removes a previously registered callback to ensure it no longer
+ * gets signaled. Any events that were waiting for the window
+ * to end are dropped.
+ *
+ * Return value: Whether deleting the observer was successful.
+ */
+gboolean   ubuntu_app_launch_observer_delete_app_batch (UbuntuAppLaunchAppBatchObserver  observer,
+                                                        gpointer                         user_data);
+
+/**
+ * ubuntu_app_launch_observer_batch_stats:
+ * @received: (out) (allow-none): Events given to batch observers
+ * @folded: (out) (allow-none): Events removed because they cancelled out
+ * @batches: (out) (allow-none): Calls made to batch observers
+ *
+ * Counters for all of the batch observers in this process since
+ * it started.
+ */
+void       ubuntu_app_launch_observer_batch_stats      (guint64 *                        received,
+                                                        guint64 *                        folded,
+                                                        guint64 *                        batches);
+
 /**
  * ubuntu_app_launch_list_running_apps:
  *
@@ -568,6 +652,33 @@ gchar **   ubuntu_app_launch_list_helpers              (const gchar *
 gchar **   ubuntu_app_launch_list_helper_instances     (const gchar *                     type,
                                                          const gchar *                     appid);
 
+/**
+ * ubuntu_app_launch_foreach_helper_instance:
+ * @func: Function to call for each instance
+ * @user_data: Data to pass to @func
+ *
+ * Calls @func for every running instance of every helper, of all
+ * types, in one pass.  The instances come sorted by type and then
+ * AppID, so all the instances of a helper are together.  Single
+ * instance helpers have an empty instance ID.
+ *
+ * Return value: Whether the helpers could be listed
+ */
+gboolean   ubuntu_app_launch_foreach_helper_instance   (UbuntuAppLaunchHelperObserver     func,
+                                                         gpointer                          user_data);
+
+/**
+ * ubuntu_app_launch_stop_all_helpers:
+ * @type: Type of helper
+ *
+ * Stops every instance of every helper of @type.  The requests to
+ * Upstart are all sent together and then waited on once, which is a
+ * lot quicker than stopping each instance separately.
+ *
+ * Return value: Number of instances that were stopped
+ */
+guint      ubuntu_app_launch_stop_all_helpers          (const gchar *                     type);
+
 
 /**
  * ubuntu_app_launch_observer_add_helper_started:
@@ -644,6 +755,73 @@ gboolean   ubuntu_app_launch_observer_delete_helper_stop    (UbuntuAppLaunchHelp
 gboolean   ubuntu_app_launch_helper_set_exec       (const gchar *            execline,
                                                     const gchar *            directory);
 
+/**
+ * ubuntu_app_launch_helper_set_exec_env:
+ * @execline: Exec line to be executed, in Desktop file format
+ * @directory: (allow-none): The directory that the exec line should
+ *     be executed in.
+ * @env: (allow-none) (array zero-terminated=1): Additional environment
+ *     variables for the helper, each in the form NAME=value
+ * @confirm: Whether to wait for Upstart to confirm that it has set
+ *     the variables
+ *
+ * Like ubuntu_app_launch_helper_set_exec() but also sets other
+ * environment variables for the helper. Everything is sent to Upstart
+ * in a single call. Unless @confirm is set the call is only sent, which
+ * is enough for an exec tool that is about to exit.
+ *
+ * Return Value: Whether we were able to set the environment, when
+ *     confirming that Upstart accepted it
+ */
+gboolean   ubuntu_app_launch_helper_set_exec_env   (const gchar *            execline,
+                                                    const gchar *            directory,
+                                                    const gchar * const *    env,
+                                                    gboolean                 confirm);
+
+/**
+ * ubuntu_app_launch_usage_list:
+ *
+ * Gets the applications that have usage recorded, ordered with the
+ * one that has been used the most first. The names are the short form
+ * of the Application ID without the version, the same as Zeitgeist
+ * uses. Reading the usage doesn't depend on how long the history is.
+ *
+ * Return value: (transfer full): A NULL terminated list of application names
+ */
+gchar **   ubuntu_app_launch_usage_list            (void);
+
+/**
+ * ubuntu_app_launch_usage_get:
+ * @app: Application ID or a name from ubuntu_app_launch_usage_list()
+ * @seconds: (out) (allow-none): Total time the application has been in use
+ * @launches: (out) (allow-none): Number of times it has been launched
+ * @last_used: (out) (allow-none): Seconds since the epoch that it was last
+ *     started or stopped
+ *
+ * Gets the usage totals for an application.
+ *
+ * Return value: Whether there is usage recorded for the application
+ */
+gboolean   ubuntu_app_launch_usage_get             (const gchar *            app,
+                                                    guint64 *                seconds,
+                                                    guint *                  launches,
+                                                    gint64 *                 last_used);
+
+/**
+ * ubuntu_app_launch_usage_get_days:
+ * @app: Application ID or a name from ubuntu_app_launch_usage_list()
+ * @days: Number of days to get, at most 30 are kept
+ * @seconds: (out caller-allocates) (array length=days): Time in use on each
+ *     day, starting with today and going back
+ *
+ * Gets the time an application was in use on each of the last few days.
+ *
+ * Return value: Whether there is usage recorded for the application
+ */
+gboolean   ubuntu_app_launch_usage_get_days        (const gchar *            app,
+                                                    guint                    days,
+                                                    guint64 *                seconds);
+
 #ifdef __cplusplus
 }
 #endif
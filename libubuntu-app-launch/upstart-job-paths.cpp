@@ -0,0 +1,227 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "upstart-job-paths.h"
+#include "ubuntu-app-launch-trace.h"
+
+#include <upstart.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Subscribes to Upstart changing owners on the bus and starts fetching
+    the paths of the jobs we know we'll need.
+
+    \param bus Connection Upstart is on, must be used on the registry thread
+    \param jobs Names of the jobs to fetch ahead of time
+*/
+UpstartJobPaths::UpstartJobPaths(const std::shared_ptr<GDBusConnection>& bus, const std::list<std::string>& jobs)
+    : bus_(bus)
+    , cancel_(g_cancellable_new(), [](GCancellable* cancel) {
+        g_cancellable_cancel(cancel);
+        g_object_unref(cancel);
+    })
+    , signal_(0)
+    , prefetch_(jobs)
+    , generation_(0)
+{
+    signal_ = g_dbus_connection_signal_subscribe(
+        bus_.get(),                   /* bus */
+        "org.freedesktop.DBus",       /* sender */
+        "org.freedesktop.DBus",       /* interface */
+        "NameOwnerChanged",           /* signal */
+        "/org/freedesktop/DBus",      /* path */
+        DBUS_SERVICE_UPSTART,         /* arg0 */
+        G_DBUS_SIGNAL_FLAGS_NONE,     /* flags */
+        [](GDBusConnection* conn, const gchar* sender, const gchar* object, const gchar* interface,
+           const gchar* signal, GVariant* params, gpointer user_data) {
+            auto paths = static_cast<UpstartJobPaths*>(user_data);
+
+            const gchar* name = nullptr;
+            const gchar* oldOwner = nullptr;
+            const gchar* newOwner = nullptr;
+            g_variant_get(params, "(&s&s&s)", &name, &oldOwner, &newOwner);
+
+            g_debug("Upstart owner changed from '%s' to '%s', dropping job paths", oldOwner, newOwner);
+            paths->invalidate();
+
+            if (newOwner[0] != '\0')
+            {
+                paths->prefetch();
+            }
+        },       /* callback */
+        this,    /* user data */
+        nullptr); /* user data destroy */
+
+    prefetch();
+}
+
+UpstartJobPaths::~UpstartJobPaths()
+{
+    if (signal_ != 0)
+    {
+        g_dbus_connection_signal_unsubscribe(bus_.get(), signal_);
+    }
+
+    /* Cancels the calls, their callbacks won't touch us */
+    cancel_.reset();
+}
+
+/** Get the object path for a job. If it isn't in the cache this makes
+    a synchronous call to Upstart on the calling thread. Returns an empty
+    string if Upstart doesn't know the job.
+
+    \param job Name of the job
+*/
+std::string UpstartJobPaths::get(const std::string& job)
+{
+    unsigned int generation;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto it = paths_.find(job);
+        if (it != paths_.end())
+        {
+            return it->second;
+        }
+        generation = generation_;
+    }
+
+    tracepoint(ubuntu_app_launch, job_path_miss, job.c_str());
+
+    GError* error = nullptr;
+    GVariant* job_path_variant = g_dbus_connection_call_sync(bus_.get(),                        /* connection */
+                                                             DBUS_SERVICE_UPSTART,              /* service */
+                                                             DBUS_PATH_UPSTART,                 /* path */
+                                                             DBUS_INTERFACE_UPSTART,            /* iface */
+                                                             "GetJobByName",                    /* method */
+                                                             g_variant_new("(s)", job.c_str()), /* params */
+                                                             G_VARIANT_TYPE("(o)"),             /* return */
+                                                             G_DBUS_CALL_FLAGS_NONE,            /* flags */
+                                                             -1,                                /* timeout: default */
+                                                             cancel_.get(),                     /* cancellable */
+                                                             &error);                           /* error */
+
+    if (error != nullptr)
+    {
+        g_warning("Unable to find job '%s': %s", job.c_str(), error->message);
+        g_error_free(error);
+        return {};
+    }
+
+    const gchar* job_path = nullptr;
+    g_variant_get(job_path_variant, "(&o)", &job_path);
+    std::string path(job_path);
+    g_variant_unref(job_path_variant);
+
+    store(job, path, generation);
+    return path;
+}
+
+/** Drop all the cached paths, anything that is being fetched right now
+    won't be stored either */
+void UpstartJobPaths::invalidate()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    paths_.clear();
+    generation_++;
+}
+
+/** Ask Upstart for the paths of all the prefetch jobs without waiting on
+    the answers. Must be called on the registry thread. */
+void UpstartJobPaths::prefetch()
+{
+    unsigned int generation;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        generation = generation_;
+    }
+
+    for (const auto& job : prefetch_)
+    {
+        auto request = new PrefetchRequest{this, job, generation};
+
+        g_dbus_connection_call(bus_.get(),                        /* bus */
+                               DBUS_SERVICE_UPSTART,              /* service */
+                               DBUS_PATH_UPSTART,                 /* path */
+                               DBUS_INTERFACE_UPSTART,            /* iface */
+                               "GetJobByName",                    /* method */
+                               g_variant_new("(s)", job.c_str()), /* params */
+                               G_VARIANT_TYPE("(o)"),             /* return */
+                               G_DBUS_CALL_FLAGS_NONE,            /* flags */
+                               -1,                                /* timeout: default */
+                               cancel_.get(),                     /* cancellable */
+                               prefetchCb,                        /* callback */
+                               request);                          /* user data */
+    }
+}
+
+/** Put a path in the cache unless it was invalidated since the path was
+    asked for
+
+    \param job Name of the job
+    \param path Object path of the job
+    \param generation Generation of the cache when the path was asked for
+*/
+void UpstartJobPaths::store(const std::string& job, const std::string& path, unsigned int generation)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    if (generation != generation_)
+    {
+        return;
+    }
+
+    paths_[job] = path;
+}
+
+/** Answer to a prefetch */
+void UpstartJobPaths::prefetchCb(GObject* obj, GAsyncResult* res, gpointer user_data)
+{
+    auto request = static_cast<PrefetchRequest*>(user_data);
+    GError* error = nullptr;
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free(error);
+        delete request;
+        return;
+    }
+
+    if (error != nullptr)
+    {
+        /* We'll try again with a sync call if someone needs it */
+        g_debug("Unable to prefetch job '%s': %s", request->job.c_str(), error->message);
+        g_error_free(error);
+        delete request;
+        return;
+    }
+
+    const gchar* job_path = nullptr;
+    g_variant_get(result, "(&o)", &job_path);
+    request->paths->store(request->job, job_path, request->generation);
+    tracepoint(ubuntu_app_launch, job_path_prefetched, request->job.c_str());
+
+    g_variant_unref(result);
+    delete request;
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Cache of the object paths of the Upstart jobs we use
+
+    Each job path takes a GetJobByName call to find, which used to be
+    a synchronous call the first time each job was launched. The paths
+    of the jobs we know about are fetched asynchronously when we're
+    created, and anything else is looked up the first time it's asked
+    for. When Upstart comes back on the bus with a new owner the paths
+    could have changed, so the cache is dropped and fetched again.
+
+    The paths can be read from any thread. It must be created and
+    destroyed on the registry thread, which is where the signals and
+    the prefetches are handled.
+*/
+class UpstartJobPaths
+{
+public:
+    UpstartJobPaths(const std::shared_ptr<GDBusConnection>& bus, const std::list<std::string>& jobs);
+    virtual ~UpstartJobPaths();
+
+    std::string get(const std::string& job);
+    void invalidate();
+
+private:
+    /** Data for the async prefetches */
+    struct PrefetchRequest
+    {
+        UpstartJobPaths* paths;
+        std::string job;
+        unsigned int generation; /**< Generation of the cache when it was sent */
+    };
+
+    /** Connection Upstart is on */
+    std::shared_ptr<GDBusConnection> bus_;
+    /** Cancels the outstanding calls when we're destroyed */
+    std::shared_ptr<GCancellable> cancel_;
+    /** Subscription to NameOwnerChanged for Upstart */
+    guint signal_;
+    /** Jobs to fetch ahead of time */
+    std::list<std::string> prefetch_;
+
+    /** Protects paths_ and generation_ */
+    std::mutex lock_;
+    /** Path for each job name */
+    std::map<std::string, std::string> paths_;
+    /** Bumped on each invalidation so that answers from before don't
+        end up in the cache */
+    unsigned int generation_;
+
+    void prefetch();
+    void store(const std::string& job, const std::string& path, unsigned int generation);
+
+    static void prefetchCb(GObject* obj, GAsyncResult* res, gpointer user_data);
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
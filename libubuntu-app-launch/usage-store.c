@@ -0,0 +1,257 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "usage-store.h"
+
+/* The usage store keeps a running total for each application so that
+   reading it doesn't depend on how much history there is. Each time
+   events are recorded the file is read, updated and replaced while
+   holding a lock, as both the registry and the job scripts write it. */
+
+#define DAY_SECONDS (24 * 60 * 60)
+
+/* Longest that we believe an application was used without a break, a
+   longer span is more likely a close that we never heard about */
+#define MAX_SPAN_SECONDS (12 * 60 * 60)
+
+/* Where the store lives unless we're told otherwise */
+gchar *
+usage_store_default_path (void)
+{
+	return g_build_filename(g_get_user_data_dir(), "ubuntu-app-launch", "usage", NULL);
+}
+
+/* Read the store, an empty one if there isn't a file yet */
+GKeyFile *
+usage_store_load (const gchar * path)
+{
+	GKeyFile * store = g_key_file_new();
+	GError * error = NULL;
+
+	if (!g_key_file_load_from_file(store, path, G_KEY_FILE_NONE, &error)) {
+		if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			g_warning("Unable to read usage store '%s': %s", path, error->message);
+		}
+		g_error_free(error);
+	}
+
+	return store;
+}
+
+/* Seconds that local time is ahead of UTC at a timestamp */
+static gint64
+local_offset (gint64 timestamp)
+{
+	GDateTime * local = g_date_time_new_from_unix_local(timestamp / 1000);
+	gint64 offset = 0;
+
+	if (local != NULL) {
+		offset = g_date_time_get_utc_offset(local) / G_TIME_SPAN_SECOND;
+		g_date_time_unref(local);
+	}
+
+	return offset;
+}
+
+/* The local day that a timestamp falls on, counted from the epoch */
+gint64
+usage_store_day (gint64 timestamp)
+{
+	return (timestamp / 1000 + local_offset(timestamp)) / DAY_SECONDS;
+}
+
+/* Get what we know about an application, returns FALSE if it
+   isn't in the store */
+gboolean
+usage_store_get (GKeyFile * store, const gchar * app, usage_record_t * record)
+{
+	memset(record, 0, sizeof(usage_record_t));
+
+	if (!g_key_file_has_group(store, app)) {
+		return FALSE;
+	}
+
+	record->seconds = g_key_file_get_uint64(store, app, "Seconds", NULL);
+	record->launches = g_key_file_get_integer(store, app, "Launches", NULL);
+	record->last_used = g_key_file_get_int64(store, app, "LastUsed", NULL);
+	record->open_since = g_key_file_get_int64(store, app, "OpenSince", NULL);
+	record->day = g_key_file_get_int64(store, app, "Day", NULL);
+
+	gsize length = 0;
+	gint * days = g_key_file_get_integer_list(store, app, "DaySeconds", &length, NULL);
+	gsize i;
+	for (i = 0; days != NULL && i < length && i < USAGE_STORE_DAYS; i++) {
+		record->day_seconds[i] = MAX(days[i], 0);
+	}
+	g_free(days);
+
+	return TRUE;
+}
+
+static void
+usage_store_set (GKeyFile * store, const gchar * app, const usage_record_t * record)
+{
+	g_key_file_set_uint64(store, app, "Seconds", record->seconds);
+	g_key_file_set_integer(store, app, "Launches", record->launches);
+	g_key_file_set_int64(store, app, "LastUsed", record->last_used);
+	g_key_file_set_int64(store, app, "OpenSince", record->open_since);
+	g_key_file_set_int64(store, app, "Day", record->day);
+
+	/* Trailing days with nothing in them don't need to be written */
+	gint days[USAGE_STORE_DAYS];
+	gsize length = 0;
+	gsize i;
+	for (i = 0; i < USAGE_STORE_DAYS; i++) {
+		days[i] = record->day_seconds[i];
+		if (days[i] != 0) {
+			length = i + 1;
+		}
+	}
+	g_key_file_set_integer_list(store, app, "DaySeconds", days, MAX(length, 1));
+}
+
+/* Add time to a day's total, moving the window along if the day
+   is newer than the ones we have */
+static void
+add_day_seconds (usage_record_t * record, gint64 day, guint seconds)
+{
+	if (day > record->day) {
+		gint64 shift = day - record->day;
+		if (shift >= USAGE_STORE_DAYS) {
+			memset(record->day_seconds, 0, sizeof(record->day_seconds));
+		} else {
+			memmove(&record->day_seconds[shift], &record->day_seconds[0], (USAGE_STORE_DAYS - shift) * sizeof(guint));
+			memset(&record->day_seconds[0], 0, shift * sizeof(guint));
+		}
+		record->day = day;
+	}
+
+	if (record->day - day < USAGE_STORE_DAYS) {
+		record->day_seconds[record->day - day] += seconds;
+	}
+}
+
+/* Add the time between open and close, split at midnights */
+static void
+add_span (usage_record_t * record, gint64 open, gint64 close)
+{
+	record->seconds += (close - open) / 1000;
+
+	while (open < close) {
+		gint64 local = open / 1000 + local_offset(open);
+		gint64 day = local / DAY_SECONDS;
+		gint64 midnight = (open / 1000 + DAY_SECONDS - (local % DAY_SECONDS)) * 1000;
+		gint64 end = MIN(close, midnight);
+
+		add_day_seconds(record, day, (end - open) / 1000);
+		open = end;
+	}
+}
+
+static void
+apply_event (usage_record_t * record, const usage_event_t * event)
+{
+	if (event->open) {
+		if (event->launch) {
+			record->launches++;
+			/* If it was still open we missed the close, that time can't
+			   be trusted so start counting again from here */
+			record->open_since = event->timestamp;
+		} else if (record->open_since == 0) {
+			/* A resume of something that's already open doesn't restart the clock */
+			record->open_since = event->timestamp;
+		}
+	} else if (record->open_since != 0) {
+		if (event->timestamp > record->open_since) {
+			add_span(record, MAX(record->open_since, event->timestamp - MAX_SPAN_SECONDS * 1000), event->timestamp);
+		}
+		record->open_since = 0;
+	}
+
+	record->last_used = MAX(record->last_used, event->timestamp);
+}
+
+/* Add events to the store at path. They need to be in the order that
+   they happened. */
+gboolean
+usage_store_update (const gchar * path, const usage_event_t * events, guint count)
+{
+	g_return_val_if_fail(path != NULL, FALSE);
+
+	if (count == 0) {
+		return TRUE;
+	}
+
+	gchar * dir = g_path_get_dirname(path);
+	if (g_mkdir_with_parents(dir, 0700) != 0) {
+		g_warning("Unable to create usage directory '%s': %s", dir, g_strerror(errno));
+		g_free(dir);
+		return FALSE;
+	}
+	g_free(dir);
+
+	/* The file itself gets replaced, so lock a file next to it */
+	gchar * lockpath = g_strdup_printf("%s.lock", path);
+	int lockfd = g_open(lockpath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	g_free(lockpath);
+
+	if (lockfd < 0 || flock(lockfd, LOCK_EX) != 0) {
+		g_warning("Unable to lock usage store '%s': %s", path, g_strerror(errno));
+		if (lockfd >= 0) {
+			close(lockfd);
+		}
+		return FALSE;
+	}
+
+	GKeyFile * store = usage_store_load(path);
+
+	guint i;
+	for (i = 0; i < count; i++) {
+		usage_record_t record;
+		usage_store_get(store, events[i].app, &record);
+		apply_event(&record, &events[i]);
+		usage_store_set(store, events[i].app, &record);
+	}
+
+	gsize length = 0;
+	gchar * data = g_key_file_to_data(store, &length, NULL);
+	GError * error = NULL;
+	gboolean saved = g_file_set_contents(path, data, length, &error);
+
+	if (error != NULL) {
+		g_warning("Unable to write usage store '%s': %s", path, error->message);
+		g_error_free(error);
+	}
+
+	g_free(data);
+	g_key_file_free(store);
+
+	flock(lockfd, LOCK_UN);
+	close(lockfd);
+
+	return saved;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#ifndef USAGE_STORE_H
+#define USAGE_STORE_H 1
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Number of days that we keep a total for */
+#define USAGE_STORE_DAYS 30
+
+/* Something that happened to an application */
+typedef struct {
+	const gchar * app;  /* Short application name, like Zeitgeist has */
+	gboolean open;      /* Whether the user started or stopped using it */
+	gboolean launch;    /* Whether an open was a new launch */
+	gint64 timestamp;   /* Milliseconds since the epoch */
+} usage_event_t;
+
+/* What we know about an application */
+typedef struct {
+	guint64 seconds;                      /* Total time in use */
+	guint launches;                       /* Number of launches */
+	gint64 last_used;                     /* Last event in ms since the epoch */
+	gint64 open_since;                    /* When it was opened, zero if it isn't */
+	gint64 day;                           /* Local day that day_seconds starts at */
+	guint day_seconds[USAGE_STORE_DAYS];  /* Time in use for day and the days before */
+} usage_record_t;
+
+gchar *    usage_store_default_path (void);
+GKeyFile * usage_store_load         (const gchar * path);
+gboolean   usage_store_get          (GKeyFile * store, const gchar * app, usage_record_t * record);
+gboolean   usage_store_update       (const gchar * path, const usage_event_t * events, guint count);
+gint64     usage_store_day          (gint64 timestamp);
+
+G_END_DECLS
+
+#endif /* USAGE_STORE_H */
@@ -0,0 +1,385 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "zg-event-queue.h"
+#include "appid.h"
+
+#include <algorithm>
+
+extern "C" {
+#include "ubuntu-app-launch-trace.h"
+#include "ubuntu-app-launch.h"
+#include "usage-store.h"
+}
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** Interface for the job scripts to report their events */
+static const char* SINK_INTERFACE =
+    "<node>"
+    "  <interface name='com.canonical.UbuntuAppLaunch.ZeitgeistSink'>"
+    "    <method name='Report'>"
+    "      <arg type='s' name='appid' direction='in' />"
+    "      <arg type='s' name='event' direction='in' />"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+/** Events for the usage store, owned by the thread writing them */
+struct ZgEventQueue::UsageBatch
+{
+    std::string path;
+    std::vector<Event> events;
+};
+
+/** Build an empty queue
+
+    \param log Zeitgeist log to send the events to
+    \param interval Longest an event waits in the queue
+    \param threshold Number of events that are sent without waiting
+    \param usagePath Usage store to keep up to date, empty for none
+*/
+ZgEventQueue::ZgEventQueue(const std::shared_ptr<ZeitgeistLog>& log,
+                           std::chrono::milliseconds interval,
+                           unsigned int threshold,
+                           const std::string& usagePath)
+    : log_(log)
+    , interval_(interval)
+    , threshold_(threshold)
+    , timer_(nullptr)
+    , usagePath_(usagePath)
+    , usageWriter_(nullptr)
+    , stats_(std::make_shared<Stats>(Stats{0, 0, 0, 0}))
+    , object_(0)
+    , name_(0)
+{
+    if (!usagePath_.empty())
+    {
+        usageWriter_ = g_thread_pool_new(writeUsage, nullptr, 1, FALSE, nullptr);
+    }
+}
+
+/** Sends anything that is left before going away */
+ZgEventQueue::~ZgEventQueue()
+{
+    if (name_ != 0)
+    {
+        g_bus_unown_name(name_);
+    }
+
+    if (object_ != 0)
+    {
+        g_dbus_connection_unregister_object(bus_.get(), object_);
+    }
+
+    flush();
+
+    /* Let the writes finish so that no usage is lost */
+    if (usageWriter_ != nullptr)
+    {
+        g_thread_pool_free(usageWriter_, FALSE, TRUE);
+    }
+}
+
+/** Queue an event
+
+    \param appname Application name as Zeitgeist knows it, without the version
+    \param interpretation Zeitgeist event type
+    \param launch Whether an access event is the application starting
+           rather than resuming
+*/
+void ZgEventQueue::push(const std::string& appname, const std::string& interpretation, bool launch)
+{
+    queue_.emplace_back(Event{"application://" + appname + ".desktop", interpretation,
+                              g_get_real_time() / G_TIME_SPAN_MILLISECOND, appname, launch});
+    stats_->queued++;
+
+    if (queue_.size() >= threshold_)
+    {
+        flush();
+        return;
+    }
+
+    if (timer_ == nullptr)
+    {
+        timer_ = g_timeout_source_new(interval_.count());
+        g_source_set_callback(timer_,
+                              [](gpointer user_data) -> gboolean {
+                                  auto queue = static_cast<ZgEventQueue*>(user_data);
+                                  queue->flush();
+                                  return G_SOURCE_REMOVE;
+                              },
+                              this, nullptr);
+        g_source_attach(timer_, g_main_context_get_thread_default());
+    }
+}
+
+/** Send everything in the queue in a single call */
+void ZgEventQueue::flush()
+{
+    if (timer_ != nullptr)
+    {
+        g_source_destroy(timer_);
+        g_source_unref(timer_);
+        timer_ = nullptr;
+    }
+
+    if (queue_.empty())
+    {
+        return;
+    }
+
+    GPtrArray* events = g_ptr_array_new_with_free_func(g_object_unref);
+
+    for (const auto& queued : queue_)
+    {
+        ZeitgeistEvent* event = zeitgeist_event_new();
+        zeitgeist_event_set_actor(event, "application://ubuntu-app-launch.desktop");
+        zeitgeist_event_set_interpretation(event, queued.interpretation.c_str());
+        zeitgeist_event_set_manifestation(event, ZEITGEIST_ZG_USER_ACTIVITY);
+        zeitgeist_event_set_timestamp(event, queued.timestamp);
+
+        ZeitgeistSubject* subject = zeitgeist_subject_new();
+        zeitgeist_subject_set_interpretation(subject, ZEITGEIST_NFO_SOFTWARE);
+        zeitgeist_subject_set_manifestation(subject, ZEITGEIST_NFO_SOFTWARE_ITEM);
+        zeitgeist_subject_set_mimetype(subject, "application/x-desktop");
+        zeitgeist_subject_set_uri(subject, queued.uri.c_str());
+
+        zeitgeist_event_add_subject(event, subject);
+        g_object_unref(subject);
+
+        g_ptr_array_add(events, event);
+    }
+
+    if (usageWriter_ != nullptr)
+    {
+        g_thread_pool_push(usageWriter_, new UsageBatch{usagePath_, queue_}, nullptr);
+    }
+
+    g_debug("Sending %d events to Zeitgeist", int(queue_.size()));
+    tracepoint(ubuntu_app_launch, zg_flush, queue_.size());
+
+    /** Data for the callback, the queue may be gone by then */
+    struct InsertData
+    {
+        std::shared_ptr<Stats> stats;
+        std::size_t count;
+    };
+
+    stats_->flushes++;
+    zeitgeist_log_insert_events(log_.get(), /* log */
+                                events,     /* events */
+                                nullptr,    /* cancellable */
+                                [](GObject* obj, GAsyncResult* res, gpointer user_data) -> void {
+                                    auto data = static_cast<InsertData*>(user_data);
+                                    GError* error = nullptr;
+                                    GArray* result = zeitgeist_log_insert_events_finish(ZEITGEIST_LOG(obj), res, &error);
+
+                                    if (error != nullptr)
+                                    {
+                                        g_warning("Unable to submit Zeitgeist Events: %s", error->message);
+                                        g_error_free(error);
+                                        data->stats->failed += data->count;
+                                    }
+                                    else
+                                    {
+                                        data->stats->inserted += data->count;
+                                    }
+
+                                    if (result != nullptr)
+                                    {
+                                        g_array_free(result, TRUE);
+                                    }
+                                    delete data;
+                                },                                        /* callback */
+                                new InsertData{stats_, queue_.size()}); /* userdata */
+
+    g_ptr_array_unref(events);
+    queue_.clear();
+}
+
+/** Write a batch of events to the usage store, run on the usage writer
+    thread as it waits for the store's lock
+
+    \param data A UsageBatch to write and free
+    \param user_data Unused
+*/
+void ZgEventQueue::writeUsage(gpointer data, gpointer user_data)
+{
+    auto batch = static_cast<UsageBatch*>(data);
+
+    std::vector<usage_event_t> usage;
+    for (const auto& queued : batch->events)
+    {
+        usage.emplace_back(usage_event_t{queued.appname.c_str(), queued.interpretation == ZEITGEIST_ZG_ACCESS_EVENT,
+                                         queued.launch, queued.timestamp});
+    }
+    usage_store_update(batch->path.c_str(), usage.data(), usage.size());
+
+    delete batch;
+}
+
+/** Number of events waiting to be sent */
+std::size_t ZgEventQueue::pending() const
+{
+    return queue_.size();
+}
+
+/** Get the counters */
+ZgEventQueue::Stats ZgEventQueue::stats() const
+{
+    return *stats_;
+}
+
+/** Put the queue on the bus so the job scripts can report to it. Only
+    one queue on the bus gets the name, the others will be in line for
+    it if that one goes away.
+
+    \param bus Session bus
+*/
+bool ZgEventQueue::exportOnBus(const std::shared_ptr<GDBusConnection>& bus)
+{
+    if (object_ != 0)
+    {
+        return true;
+    }
+
+    GError* error = nullptr;
+    auto nodeinfo = std::shared_ptr<GDBusNodeInfo>(g_dbus_node_info_new_for_xml(SINK_INTERFACE, &error),
+                                                   [](GDBusNodeInfo* info) {
+                                                       if (info != nullptr)
+                                                       {
+                                                           g_dbus_node_info_unref(info);
+                                                       }
+                                                   });
+    if (error != nullptr)
+    {
+        g_warning("Unable to parse Zeitgeist sink interface: %s", error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    static const GDBusInterfaceVTable vtable = {handleMethod, nullptr, nullptr, {nullptr}};
+
+    object_ = g_dbus_connection_register_object(bus.get(), OBJECT_PATH, nodeinfo->interfaces[0], &vtable, this,
+                                                nullptr, &error);
+    if (error != nullptr)
+    {
+        g_warning("Unable to export Zeitgeist sink: %s", error->message);
+        g_error_free(error);
+        object_ = 0;
+        return false;
+    }
+
+    bus_ = bus;
+    name_ = g_bus_own_name_on_connection(bus.get(), BUS_NAME, G_BUS_NAME_OWNER_FLAGS_NONE, nullptr, nullptr, nullptr,
+                                         nullptr);
+
+    return true;
+}
+
+/** Whether a string from a job script is an AppID, either a full one
+    or the desktop file name of a legacy application
+
+    \param appid String to check
+*/
+bool ZgEventQueue::validAppId(const std::string& appid)
+{
+    if (AppID::valid(appid))
+    {
+        return true;
+    }
+
+    /* Same characters that AppID allows in an application name */
+    static const std::string allowed{"+-.:~ "};
+    if (appid.size() < 2 || appid.size() > 255 || appid[0] == ' ')
+    {
+        return false;
+    }
+
+    return std::all_of(appid.begin(), appid.end(),
+                       [](char c) { return g_ascii_isalnum(c) || allowed.find(c) != std::string::npos; });
+}
+
+/** Handle a report from a job script, the events are 'open' and 'close'
+    just like the arguments to zg-report-app. Anything else, or an AppID
+    that isn't one, is refused so it doesn't end up in Zeitgeist. */
+void ZgEventQueue::handleMethod(GDBusConnection* connection,
+                                const gchar* sender,
+                                const gchar* path,
+                                const gchar* interface,
+                                const gchar* method,
+                                GVariant* params,
+                                GDBusMethodInvocation* invocation,
+                                gpointer user_data)
+{
+    auto queue = static_cast<ZgEventQueue*>(user_data);
+
+    const gchar* appid = nullptr;
+    const gchar* event = nullptr;
+    g_variant_get(params, "(&s&s)", &appid, &event);
+
+    if (!validAppId(appid))
+    {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                              "Invalid AppID '%s'", appid);
+        return;
+    }
+
+    const gchar* interpretation = nullptr;
+    if (g_strcmp0(event, "open") == 0)
+    {
+        interpretation = ZEITGEIST_ZG_ACCESS_EVENT;
+    }
+    else if (g_strcmp0(event, "close") == 0)
+    {
+        interpretation = ZEITGEIST_ZG_LEAVE_EVENT;
+    }
+    else
+    {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                              "Unknown event type '%s'", event);
+        return;
+    }
+
+    /* Same short form that zg-report-app uses */
+    gchar* pkg = nullptr;
+    gchar* app = nullptr;
+    std::string appname;
+    if (ubuntu_app_launch_app_id_parse(appid, &pkg, &app, nullptr))
+    {
+        appname = std::string(pkg) + "_" + app;
+        g_free(pkg);
+        g_free(app);
+    }
+    else
+    {
+        appname = appid;
+    }
+
+    queue->push(appname, interpretation, g_strcmp0(event, "open") == 0);
+    g_dbus_method_invocation_return_value(invocation, nullptr);
+}
+
+}  // namespace app_launch
+}  // namespace ubuntu
@@ -0,0 +1,136 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <gio/gio.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <zeitgeist.h>
+
+namespace ubuntu
+{
+namespace app_launch
+{
+
+/** \private
+    \brief Collects Zeitgeist events and sends them in batches
+
+    Every pause, resume, start and stop used to be its own call into
+    Zeitgeist, and the starts and stops each forked zg-report-app to
+    do it. Here the events are queued and sent with one InsertEvents
+    call once the flush interval has passed since the first queued
+    event, or as soon as the threshold is reached. The timestamps are
+    taken when the events are queued so batching doesn't move them.
+    The same batches update the usage store, so that it gets written
+    once per batch as well. That write waits on a lock that zg-report-app
+    also takes, so it is done on a thread of its own, one batch at a time
+    so that they stay in order.
+
+    The queue can also be put on the session bus so that the job
+    scripts can hand their events to a running registry with a single
+    message instead of starting zg-report-app.
+
+    All functions must be called on the registry thread.
+*/
+class ZgEventQueue
+{
+public:
+    /** Counters for the queue */
+    struct Stats
+    {
+        std::uint64_t queued;   /**< Events put in the queue */
+        std::uint64_t flushes;  /**< InsertEvents calls made */
+        std::uint64_t inserted; /**< Events that Zeitgeist accepted */
+        std::uint64_t failed;   /**< Events in calls that failed */
+    };
+
+    ZgEventQueue(const std::shared_ptr<ZeitgeistLog>& log,
+                 std::chrono::milliseconds interval,
+                 unsigned int threshold,
+                 const std::string& usagePath);
+    virtual ~ZgEventQueue();
+
+    void push(const std::string& appname, const std::string& interpretation, bool launch = false);
+    void flush();
+    std::size_t pending() const;
+    Stats stats() const;
+
+    bool exportOnBus(const std::shared_ptr<GDBusConnection>& bus);
+
+    static bool validAppId(const std::string& appid);
+
+    /** Bus name the queue owns when it is exported */
+    static constexpr const char* BUS_NAME = "com.canonical.UbuntuAppLaunch.ZeitgeistSink";
+    /** Object path the queue is exported on */
+    static constexpr const char* OBJECT_PATH = "/com/canonical/UbuntuAppLaunch/ZeitgeistSink";
+
+private:
+    /** An event waiting to be sent */
+    struct Event
+    {
+        std::string uri;            /**< Desktop URI of the application */
+        std::string interpretation; /**< Zeitgeist event type */
+        gint64 timestamp;           /**< Milliseconds since the epoch */
+        std::string appname;        /**< Application name for the usage store */
+        bool launch;                /**< Whether an access was a new launch */
+    };
+
+    /** Log to send to */
+    std::shared_ptr<ZeitgeistLog> log_;
+    /** How long events can wait */
+    std::chrono::milliseconds interval_;
+    /** How many events to queue before sending right away */
+    unsigned int threshold_;
+    /** Events waiting to be sent */
+    std::vector<Event> queue_;
+    /** Flush timer, only set when there are events */
+    GSource* timer_;
+    /** Usage store to update, empty to not keep usage */
+    std::string usagePath_;
+    /** Single thread that writes the usage store, null without one */
+    GThreadPool* usageWriter_;
+    /** Counters, shared with the callbacks of calls in flight */
+    std::shared_ptr<Stats> stats_;
+
+    /** Bus we're exported on */
+    std::shared_ptr<GDBusConnection> bus_;
+    /** Exported object registration */
+    guint object_;
+    /** Bus name ownership */
+    guint name_;
+
+    struct UsageBatch;
+    static void writeUsage(gpointer data, gpointer user_data);
+    static void handleMethod(GDBusConnection* connection,
+                             const gchar* sender,
+                             const gchar* path,
+                             const gchar* interface,
+                             const gchar* method,
+                             GVariant* params,
+                             GDBusMethodInvocation* invocation,
+                             gpointer user_data);
+};
+
+}  // namespace app_launch
+}  // namespace ubuntu
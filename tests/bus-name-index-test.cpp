@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "bus-name-index.h"
+#include "eventually-fixture.h"
+
+#include <algorithm>
+#include <gio/gio.h>
+#include <gtest/gtest.h>
+#include <libdbustest/dbus-test.h>
+#include <unistd.h>
+
+class BusNameIndex : public EventuallyFixture
+{
+protected:
+    DbusTestService* service = nullptr;
+    std::shared_ptr<GDBusConnection> bus;
+
+    virtual void SetUp()
+    {
+        service = dbus_test_service_new(nullptr);
+        dbus_test_service_start_tasks(service);
+
+        bus = std::shared_ptr<GDBusConnection>(g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr),
+                                               [](GDBusConnection* bus) { g_clear_object(&bus); });
+        g_dbus_connection_set_exit_on_close(bus.get(), FALSE);
+    }
+
+    virtual void TearDown()
+    {
+        bus.reset();
+        g_clear_object(&service);
+    }
+
+    /** Open a new connection to the bus, which gets a new unique name
+        that is owned by this process */
+    std::shared_ptr<GDBusConnection> newConnection()
+    {
+        gchar* address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
+        auto conn = std::shared_ptr<GDBusConnection>(
+            g_dbus_connection_new_for_address_sync(
+                address, GDBusConnectionFlags(G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                              G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+                nullptr, nullptr, nullptr),
+            [](GDBusConnection* conn) {
+                g_dbus_connection_close_sync(conn, nullptr, nullptr);
+                g_object_unref(conn);
+            });
+        g_free(address);
+        return conn;
+    }
+
+    /** Run the main loop until the index has a name, or not */
+    bool waitForName(const std::shared_ptr<ubuntu::app_launch::BusNameIndex>& index,
+                     const std::string& name,
+                     bool present)
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            auto names = index->namesForPid(getpid());
+            bool found = std::find(names.begin(), names.end(), name) != names.end();
+            if (index->isReady() && found == present)
+            {
+                return true;
+            }
+            pause(10);
+        }
+        return false;
+    }
+};
+
+TEST_F(BusNameIndex, InitialScan)
+{
+    auto index = std::make_shared<ubuntu::app_launch::BusNameIndex>(bus);
+
+    /* Our own connection was on the bus before the index */
+    EXPECT_TRUE(waitForName(index, g_dbus_connection_get_unique_name(bus.get()), true));
+
+    EXPECT_TRUE(index->namesForPid(0).empty());
+}
+
+TEST_F(BusNameIndex, FollowsChanges)
+{
+    auto index = std::make_shared<ubuntu::app_launch::BusNameIndex>(bus);
+    ASSERT_TRUE(waitForName(index, g_dbus_connection_get_unique_name(bus.get()), true));
+
+    auto conn = newConnection();
+    std::string name = g_dbus_connection_get_unique_name(conn.get());
+
+    EXPECT_TRUE(waitForName(index, name, true));
+
+    conn.reset();
+
+    EXPECT_TRUE(waitForName(index, name, false));
+}
+
+TEST_F(BusNameIndex, Destroy)
+{
+    /* Dropping the index with calls outstanding must not crash
+       when they complete */
+    auto index = std::make_shared<ubuntu::app_launch::BusNameIndex>(bus);
+    index.reset();
+
+    pause(100);
+}
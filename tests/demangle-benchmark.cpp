@@ -0,0 +1,254 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+/* Compares getting the Mir socket for a helper in exec-line-exec with
+   exec'ing socket-demangler to do it. A server process exports a
+   SocketDemangler object that hands out one end of a socket pair. Each
+   round starts a process that gets the socket and then execs true,
+   either by calling mir_socket_demangle() itself like exec-line-exec
+   does now, or by exec'ing socket-demangler which makes the call and
+   then execs true. The time from the fork until the process exits is
+   what gets reported, the two are alternated so that they see the same
+   caches.
+
+   This isn't run as part of the test suite as it needs a session bus,
+   run it by hand:
+
+   ./demangle-benchmark [rounds] */
+
+extern "C" {
+#include "helpers.h"
+}
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <gio/gunixfdlist.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char* BUS_NAME = "com.canonical.UbuntuAppLaunch.DemangleBenchmark";
+static const char* OBJECT_PATH = "/com/canonical/UbuntuAppLaunch/DemangleBenchmark";
+static const char* TRUE_PATH = "/bin/true";
+
+static const char* DEMANGLER_INTERFACE =
+    "<node>"
+    "  <interface name='com.canonical.UbuntuAppLaunch.SocketDemangler'>"
+    "    <method name='GetMirSocket'>"
+    "      <arg type='h' name='socket' direction='out' />"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+/** Hand out one end of a new socket pair, like the Mir prompt session
+    code in the registry does */
+static void getMirSocket(GDBusConnection* connection,
+                         const gchar* sender,
+                         const gchar* path,
+                         const gchar* interface,
+                         const gchar* method,
+                         GVariant* params,
+                         GDBusMethodInvocation* invocation,
+                         gpointer user_data)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+    {
+        g_dbus_method_invocation_return_error(invocation, G_IO_ERROR, G_IO_ERROR_FAILED, "Unable to create socket");
+        return;
+    }
+
+    /* The list takes the one we send */
+    GUnixFDList* list = g_unix_fd_list_new_from_array(&fds[0], 1);
+    close(fds[1]);
+
+    g_dbus_method_invocation_return_value_with_unix_fd_list(invocation, g_variant_new("(h)", 0), list);
+    g_object_unref(list);
+}
+
+/** Export the demangler on the session bus and answer calls until we're
+    killed. A byte is written to the pipe once the name is ours. */
+static void serve(int ready)
+{
+    GError* error = nullptr;
+    GDBusConnection* bus = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &error);
+    if (error != nullptr)
+    {
+        fprintf(stderr, "Unable to get session bus: %s\n", error->message);
+        g_error_free(error);
+        _exit(EXIT_FAILURE);
+    }
+
+    GDBusNodeInfo* nodeinfo = g_dbus_node_info_new_for_xml(DEMANGLER_INTERFACE, nullptr);
+    static const GDBusInterfaceVTable vtable = {getMirSocket, nullptr, nullptr, {nullptr}};
+    g_dbus_connection_register_object(bus, OBJECT_PATH, nodeinfo->interfaces[0], &vtable, nullptr, nullptr, &error);
+    if (error != nullptr)
+    {
+        fprintf(stderr, "Unable to export demangler: %s\n", error->message);
+        g_error_free(error);
+        _exit(EXIT_FAILURE);
+    }
+
+    g_bus_own_name_on_connection(bus, BUS_NAME, G_BUS_NAME_OWNER_FLAGS_NONE,
+                                 [](GDBusConnection* connection, const gchar* name, gpointer user_data) {
+                                     int ready = GPOINTER_TO_INT(user_data);
+                                     if (write(ready, "r", 1) != 1)
+                                     {
+                                         _exit(EXIT_FAILURE);
+                                     }
+                                     close(ready);
+                                 },
+                                 [](GDBusConnection* connection, const gchar* name, gpointer user_data) {
+                                     fprintf(stderr, "Unable to get bus name '%s'\n", name);
+                                     _exit(EXIT_FAILURE);
+                                 },
+                                 GINT_TO_POINTER(ready), nullptr);
+
+    g_main_loop_run(g_main_loop_new(nullptr, FALSE));
+}
+
+/** Fork a process that runs the function and wait for it, returns the
+    time it took in milliseconds or a negative number if it failed */
+static double timeChild(void (*child)())
+{
+    auto start = std::chrono::steady_clock::now();
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        child();
+        _exit(EXIT_FAILURE);
+    }
+
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        return -1.0;
+    }
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** What exec-line-exec does now */
+static void inProcess()
+{
+    if (mir_socket_demangle(BUS_NAME, OBJECT_PATH) >= 0)
+    {
+        execl(TRUE_PATH, TRUE_PATH, nullptr);
+    }
+}
+
+/** What exec-line-exec used to do */
+static void execDemangler()
+{
+    setenv("UBUNTU_APP_LAUNCH_DEMANGLE_NAME", BUS_NAME, 1);
+    setenv("UBUNTU_APP_LAUNCH_DEMANGLE_PATH", OBJECT_PATH, 1);
+    execl(SOCKET_DEMANGLER, SOCKET_DEMANGLER, TRUE_PATH, nullptr);
+}
+
+/** Print statistics on the times */
+static void report(const char* name, std::vector<double>& times)
+{
+    std::sort(times.begin(), times.end());
+    double total = 0.0;
+    for (auto time : times)
+    {
+        total += time;
+    }
+
+    auto count = times.size();
+    printf("%-12s mean %7.2fms  p50 %7.2fms  p95 %7.2fms  p99 %7.2fms\n", name, total / count, times[count / 2],
+           times[(count * 95) / 100], times[(count * 99) / 100]);
+}
+
+int main(int argc, char* argv[])
+{
+    int rounds = argc > 1 ? std::atoi(argv[1]) : 200;
+
+    if (rounds < 1)
+    {
+        fprintf(stderr, "Usage: %s [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* The server is forked before we have any threads, and we never
+       start any in this process so that forking the rounds is safe */
+    int ready[2];
+    if (pipe(ready) != 0)
+    {
+        perror("Unable to create pipe");
+        return EXIT_FAILURE;
+    }
+
+    pid_t server = fork();
+    if (server == 0)
+    {
+        close(ready[0]);
+        serve(ready[1]);
+        _exit(EXIT_FAILURE);
+    }
+    close(ready[1]);
+
+    char byte;
+    if (read(ready[0], &byte, 1) != 1)
+    {
+        fprintf(stderr, "Demangler server didn't start\n");
+        waitpid(server, nullptr, 0);
+        return EXIT_FAILURE;
+    }
+    close(ready[0]);
+
+    /* Not counted, gets everything into the page cache */
+    timeChild(inProcess);
+    timeChild(execDemangler);
+
+    std::vector<double> inprocess;
+    std::vector<double> exec;
+    bool failed = false;
+
+    for (int i = 0; i < rounds && !failed; i++)
+    {
+        auto in = timeChild(inProcess);
+        auto ex = timeChild(execDemangler);
+
+        failed = in < 0.0 || ex < 0.0;
+        inprocess.push_back(in);
+        exec.push_back(ex);
+    }
+
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+
+    if (failed)
+    {
+        fprintf(stderr, "Unable to get the Mir socket\n");
+        return EXIT_FAILURE;
+    }
+
+    report("in-process", inprocess);
+    report("exec", exec);
+
+    return EXIT_SUCCESS;
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright 2013 Canonical Ltd.
+ * Copyright © 2016 Canonical Ltd.
  *
  * This program is free software: you can redistribute it and/or modify it
  * under the terms of the GNU General Public License version 3, as published
@@ -17,107 +17,157 @@
  *     Ted Gould <ted.gould@canonical.com>
  */
 
-#include <gtest/gtest.h>
-#include <glib/gstdio.h>
-#include <gio/gio.h>
+#include "eventually-fixture.h"
+#include "registry-impl.h"
+#include "registry.h"
 
-extern "C" {
-#include "../helpers.h"
-}
+#include <atomic>
+#include <chrono>
+#include <gio/gio.h>
+#include <gtest/gtest.h>
+#include <libdbustest/dbus-test.h>
+#include <mutex>
 
-class HelperHandshakeTest : public ::testing::Test
+class HelperHandshakeTest : public EventuallyFixture
 {
-	private:
-		GTestDBus * testbus = NULL;
-
-	protected:
-		GMainLoop * mainloop = NULL;
-
-		virtual void SetUp() {
-			mainloop = g_main_loop_new(NULL, FALSE);
-			testbus = g_test_dbus_new(G_TEST_DBUS_NONE);
-			g_test_dbus_up(testbus);
-		}
-
-		virtual void TearDown() {
-			g_test_dbus_down(testbus);
-			g_clear_object(&testbus);
-			g_main_loop_unref(mainloop);
-			mainloop = NULL;
-			return;
-		}
-
-	public:
-		GDBusMessage * FilterFunc (GDBusConnection * conn, GDBusMessage * message, gboolean incomming) {
-			if (g_strcmp0(g_dbus_message_get_member(message), "UnityStartingBroadcast") == 0) {
-				GVariant * body = g_dbus_message_get_body(message);
-				GVariant * correct_body = g_variant_new("(s)", "fooapp");
-				g_variant_ref_sink(correct_body);
-
-				[body, correct_body]() {
-					ASSERT_TRUE(g_variant_equal(body, correct_body));
-				}();
-
-				g_variant_unref(correct_body);
-				g_main_loop_quit(mainloop);
-			}
-
-			return message;
-		}
-
+protected:
+    DbusTestService* service = nullptr;
+    GDBusConnection* bus = nullptr;
+    guint filter = 0;
+    std::shared_ptr<ubuntu::app_launch::Registry> registry;
+
+    std::atomic<unsigned int> broadcasts{0};
+    std::mutex broadcastLock;
+    std::string broadcastAppId;
+
+    virtual void SetUp()
+    {
+        service = dbus_test_service_new(nullptr);
+        dbus_test_service_start_tasks(service);
+
+        bus = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
+        g_dbus_connection_set_exit_on_close(bus, FALSE);
+        filter = g_dbus_connection_add_filter(bus, filter_broadcast, this, nullptr);
+
+        registry = std::make_shared<ubuntu::app_launch::Registry>();
+    }
+
+    virtual void TearDown()
+    {
+        registry.reset();
+
+        g_dbus_connection_remove_filter(bus, filter);
+        g_clear_object(&bus);
+        g_clear_object(&service);
+    }
+
+    /** Note the AppIDs in the broadcasts the registry sends */
+    static GDBusMessage* filter_broadcast(GDBusConnection* conn,
+                                          GDBusMessage* message,
+                                          gboolean incoming,
+                                          gpointer user_data)
+    {
+        auto test = static_cast<HelperHandshakeTest*>(user_data);
+
+        if (!incoming && g_strcmp0(g_dbus_message_get_member(message), "UnityStartingBroadcast") == 0)
+        {
+            const gchar* appid = nullptr;
+            g_variant_get(g_dbus_message_get_body(message), "(&s)", &appid);
+
+            std::lock_guard<std::mutex> lock(test->broadcastLock);
+            test->broadcastAppId = appid;
+            test->broadcasts++;
+        }
+
+        return message;
+    }
+
+    /** Start a handshake on the registry thread like a launch would */
+    std::shared_ptr<ubuntu::app_launch::Registry::Impl::StartingHandshake> start(const std::string& appid)
+    {
+        auto impl = registry->impl.get();
+        return impl->thread.executeOnThread<std::shared_ptr<ubuntu::app_launch::Registry::Impl::StartingHandshake>>(
+            [impl, appid]() { return impl->startingHandshakeStart(appid); });
+    }
+
+    /** Answer as Unity would. Sending it straight to ourselves means it
+        doesn't depend on the match rule having reached the bus yet. */
+    void answer(const std::string& appid)
+    {
+        g_dbus_connection_emit_signal(bus,                                    /* bus */
+                                      g_dbus_connection_get_unique_name(bus), /* destination */
+                                      "/",                                    /* path */
+                                      "com.canonical.UbuntuAppLaunch",        /* interface */
+                                      "UnityStartingSignal",                  /* signal */
+                                      g_variant_new("(s)", appid.c_str()),    /* params */
+                                      nullptr);                               /* error */
+    }
 };
 
-static GDBusMessage *
-filter_func (GDBusConnection * conn, GDBusMessage * message, gboolean incomming, gpointer user_data) {
-	return static_cast<HelperHandshakeTest *>(user_data)->FilterFunc(conn, message, incomming);
-}
-
 TEST_F(HelperHandshakeTest, BaseHandshake)
 {
-	GDBusConnection * con = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
-	guint filter = g_dbus_connection_add_filter(con, filter_func, this, NULL);
-
-	handshake_t * handshake = starting_handshake_start("fooapp", 1);
+    registry->impl->setStartingHandshakeTimeout(std::chrono::seconds{10});
 
-	g_main_loop_run(mainloop);
+    auto begin = std::chrono::steady_clock::now();
+    auto handshake = start("fooapp");
+    ASSERT_NE(nullptr, handshake);
 
-	g_dbus_connection_remove_filter(con, filter);
+    EXPECT_EVENTUALLY_EQ(1u, broadcasts);
+    {
+        std::lock_guard<std::mutex> lock(broadcastLock);
+        EXPECT_EQ("fooapp", broadcastAppId);
+    }
 
-	g_dbus_connection_emit_signal(con,
-		g_dbus_connection_get_unique_name(con), /* destination */
-		"/", /* path */
-		"com.canonical.UbuntuAppLaunch", /* interface */
-		"UnityStartingSignal", /* signal */
-		g_variant_new("(s)", "fooapp"), /* params, the same */
-		NULL);
+    answer("fooapp");
+    registry->impl->startingHandshakeWait(handshake);
 
-	starting_handshake_wait(handshake);
+    EXPECT_GT(std::chrono::seconds{5}, std::chrono::steady_clock::now() - begin);
 
-	g_object_unref(con);
-
-	return;
+    auto stats = registry->impl->startingHandshakeStats();
+    EXPECT_EQ(1u, stats.handshakes);
+    EXPECT_EQ(1u, stats.answered);
+    EXPECT_EQ(0u, stats.timeouts);
 }
 
-static gboolean
-two_second_reached (gpointer user_data)
+TEST_F(HelperHandshakeTest, HandshakeTimeout)
 {
-	bool * reached = static_cast<bool *>(user_data);
-	*reached = true;
-	return true;
+    registry->impl->setStartingHandshakeTimeout(std::chrono::milliseconds{100});
+
+    auto begin = std::chrono::steady_clock::now();
+    auto handshake = start("fooapp");
+    ASSERT_NE(nullptr, handshake);
+
+    registry->impl->startingHandshakeWait(handshake);
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+
+    EXPECT_LE(std::chrono::milliseconds{100}, elapsed);
+    EXPECT_GT(std::chrono::seconds{2}, elapsed);
+
+    auto stats = registry->impl->startingHandshakeStats();
+    EXPECT_EQ(1u, stats.handshakes);
+    EXPECT_EQ(0u, stats.answered);
+    EXPECT_EQ(1u, stats.timeouts);
 }
 
-TEST_F(HelperHandshakeTest, HandshakeTimeout)
+TEST_F(HelperHandshakeTest, TwoWaitersOneAnswer)
 {
-	bool timeout_reached = false;
-	handshake_t * handshake = starting_handshake_start("fooapp", 1);
-
-	guint outertimeout = g_timeout_add_seconds(2, two_second_reached, &timeout_reached);
+    registry->impl->setStartingHandshakeTimeout(std::chrono::seconds{10});
 
-	starting_handshake_wait(handshake);
+    auto begin = std::chrono::steady_clock::now();
+    auto first = start("fooapp");
+    auto second = start("fooapp");
+    ASSERT_NE(nullptr, first);
+    ASSERT_NE(nullptr, second);
 
-	g_source_remove(outertimeout);
+    /* One answer lets both launches of the AppID go */
+    answer("fooapp");
+    registry->impl->startingHandshakeWait(first);
+    registry->impl->startingHandshakeWait(second);
 
-	ASSERT_FALSE(timeout_reached);
+    EXPECT_GT(std::chrono::seconds{5}, std::chrono::steady_clock::now() - begin);
 
-	return;
+    auto stats = registry->impl->startingHandshakeStats();
+    EXPECT_EQ(2u, stats.handshakes);
+    EXPECT_EQ(2u, stats.answered);
+    EXPECT_EQ(0u, stats.timeouts);
 }
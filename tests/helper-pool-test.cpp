@@ -0,0 +1,179 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "helper-pool.h"
+
+#include <glib.h>
+#include <gtest/gtest.h>
+
+namespace
+{
+
+using Entry = ubuntu::app_launch::HelperPool::Entry;
+using Missing = std::list<std::pair<std::string, std::string>>;
+
+Entry parked(const std::string& type, const std::string& appid, const std::string& instanceid)
+{
+    return Entry{type, appid, instanceid, std::chrono::steady_clock::now()};
+}
+
+TEST(HelperPool, Disabled)
+{
+    ubuntu::app_launch::HelperPool pool;
+
+    EXPECT_FALSE(pool.allowed("url-overlay", "com.test.overlay_overlay_1.2.3"));
+    EXPECT_TRUE(pool.missing().empty());
+
+    Entry entry;
+    EXPECT_FALSE(pool.take("url-overlay", "com.test.overlay_overlay_1.2.3", entry));
+}
+
+TEST(HelperPool, Missing)
+{
+    ubuntu::app_launch::HelperPool pool;
+
+    EXPECT_TRUE(pool.configure("url-overlay", {"overlay-a", "overlay-b"}, 2).empty());
+    EXPECT_TRUE(pool.allowed("url-overlay", "overlay-a"));
+    EXPECT_FALSE(pool.allowed("url-overlay", "overlay-c"));
+    EXPECT_FALSE(pool.allowed("content-peer", "overlay-a"));
+
+    EXPECT_EQ((Missing{{"url-overlay", "overlay-a"},
+                       {"url-overlay", "overlay-a"},
+                       {"url-overlay", "overlay-b"},
+                       {"url-overlay", "overlay-b"}}),
+              pool.missing());
+
+    pool.add(parked("url-overlay", "overlay-a", "1"));
+    pool.add(parked("url-overlay", "overlay-b", "2"));
+    pool.add(parked("url-overlay", "overlay-b", "3"));
+
+    EXPECT_EQ((Missing{{"url-overlay", "overlay-a"}}), pool.missing());
+    EXPECT_EQ(3u, pool.stats().parked);
+}
+
+TEST(HelperPool, Take)
+{
+    ubuntu::app_launch::HelperPool pool;
+    pool.configure("url-overlay", {"overlay-a"}, 2);
+
+    pool.add(parked("url-overlay", "overlay-a", "1"));
+    pool.add(parked("url-overlay", "overlay-a", "2"));
+
+    Entry entry;
+    EXPECT_FALSE(pool.take("content-peer", "overlay-a", entry));
+
+    /* Oldest first */
+    ASSERT_TRUE(pool.take("url-overlay", "overlay-a", entry));
+    EXPECT_EQ("1", entry.instanceid);
+    ASSERT_TRUE(pool.take("url-overlay", "overlay-a", entry));
+    EXPECT_EQ("2", entry.instanceid);
+    EXPECT_FALSE(pool.take("url-overlay", "overlay-a", entry));
+
+    pool.countHit();
+    pool.countHit();
+    pool.countMiss();
+
+    auto stats = pool.stats();
+    EXPECT_EQ(2u, stats.parked);
+    EXPECT_EQ(2u, stats.hits);
+    EXPECT_EQ(1u, stats.misses);
+}
+
+TEST(HelperPool, Reconfigure)
+{
+    ubuntu::app_launch::HelperPool pool;
+    pool.configure("url-overlay", {"overlay-a", "overlay-b"}, 2);
+    pool.configure("content-peer", {"peer-a"}, 1);
+
+    pool.add(parked("url-overlay", "overlay-a", "1"));
+    pool.add(parked("url-overlay", "overlay-a", "2"));
+    pool.add(parked("url-overlay", "overlay-b", "3"));
+    pool.add(parked("content-peer", "peer-a", "4"));
+
+    /* Dropping overlay-b and shrinking loses the oldest overlay-a */
+    auto evicted = pool.configure("url-overlay", {"overlay-a"}, 1);
+    ASSERT_EQ(2u, evicted.size());
+    EXPECT_EQ("1", evicted.front().instanceid);
+    EXPECT_EQ("3", evicted.back().instanceid);
+
+    /* Other types are left alone */
+    Entry entry;
+    EXPECT_TRUE(pool.take("content-peer", "peer-a", entry));
+
+    /* Turning it off takes everything */
+    evicted = pool.configure("url-overlay", {}, 1);
+    ASSERT_EQ(1u, evicted.size());
+    EXPECT_EQ("2", evicted.front().instanceid);
+    EXPECT_FALSE(pool.allowed("url-overlay", "overlay-a"));
+
+    /* Bigger than we allow gets clamped */
+    pool.configure("content-peer", {}, 1);
+    pool.configure("url-overlay", {"overlay-a"}, 100);
+    EXPECT_EQ(4u, pool.missing().size());
+}
+
+TEST(HelperPool, Clear)
+{
+    ubuntu::app_launch::HelperPool pool;
+    pool.configure("url-overlay", {"overlay-a"}, 1);
+    pool.configure("content-peer", {"peer-a"}, 1);
+
+    pool.add(parked("url-overlay", "overlay-a", "1"));
+    pool.add(parked("content-peer", "peer-a", "2"));
+
+    auto cleared = pool.clear("url-overlay");
+    ASSERT_EQ(1u, cleared.size());
+    EXPECT_EQ("1", cleared.front().instanceid);
+
+    /* Still configured, so it'll be refilled */
+    EXPECT_TRUE(pool.allowed("url-overlay", "overlay-a"));
+    EXPECT_EQ((Missing{{"url-overlay", "overlay-a"}}), pool.missing());
+
+    pool.remove("content-peer", "peer-a", "2");
+    EXPECT_EQ(2u, pool.missing().size());
+}
+
+TEST(HelperPool, ConfigureFromEnv)
+{
+    g_setenv("UBUNTU_APP_LAUNCH_HELPER_POOL", "url-overlay:overlay-a,bad,content-peer:peer-a,url-overlay:overlay-b",
+             TRUE);
+    g_setenv("UBUNTU_APP_LAUNCH_HELPER_POOL_SIZE", "2", TRUE);
+
+    ubuntu::app_launch::HelperPool pool;
+    pool.configureFromEnv();
+
+    EXPECT_TRUE(pool.allowed("url-overlay", "overlay-a"));
+    EXPECT_TRUE(pool.allowed("url-overlay", "overlay-b"));
+    EXPECT_TRUE(pool.allowed("content-peer", "peer-a"));
+    EXPECT_EQ(6u, pool.missing().size());
+
+    /* Size defaults to one */
+    g_unsetenv("UBUNTU_APP_LAUNCH_HELPER_POOL_SIZE");
+    ubuntu::app_launch::HelperPool single;
+    single.configureFromEnv();
+    EXPECT_EQ(3u, single.missing().size());
+
+    g_unsetenv("UBUNTU_APP_LAUNCH_HELPER_POOL");
+    ubuntu::app_launch::HelperPool empty;
+    empty.configureFromEnv();
+    EXPECT_TRUE(empty.missing().empty());
+}
+
+}  // namespace
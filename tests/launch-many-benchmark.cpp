@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+/* Compares launching a set of applications one after another with
+   launching them all with Registry::launchMany(). Each sequential
+   launch waits on its own starting handshake and Upstart round trip
+   before the next one goes out, where launchMany() overlaps them.
+
+   This isn't run as part of the test suite as it needs a session with
+   Upstart and installed applications, and the results depend on the
+   machine and the shell. Run it by hand with the AppIDs to launch:
+
+   ./launch-many-benchmark [--rounds N] appid [appid ...] */
+
+#include "registry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <thread>
+#include <vector>
+
+using ubuntu::app_launch::AppID;
+using ubuntu::app_launch::Application;
+using ubuntu::app_launch::Registry;
+
+/** Stop everything we launched and give Upstart a moment to notice, so
+    every round starts from the same place */
+static void stopAll(const std::vector<AppID>& appids, const std::shared_ptr<Registry>& registry)
+{
+    for (const auto& appid : appids)
+    {
+        try
+        {
+            auto app = Application::create(appid, registry);
+            for (const auto& instance : app->instances())
+            {
+                instance->stop();
+            }
+        }
+        catch (std::runtime_error& e)
+        {
+            fprintf(stderr, "Unable to stop '%s': %s\n", std::string(appid).c_str(), e.what());
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds{2});
+}
+
+/** Launch the applications one after another */
+static std::chrono::microseconds sequential(const std::vector<AppID>& appids, const std::shared_ptr<Registry>& registry)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (const auto& appid : appids)
+    {
+        try
+        {
+            Application::create(appid, registry)->launch();
+        }
+        catch (std::runtime_error& e)
+        {
+            fprintf(stderr, "Unable to launch '%s': %s\n", std::string(appid).c_str(), e.what());
+        }
+    }
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+}
+
+/** Launch the applications all at once */
+static std::chrono::microseconds batched(const std::vector<AppID>& appids, const std::shared_ptr<Registry>& registry)
+{
+    std::list<Registry::LaunchRequest> requests;
+    for (const auto& appid : appids)
+    {
+        requests.emplace_back(Registry::LaunchRequest{appid, {}});
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto& future : Registry::launchMany(requests, registry))
+    {
+        try
+        {
+            future.get();
+        }
+        catch (std::runtime_error& e)
+        {
+            fprintf(stderr, "Unable to launch: %s\n", e.what());
+        }
+    }
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+}
+
+/** Print the median and worst of a set of runs */
+static void report(const char* name, std::vector<std::chrono::microseconds> times)
+{
+    std::sort(times.begin(), times.end());
+
+    printf("%-12s median %8.2f ms   worst %8.2f ms\n", name, times[times.size() / 2].count() / 1000.0,
+           times.back().count() / 1000.0);
+}
+
+int main(int argc, char* argv[])
+{
+    auto registry = std::make_shared<Registry>();
+    int rounds = 5;
+    std::vector<AppID> appids;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+        {
+            rounds = std::max(1, atoi(argv[++i]));
+            continue;
+        }
+
+        auto appid = AppID::find(registry, argv[i]);
+        if (appid.empty())
+        {
+            fprintf(stderr, "Unable to find application '%s'\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        appids.push_back(appid);
+    }
+
+    if (appids.empty())
+    {
+        fprintf(stderr, "Usage: %s [--rounds N] appid [appid ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::chrono::microseconds> sequentialTimes;
+    std::vector<std::chrono::microseconds> batchedTimes;
+
+    printf("Launching %d applications, %d rounds\n", int(appids.size()), rounds);
+
+    for (int round = 0; round < rounds; round++)
+    {
+        stopAll(appids, registry);
+        sequentialTimes.push_back(sequential(appids, registry));
+
+        stopAll(appids, registry);
+        batchedTimes.push_back(batched(appids, registry));
+    }
+
+    stopAll(appids, registry);
+
+    report("sequential", sequentialTimes);
+    report("launchMany", batchedTimes);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "launch-predictor.h"
+
+#include <ctime>
+#include <glib.h>
+#include <gtest/gtest.h>
+
+namespace
+{
+
+/** A time today at the local hour */
+std::chrono::system_clock::time_point atHour(int hour)
+{
+    auto now = std::time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    local.tm_hour = hour;
+    local.tm_min = 30;
+    local.tm_sec = 0;
+    local.tm_isdst = -1;
+    return std::chrono::system_clock::from_time_t(std::mktime(&local));
+}
+
+TEST(LaunchPredictor, Disabled)
+{
+    ubuntu::app_launch::LaunchPredictor predictor(0);
+
+    predictor.addLaunch("dialer-app", atHour(9));
+    EXPECT_TRUE(predictor.predict(atHour(9)).empty());
+}
+
+TEST(LaunchPredictor, Frequency)
+{
+    ubuntu::app_launch::LaunchPredictor predictor(2);
+
+    EXPECT_TRUE(predictor.predict(atHour(12)).empty());
+
+    for (int i = 0; i < 5; i++)
+    {
+        predictor.addLaunch("com.ubuntu.music_music", atHour(12));
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        predictor.addLaunch("dialer-app", atHour(12));
+    }
+    predictor.addLaunch("com.ubuntu.calculator_calculator", atHour(12));
+
+    auto predicted = predictor.predict(atHour(12));
+    ASSERT_EQ(2u, predicted.size());
+    EXPECT_EQ("com.ubuntu.music_music", predicted[0]);
+    EXPECT_EQ("dialer-app", predicted[1]);
+}
+
+TEST(LaunchPredictor, TimeOfDay)
+{
+    ubuntu::app_launch::LaunchPredictor predictor(1);
+
+    /* Used a lot, but only in the evening */
+    for (int i = 0; i < 6; i++)
+    {
+        predictor.addLaunch("com.ubuntu.music_music", atHour(20));
+    }
+    /* Used less, but always in the morning */
+    for (int i = 0; i < 4; i++)
+    {
+        predictor.addLaunch("dialer-app", atHour(8));
+    }
+
+    EXPECT_EQ(std::vector<std::string>{"dialer-app"}, predictor.predict(atHour(8)));
+    /* Neighboring hours count too */
+    EXPECT_EQ(std::vector<std::string>{"dialer-app"}, predictor.predict(atHour(9)));
+    EXPECT_EQ(std::vector<std::string>{"com.ubuntu.music_music"}, predictor.predict(atHour(20)));
+    /* No history for this hour, overall use wins */
+    EXPECT_EQ(std::vector<std::string>{"com.ubuntu.music_music"}, predictor.predict(atHour(3)));
+}
+
+TEST(LaunchPredictor, HitsAndMisses)
+{
+    ubuntu::app_launch::LaunchPredictor predictor(2);
+
+    predictor.prewarmed("dialer-app", std::chrono::microseconds{1500});
+    predictor.prewarmed("com.ubuntu.music_music", std::chrono::microseconds{2500});
+
+    EXPECT_TRUE(predictor.launched("dialer-app"));
+    /* Only counts once per prewarm */
+    EXPECT_FALSE(predictor.launched("dialer-app"));
+    EXPECT_FALSE(predictor.launched("com.ubuntu.calculator_calculator"));
+
+    predictor.clearPrewarmed();
+    EXPECT_FALSE(predictor.launched("com.ubuntu.music_music"));
+
+    auto stats = predictor.stats();
+    EXPECT_EQ(4u, stats.launches);
+    EXPECT_EQ(1u, stats.hits);
+    EXPECT_EQ(2u, stats.prewarmed);
+    EXPECT_EQ(1500u, stats.savedUsec);
+}
+
+TEST(LaunchPredictor, CandidatesFromEnv)
+{
+    g_unsetenv("UBUNTU_APP_LAUNCH_PREDICT");
+    EXPECT_EQ(0u, ubuntu::app_launch::LaunchPredictor::candidatesFromEnv());
+
+    g_setenv("UBUNTU_APP_LAUNCH_PREDICT", "3", TRUE);
+    EXPECT_EQ(3u, ubuntu::app_launch::LaunchPredictor::candidatesFromEnv());
+
+    /* Clamped */
+    g_setenv("UBUNTU_APP_LAUNCH_PREDICT", "50", TRUE);
+    EXPECT_EQ(8u, ubuntu::app_launch::LaunchPredictor::candidatesFromEnv());
+
+    g_setenv("UBUNTU_APP_LAUNCH_PREDICT", "-2", TRUE);
+    EXPECT_EQ(0u, ubuntu::app_launch::LaunchPredictor::candidatesFromEnv());
+
+    g_unsetenv("UBUNTU_APP_LAUNCH_PREDICT");
+}
+
+}  // namespace
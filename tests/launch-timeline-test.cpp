@@ -0,0 +1,284 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "launch-timeline.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <gio/gio.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+
+using LaunchTimeline = ubuntu::app_launch::LaunchTimeline;
+using Milestone = ubuntu::app_launch::LaunchTimeline::Milestone;
+
+gint64 stampOf(const LaunchTimeline::Launch& launch, Milestone milestone)
+{
+    return launch.stamps[std::size_t(milestone)];
+}
+
+TEST(LaunchTimeline, Stamps)
+{
+    LaunchTimeline timeline(4);
+
+    auto id = timeline.start("com.test.good_application_1.2.3", 1000);
+    timeline.stamp("com.test.good_application_1.2.3", id, Milestone::JOB_PATH, 1100);
+    timeline.stamp("com.test.good_application_1.2.3", id, Milestone::MESSAGE_SENT, 1300);
+
+    /* Only the first time counts */
+    timeline.stamp("com.test.good_application_1.2.3", id, Milestone::JOB_PATH, 1500);
+
+    /* Launches we don't know are ignored */
+    timeline.stamp("com.test.good_application_1.2.3", id + 1, Milestone::JOB_PATH, 1600);
+    timeline.stamp("foo", id, Milestone::JOB_PATH, 1600);
+
+    auto launches = timeline.launches();
+    ASSERT_EQ(1u, launches.size());
+    EXPECT_EQ("com.test.good_application_1.2.3", launches.front().appid);
+    EXPECT_EQ(id, launches.front().id);
+    EXPECT_EQ(1000, stampOf(launches.front(), Milestone::START));
+    EXPECT_EQ(1100, stampOf(launches.front(), Milestone::JOB_PATH));
+    EXPECT_EQ(1300, stampOf(launches.front(), Milestone::MESSAGE_SENT));
+    EXPECT_EQ(0, stampOf(launches.front(), Milestone::HANDSHAKE_WAIT));
+}
+
+TEST(LaunchTimeline, History)
+{
+    LaunchTimeline timeline(2);
+
+    auto first = timeline.start("app-a", 1000);
+    timeline.start("app-a", 2000);
+    timeline.start("app-a", 3000);
+    timeline.start("app-b", 4000);
+
+    /* The oldest of app-a is gone, app-b has its own history */
+    auto launches = timeline.launches();
+    ASSERT_EQ(3u, launches.size());
+    for (const auto& launch : launches)
+    {
+        EXPECT_NE(first, launch.id);
+    }
+
+    timeline.stamp("app-a", first, Milestone::JOB_PATH, 5000);
+    for (const auto& launch : timeline.launches())
+    {
+        EXPECT_EQ(0, stampOf(launch, Milestone::JOB_PATH));
+    }
+}
+
+TEST(LaunchTimeline, ExecReport)
+{
+    LaunchTimeline timeline(4);
+
+    EXPECT_FALSE(timeline.execReport("app-a", 100, 200, 300));
+
+    auto first = timeline.start("app-a", 1000);
+    auto second = timeline.start("app-a", 2000);
+
+    /* Before the second started, so it's the first's */
+    EXPECT_TRUE(timeline.execReport("app-a", 1100, 1200, 1300));
+    /* The second's */
+    EXPECT_TRUE(timeline.execReport("app-a", 2100, 2200, 2300));
+    /* Nothing left to take it */
+    EXPECT_FALSE(timeline.execReport("app-a", 2400, 2500, 2600));
+
+    for (const auto& launch : timeline.launches())
+    {
+        if (launch.id == first)
+        {
+            EXPECT_EQ(1100, stampOf(launch, Milestone::EXEC_START));
+            EXPECT_EQ(1200, stampOf(launch, Milestone::EXEC_PARSED));
+            EXPECT_EQ(1300, stampOf(launch, Milestone::EXEC_PRE_EXEC));
+        }
+        else if (launch.id == second)
+        {
+            EXPECT_EQ(2300, stampOf(launch, Milestone::EXEC_PRE_EXEC));
+        }
+    }
+
+    /* A parked job parsed before the launch */
+    timeline.start("app-b", 5000);
+    EXPECT_TRUE(timeline.execReport("app-b 3000 3100 5200"));
+    auto launches = timeline.launches();
+    EXPECT_EQ(3100, stampOf(launches.back(), Milestone::EXEC_PARSED));
+    EXPECT_EQ(5200, stampOf(launches.back(), Milestone::EXEC_PRE_EXEC));
+}
+
+TEST(LaunchTimeline, BadReports)
+{
+    LaunchTimeline timeline(4);
+    timeline.start("app-a", 1000);
+
+    EXPECT_FALSE(timeline.execReport(""));
+    EXPECT_FALSE(timeline.execReport("app-a"));
+    EXPECT_FALSE(timeline.execReport("app-a 1100 1200"));
+    EXPECT_FALSE(timeline.execReport("app-a 1100 1200 1300 1400"));
+    EXPECT_FALSE(timeline.execReport("app-a 1100 twelve 1300"));
+    EXPECT_FALSE(timeline.execReport("app-a 1100 -1200 1300"));
+
+    EXPECT_EQ(0, stampOf(timeline.launches().front(), Milestone::EXEC_PRE_EXEC));
+}
+
+TEST(LaunchTimeline, Percentiles)
+{
+    LaunchTimeline timeline(100);
+
+    for (gint64 i = 1; i <= 100; i++)
+    {
+        auto id = timeline.start("app-a", i * 10000);
+        timeline.stamp("app-a", id, Milestone::MESSAGE_SENT, i * 10000 + i);
+    }
+    timeline.start("app-b", 10000);
+
+    auto percentiles = timeline.percentiles();
+    ASSERT_EQ(1u, percentiles.size());
+    EXPECT_EQ("app-a", percentiles.front().appid);
+    EXPECT_EQ(Milestone::MESSAGE_SENT, percentiles.front().milestone);
+    EXPECT_EQ(100u, percentiles.front().count);
+    EXPECT_EQ(50, percentiles.front().p50);
+    EXPECT_EQ(90, percentiles.front().p90);
+    EXPECT_EQ(99, percentiles.front().p99);
+
+    /* With one launch they're all the same */
+    LaunchTimeline single(4);
+    auto id = single.start("app-a", 1000);
+    single.stamp("app-a", id, Milestone::JOB_PATH, 1250);
+    percentiles = single.percentiles();
+    ASSERT_EQ(1u, percentiles.size());
+    EXPECT_EQ(250, percentiles.front().p50);
+    EXPECT_EQ(250, percentiles.front().p99);
+}
+
+TEST(LaunchTimeline, Socket)
+{
+    /* Not our real PID so we don't clash with anything else */
+    pid_t fakepid = getpid() + 100000;
+
+    LaunchTimeline timeline(4);
+    ASSERT_TRUE(timeline.listen(fakepid));
+
+    /* A second one can't have it */
+    LaunchTimeline other(4);
+    EXPECT_FALSE(other.listen(fakepid));
+
+    auto start = g_get_monotonic_time();
+    timeline.start("app-a", start);
+
+    auto name = LaunchTimeline::socketName(fakepid);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, name.c_str(), name.size());
+
+    auto report =
+        "app-a " + std::to_string(start + 1) + " " + std::to_string(start + 2) + " " + std::to_string(start + 3);
+    int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    ASSERT_LE(0, sock);
+    EXPECT_EQ(ssize_t(report.size()),
+              sendto(sock, report.c_str(), report.size(), 0, reinterpret_cast<struct sockaddr*>(&addr),
+                     offsetof(struct sockaddr_un, sun_path) + 1 + name.size()));
+    close(sock);
+
+    for (int i = 0; i < 100 && stampOf(timeline.launches().front(), Milestone::EXEC_PRE_EXEC) == 0; i++)
+    {
+        g_main_context_iteration(nullptr, FALSE);
+        g_usleep(1000);
+    }
+
+    EXPECT_EQ(start + 3, stampOf(timeline.launches().front(), Milestone::EXEC_PRE_EXEC));
+}
+
+TEST(LaunchTimeline, SocketOtherUser)
+{
+    pid_t fakepid = getpid() + 100001;
+
+    LaunchTimeline timeline(4);
+    ASSERT_TRUE(timeline.listen(fakepid));
+
+    auto start = g_get_monotonic_time();
+    timeline.start("app-a", start);
+
+    auto name = LaunchTimeline::socketName(fakepid);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, name.c_str(), name.size());
+
+    auto report =
+        "app-a " + std::to_string(start + 1) + " " + std::to_string(start + 2) + " " + std::to_string(start + 3);
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(report.c_str());
+    iov.iov_len = report.size();
+
+    /* Claim to be someone else, which only works with CAP_SETUID */
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(struct ucred))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &addr;
+    msg.msg_namelen = offsetof(struct sockaddr_un, sun_path) + 1 + name.size();
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_CREDENTIALS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+    struct ucred cred;
+    cred.pid = getpid();
+    cred.uid = getuid() + 1;
+    cred.gid = getgid();
+    memcpy(CMSG_DATA(cmsg), &cred, sizeof(cred));
+
+    int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    ASSERT_LE(0, sock);
+    auto sent = sendmsg(sock, &msg, 0);
+    auto senderr = errno;
+    close(sock);
+
+    if (sent < 0)
+    {
+        /* Not privileged, the kernel won't let us lie */
+        EXPECT_EQ(EPERM, senderr);
+        return;
+    }
+
+    for (int i = 0; i < 20; i++)
+    {
+        g_main_context_iteration(nullptr, FALSE);
+        g_usleep(1000);
+    }
+
+    EXPECT_EQ(0, stampOf(timeline.launches().front(), Milestone::EXEC_PRE_EXEC));
+}
+
+}  // namespace
@@ -18,6 +18,7 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <fcntl.h>
 #include <functional>
 #include <future>
@@ -25,12 +26,14 @@
 #include <glib/gstdio.h>
 #include <gtest/gtest.h>
 #include <libdbustest/dbus-test.h>
+#include <mutex>
 #include <numeric>
 #include <thread>
 #include <zeitgeist.h>
 
 #include "application.h"
 #include "glib-thread.h"
+#include "helper-instance-table.h"
 #include "helper.h"
 #include "registry.h"
 #include "ubuntu-app-launch.h"
@@ -137,6 +140,7 @@ protected:
                                               NULL);
 
         dbus_test_dbus_mock_object_add_method(mock, obj, "SetEnv", G_VARIANT_TYPE("(assb)"), NULL, "", NULL);
+        dbus_test_dbus_mock_object_add_method(mock, obj, "SetEnvList", G_VARIANT_TYPE("(asasb)"), NULL, "", NULL);
 
         /* Click App */
         DbusTestDbusMockObject* jobobj =
@@ -895,6 +899,126 @@ TEST_F(LibUAL, StartStopObserver)
     ASSERT_TRUE(ubuntu_app_launch_observer_delete_app_stop(observer_cb, &stop_data));
 }
 
+TEST_F(LibUAL, LifecycleSignals)
+{
+    std::mutex lock;
+    std::string lastStarted;
+    std::string lastStopped;
+    std::atomic<unsigned int> started{0};
+    std::atomic<unsigned int> stopped{0};
+    std::atomic<unsigned int> batches{0};
+    std::list<ubuntu::app_launch::Registry::AppEvent> lastBatch;
+
+    ubuntu::app_launch::Registry::appStarted(registry).connect(
+        [&](const std::shared_ptr<ubuntu::app_launch::Application>& app,
+            const std::shared_ptr<ubuntu::app_launch::Application::Instance>& instance) {
+            std::lock_guard<std::mutex> guard(lock);
+            lastStarted = std::string(app->appId());
+            started++;
+        });
+    ubuntu::app_launch::Registry::appStopped(registry).connect(
+        [&](const std::shared_ptr<ubuntu::app_launch::Application>& app,
+            const std::shared_ptr<ubuntu::app_launch::Application::Instance>& instance) {
+            std::lock_guard<std::mutex> guard(lock);
+            lastStopped = std::string(app->appId());
+            stopped++;
+        });
+
+    ubuntu::app_launch::Registry::setAppEventBatchWindow(std::chrono::milliseconds{100}, registry);
+    ubuntu::app_launch::Registry::appEventBatch(registry).connect(
+        [&](const std::list<ubuntu::app_launch::Registry::AppEvent>& events) {
+            std::lock_guard<std::mutex> guard(lock);
+            lastBatch = events;
+            batches++;
+        });
+
+    DbusTestDbusMockObject* obj =
+        dbus_test_dbus_mock_get_object(mock, "/com/ubuntu/Upstart", "com.ubuntu.Upstart0_6", NULL);
+
+    /* Click and legacy start, then the click stops */
+    dbus_test_dbus_mock_object_emit_signal(
+        mock, obj, "EventEmitted", G_VARIANT_TYPE("(sas)"),
+        g_variant_new_parsed("('started', ['JOB=application-click', 'INSTANCE=com.test.good_application_1.2.3'])"),
+        NULL);
+    dbus_test_dbus_mock_object_emit_signal(
+        mock, obj, "EventEmitted", G_VARIANT_TYPE("(sas)"),
+        g_variant_new_parsed("('started', ['JOB=application-legacy', 'INSTANCE=multiple-234235'])"), NULL);
+    dbus_test_dbus_mock_object_emit_signal(
+        mock, obj, "EventEmitted", G_VARIANT_TYPE("(sas)"),
+        g_variant_new_parsed("('stopped', ['JOB=application-click', 'INSTANCE=com.test.good_application_1.2.3'])"),
+        NULL);
+
+    EXPECT_EVENTUALLY_EQ(2u, started);
+    EXPECT_EVENTUALLY_EQ(1u, stopped);
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        EXPECT_EQ("multiple", lastStarted);
+        EXPECT_EQ("com.test.good_application_1.2.3", lastStopped);
+    }
+
+    /* All of them come in one batch, in order */
+    EXPECT_EVENTUALLY_EQ(1u, batches);
+
+    std::lock_guard<std::mutex> guard(lock);
+    ASSERT_EQ(3u, lastBatch.size());
+    auto event = lastBatch.begin();
+    EXPECT_EQ(ubuntu::app_launch::Registry::AppEvent::Type::STARTED, event->type);
+    EXPECT_EQ("com.test.good_application_1.2.3", std::string(event->app->appId()));
+    ++event;
+    EXPECT_EQ(ubuntu::app_launch::Registry::AppEvent::Type::STARTED, event->type);
+    EXPECT_EQ("multiple", std::string(event->app->appId()));
+    ++event;
+    EXPECT_EQ(ubuntu::app_launch::Registry::AppEvent::Type::STOPPED, event->type);
+    EXPECT_EQ("com.test.good_application_1.2.3", std::string(event->app->appId()));
+}
+
+TEST_F(LibUAL, LifecycleCoalescing)
+{
+    std::mutex lock;
+    std::atomic<unsigned int> batches{0};
+    std::list<ubuntu::app_launch::Registry::AppEvent> lastBatch;
+
+    ubuntu::app_launch::Registry::setAppEventBatchWindow(std::chrono::milliseconds{100}, registry);
+    ubuntu::app_launch::Registry::setAppEventCoalescing(true, registry);
+    ubuntu::app_launch::Registry::appEventBatch(registry).connect(
+        [&](const std::list<ubuntu::app_launch::Registry::AppEvent>& events) {
+            std::lock_guard<std::mutex> guard(lock);
+            lastBatch = events;
+            batches++;
+        });
+
+    DbusTestDbusMockObject* obj =
+        dbus_test_dbus_mock_get_object(mock, "/com/ubuntu/Upstart", "com.ubuntu.Upstart0_6", NULL);
+
+    /* The click start and stop cancel out */
+    dbus_test_dbus_mock_object_emit_signal(
+        mock, obj, "EventEmitted", G_VARIANT_TYPE("(sas)"),
+        g_variant_new_parsed("('started', ['JOB=application-click', 'INSTANCE=com.test.good_application_1.2.3'])"),
+        NULL);
+    dbus_test_dbus_mock_object_emit_signal(
+        mock, obj, "EventEmitted", G_VARIANT_TYPE("(sas)"),
+        g_variant_new_parsed("('started', ['JOB=application-legacy', 'INSTANCE=multiple-234235'])"), NULL);
+    dbus_test_dbus_mock_object_emit_signal(
+        mock, obj, "EventEmitted", G_VARIANT_TYPE("(sas)"),
+        g_variant_new_parsed("('stopped', ['JOB=application-click', 'INSTANCE=com.test.good_application_1.2.3'])"),
+        NULL);
+
+    EXPECT_EVENTUALLY_EQ(1u, batches);
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        ASSERT_EQ(1u, lastBatch.size());
+        EXPECT_EQ(ubuntu::app_launch::Registry::AppEvent::Type::STARTED, lastBatch.front().type);
+        EXPECT_EQ("multiple", std::string(lastBatch.front().app->appId()));
+    }
+
+    auto stats = ubuntu::app_launch::Registry::appEventStats(registry);
+    EXPECT_EQ(3u, stats.received);
+    EXPECT_EQ(2u, stats.folded);
+    EXPECT_EQ(1u, stats.batches);
+}
+
 static GDBusMessage* filter_starting(GDBusConnection* conn,
                                      GDBusMessage* message,
                                      gboolean incomming,
@@ -918,6 +1042,54 @@ static void starting_observer(const gchar* appid, gpointer user_data)
     return;
 }
 
+static GDBusMessage* filter_list_names(GDBusConnection* conn,
+                                       GDBusMessage* message,
+                                       gboolean incomming,
+                                       gpointer user_data)
+{
+    if (!incomming && g_strcmp0(g_dbus_message_get_member(message), "ListNames") == 0)
+    {
+        auto count = static_cast<std::atomic<unsigned int>*>(user_data);
+        (*count)++;
+    }
+
+    return message;
+}
+
+TEST_F(LibUAL, SecondExecIndexNoNames)
+{
+    /* A PID that doesn't have any connections on the bus */
+    DbusTestDbusMockObject* instobj =
+        dbus_test_dbus_mock_get_object(mock, "/com/test/app_instance", "com.ubuntu.Upstart0_6.Instance", NULL);
+    gchar* process_var = g_strdup_printf("[('main', %d)]", getpid() + 100000);
+    dbus_test_dbus_mock_object_update_property(mock, instobj, "processes", g_variant_new_parsed(process_var), NULL);
+    g_free(process_var);
+
+    auto appid = ubuntu::app_launch::AppID::parse("com.test.good_application_1.2.3");
+    auto app = ubuntu::app_launch::Application::create(appid, registry);
+    std::vector<ubuntu::app_launch::Application::URL> urls{
+        ubuntu::app_launch::Application::URL::from_raw("http://www.test.com")};
+
+    /* The first one builds the index, let it finish its scan */
+    app->launch(urls);
+    pause(200);
+
+    std::atomic<unsigned int> listnames{0};
+    GDBusConnection* session = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    guint filter = g_dbus_connection_add_filter(session, filter_list_names, &listnames, NULL);
+
+    /* The index is ready but has nothing for the PID, so second exec
+       has to look at the bus itself */
+    app->launch(urls);
+    EXPECT_EVENTUALLY_EQ(1u, listnames);
+
+    g_dbus_connection_remove_filter(session, filter);
+    g_object_unref(session);
+
+    /* Let second exec finish before the bus goes away */
+    pause(100);
+}
+
 TEST_F(LibUAL, StartingResponses)
 {
     std::string last_observer;
@@ -943,6 +1115,250 @@ TEST_F(LibUAL, StartingResponses)
     g_object_unref(session);
 }
 
+TEST_F(LibUAL, PrimaryPidCache)
+{
+    DbusTestDbusMockObject* instobj =
+        dbus_test_dbus_mock_get_object(mock, "/com/test/app_instance", "com.ubuntu.Upstart0_6.Instance", NULL);
+
+    auto appid = ubuntu::app_launch::AppID::find(registry, "com.test.good_application_1.2.3");
+    auto app = ubuntu::app_launch::Application::create(appid, registry);
+    auto instance = app->instances()[0];
+
+    EXPECT_EQ(getpid(), instance->primaryPid());
+
+    /* Upstart hasn't said anything changed, so we keep what we had */
+    dbus_test_dbus_mock_object_update_property(mock, instobj, "processes", g_variant_new_parsed("[('main', 1234)]"),
+                                               NULL);
+    EXPECT_TRUE(instance->isRunning());
+    EXPECT_EQ(getpid(), instance->primaryPid());
+
+    /* Now it does */
+    dbus_test_dbus_mock_object_emit_signal(mock, instobj, "StateChanged", G_VARIANT_TYPE("(s)"),
+                                           g_variant_new_parsed("('running',)"), NULL);
+    pause(100);
+
+    EXPECT_EQ(1234, instance->primaryPid());
+
+    /* Stopping drops what we know about it, which still counts as a change */
+    dbus_test_dbus_mock_object_update_property(mock, instobj, "processes", g_variant_new_parsed("[('main', 5678)]"),
+                                               NULL);
+    dbus_test_dbus_mock_object_emit_signal(mock, instobj, "StateChanged", G_VARIANT_TYPE("(s)"),
+                                           g_variant_new_parsed("('waiting',)"), NULL);
+    pause(100);
+
+    EXPECT_EQ(5678, instance->primaryPid());
+}
+
+TEST_F(LibUAL, JobPathPrefetch)
+{
+    DbusTestDbusMockObject* obj =
+        dbus_test_dbus_mock_get_object(mock, "/com/ubuntu/Upstart", "com.ubuntu.Upstart0_6", NULL);
+
+    /* All our jobs are looked up when the registry is created */
+    pause(100);
+    EXPECT_EQ(4, dbus_test_dbus_mock_object_check_method_call(mock, obj, "GetJobByName", NULL, NULL));
+
+    /* So launching doesn't need to ask again */
+    auto appid = ubuntu::app_launch::AppID::parse("com.test.good_application_1.2.3");
+    auto app = ubuntu::app_launch::Application::create(appid, registry);
+    app->launch();
+
+    EXPECT_EQ(4, dbus_test_dbus_mock_object_check_method_call(mock, obj, "GetJobByName", NULL, NULL));
+}
+
+TEST_F(LibUAL, LaunchMany)
+{
+    DbusTestDbusMockObject* obj =
+        dbus_test_dbus_mock_get_object(mock, "/com/test/application_click", "com.ubuntu.Upstart0_6.Job", NULL);
+
+    std::list<ubuntu::app_launch::Registry::LaunchRequest> requests{
+        {ubuntu::app_launch::AppID::parse("com.test.good_application_1.2.3"), {}},
+        {ubuntu::app_launch::AppID{}, {}},
+        {ubuntu::app_launch::AppID::parse("com.test.multiple_first_1.2.3"),
+         {ubuntu::app_launch::Application::URL::from_raw("http://ubuntu.com/")}}};
+
+    auto futures = ubuntu::app_launch::Registry::launchMany(requests, registry);
+    ASSERT_EQ(3u, futures.size());
+
+    auto future = futures.begin();
+    EXPECT_NE(nullptr, (future++)->get());
+    EXPECT_THROW((future++)->get(), std::runtime_error);
+    EXPECT_NE(nullptr, (future++)->get());
+
+    guint len = 0;
+    const DbusTestDbusMockCall* calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "Start", &len, NULL);
+    ASSERT_EQ(2, len);
+
+    GVariant* env = g_variant_get_child_value(calls[0].params, 0);
+    EXPECT_TRUE(check_env(env, "APP_ID", "com.test.good_application_1.2.3"));
+    g_variant_unref(env);
+
+    env = g_variant_get_child_value(calls[1].params, 0);
+    EXPECT_TRUE(check_env(env, "APP_ID", "com.test.multiple_first_1.2.3"));
+    EXPECT_TRUE(check_env(env, "APP_URIS", "'http://ubuntu.com/'"));
+    g_variant_unref(env);
+}
+
+TEST_F(LibUAL, StartingHandshakeStats)
+{
+    ubuntu::app_launch::Registry::setStartingHandshakeTimeout(std::chrono::milliseconds{50}, registry);
+
+    auto appid = ubuntu::app_launch::AppID::parse("com.test.good_application_1.2.3");
+    auto app = ubuntu::app_launch::Application::create(appid, registry);
+
+    auto begin = std::chrono::steady_clock::now();
+    app->launch();
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+
+    /* Nobody answers on the test bus, so the launch waits out the deadline */
+    EXPECT_LE(std::chrono::milliseconds{50}, elapsed);
+
+    auto stats = ubuntu::app_launch::Registry::startingHandshakeStats(registry);
+    EXPECT_EQ(1u, stats.handshakes);
+    EXPECT_EQ(0u, stats.answered);
+    EXPECT_EQ(1u, stats.timeouts);
+}
+
+TEST_F(LibUAL, StartingHandshakeConcurrent)
+{
+    ubuntu::app_launch::Registry::setStartingHandshakeTimeout(std::chrono::milliseconds{500}, registry);
+
+    auto first = ubuntu::app_launch::Application::create(
+        ubuntu::app_launch::AppID::parse("com.test.good_application_1.2.3"), registry);
+    auto second = ubuntu::app_launch::Application::create(
+        ubuntu::app_launch::AppID::parse("com.test.multiple_first_1.2.3"), registry);
+
+    /* Each launch waits off the registry thread, so their deadlines
+       run side by side instead of one after the other */
+    auto begin = std::chrono::steady_clock::now();
+    std::thread firstLaunch([first]() { first->launch(); });
+    std::thread secondLaunch([second]() { second->launch(); });
+    firstLaunch.join();
+    secondLaunch.join();
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+
+    EXPECT_LE(std::chrono::milliseconds{500}, elapsed);
+    EXPECT_GT(std::chrono::milliseconds{900}, elapsed);
+
+    auto stats = ubuntu::app_launch::Registry::startingHandshakeStats(registry);
+    EXPECT_EQ(2u, stats.handshakes);
+    EXPECT_EQ(0u, stats.answered);
+    EXPECT_EQ(2u, stats.timeouts);
+}
+
+static GDBusMessage* filter_starting_broadcast(GDBusConnection* conn,
+                                               GDBusMessage* message,
+                                               gboolean incomming,
+                                               gpointer user_data)
+{
+    if (!incomming && g_strcmp0(g_dbus_message_get_member(message), "UnityStartingBroadcast") == 0)
+    {
+        auto count = static_cast<std::atomic<unsigned int>*>(user_data);
+        (*count)++;
+    }
+
+    return message;
+}
+
+TEST_F(LibUAL, StartingHandshakeAnswered)
+{
+    ubuntu::app_launch::Registry::setStartingHandshakeTimeout(std::chrono::seconds{10}, registry);
+
+    std::atomic<unsigned int> broadcasts{0};
+    GDBusConnection* session = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    guint filter = g_dbus_connection_add_filter(session, filter_starting_broadcast, &broadcasts, NULL);
+
+    auto appid = ubuntu::app_launch::AppID::parse("com.test.good_application_1.2.3");
+    auto app = ubuntu::app_launch::Application::create(appid, registry);
+
+    auto begin = std::chrono::steady_clock::now();
+    std::thread launch([app]() { app->launch(); });
+
+    /* Answer like Unity once the launch has asked */
+    EXPECT_EVENTUALLY_EQ(1u, broadcasts);
+    g_dbus_connection_emit_signal(session, g_dbus_connection_get_unique_name(session),     /* destination */
+                                  "/",                                                     /* path */
+                                  "com.canonical.UbuntuAppLaunch",                         /* interface */
+                                  "UnityStartingSignal",                                   /* signal */
+                                  g_variant_new("(s)", "com.test.good_application_1.2.3"), /* params */
+                                  NULL);
+
+    launch.join();
+    EXPECT_GT(std::chrono::seconds{5}, std::chrono::steady_clock::now() - begin);
+
+    auto stats = ubuntu::app_launch::Registry::startingHandshakeStats(registry);
+    EXPECT_EQ(1u, stats.handshakes);
+    EXPECT_EQ(1u, stats.answered);
+    EXPECT_EQ(0u, stats.timeouts);
+
+    g_dbus_connection_remove_filter(session, filter);
+    g_object_unref(session);
+}
+
+TEST_F(LibUAL, LaunchTimeline)
+{
+    auto appid = ubuntu::app_launch::AppID::parse("com.test.good_application_1.2.3");
+    auto app = ubuntu::app_launch::Application::create(appid, registry);
+    app->launch();
+
+    /* Ask our own connection, that's where the registry put it */
+    GDBusConnection* session = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    GVariant* timelines = g_dbus_connection_call_sync(
+        session, g_dbus_connection_get_unique_name(session), "/com/canonical/UbuntuAppLaunch/Stats",
+        "com.canonical.UbuntuAppLaunch.Stats", "GetTimelines", nullptr, G_VARIANT_TYPE("(a(stxa(sx)))"),
+        G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr);
+    ASSERT_NE(nullptr, timelines);
+
+    GVariant* launches = g_variant_get_child_value(timelines, 0);
+    ASSERT_EQ(1u, g_variant_n_children(launches));
+
+    const gchar* launchappid = nullptr;
+    guint64 id = 0;
+    gint64 start = 0;
+    GVariantIter* stamps = nullptr;
+    g_variant_get_child(launches, 0, "(&stxa(sx))", &launchappid, &id, &start, &stamps);
+    EXPECT_STREQ("com.test.good_application_1.2.3", launchappid);
+    EXPECT_LT(0, start);
+
+    std::vector<std::string> milestones;
+    const gchar* milestone = nullptr;
+    gint64 offset = 0;
+    gint64 lastoffset = 0;
+    while (g_variant_iter_loop(stamps, "(&sx)", &milestone, &offset))
+    {
+        milestones.push_back(milestone);
+        EXPECT_LE(lastoffset, offset);
+        lastoffset = offset;
+    }
+    g_variant_iter_free(stamps);
+
+    /* The handshake goes along with the rest, so only the start has
+       to be first */
+    ASSERT_FALSE(milestones.empty());
+    EXPECT_EQ("libual_start", milestones.front());
+    std::sort(milestones.begin(), milestones.end());
+    std::vector<std::string> expected{"handshake_complete", "handshake_wait", "libual_job_path_determined",
+                                      "libual_start", "libual_start_message_sent"};
+    EXPECT_EQ(expected, milestones);
+
+    g_variant_unref(launches);
+    g_variant_unref(timelines);
+
+    GVariant* percentiles = g_dbus_connection_call_sync(
+        session, g_dbus_connection_get_unique_name(session), "/com/canonical/UbuntuAppLaunch/Stats",
+        "com.canonical.UbuntuAppLaunch.Stats", "GetPercentiles", nullptr, G_VARIANT_TYPE("(a(ssuxxx))"),
+        G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr);
+    ASSERT_NE(nullptr, percentiles);
+
+    /* One for each milestone after the start */
+    GVariant* entries = g_variant_get_child_value(percentiles, 0);
+    EXPECT_EQ(4u, g_variant_n_children(entries));
+    g_variant_unref(entries);
+    g_variant_unref(percentiles);
+
+    g_object_unref(session);
+}
+
 TEST_F(LibUAL, AppIdTest)
 {
     auto appid = ubuntu::app_launch::AppID::parse("com.test.good_application_1.2.3");
@@ -1349,6 +1765,130 @@ TEST_F(LibUAL, HelperList)
     EXPECT_TRUE(goodlist.back()->instances()[0]->isRunning());
 }
 
+TEST_F(LibUAL, HelperBulk)
+{
+    DbusTestDbusMockObject* obj =
+        dbus_test_dbus_mock_get_object(mock, "/com/test/untrusted/helper", "com.ubuntu.Upstart0_6.Job", NULL);
+
+    auto helpers = ubuntu::app_launch::Registry::runningHelperInstances(registry);
+    ASSERT_EQ(2, helpers.size());
+
+    EXPECT_EQ("untrusted-type", helpers.front().type.value());
+    EXPECT_EQ("com.bar_foo_8432.13.1", (std::string)helpers.front().appid);
+    ASSERT_EQ(1, helpers.front().instanceIds.size());
+    EXPECT_EQ("24034582324132", helpers.front().instanceIds[0]);
+
+    EXPECT_EQ("untrusted-type", helpers.back().type.value());
+    EXPECT_EQ("com.foo_bar_43.23.12", (std::string)helpers.back().appid);
+    ASSERT_EQ(1, helpers.back().instanceIds.size());
+    EXPECT_EQ("", helpers.back().instanceIds[0]);
+
+    /* Nothing of this type */
+    auto nothelper = ubuntu::app_launch::Helper::Type::from_raw("not-a-type");
+    EXPECT_EQ(0, ubuntu::app_launch::Registry::stopHelpers(nothelper, registry));
+    EXPECT_EQ(0, dbus_test_dbus_mock_object_check_method_call(mock, obj, "Stop", NULL, NULL));
+
+    /* Stop them all */
+    auto untrusted = ubuntu::app_launch::Helper::Type::from_raw("untrusted-type");
+    EXPECT_EQ(2, ubuntu::app_launch::Registry::stopHelpers(untrusted, registry));
+
+    guint len = 0;
+    auto calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "Stop", &len, NULL);
+    ASSERT_EQ(2, len);
+
+    auto env = g_variant_get_child_value(calls[0].params, 0);
+    EXPECT_TRUE(check_env(env, "APP_ID", "com.bar_foo_8432.13.1"));
+    EXPECT_TRUE(check_env(env, "HELPER_TYPE", "untrusted-type"));
+    EXPECT_TRUE(check_env(env, "INSTANCE_ID", "24034582324132"));
+    g_variant_unref(env);
+
+    env = g_variant_get_child_value(calls[1].params, 0);
+    EXPECT_TRUE(check_env(env, "APP_ID", "com.foo_bar_43.23.12"));
+    EXPECT_TRUE(check_env(env, "HELPER_TYPE", "untrusted-type"));
+    g_variant_unref(env);
+
+    ASSERT_TRUE(dbus_test_dbus_mock_object_clear_method_calls(mock, obj, NULL));
+}
+
+TEST_F(LibUAL, HelperInstanceSignals)
+{
+    DbusTestDbusMockObject* obj =
+        dbus_test_dbus_mock_get_object(mock, "/com/test/untrusted/helper", "com.ubuntu.Upstart0_6.Job", NULL);
+    ASSERT_TRUE(dbus_test_dbus_mock_object_clear_method_calls(mock, obj, NULL));
+
+    auto untrusted = ubuntu::app_launch::Helper::Type::from_raw("untrusted-type");
+    auto appid = ubuntu::app_launch::AppID::parse("com.bar_foo_8432.13.1");
+    auto helper = ubuntu::app_launch::Helper::create(untrusted, appid, registry);
+
+    ASSERT_TRUE(helper->hasInstances());
+    auto instance = helper->instances()[0];
+    EXPECT_TRUE(instance->isRunning());
+
+    /* Instance goes away */
+    dbus_test_dbus_mock_object_emit_signal(
+        mock, obj, "InstanceRemoved", G_VARIANT_TYPE("(o)"),
+        g_variant_new_parsed("(@o '/com/test/untrusted/helper/multi_instance',)"), NULL);
+    pause(100);
+
+    EXPECT_FALSE(helper->hasInstances());
+    EXPECT_FALSE(instance->isRunning());
+    EXPECT_EQ(1, ubuntu::app_launch::Registry::runningHelpers(untrusted, registry).size());
+
+    /* And comes back */
+    dbus_test_dbus_mock_object_emit_signal(
+        mock, obj, "InstanceAdded", G_VARIANT_TYPE("(o)"),
+        g_variant_new_parsed("(@o '/com/test/untrusted/helper/multi_instance',)"), NULL);
+    pause(100);
+
+    EXPECT_TRUE(helper->hasInstances());
+    EXPECT_TRUE(instance->isRunning());
+    EXPECT_EQ(2, ubuntu::app_launch::Registry::runningHelpers(untrusted, registry).size());
+
+    /* Only looked at the job once */
+    EXPECT_EQ(1, dbus_test_dbus_mock_object_check_method_call(mock, obj, "GetAllInstances", NULL, NULL));
+}
+
+TEST_F(LibUAL, HelperInstanceParkedRemoved)
+{
+    DbusTestDbusMockObject* obj =
+        dbus_test_dbus_mock_get_object(mock, "/com/test/untrusted/helper", "com.ubuntu.Upstart0_6.Job", NULL);
+
+    auto bus = std::shared_ptr<GDBusConnection>(g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr),
+                                                [](GDBusConnection* bus) { g_clear_object(&bus); });
+    auto cancel = std::shared_ptr<GCancellable>(g_cancellable_new(), [](GCancellable* cancel) {
+        g_cancellable_cancel(cancel);
+        g_object_unref(cancel);
+    });
+
+    ubuntu::app_launch::HelperInstanceTable table(bus, "/com/test/untrusted/helper", cancel);
+
+    unsigned int removed = 0;
+    std::string last;
+    table.setParkedRemoved(
+        [&removed, &last](const std::string& type, const std::string& appid, const std::string& instanceid) {
+            removed++;
+            last = type + ":" + instanceid + ":" + appid;
+        });
+
+    /* The multi instance helper is parked, then times out */
+    table.setParked("untrusted-type", "com.bar_foo_8432.13.1", "24034582324132", true);
+    EXPECT_FALSE(table.hasInstance("untrusted-type", "com.bar_foo_8432.13.1", "24034582324132"));
+
+    dbus_test_dbus_mock_object_emit_signal(
+        mock, obj, "InstanceRemoved", G_VARIANT_TYPE("(o)"),
+        g_variant_new_parsed("(@o '/com/test/untrusted/helper/multi_instance',)"), NULL);
+    EXPECT_EVENTUALLY_EQ(1u, removed);
+    EXPECT_EQ("untrusted-type:24034582324132:com.bar_foo_8432.13.1", last);
+
+    /* One that's running going away isn't a parked one */
+    dbus_test_dbus_mock_object_emit_signal(mock, obj, "InstanceRemoved", G_VARIANT_TYPE("(o)"),
+                                           g_variant_new_parsed("(@o '/com/test/untrusted/helper/instance',)"), NULL);
+    pause(100);
+
+    EXPECT_EQ(1u, removed);
+    EXPECT_TRUE(table.appIds("untrusted-type").empty());
+}
+
 typedef struct
 {
     unsigned int count;
@@ -1833,6 +2373,47 @@ TEST_F(LibUAL, OOMSet)
     g_free(oomadjfile);
 }
 
+TEST_F(LibUAL, ResourceUsage)
+{
+    g_setenv("UBUNTU_APP_LAUNCH_CGROUP_ROOT", CMAKE_SOURCE_DIR "/cgroup-root", TRUE);
+
+    /* Single instance */
+    auto appid = ubuntu::app_launch::AppID::parse("com.test.good_application_1.2.3");
+    auto app = ubuntu::app_launch::Application::create(appid, registry);
+
+    ASSERT_LT(0, app->instances().size());
+
+    auto usage = app->instances()[0]->resourceUsage();
+    EXPECT_EQ(std::chrono::nanoseconds(1500000000), usage.cpuTime);
+    EXPECT_EQ(10485760u, usage.rss);
+    EXPECT_EQ(1048576u, usage.swap);
+    EXPECT_EQ(3u, usage.pidCount);
+
+    /* Everyone at once */
+    auto snapshot = ubuntu::app_launch::Registry::resourceSnapshot(registry);
+    ASSERT_EQ(2u, snapshot.size());
+
+    for (const auto& entry : snapshot)
+    {
+        if (entry.app->appId() == appid)
+        {
+            EXPECT_EQ(10485760u, entry.usage.rss);
+            EXPECT_EQ(3u, entry.usage.pidCount);
+        }
+        else
+        {
+            EXPECT_EQ("multiple", std::string(entry.app->appId()));
+            EXPECT_EQ(std::chrono::nanoseconds(250000000), entry.usage.cpuTime);
+            EXPECT_EQ(4194304u, entry.usage.rss);
+            EXPECT_EQ(0u, entry.usage.swap);
+            EXPECT_EQ(1u, entry.usage.pidCount);
+            EXPECT_EQ(5678, entry.instance->primaryPid());
+        }
+    }
+
+    g_unsetenv("UBUNTU_APP_LAUNCH_CGROUP_ROOT");
+}
+
 TEST_F(LibUAL, StartSessionHelper)
 {
     DbusTestDbusMockObject* obj =
@@ -1938,13 +2519,17 @@ TEST_F(LibUAL, SetExec)
     EXPECT_TRUE(ubuntu_app_launch_helper_set_exec(exec, NULL));
 
     guint len = 0;
-    const DbusTestDbusMockCall* calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "SetEnv", &len, NULL);
+    const DbusTestDbusMockCall* calls =
+        dbus_test_dbus_mock_object_get_method_calls(mock, obj, "SetEnvList", &len, NULL);
     ASSERT_NE(nullptr, calls);
     ASSERT_EQ(1, len);
 
     gchar* appexecstr = g_strdup_printf("APP_EXEC=%s", exec);
     GVariant* appexecenv = g_variant_get_child_value(calls[0].params, 1);
-    EXPECT_STREQ(appexecstr, g_variant_get_string(appexecenv, nullptr));
+    ASSERT_EQ(1, g_variant_n_children(appexecenv));
+    GVariant* envvar = g_variant_get_child_value(appexecenv, 0);
+    EXPECT_STREQ(appexecstr, g_variant_get_string(envvar, nullptr));
+    g_variant_unref(envvar);
     g_variant_unref(appexecenv);
     g_free(appexecstr);
 
@@ -1954,30 +2539,59 @@ TEST_F(LibUAL, SetExec)
     g_setenv("UBUNTU_APP_LAUNCH_DEMANGLE_NAME", g_dbus_connection_get_unique_name(bus), TRUE);
     EXPECT_TRUE(ubuntu_app_launch_helper_set_exec(exec, NULL));
 
-    calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "SetEnv", &len, NULL);
+    calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "SetEnvList", &len, NULL);
     ASSERT_NE(nullptr, calls);
     ASSERT_EQ(1, len);
 
     gchar* demangleexecstr = g_strdup_printf("APP_EXEC=%s %s", SOCKET_DEMANGLER_INSTALL, exec);
     appexecenv = g_variant_get_child_value(calls[0].params, 1);
-    EXPECT_STREQ(demangleexecstr, g_variant_get_string(appexecenv, nullptr));
+    envvar = g_variant_get_child_value(appexecenv, 0);
+    EXPECT_STREQ(demangleexecstr, g_variant_get_string(envvar, nullptr));
+    g_variant_unref(envvar);
     g_variant_unref(appexecenv);
     g_free(demangleexecstr);
 
     ASSERT_TRUE(dbus_test_dbus_mock_object_clear_method_calls(mock, obj, NULL));
 
-    /* Now check for the directory */
+    /* Now check for the directory, in the same call */
     g_setenv("UBUNTU_APP_LAUNCH_DEMANGLE_NAME", g_dbus_connection_get_unique_name(bus), TRUE);
     EXPECT_TRUE(ubuntu_app_launch_helper_set_exec(exec, "/not/a/real/directory"));
 
-    calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "SetEnv", &len, NULL);
+    calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "SetEnvList", &len, NULL);
+    ASSERT_NE(nullptr, calls);
+    EXPECT_EQ(1, len);
+
+    appexecenv = g_variant_get_child_value(calls[0].params, 1);
+    ASSERT_EQ(2, g_variant_n_children(appexecenv));
+    envvar = g_variant_get_child_value(appexecenv, 1);
+    EXPECT_STREQ("APP_DIR=/not/a/real/directory", g_variant_get_string(envvar, nullptr));
+    g_variant_unref(envvar);
+    g_variant_unref(appexecenv);
+
+    ASSERT_TRUE(dbus_test_dbus_mock_object_clear_method_calls(mock, obj, NULL));
+
+    /* Other variables from the exec tool go in the same call too */
+    g_unsetenv("UBUNTU_APP_LAUNCH_DEMANGLE_NAME");
+    const gchar* env[] = {"HELPER_MODE=fast", "not a variable", "EMPTY=", nullptr};
+    EXPECT_TRUE(ubuntu_app_launch_helper_set_exec_env(exec, "/a/directory", env, TRUE));
+
+    calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "SetEnvList", &len, NULL);
     ASSERT_NE(nullptr, calls);
-    EXPECT_EQ(2, len);
+    EXPECT_EQ(1, len);
 
-    appexecenv = g_variant_get_child_value(calls[1].params, 1);
-    EXPECT_STREQ("APP_DIR=/not/a/real/directory", g_variant_get_string(appexecenv, nullptr));
+    appexecenv = g_variant_get_child_value(calls[0].params, 1);
+    ASSERT_EQ(4, g_variant_n_children(appexecenv));
+    envvar = g_variant_get_child_value(appexecenv, 2);
+    EXPECT_STREQ("HELPER_MODE=fast", g_variant_get_string(envvar, nullptr));
+    g_variant_unref(envvar);
+    envvar = g_variant_get_child_value(appexecenv, 3);
+    EXPECT_STREQ("EMPTY=", g_variant_get_string(envvar, nullptr));
+    g_variant_unref(envvar);
     g_variant_unref(appexecenv);
 
+    calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "SetEnv", &len, NULL);
+    EXPECT_EQ(0, len);
+
     ASSERT_TRUE(dbus_test_dbus_mock_object_clear_method_calls(mock, obj, NULL));
 }
 
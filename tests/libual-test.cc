@@ -716,6 +716,134 @@ TEST_F(LibUAL, StartStopObserver)
 	ASSERT_TRUE(ubuntu_app_launch_observer_delete_app_stop(observer_cb, &stop_data));
 }
 
+static void
+removing_observer_cb (const gchar * appid, gpointer user_data)
+{
+	observer_data_t * data = (observer_data_t *)user_data;
+	data->count++;
+	ubuntu_app_launch_observer_delete_app_started(removing_observer_cb, user_data);
+}
+
+TEST_F(LibUAL, MultipleObservers)
+{
+	observer_data_t first_data = {
+		.count = 0,
+		.name = nullptr
+	};
+	observer_data_t second_data = {
+		.count = 0,
+		.name = nullptr
+	};
+	observer_data_t removing_data = {
+		.count = 0,
+		.name = nullptr
+	};
+
+	ASSERT_TRUE(ubuntu_app_launch_observer_add_app_started(observer_cb, &first_data));
+	ASSERT_TRUE(ubuntu_app_launch_observer_add_app_started(observer_cb, &second_data));
+	ASSERT_TRUE(ubuntu_app_launch_observer_add_app_started(observer_cb, &second_data));
+	ASSERT_TRUE(ubuntu_app_launch_observer_add_app_started(removing_observer_cb, &removing_data));
+
+	DbusTestDbusMockObject * obj = dbus_test_dbus_mock_get_object(mock, "/com/ubuntu/Upstart", "com.ubuntu.Upstart0_6", NULL);
+
+	dbus_test_dbus_mock_object_emit_signal(mock, obj,
+		"EventEmitted",
+		G_VARIANT_TYPE("(sas)"),
+		g_variant_new_parsed("('started', ['JOB=application-click', 'INSTANCE=com.test.good_application_1.2.3'])"),
+		NULL
+	);
+
+	/* Added twice gets called twice, and removing during the callback is fine */
+	EXPECT_EVENTUALLY_EQ(1, first_data.count);
+	EXPECT_EVENTUALLY_EQ(2, second_data.count);
+	EXPECT_EVENTUALLY_EQ(1, removing_data.count);
+
+	/* Only removes one of the two */
+	ASSERT_TRUE(ubuntu_app_launch_observer_delete_app_started(observer_cb, &second_data));
+	ASSERT_FALSE(ubuntu_app_launch_observer_delete_app_started(removing_observer_cb, &removing_data));
+
+	dbus_test_dbus_mock_object_emit_signal(mock, obj,
+		"EventEmitted",
+		G_VARIANT_TYPE("(sas)"),
+		g_variant_new_parsed("('started', ['JOB=application-click', 'INSTANCE=com.test.good_application_1.2.3'])"),
+		NULL
+	);
+
+	EXPECT_EVENTUALLY_EQ(2, first_data.count);
+	EXPECT_EVENTUALLY_EQ(3, second_data.count);
+	EXPECT_EQ(1, removing_data.count);
+
+	ASSERT_TRUE(ubuntu_app_launch_observer_delete_app_started(observer_cb, &first_data));
+	ASSERT_TRUE(ubuntu_app_launch_observer_delete_app_started(observer_cb, &second_data));
+	ASSERT_FALSE(ubuntu_app_launch_observer_delete_app_started(observer_cb, &second_data));
+}
+
+typedef struct {
+	unsigned int batches;
+	std::vector<std::pair<UbuntuAppLaunchAppEventType, std::string>> events;
+} batch_data_t;
+
+static void
+batch_observer_cb (const UbuntuAppLaunchAppEvent * events, guint num_events, gpointer user_data)
+{
+	batch_data_t * data = static_cast<batch_data_t *>(user_data);
+	data->batches++;
+
+	for (guint i = 0; i < num_events; i++) {
+		data->events.push_back(std::make_pair(events[i].type, std::string(events[i].appid)));
+	}
+}
+
+TEST_F(LibUAL, BatchObserver)
+{
+	batch_data_t data;
+	data.batches = 0;
+
+	guint64 received_start = 0, folded_start = 0, batches_start = 0;
+	ubuntu_app_launch_observer_batch_stats(&received_start, &folded_start, &batches_start);
+
+	ASSERT_TRUE(ubuntu_app_launch_observer_add_app_batch(batch_observer_cb, 100, &data));
+
+	DbusTestDbusMockObject * obj = dbus_test_dbus_mock_get_object(mock, "/com/ubuntu/Upstart", "com.ubuntu.Upstart0_6", NULL);
+
+	/* A start and stop of the same app cancel out, the other start stays */
+	dbus_test_dbus_mock_object_emit_signal(mock, obj,
+		"EventEmitted",
+		G_VARIANT_TYPE("(sas)"),
+		g_variant_new_parsed("('started', ['JOB=application-click', 'INSTANCE=com.test.good_application_1.2.3'])"),
+		NULL
+	);
+	dbus_test_dbus_mock_object_emit_signal(mock, obj,
+		"EventEmitted",
+		G_VARIANT_TYPE("(sas)"),
+		g_variant_new_parsed("('started', ['JOB=application-legacy', 'INSTANCE=multiple-234235'])"),
+		NULL
+	);
+	dbus_test_dbus_mock_object_emit_signal(mock, obj,
+		"EventEmitted",
+		G_VARIANT_TYPE("(sas)"),
+		g_variant_new_parsed("('stopped', ['JOB=application-click', 'INSTANCE=com.test.good_application_1.2.3'])"),
+		NULL
+	);
+
+	EXPECT_EVENTUALLY_EQ(1u, data.batches);
+	pause(200); /* Make sure there isn't another one */
+	EXPECT_EQ(1u, data.batches);
+
+	ASSERT_EQ(1u, data.events.size());
+	EXPECT_EQ(UBUNTU_APP_LAUNCH_APP_EVENT_STARTED, data.events[0].first);
+	EXPECT_EQ("multiple", data.events[0].second);
+
+	guint64 received = 0, folded = 0, batches = 0;
+	ubuntu_app_launch_observer_batch_stats(&received, &folded, &batches);
+	EXPECT_EQ(3u, received - received_start);
+	EXPECT_EQ(2u, folded - folded_start);
+	EXPECT_EQ(1u, batches - batches_start);
+
+	ASSERT_TRUE(ubuntu_app_launch_observer_delete_app_batch(batch_observer_cb, &data));
+	ASSERT_FALSE(ubuntu_app_launch_observer_delete_app_batch(batch_observer_cb, &data));
+}
+
 static GDBusMessage *
 filter_starting (GDBusConnection * conn, GDBusMessage * message, gboolean incomming, gpointer user_data)
 {
@@ -1222,6 +1350,29 @@ helper_observer_cb (const gchar * appid, const gchar * instance, const gchar * t
 	}
 }
 
+static void
+helper_instance_cb (const gchar * appid, const gchar * instanceid, const gchar * type, gpointer user_data)
+{
+	GString * str = (GString *)user_data;
+	g_string_append_printf(str, "%s:%s:%s;", type, instanceid, appid);
+}
+
+TEST_F(LibUAL, HelperBulk)
+{
+	DbusTestDbusMockObject * obj = dbus_test_dbus_mock_get_object(mock, "/com/test/untrusted/helper", "com.ubuntu.Upstart0_6.Job", NULL);
+
+	GString * str = g_string_new(NULL);
+	EXPECT_TRUE(ubuntu_app_launch_foreach_helper_instance(helper_instance_cb, str));
+	EXPECT_STREQ("untrusted-type:24034582324132:com.bar_foo_8432.13.1;untrusted-type::com.foo_bar_43.23.12;", str->str);
+	g_string_free(str, TRUE);
+
+	EXPECT_EQ(0, ubuntu_app_launch_stop_all_helpers("not-a-type"));
+	EXPECT_EQ(2, ubuntu_app_launch_stop_all_helpers("untrusted-type"));
+
+	ASSERT_EQ(dbus_test_dbus_mock_object_check_method_call(mock, obj, "Stop", NULL, NULL), 2);
+	ASSERT_TRUE(dbus_test_dbus_mock_object_clear_method_calls(mock, obj, NULL));
+}
+
 TEST_F(LibUAL, StartStopHelperObserver)
 {
 	helper_observer_data_t start_data = {
@@ -0,0 +1,146 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "memory-reclaim.h"
+
+#include <fstream>
+#include <glib.h>
+#include <gtest/gtest.h>
+#include <sstream>
+
+namespace
+{
+
+/** Builds a fake memory controller directory, the files are just regular
+    files so the kernel doesn't free anything when we write to them */
+class MemoryReclaim : public ::testing::Test
+{
+protected:
+    std::string memorypath;
+
+    virtual void SetUp()
+    {
+        auto dir = g_dir_make_tmp("memory-reclaim-test-XXXXXX", nullptr);
+        ASSERT_NE(nullptr, dir);
+        memorypath = dir;
+        g_free(dir);
+
+        g_unsetenv("UBUNTU_APP_LAUNCH_RECLAIM_BUDGET");
+    }
+
+    virtual void TearDown()
+    {
+        gchar* argv[] = {(gchar*)"rm", (gchar*)"-rf", (gchar*)memorypath.c_str(), nullptr};
+        g_spawn_sync(nullptr, argv, nullptr, G_SPAWN_SEARCH_PATH, nullptr, nullptr, nullptr, nullptr, nullptr,
+                     nullptr);
+
+        g_unsetenv("UBUNTU_APP_LAUNCH_RECLAIM_BUDGET");
+    }
+
+    void writeFile(const std::string& name, const std::string& contents)
+    {
+        std::ofstream file(memorypath + "/" + name);
+        file << contents;
+    }
+
+    std::string readFile(const std::string& name)
+    {
+        std::ifstream file(memorypath + "/" + name);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    std::uint64_t budgetFor(const char* value)
+    {
+        g_setenv("UBUNTU_APP_LAUNCH_RECLAIM_BUDGET", value, TRUE);
+        return ubuntu::app_launch::MemoryReclaim::budget();
+    }
+};
+
+TEST_F(MemoryReclaim, Budget)
+{
+    /* Off unless it is set */
+    EXPECT_EQ(0u, ubuntu::app_launch::MemoryReclaim::budget());
+
+    EXPECT_EQ(0u, budgetFor("0"));
+    EXPECT_EQ(4096u, budgetFor("4096"));
+    EXPECT_EQ(2u * 1024u, budgetFor("2K"));
+    EXPECT_EQ(2u * 1024u, budgetFor("2k"));
+    EXPECT_EQ(64u * 1024u * 1024u, budgetFor("64M"));
+    EXPECT_EQ(3ull * 1024u * 1024u * 1024u, budgetFor("3G"));
+    EXPECT_EQ(3ull * 1024u * 1024u * 1024u, budgetFor("3g"));
+}
+
+TEST_F(MemoryReclaim, BadBudget)
+{
+    /* Anything we can't understand turns it off */
+    EXPECT_EQ(0u, budgetFor(""));
+    EXPECT_EQ(0u, budgetFor("lots"));
+    EXPECT_EQ(0u, budgetFor("10X"));
+    EXPECT_EQ(0u, budgetFor("10 M"));
+}
+
+TEST_F(MemoryReclaim, ReclaimFile)
+{
+    writeFile("memory.current", "1048576\n");
+    writeFile("memory.high", "max\n");
+    writeFile("memory.reclaim", "");
+
+    auto result = ubuntu::app_launch::MemoryReclaim::reclaim(memorypath, true, {}, 65536);
+
+    /* The budget is what gets asked for, and as nothing was freed that
+       is what gets reported */
+    EXPECT_EQ("memory.reclaim", result.method);
+    EXPECT_EQ("65536", readFile("memory.reclaim"));
+    EXPECT_EQ(0u, result.bytes);
+    EXPECT_EQ("max\n", readFile("memory.high"));
+}
+
+TEST_F(MemoryReclaim, LowerHigh)
+{
+    writeFile("memory.current", "1048576\n");
+    writeFile("memory.high", "max\n");
+
+    auto result = ubuntu::app_launch::MemoryReclaim::reclaim(memorypath, true, {}, 65536);
+
+    /* The limit is put back when it's done */
+    EXPECT_EQ("memory.high", result.method);
+    EXPECT_EQ("max\n", readFile("memory.high"));
+    EXPECT_EQ(0u, result.bytes);
+}
+
+TEST_F(MemoryReclaim, NoCGroup)
+{
+    /* Nothing in the cgroup is used on the legacy hierarchy */
+    writeFile("memory.current", "1048576\n");
+    writeFile("memory.high", "max\n");
+    writeFile("memory.reclaim", "");
+
+    auto result = ubuntu::app_launch::MemoryReclaim::reclaim(memorypath, false, {}, 65536);
+    EXPECT_EQ("none", result.method);
+    EXPECT_EQ(0u, result.bytes);
+    EXPECT_EQ("", readFile("memory.reclaim"));
+
+    /* Nothing to use at all */
+    result = ubuntu::app_launch::MemoryReclaim::reclaim(memorypath + "/missing", true, {}, 65536);
+    EXPECT_EQ("none", result.method);
+}
+
+}  // namespace
@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include "oom-policy.h"
+
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+
+using Level = ubuntu::app_launch::OomPolicy::Level;
+using Scores = std::map<std::string, std::int32_t>;
+
+class OomPolicy : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        start = std::chrono::steady_clock::now();
+
+        /* Oldest, but medium size */
+        policy.paused("application-click-a", start);
+        footprints["application-click-a"] = 100 * 1024 * 1024;
+        /* Middle age, biggest */
+        policy.paused("application-click-b", start + std::chrono::seconds{10});
+        footprints["application-click-b"] = 300 * 1024 * 1024;
+        /* Most recent and smallest */
+        policy.paused("application-click-c", start + std::chrono::seconds{20});
+        footprints["application-click-c"] = 50 * 1024 * 1024;
+    }
+
+    /** Read a recorded trace, each sample is the contents of the pressure
+        file and they are separated by '---' lines */
+    std::vector<ubuntu::app_launch::OomPolicy::Pressure> loadTrace(const std::string& name)
+    {
+        std::ifstream file(std::string{CMAKE_SOURCE_DIR "/pressure-traces/"} + name);
+        EXPECT_TRUE(file.is_open());
+
+        std::vector<ubuntu::app_launch::OomPolicy::Pressure> samples;
+        std::string line;
+        std::string sample;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+
+            if (line == "---")
+            {
+                samples.push_back(ubuntu::app_launch::OomPolicy::parsePressure(sample));
+                sample.clear();
+                continue;
+            }
+
+            sample += line + "\n";
+        }
+
+        if (!sample.empty())
+        {
+            samples.push_back(ubuntu::app_launch::OomPolicy::parsePressure(sample));
+        }
+
+        return samples;
+    }
+
+    ubuntu::app_launch::OomPolicy policy;
+    std::chrono::steady_clock::time_point start;
+    std::map<std::string, std::uint64_t> footprints;
+};
+
+TEST_F(OomPolicy, ParsePressure)
+{
+    auto pressure = ubuntu::app_launch::OomPolicy::parsePressure(
+        "some avg10=12.31 avg60=3.05 avg300=0.68 total=1285714\n"
+        "full avg10=1.02 avg60=0.25 avg300=0.05 total=102311\n");
+
+    EXPECT_DOUBLE_EQ(12.31, pressure.some10);
+    EXPECT_DOUBLE_EQ(1.02, pressure.full10);
+
+    /* No PSI in the kernel */
+    pressure = ubuntu::app_launch::OomPolicy::parsePressure("");
+    EXPECT_DOUBLE_EQ(0.0, pressure.some10);
+    EXPECT_DOUBLE_EQ(0.0, pressure.full10);
+}
+
+TEST_F(OomPolicy, SpikeTrace)
+{
+    auto trace = loadTrace("spike.trace");
+    ASSERT_EQ(7u, trace.size());
+
+    const Scores moderate{
+        {"application-click-a", 950}, {"application-click-b", 933}, {"application-click-c", 916}};
+    const Scores critical{
+        {"application-click-a", 1000}, {"application-click-b", 966}, {"application-click-c", 933}};
+    const Scores none{{"application-click-a", 900}, {"application-click-b", 900}, {"application-click-c", 900}};
+
+    std::vector<std::pair<Level, Scores>> expected{
+        {Level::NONE, {}},          /* Everyone is already at the paused score */
+        {Level::MODERATE, moderate}, /* Crossed the moderate threshold */
+        {Level::MODERATE, {}},       /* Below enter, but above leave, no writes */
+        {Level::CRITICAL, critical}, /* Spike */
+        {Level::CRITICAL, {}},       /* Still too high to come down */
+        {Level::MODERATE, moderate}, /* Recovering */
+        {Level::NONE, none},         /* All back to normal */
+    };
+
+    for (std::size_t i = 0; i < trace.size(); i++)
+    {
+        auto changes = policy.update(trace[i], footprints);
+        EXPECT_EQ(expected[i].first, policy.level()) << "Sample " << i;
+        EXPECT_EQ(expected[i].second, changes) << "Sample " << i;
+    }
+}
+
+TEST_F(OomPolicy, IdleTrace)
+{
+    for (const auto& sample : loadTrace("idle.trace"))
+    {
+        EXPECT_TRUE(policy.update(sample, footprints).empty());
+        EXPECT_EQ(Level::NONE, policy.level());
+    }
+}
+
+TEST_F(OomPolicy, PauseResume)
+{
+    auto critical = loadTrace("spike.trace")[3];
+
+    policy.update(critical, footprints);
+    ASSERT_EQ(Level::CRITICAL, policy.level());
+
+    /* Resuming the biggest leaves only two to spread */
+    policy.resumed("application-click-b");
+    footprints.erase("application-click-b");
+
+    Scores expected{{"application-click-c", 950}};
+    EXPECT_EQ(expected, policy.update(critical, footprints));
+
+    /* A newly paused app starts at the paused score and gets graded */
+    policy.paused("application-click-d", start + std::chrono::seconds{30});
+    footprints["application-click-d"] = 500 * 1024 * 1024;
+
+    expected = Scores{{"application-click-c", 933}, {"application-click-d", 966}};
+    EXPECT_EQ(expected, policy.update(critical, footprints));
+
+    policy.resumed("application-click-a");
+    policy.resumed("application-click-c");
+    policy.resumed("application-click-d");
+    EXPECT_TRUE(policy.empty());
+}
+
+}  // namespace
@@ -0,0 +1,178 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "prelaunch-pool.h"
+
+#include <glib.h>
+#include <gtest/gtest.h>
+
+namespace
+{
+
+using Entry = ubuntu::app_launch::PrelaunchPool::Entry;
+
+Entry parked(const std::string& appid, const std::string& job)
+{
+    return Entry{appid, job, {}, std::chrono::steady_clock::now()};
+}
+
+TEST(PrelaunchPool, Disabled)
+{
+    ubuntu::app_launch::PrelaunchPool pool(0);
+
+    EXPECT_EQ(0u, pool.size());
+
+    auto evicted = pool.add(parked("com.test.good_application_1.2.3", "application-click"));
+    EXPECT_EQ(1u, evicted.size());
+    EXPECT_FALSE(pool.contains("com.test.good_application_1.2.3"));
+}
+
+TEST(PrelaunchPool, EvictOldestPerJob)
+{
+    ubuntu::app_launch::PrelaunchPool pool(2);
+
+    EXPECT_TRUE(pool.add(parked("click-a", "application-click")).empty());
+    EXPECT_TRUE(pool.add(parked("click-b", "application-click")).empty());
+    EXPECT_TRUE(pool.add(parked("legacy-a", "application-legacy")).empty());
+
+    /* Full for click, but legacy still has room */
+    auto evicted = pool.add(parked("click-c", "application-click"));
+    ASSERT_EQ(1u, evicted.size());
+    EXPECT_EQ("click-a", evicted.front().appid);
+
+    EXPECT_FALSE(pool.contains("click-a"));
+    EXPECT_TRUE(pool.contains("click-b"));
+    EXPECT_TRUE(pool.contains("click-c"));
+    EXPECT_TRUE(pool.contains("legacy-a"));
+
+    EXPECT_EQ(4u, pool.stats().prelaunched);
+    EXPECT_EQ(1u, pool.stats().evicted);
+}
+
+TEST(PrelaunchPool, Take)
+{
+    ubuntu::app_launch::PrelaunchPool pool(2);
+
+    pool.add(Entry{"legacy-a", "application-legacy", "1234", std::chrono::steady_clock::now()});
+
+    Entry entry;
+    EXPECT_FALSE(pool.take("legacy-b", entry));
+    ASSERT_TRUE(pool.take("legacy-a", entry));
+    EXPECT_EQ("application-legacy", entry.job);
+    EXPECT_EQ("1234", entry.instance);
+
+    /* Only once */
+    EXPECT_FALSE(pool.contains("legacy-a"));
+    EXPECT_FALSE(pool.take("legacy-a", entry));
+
+    pool.countHit();
+    pool.countMiss();
+    pool.countMiss();
+
+    auto stats = pool.stats();
+    EXPECT_EQ(1u, stats.prelaunched);
+    EXPECT_EQ(1u, stats.hits);
+    EXPECT_EQ(2u, stats.misses);
+    EXPECT_EQ(0u, stats.evicted);
+}
+
+TEST(PrelaunchPool, Shrink)
+{
+    ubuntu::app_launch::PrelaunchPool pool(3);
+
+    pool.add(parked("click-a", "application-click"));
+    pool.add(parked("click-b", "application-click"));
+    pool.add(parked("click-c", "application-click"));
+    pool.add(parked("snap-a", "application-snap"));
+    pool.add(parked("snap-b", "application-snap"));
+
+    auto evicted = pool.setSize(1);
+    EXPECT_EQ(1u, pool.size());
+    EXPECT_EQ(3u, evicted.size());
+
+    EXPECT_TRUE(pool.contains("click-c"));
+    EXPECT_TRUE(pool.contains("snap-b"));
+    EXPECT_FALSE(pool.contains("click-a"));
+    EXPECT_FALSE(pool.contains("click-b"));
+    EXPECT_FALSE(pool.contains("snap-a"));
+
+    /* Bigger than we allow gets clamped */
+    EXPECT_TRUE(pool.setSize(100).empty());
+    EXPECT_EQ(8u, pool.size());
+}
+
+TEST(PrelaunchPool, Parked)
+{
+    ubuntu::app_launch::PrelaunchPool pool(2);
+
+    pool.add(parked("com.test.good_application_1.2.3", "application-click"));
+    pool.add(Entry{"multiple", "application-legacy", "1234", std::chrono::steady_clock::now()});
+    pool.add(Entry{"single", "application-legacy", "", std::chrono::steady_clock::now()});
+
+    /* Upstart's instance names for each job */
+    EXPECT_TRUE(pool.parked("application-click", "com.test.good_application_1.2.3"));
+    EXPECT_TRUE(pool.parked("application-legacy", "multiple-1234"));
+    EXPECT_TRUE(pool.parked("application-legacy", "single-"));
+
+    /* Other instances of the same application aren't parked */
+    EXPECT_FALSE(pool.parked("application-legacy", "multiple-5678"));
+    EXPECT_FALSE(pool.parked("application-snap", "single-"));
+    EXPECT_FALSE(pool.parked("application-click", "com.test.good_application_1.2.4"));
+}
+
+TEST(PrelaunchPool, Stopped)
+{
+    ubuntu::app_launch::PrelaunchPool pool(2);
+
+    pool.add(parked("com.test.good_application_1.2.3", "application-click"));
+    pool.add(Entry{"multiple", "application-legacy", "1234", std::chrono::steady_clock::now()});
+
+    /* Another instance stopping leaves the parked one alone */
+    EXPECT_FALSE(pool.stopped("application-legacy", "multiple-5678"));
+    EXPECT_TRUE(pool.contains("multiple"));
+
+    /* The parked job timing out drops it */
+    EXPECT_TRUE(pool.stopped("application-legacy", "multiple-1234"));
+    EXPECT_FALSE(pool.contains("multiple"));
+    EXPECT_FALSE(pool.parked("application-legacy", "multiple-1234"));
+
+    EXPECT_TRUE(pool.stopped("application-click", "com.test.good_application_1.2.3"));
+    EXPECT_FALSE(pool.contains("com.test.good_application_1.2.3"));
+
+    /* Nothing was counted as evicted or missed */
+    EXPECT_EQ(0u, pool.stats().evicted);
+    EXPECT_EQ(0u, pool.stats().misses);
+}
+
+TEST(PrelaunchPool, SizeFromEnv)
+{
+    g_unsetenv("UBUNTU_APP_LAUNCH_PRELAUNCH_POOL");
+    EXPECT_EQ(0u, ubuntu::app_launch::PrelaunchPool::sizeFromEnv());
+
+    g_setenv("UBUNTU_APP_LAUNCH_PRELAUNCH_POOL", "2", TRUE);
+    EXPECT_EQ(2u, ubuntu::app_launch::PrelaunchPool::sizeFromEnv());
+
+    g_setenv("UBUNTU_APP_LAUNCH_PRELAUNCH_POOL", "-1", TRUE);
+    EXPECT_EQ(0u, ubuntu::app_launch::PrelaunchPool::sizeFromEnv());
+
+    g_unsetenv("UBUNTU_APP_LAUNCH_PRELAUNCH_POOL");
+}
+
+}  // namespace
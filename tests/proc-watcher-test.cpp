@@ -0,0 +1,199 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "proc-watcher.h"
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+
+using Handler = ubuntu::app_launch::ProcWatcher::Handler;
+
+/** Feeds the watcher events like the connector would, through one end
+    of a socket pair */
+class ProcWatcherTest : public ::testing::Test
+{
+protected:
+    int sender = -1;
+    std::shared_ptr<ubuntu::app_launch::ProcWatcher> watcher;
+
+    virtual void SetUp()
+    {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds));
+        sender = fds[0];
+        watcher = std::make_shared<ubuntu::app_launch::ProcWatcher>(fds[1]);
+    }
+
+    virtual void TearDown()
+    {
+        watcher.reset();
+        close(sender);
+    }
+
+    void sendEvent(const struct proc_event& event)
+    {
+        char buffer[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(struct proc_event))];
+        memset(buffer, 0, sizeof(buffer));
+
+        auto nlhdr = reinterpret_cast<struct nlmsghdr*>(buffer);
+        nlhdr->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(struct proc_event));
+        nlhdr->nlmsg_type = NLMSG_DONE;
+
+        auto cnmsg = static_cast<struct cn_msg*>(NLMSG_DATA(nlhdr));
+        cnmsg->id.idx = CN_IDX_PROC;
+        cnmsg->id.val = CN_VAL_PROC;
+        cnmsg->len = sizeof(struct proc_event);
+        memcpy(cnmsg->data, &event, sizeof(event));
+
+        ASSERT_EQ(ssize_t(nlhdr->nlmsg_len), send(sender, buffer, nlhdr->nlmsg_len, 0));
+    }
+
+    void sendFork(pid_t parent, pid_t child, pid_t childThread = 0)
+    {
+        struct proc_event event;
+        memset(&event, 0, sizeof(event));
+        event.what = proc_event::PROC_EVENT_FORK;
+        event.event_data.fork.parent_pid = parent;
+        event.event_data.fork.parent_tgid = parent;
+        event.event_data.fork.child_pid = childThread != 0 ? childThread : child;
+        event.event_data.fork.child_tgid = child;
+        sendEvent(event);
+    }
+
+    void sendExit(pid_t pid)
+    {
+        struct proc_event event;
+        memset(&event, 0, sizeof(event));
+        event.what = proc_event::PROC_EVENT_EXIT;
+        event.event_data.exit.process_pid = pid;
+        event.event_data.exit.process_tgid = pid;
+        sendEvent(event);
+    }
+
+    std::vector<pid_t> track(const std::string& jobpath, std::vector<pid_t> seed, std::vector<pid_t>& forked)
+    {
+        return watcher->track(jobpath, [seed]() { return seed; }, Handler::LIFECYCLE,
+                              [&forked](pid_t pid) { forked.push_back(pid); });
+    }
+};
+
+TEST_F(ProcWatcherTest, SeedOnce)
+{
+    std::vector<pid_t> forked;
+    auto pids = track("application-click-app", {100, 101}, forked);
+    EXPECT_EQ((std::vector<pid_t>{100, 101}), pids);
+    EXPECT_TRUE(watcher->isTracking("application-click-app"));
+
+    /* Already tracking, so the seed isn't used again */
+    pids = watcher->track("application-click-app", []() { return std::vector<pid_t>{999}; }, Handler::LIFECYCLE,
+                          [](pid_t) {});
+    EXPECT_EQ((std::vector<pid_t>{100, 101}), pids);
+
+    /* Nothing running, nothing to track */
+    EXPECT_TRUE(track("application-click-none", {}, forked).empty());
+    EXPECT_FALSE(watcher->isTracking("application-click-none"));
+}
+
+TEST_F(ProcWatcherTest, ForkAndExit)
+{
+    std::vector<pid_t> forked;
+    track("application-click-app", {100, 101}, forked);
+
+    sendFork(100, 200);
+    sendExit(101);
+    /* Not ours */
+    sendFork(300, 301);
+    /* A new thread isn't a new process */
+    sendFork(100, 100, 102);
+
+    EXPECT_EQ((std::vector<pid_t>{100, 200}), watcher->pids("application-click-app"));
+    EXPECT_EQ((std::vector<pid_t>{200}), forked);
+
+    /* Children of the child are ours too */
+    sendFork(200, 201);
+    EXPECT_EQ((std::vector<pid_t>{100, 200, 201}), watcher->pids("application-click-app"));
+    EXPECT_EQ((std::vector<pid_t>{200, 201}), forked);
+
+    /* Once they're all gone it isn't tracked anymore */
+    sendExit(100);
+    sendExit(200);
+    sendExit(201);
+    EXPECT_FALSE(watcher->isTracking("application-click-app"));
+    EXPECT_TRUE(watcher->pids("application-click-app").empty());
+}
+
+TEST_F(ProcWatcherTest, HandlerKinds)
+{
+    std::vector<std::string> calls;
+    auto handler = [&calls](const std::string& name) {
+        return [&calls, name](pid_t pid) { calls.push_back(name + std::to_string(pid)); };
+    };
+
+    watcher->track("application-click-app", []() { return std::vector<pid_t>{100}; }, Handler::OOM, handler("oom"));
+    watcher->track("application-click-app", {}, Handler::LIFECYCLE, handler("pause"));
+
+    /* Both run, the lifecycle one first */
+    sendFork(100, 101);
+    watcher->pids("application-click-app");
+    EXPECT_EQ((std::vector<std::string>{"pause101", "oom101"}), calls);
+
+    /* Only the handler of the same kind is replaced */
+    calls.clear();
+    watcher->track("application-click-app", {}, Handler::OOM, handler("policy"));
+    sendFork(100, 102);
+    watcher->pids("application-click-app");
+    EXPECT_EQ((std::vector<std::string>{"pause102", "policy102"}), calls);
+
+    calls.clear();
+    watcher->clearHandler("application-click-app", Handler::OOM);
+    sendFork(100, 103);
+    watcher->pids("application-click-app");
+    EXPECT_EQ((std::vector<std::string>{"pause103"}), calls);
+}
+
+TEST_F(ProcWatcherTest, Untrack)
+{
+    std::vector<pid_t> forked;
+    track("application-legacy-app-1", {100}, forked);
+    track("application-legacy-app-2", {200}, forked);
+
+    watcher->untrack("application-legacy-app-1");
+    EXPECT_FALSE(watcher->isTracking("application-legacy-app-1"));
+    EXPECT_TRUE(watcher->isTracking("application-legacy-app-2"));
+
+    /* The handler is gone with it */
+    sendFork(100, 101);
+    sendFork(200, 201);
+    EXPECT_EQ((std::vector<pid_t>{200, 201}), watcher->pids("application-legacy-app-2"));
+    EXPECT_EQ((std::vector<pid_t>{201}), forked);
+
+    /* Unknown jobs are fine */
+    watcher->untrack("application-legacy-app-3");
+}
+
+}  // namespace
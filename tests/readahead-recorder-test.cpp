@@ -0,0 +1,170 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+#include "readahead-recorder.h"
+
+#include <fstream>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtest/gtest.h>
+#include <utime.h>
+
+namespace
+{
+
+class ReadaheadRecorder : public ::testing::Test
+{
+protected:
+    std::string tmpdir;
+    std::string appdir;
+    std::string cachedir;
+
+    virtual void SetUp()
+    {
+        auto dir = g_dir_make_tmp("readahead-test-XXXXXX", nullptr);
+        ASSERT_NE(nullptr, dir);
+        tmpdir = dir;
+        g_free(dir);
+
+        appdir = tmpdir + "/app";
+        cachedir = tmpdir + "/cache";
+
+        g_mkdir_with_parents((appdir + "/lib").c_str(), 0700);
+        g_mkdir_with_parents((appdir + "/empty").c_str(), 0700);
+
+        writeFile(appdir + "/application", 3 * 4096 + 100);
+        writeFile(appdir + "/lib/libstuff.so", 8192);
+        writeFile(appdir + "/zero", 0);
+    }
+
+    virtual void TearDown()
+    {
+        gchar* argv[] = {(gchar*)"rm", (gchar*)"-rf", (gchar*)tmpdir.c_str(), nullptr};
+        g_spawn_sync(nullptr, argv, nullptr, G_SPAWN_SEARCH_PATH, nullptr, nullptr, nullptr, nullptr, nullptr,
+                     nullptr);
+    }
+
+    void writeFile(const std::string& path, std::size_t size)
+    {
+        /* Written through the page cache, so it'll all be resident */
+        std::ofstream file(path);
+        file << std::string(size, 'x');
+    }
+};
+
+TEST_F(ReadaheadRecorder, RecordAndReplay)
+{
+    ubuntu::app_launch::ReadaheadRecorder recorder(cachedir, std::chrono::seconds{5});
+
+    EXPECT_EQ(5, recorder.window().count());
+    EXPECT_FALSE(recorder.hasList("com.test.good_application_1.2.3"));
+
+    auto recorded = recorder.record("com.test.good_application_1.2.3", appdir);
+    EXPECT_EQ(2u, recorded.files);
+    EXPECT_EQ(3u * 4096u + 100u + 8192u, recorded.bytes);
+
+    EXPECT_TRUE(recorder.hasList("com.test.good_application_1.2.3"));
+    EXPECT_FALSE(recorder.hasList("com.test.good_application_1.2.4"));
+
+    auto replayed = recorder.replay("com.test.good_application_1.2.3");
+    EXPECT_EQ(recorded.files, replayed.files);
+    EXPECT_EQ(recorded.bytes, replayed.bytes);
+
+    /* Files that have gone away are skipped */
+    g_unlink((appdir + "/lib/libstuff.so").c_str());
+    replayed = recorder.replay("com.test.good_application_1.2.3");
+    EXPECT_EQ(1u, replayed.files);
+    EXPECT_EQ(3u * 4096u + 100u, replayed.bytes);
+}
+
+TEST_F(ReadaheadRecorder, NoList)
+{
+    ubuntu::app_launch::ReadaheadRecorder recorder(cachedir, std::chrono::seconds{5});
+
+    auto replayed = recorder.replay("com.test.good_application_1.2.3");
+    EXPECT_EQ(0u, replayed.files);
+    EXPECT_EQ(0u, replayed.bytes);
+
+    /* A bad directory still records, just nothing */
+    auto recorded = recorder.record("com.test.good_application_1.2.3", tmpdir + "/not-there");
+    EXPECT_EQ(0u, recorded.files);
+    EXPECT_TRUE(recorder.hasList("com.test.good_application_1.2.3"));
+}
+
+TEST_F(ReadaheadRecorder, NeedsRecording)
+{
+    ubuntu::app_launch::ReadaheadRecorder recorder(cachedir, std::chrono::seconds{5});
+    auto listpath = cachedir + "/com.test.good_application_1.2.3";
+
+    EXPECT_TRUE(recorder.needsRecording("com.test.good_application_1.2.3", appdir));
+
+    /* Set the application directory in the past so the new list is newer */
+    struct utimbuf past = {time(nullptr) - 60, time(nullptr) - 60};
+    utime(appdir.c_str(), &past);
+
+    recorder.record("com.test.good_application_1.2.3", appdir);
+    EXPECT_FALSE(recorder.needsRecording("com.test.good_application_1.2.3", appdir));
+
+    /* The application was updated after it was recorded */
+    struct utimbuf older = {time(nullptr) - 120, time(nullptr) - 120};
+    utime(listpath.c_str(), &older);
+    EXPECT_TRUE(recorder.needsRecording("com.test.good_application_1.2.3", appdir));
+
+    /* Old lists get recorded again */
+    struct utimbuf ancient = {time(nullptr) - 8 * 24 * 60 * 60, time(nullptr) - 8 * 24 * 60 * 60};
+    utime(appdir.c_str(), &ancient);
+    recorder.record("com.test.good_application_1.2.3", appdir);
+    EXPECT_FALSE(recorder.needsRecording("com.test.good_application_1.2.3", appdir));
+    utime(listpath.c_str(), &ancient);
+    EXPECT_TRUE(recorder.needsRecording("com.test.good_application_1.2.3", appdir));
+}
+
+TEST_F(ReadaheadRecorder, UnknownFormat)
+{
+    ubuntu::app_launch::ReadaheadRecorder recorder(cachedir, std::chrono::seconds{5});
+
+    g_mkdir_with_parents(cachedir.c_str(), 0700);
+    std::ofstream list(cachedir + "/com.test.good_application_1.2.3");
+    list << "# something else" << std::endl << appdir << "/application\t0:4096" << std::endl;
+    list.close();
+
+    auto replayed = recorder.replay("com.test.good_application_1.2.3");
+    EXPECT_EQ(0u, replayed.files);
+}
+
+TEST_F(ReadaheadRecorder, WindowFromEnv)
+{
+    g_unsetenv("UBUNTU_APP_LAUNCH_READAHEAD");
+    EXPECT_EQ(0, ubuntu::app_launch::ReadaheadRecorder::windowFromEnv().count());
+
+    g_setenv("UBUNTU_APP_LAUNCH_READAHEAD", "10", TRUE);
+    EXPECT_EQ(10, ubuntu::app_launch::ReadaheadRecorder::windowFromEnv().count());
+
+    /* Clamped to a minute */
+    g_setenv("UBUNTU_APP_LAUNCH_READAHEAD", "600", TRUE);
+    EXPECT_EQ(60, ubuntu::app_launch::ReadaheadRecorder::windowFromEnv().count());
+
+    g_setenv("UBUNTU_APP_LAUNCH_READAHEAD", "-5", TRUE);
+    EXPECT_EQ(0, ubuntu::app_launch::ReadaheadRecorder::windowFromEnv().count());
+
+    g_unsetenv("UBUNTU_APP_LAUNCH_READAHEAD");
+}
+
+}  // namespace
@@ -0,0 +1,168 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+/* Shows what the scheduling classes do for the frame times of a
+   foreground application. Everything is pinned to one CPU so that the
+   numbers don't depend on the number of cores. A set of busy looping
+   processes act as the background applications, and we render frames
+   with a fixed amount of work at 60Hz, first with the background
+   processes at the default priority and then after moving them to the
+   background class.
+
+   This isn't run as part of the test suite as the results depend on
+   the machine, run it by hand:
+
+   ./scheduling-benchmark [background processes] [frames] */
+
+#include "priority-control.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using SchedulingClass = ubuntu::app_launch::PriorityControl::SchedulingClass;
+
+static const std::chrono::microseconds FRAME_PERIOD{16667};
+static const std::chrono::microseconds FRAME_WORK{4000};
+
+/** Spin for the given amount of CPU time, not wall time, so it takes
+    longer when someone else is using the CPU */
+static void work(std::chrono::microseconds amount)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+
+    volatile unsigned long spin = 0;
+    while (true)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            spin = spin + 1;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        auto used = std::chrono::seconds(now.tv_sec - start.tv_sec) +
+                    std::chrono::nanoseconds(now.tv_nsec - start.tv_nsec);
+        if (used >= amount)
+        {
+            break;
+        }
+    }
+}
+
+/** Render a set of frames and print statistics on how long they took */
+static void frames(const char* name, int count)
+{
+    std::vector<double> times;
+    auto next = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < count; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        work(FRAME_WORK);
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+        next += FRAME_PERIOD;
+        std::this_thread::sleep_until(next);
+        if (std::chrono::steady_clock::now() > next)
+        {
+            next = std::chrono::steady_clock::now();
+        }
+    }
+
+    std::sort(times.begin(), times.end());
+    double total = 0.0;
+    int missed = 0;
+    for (auto time : times)
+    {
+        total += time;
+        if (time > std::chrono::duration<double, std::milli>(FRAME_PERIOD).count())
+        {
+            missed++;
+        }
+    }
+
+    printf("%-12s mean %7.2fms  p50 %7.2fms  p95 %7.2fms  p99 %7.2fms  missed %d/%d\n", name, total / count,
+           times[count / 2], times[(count * 95) / 100], times[(count * 99) / 100], missed, count);
+}
+
+int main(int argc, char* argv[])
+{
+    int background = argc > 1 ? std::atoi(argv[1]) : 4;
+    int count = argc > 2 ? std::atoi(argv[2]) : 300;
+
+    if (background < 1 || count < 1)
+    {
+        fprintf(stderr, "Usage: %s [background processes] [frames]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+    {
+        perror("Unable to pin to a CPU");
+        return EXIT_FAILURE;
+    }
+
+    frames("idle", count);
+
+    /* Children inherit the affinity */
+    std::vector<pid_t> pids;
+    for (int i = 0; i < background; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            while (true)
+            {
+                work(std::chrono::microseconds{100000});
+            }
+        }
+        pids.push_back(pid);
+    }
+
+    frames("contended", count);
+
+    for (auto pid : pids)
+    {
+        ubuntu::app_launch::PriorityControl::applyToPid(pid, SchedulingClass::BACKGROUND);
+    }
+
+    frames("background", count);
+
+    for (auto pid : pids)
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+
+    return EXIT_SUCCESS;
+}
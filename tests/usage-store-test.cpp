@@ -0,0 +1,206 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+
+extern "C" {
+#include "ubuntu-app-launch.h"
+#include "usage-store.h"
+}
+
+#include <glib.h>
+#include <gtest/gtest.h>
+#include <string>
+
+namespace
+{
+
+/** Milliseconds for a time today, local noon plus an offset */
+gint64 today(gint64 offsetSeconds)
+{
+    GDateTime* now = g_date_time_new_now_local();
+    GDateTime* noon = g_date_time_new_local(g_date_time_get_year(now), g_date_time_get_month(now),
+                                            g_date_time_get_day_of_month(now), 12, 0, 0);
+    gint64 retval = (g_date_time_to_unix(noon) + offsetSeconds) * 1000;
+    g_date_time_unref(noon);
+    g_date_time_unref(now);
+    return retval;
+}
+
+class UsageStore : public ::testing::Test
+{
+protected:
+    std::string tmpdir;
+    std::string path;
+
+    virtual void SetUp()
+    {
+        auto dir = g_dir_make_tmp("usage-store-test-XXXXXX", nullptr);
+        ASSERT_NE(nullptr, dir);
+        tmpdir = dir;
+        g_free(dir);
+
+        g_setenv("XDG_DATA_HOME", tmpdir.c_str(), TRUE);
+
+        auto defpath = usage_store_default_path();
+        path = defpath;
+        g_free(defpath);
+    }
+
+    virtual void TearDown()
+    {
+        gchar* argv[] = {(gchar*)"rm", (gchar*)"-rf", (gchar*)tmpdir.c_str(), nullptr};
+        g_spawn_sync(nullptr, argv, nullptr, G_SPAWN_SEARCH_PATH, nullptr, nullptr, nullptr, nullptr, nullptr,
+                     nullptr);
+    }
+};
+
+TEST_F(UsageStore, Empty)
+{
+    auto apps = ubuntu_app_launch_usage_list();
+    ASSERT_NE(nullptr, apps);
+    EXPECT_EQ(nullptr, apps[0]);
+    g_strfreev(apps);
+
+    EXPECT_FALSE(ubuntu_app_launch_usage_get("com.test.good_application", nullptr, nullptr, nullptr));
+}
+
+TEST_F(UsageStore, Totals)
+{
+    usage_event_t events[] = {
+        {"com.test.good_application", TRUE, TRUE, today(0)},
+        /* A resume while open doesn't restart the clock or count as a launch */
+        {"com.test.good_application", TRUE, FALSE, today(10)},
+        {"com.test.good_application", FALSE, FALSE, today(60)},
+        {"foo", TRUE, TRUE, today(0)},
+        {"foo", FALSE, FALSE, today(5)},
+    };
+    ASSERT_TRUE(usage_store_update(path.c_str(), events, 5));
+
+    /* Split in two, like the registry and the job scripts write it */
+    usage_event_t more[] = {
+        {"com.test.good_application", TRUE, FALSE, today(100)},
+        {"com.test.good_application", FALSE, FALSE, today(130)},
+    };
+    ASSERT_TRUE(usage_store_update(path.c_str(), more, 2));
+
+    guint64 seconds = 0;
+    guint launches = 0;
+    gint64 lastUsed = 0;
+    ASSERT_TRUE(ubuntu_app_launch_usage_get("com.test.good_application", &seconds, &launches, &lastUsed));
+    EXPECT_EQ(90u, seconds);
+    EXPECT_EQ(1u, launches);
+    EXPECT_EQ(today(130) / 1000, lastUsed);
+
+    /* The full Application ID finds the same totals */
+    ASSERT_TRUE(ubuntu_app_launch_usage_get("com.test.good_application_1.2.3", &seconds, nullptr, nullptr));
+    EXPECT_EQ(90u, seconds);
+
+    auto apps = ubuntu_app_launch_usage_list();
+    ASSERT_NE(nullptr, apps);
+    EXPECT_STREQ("com.test.good_application", apps[0]);
+    EXPECT_STREQ("foo", apps[1]);
+    EXPECT_EQ(nullptr, apps[2]);
+    g_strfreev(apps);
+}
+
+TEST_F(UsageStore, Days)
+{
+    const gint64 day = 24 * 60 * 60;
+
+    usage_event_t events[] = {
+        {"foo", TRUE, TRUE, today(-2 * day)},
+        {"foo", FALSE, FALSE, today(-2 * day + 300)},
+        /* Runs over midnight */
+        {"foo", TRUE, TRUE, today(-day + 11 * 60 * 60)},
+        {"foo", FALSE, FALSE, today(-day + 13 * 60 * 60)},
+    };
+    ASSERT_TRUE(usage_store_update(path.c_str(), events, 4));
+
+    guint64 seconds[4] = {1, 1, 1, 1};
+    ASSERT_TRUE(ubuntu_app_launch_usage_get_days("foo", 4, seconds));
+    EXPECT_EQ(60u * 60u, seconds[0]);
+    EXPECT_EQ(60u * 60u, seconds[1]);
+    EXPECT_EQ(300u, seconds[2]);
+    EXPECT_EQ(0u, seconds[3]);
+
+    guint64 total = 0;
+    ASSERT_TRUE(ubuntu_app_launch_usage_get("foo", &total, nullptr, nullptr));
+    EXPECT_EQ(2u * 60u * 60u + 300u, total);
+}
+
+TEST_F(UsageStore, MissedClose)
+{
+    usage_event_t events[] = {
+        {"foo", TRUE, TRUE, today(-3600)},
+        /* The close never made it, the next launch starts over */
+        {"foo", TRUE, TRUE, today(0)},
+        {"foo", FALSE, FALSE, today(30)},
+    };
+    ASSERT_TRUE(usage_store_update(path.c_str(), events, 3));
+
+    guint64 seconds = 0;
+    guint launches = 0;
+    ASSERT_TRUE(ubuntu_app_launch_usage_get("foo", &seconds, &launches, nullptr));
+    EXPECT_EQ(30u, seconds);
+    EXPECT_EQ(2u, launches);
+}
+
+TEST_F(UsageStore, LongSpan)
+{
+    const gint64 day = 24 * 60 * 60;
+
+    usage_event_t events[] = {
+        {"foo", TRUE, TRUE, today(-3 * day)},
+        {"foo", FALSE, FALSE, today(0)},
+    };
+    ASSERT_TRUE(usage_store_update(path.c_str(), events, 2));
+
+    /* Only the last twelve hours are believed */
+    guint64 seconds = 0;
+    ASSERT_TRUE(ubuntu_app_launch_usage_get("foo", &seconds, nullptr, nullptr));
+    EXPECT_EQ(12u * 60u * 60u, seconds);
+}
+
+TEST_F(UsageStore, OldDaysDropped)
+{
+    const gint64 day = 24 * 60 * 60;
+
+    usage_event_t events[] = {
+        {"foo", TRUE, TRUE, today(-(USAGE_STORE_DAYS + 5) * day)},
+        {"foo", FALSE, FALSE, today(-(USAGE_STORE_DAYS + 5) * day + 100)},
+        {"foo", TRUE, TRUE, today(0)},
+        {"foo", FALSE, FALSE, today(20)},
+    };
+    ASSERT_TRUE(usage_store_update(path.c_str(), events, 4));
+
+    guint64 seconds[USAGE_STORE_DAYS];
+    ASSERT_TRUE(ubuntu_app_launch_usage_get_days("foo", USAGE_STORE_DAYS, seconds));
+    EXPECT_EQ(20u, seconds[0]);
+    for (guint i = 1; i < USAGE_STORE_DAYS; i++)
+    {
+        EXPECT_EQ(0u, seconds[i]);
+    }
+
+    /* Still in the overall total */
+    guint64 total = 0;
+    ASSERT_TRUE(ubuntu_app_launch_usage_get("foo", &total, nullptr, nullptr));
+    EXPECT_EQ(120u, total);
+}
+
+}  // namespace
@@ -22,6 +22,7 @@
 #include <libdbustest/dbus-test.h>
 
 #include "eventually-fixture.h"
+#include "zg-event-queue.h"
 
 class ZGEvent : public EventuallyFixture
 {
@@ -30,6 +31,8 @@ class ZGEvent : public EventuallyFixture
 protected:
     virtual void SetUp()
     {
+        /* Keep the usage store out of the real data directory */
+        g_setenv("XDG_DATA_HOME", CMAKE_BINARY_DIR "/zg-test-data", TRUE);
     }
 
     virtual void TearDown()
@@ -130,3 +133,110 @@ TEST_F(ZGEvent, TimeoutTest)
     g_object_unref(mock);
     g_object_unref(service);
 }
+
+TEST_F(ZGEvent, QueueTest)
+{
+    DbusTestService* service = dbus_test_service_new(NULL);
+
+    DbusTestDbusMock* mock = dbus_test_dbus_mock_new("org.gnome.zeitgeist.Engine");
+    DbusTestDbusMockObject* obj =
+        dbus_test_dbus_mock_get_object(mock, "/org/gnome/zeitgeist/log/activity", "org.gnome.zeitgeist.Log", NULL);
+
+    dbus_test_dbus_mock_object_add_method(mock, obj, "InsertEvents", G_VARIANT_TYPE("a(asaasay)"), G_VARIANT_TYPE("au"),
+                                          "ret = [ 0 ] * len(args[0])", NULL);
+
+    dbus_test_service_add_task(service, DBUS_TEST_TASK(mock));
+    dbus_test_service_start_tasks(service);
+    grabBus();
+
+    {
+        auto log = std::shared_ptr<ZeitgeistLog>(zeitgeist_log_new(), [](ZeitgeistLog* log) { g_clear_object(&log); });
+        ubuntu::app_launch::ZgEventQueue queue(log, std::chrono::milliseconds{100}, 10, std::string{});
+
+        queue.push("foo", ZEITGEIST_ZG_ACCESS_EVENT);
+        queue.push("bar", ZEITGEIST_ZG_ACCESS_EVENT);
+        queue.push("foo", ZEITGEIST_ZG_LEAVE_EVENT);
+        EXPECT_EQ(3u, queue.pending());
+
+        pause(500);
+
+        EXPECT_EQ(0u, queue.pending());
+
+        guint numcalls = 0;
+        const DbusTestDbusMockCall* calls =
+            dbus_test_dbus_mock_object_get_method_calls(mock, obj, "InsertEvents", &numcalls, NULL);
+
+        ASSERT_NE(nullptr, calls);
+        ASSERT_EQ(1, numcalls);
+
+        /* All three in the one call */
+        GVariant* events = g_variant_get_child_value(calls[0].params, 0);
+        EXPECT_EQ(3u, g_variant_n_children(events));
+        g_variant_unref(events);
+
+        EXPECT_EQ(3u, queue.stats().queued);
+        EXPECT_EQ(1u, queue.stats().flushes);
+        EXPECT_EQ(3u, queue.stats().inserted);
+    }
+
+    g_object_unref(mock);
+    g_object_unref(service);
+}
+
+TEST_F(ZGEvent, QueueThresholdTest)
+{
+    DbusTestService* service = dbus_test_service_new(NULL);
+
+    DbusTestDbusMock* mock = dbus_test_dbus_mock_new("org.gnome.zeitgeist.Engine");
+    DbusTestDbusMockObject* obj =
+        dbus_test_dbus_mock_get_object(mock, "/org/gnome/zeitgeist/log/activity", "org.gnome.zeitgeist.Log", NULL);
+
+    dbus_test_dbus_mock_object_add_method(mock, obj, "InsertEvents", G_VARIANT_TYPE("a(asaasay)"), G_VARIANT_TYPE("au"),
+                                          "ret = [ 0 ] * len(args[0])", NULL);
+
+    dbus_test_service_add_task(service, DBUS_TEST_TASK(mock));
+    dbus_test_service_start_tasks(service);
+    grabBus();
+
+    {
+        auto log = std::shared_ptr<ZeitgeistLog>(zeitgeist_log_new(), [](ZeitgeistLog* log) { g_clear_object(&log); });
+        /* Long enough that only the threshold can send them */
+        ubuntu::app_launch::ZgEventQueue queue(log, std::chrono::milliseconds{60 * 1000}, 2, std::string{});
+
+        queue.push("foo", ZEITGEIST_ZG_ACCESS_EVENT);
+        EXPECT_EQ(1u, queue.pending());
+        queue.push("bar", ZEITGEIST_ZG_ACCESS_EVENT);
+        EXPECT_EQ(0u, queue.pending());
+
+        /* Left over for the destructor */
+        queue.push("baz", ZEITGEIST_ZG_ACCESS_EVENT);
+
+        pause(200);
+
+        guint numcalls = 0;
+        dbus_test_dbus_mock_object_get_method_calls(mock, obj, "InsertEvents", &numcalls, NULL);
+        EXPECT_EQ(1, numcalls);
+    }
+
+    pause(200);
+
+    guint numcalls = 0;
+    dbus_test_dbus_mock_object_get_method_calls(mock, obj, "InsertEvents", &numcalls, NULL);
+    EXPECT_EQ(2, numcalls);
+
+    g_object_unref(mock);
+    g_object_unref(service);
+}
+
+TEST_F(ZGEvent, SinkAppIdTest)
+{
+    EXPECT_TRUE(ubuntu::app_launch::ZgEventQueue::validAppId("com.test.good_application_1.2.3"));
+    EXPECT_TRUE(ubuntu::app_launch::ZgEventQueue::validAppId("gedit"));
+    EXPECT_TRUE(ubuntu::app_launch::ZgEventQueue::validAppId("org.gnome.Calculator"));
+
+    EXPECT_FALSE(ubuntu::app_launch::ZgEventQueue::validAppId(""));
+    EXPECT_FALSE(ubuntu::app_launch::ZgEventQueue::validAppId(" gedit"));
+    EXPECT_FALSE(ubuntu::app_launch::ZgEventQueue::validAppId("../../etc/passwd"));
+    EXPECT_FALSE(ubuntu::app_launch::ZgEventQueue::validAppId("gedit\n"));
+    EXPECT_FALSE(ubuntu::app_launch::ZgEventQueue::validAppId(std::string(300, 'a')));
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Ted Gould <ted.gould@canonical.com>
+ */
+
+#include <gio/gio.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/* Asks a process that launched applications for the timelines it has
+   recorded. By default that's whoever has the stats name on the bus,
+   but any process's unique name can be given instead. */
+
+static std::string ms(gint64 us)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << double(us) / G_TIME_SPAN_MILLISECOND << " ms";
+    return out.str();
+}
+
+static GVariant* call(GDBusConnection* bus, const std::string& name, const gchar* method, const gchar* type)
+{
+    GError* error = nullptr;
+    GVariant* retval = g_dbus_connection_call_sync(bus,                                    /* bus */
+                                                   name.c_str(),                           /* service name */
+                                                   "/com/canonical/UbuntuAppLaunch/Stats", /* path */
+                                                   "com.canonical.UbuntuAppLaunch.Stats",  /* interface */
+                                                   method,                                 /* method */
+                                                   nullptr,                                /* params */
+                                                   G_VARIANT_TYPE(type),                   /* return */
+                                                   G_DBUS_CALL_FLAGS_NONE,                 /* flags */
+                                                   -1,                                     /* default timeout */
+                                                   nullptr,                                /* cancellable */
+                                                   &error);                                /* error */
+
+    if (error != nullptr)
+    {
+        std::cerr << "Unable to get launch stats from '" << name << "': " << error->message << std::endl;
+        g_error_free(error);
+    }
+
+    return retval;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [bus name]" << std::endl;
+        return 1;
+    }
+
+    std::string name{"com.canonical.UbuntuAppLaunch.Stats"};
+    if (argc == 2)
+    {
+        name = argv[1];
+    }
+
+    GDBusConnection* bus = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
+    if (bus == nullptr)
+    {
+        std::cerr << "Unable to get session bus" << std::endl;
+        return 1;
+    }
+
+    GVariant* timelines = call(bus, name, "GetTimelines", "(a(stxa(sx)))");
+    if (timelines == nullptr)
+    {
+        g_object_unref(bus);
+        return 1;
+    }
+
+    GVariantIter* launches = nullptr;
+    g_variant_get(timelines, "(a(stxa(sx)))", &launches);
+
+    const gchar* appid = nullptr;
+    guint64 id = 0;
+    gint64 start = 0;
+    GVariantIter* stamps = nullptr;
+    while (g_variant_iter_loop(launches, "(&stxa(sx))", &appid, &id, &start, &stamps))
+    {
+        std::cout << appid << " (launch " << id << ")" << std::endl;
+
+        const gchar* milestone = nullptr;
+        gint64 offset = 0;
+        while (g_variant_iter_loop(stamps, "(&sx)", &milestone, &offset))
+        {
+            std::cout << "    " << std::left << std::setw(28) << milestone << std::right << std::setw(12) << ms(offset)
+                      << std::endl;
+        }
+    }
+
+    g_variant_iter_free(launches);
+    g_variant_unref(timelines);
+
+    GVariant* percentiles = call(bus, name, "GetPercentiles", "(a(ssuxxx))");
+    if (percentiles == nullptr)
+    {
+        g_object_unref(bus);
+        return 1;
+    }
+
+    GVariantIter* entries = nullptr;
+    g_variant_get(percentiles, "(a(ssuxxx))", &entries);
+
+    std::string lastappid;
+    const gchar* milestone = nullptr;
+    guint32 count = 0;
+    gint64 p50 = 0, p90 = 0, p99 = 0;
+    while (g_variant_iter_loop(entries, "(&s&suxxx)", &appid, &milestone, &count, &p50, &p90, &p99))
+    {
+        if (lastappid != appid)
+        {
+            std::cout << std::endl << appid << " percentiles" << std::endl;
+            lastappid = appid;
+        }
+
+        std::cout << "    " << std::left << std::setw(28) << milestone << std::right << "  n=" << std::setw(3) << count
+                  << "  p50 " << std::setw(10) << ms(p50) << "  p90 " << std::setw(10) << ms(p90) << "  p99 "
+                  << std::setw(10) << ms(p99) << std::endl;
+    }
+
+    g_variant_iter_free(entries);
+    g_variant_unref(percentiles);
+    g_object_unref(bus);
+
+    return 0;
+}
@@ -20,6 +20,7 @@
 
 #include <zeitgeist.h>
 #include "libubuntu-app-launch/ubuntu-app-launch.h"
+#include "libubuntu-app-launch/usage-store.h"
 
 static gboolean
 watchdog_timeout (gpointer user_data)
@@ -62,18 +63,31 @@ main (int argc, char * argv[])
 		return 1;
 	}
 
+	gchar * name = NULL;
 	gchar * uri = NULL;
 	gchar * pkg = NULL;
 	gchar * app = NULL;
 
 	if (ubuntu_app_launch_app_id_parse(appid, &pkg, &app, NULL)) {
 		/* If it's parseable, use the short form */
-		uri = g_strdup_printf("application://%s_%s.desktop", pkg, app);
+		name = g_strdup_printf("%s_%s", pkg, app);
 		g_free(pkg);
 		g_free(app);
 	} else {
-		uri = g_strdup_printf("application://%s.desktop", appid);
-	}    
+		name = g_strdup(appid);
+	}
+	uri = g_strdup_printf("application://%s.desktop", name);
+
+	/* Keep the usage totals up to date, starts are launches */
+	usage_event_t usage = {
+		.app = name,
+		.open = g_strcmp0(argv[1], "open") == 0,
+		.launch = g_strcmp0(argv[1], "open") == 0,
+		.timestamp = g_get_real_time() / 1000
+	};
+	gchar * usagepath = usage_store_default_path();
+	usage_store_update(usagepath, &usage, 1);
+	g_free(usagepath);
 
 	ZeitgeistLog * log = zeitgeist_log_get_default();
 
@@ -103,6 +117,7 @@ main (int argc, char * argv[])
 
 	g_main_loop_unref(main_loop);
 	g_free(uri);
+	g_free(name);
 
 	return 0;
 }